@@ -0,0 +1,263 @@
+#pragma once
+
+#include "../RCUtils/RCUtilsBase.h"
+#include "../RCUtils/RCUtilsMath.h"
+
+#include <algorithm>
+#include <map>
+#include <math.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+// Fixed length run: the first WarmupFrames frames are dropped, the next NumFrames are kept and written out as one CSV row per
+// frame, plus a JSON file with min/mean/p50/p95/p99/max of every column and of every GPU scope
+struct FBenchmark
+{
+	// Columns, in CSV order
+	enum EStat
+	{
+		CpuMs,
+		GpuMs,
+		NumDraws,
+		NumVertexBinds,
+		NumPSOMisses,
+		NumDescriptorAllocs,
+		NumStagingAllocs,
+		NumUniformAllocs,
+		MemUsedMB,
+
+		NumStats,
+	};
+
+	static const char* GetStatName(uint32 Stat)
+	{
+		static const char* Names[NumStats] =
+		{
+			"cpu_ms",
+			"gpu_ms",
+			"draws",
+			"vertex_binds",
+			"pso_misses",
+			"descriptor_allocs",
+			"staging_allocs",
+			"uniform_allocs",
+			"mem_used_mb",
+		};
+		return Names[Stat];
+	}
+
+	struct FSample
+	{
+		double Values[NumStats] = {};
+	};
+
+	bool bEnabled = false;
+	uint32 WarmupFrames = 60;
+	uint32 NumFrames = 600;
+	uint32 Frame = 0;
+	std::string OutputPrefix = "Benchmark";
+	std::vector<FSample> Samples;
+
+	// GPU time of each FGPUProfiler scope by its path (eg "Frame/Scene"). Only written to the JSON, as the scopes can change
+	// from frame to frame and results come in a few frames late
+	std::map<std::string, std::vector<double>> GpuScopes;
+
+	bool IsWarmingUp() const
+	{
+		return Frame < WarmupFrames;
+	}
+
+	bool IsFinished() const
+	{
+		return Frame >= WarmupFrames + NumFrames;
+	}
+
+	// 0 to 1 over the measured frames
+	float GetProgress() const
+	{
+		return IsWarmingUp() ? 0.0f : (float)(Frame - WarmupFrames) / (float)std::max(1u, NumFrames - 1);
+	}
+
+	void AddFrame(const FSample& Sample)
+	{
+		check(!IsFinished());
+		if (!IsWarmingUp())
+		{
+			Samples.push_back(Sample);
+		}
+		++Frame;
+	}
+
+	void AddGpuScope(const std::string& Path, double Ms)
+	{
+		if (!IsWarmingUp() && !IsFinished())
+		{
+			GpuScopes[Path].push_back(Ms);
+		}
+	}
+
+	// Nearest rank
+	static double GetPercentile(const std::vector<double>& Sorted, double Percentile)
+	{
+		if (Sorted.empty())
+		{
+			return 0;
+		}
+		size_t Rank = (size_t)ceil(Percentile / 100.0 * (double)Sorted.size());
+		return Sorted[std::min(std::max(Rank, (size_t)1), Sorted.size()) - 1];
+	}
+
+	std::vector<double> GetSortedValues(uint32 Stat) const
+	{
+		std::vector<double> Values;
+		for (const FSample& Sample : Samples)
+		{
+			Values.push_back(Sample.Values[Stat]);
+		}
+		std::sort(Values.begin(), Values.end());
+		return Values;
+	}
+
+	bool WriteCSV(const char* Filename) const
+	{
+		FILE* File = nullptr;
+		if (fopen_s(&File, Filename, "w") || !File)
+		{
+			return false;
+		}
+
+		fprintf(File, "frame");
+		for (uint32 Stat = 0; Stat < NumStats; ++Stat)
+		{
+			fprintf(File, ",%s", GetStatName(Stat));
+		}
+		fprintf(File, "\n");
+		for (uint32 Index = 0; Index < (uint32)Samples.size(); ++Index)
+		{
+			fprintf(File, "%u", Index);
+			for (uint32 Stat = 0; Stat < NumStats; ++Stat)
+			{
+				fprintf(File, ",%.4f", Samples[Index].Values[Stat]);
+			}
+			fprintf(File, "\n");
+		}
+		fclose(File);
+		return true;
+	}
+
+	bool WriteJSON(const char* Filename, const char* Description) const
+	{
+		FILE* File = nullptr;
+		if (fopen_s(&File, Filename, "w") || !File)
+		{
+			return false;
+		}
+
+		fprintf(File, "{\n\t\"description\": \"%s\",\n\t\"warmup_frames\": %u,\n\t\"frames\": %u,\n\t\"stats\": {\n", Description, WarmupFrames, (uint32)Samples.size());
+		for (uint32 Stat = 0; Stat < NumStats; ++Stat)
+		{
+			WriteJSONStats(File, GetStatName(Stat), GetSortedValues(Stat), Stat + 1 == NumStats);
+		}
+		fprintf(File, "\t},\n\t\"gpu_scopes_ms\": {\n");
+		uint32 NumWritten = 0;
+		for (auto& Pair : GpuScopes)
+		{
+			std::vector<double> Values = Pair.second;
+			std::sort(Values.begin(), Values.end());
+			WriteJSONStats(File, Pair.first.c_str(), Values, ++NumWritten == (uint32)GpuScopes.size());
+		}
+		fprintf(File, "\t}\n}\n");
+		fclose(File);
+		return true;
+	}
+
+	static void WriteJSONStats(FILE* File, const char* Name, const std::vector<double>& Sorted, bool bLast)
+	{
+		double Total = 0;
+		for (double Value : Sorted)
+		{
+			Total += Value;
+		}
+		fprintf(File, "\t\t\"%s\": { \"min\": %.4f, \"mean\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f }%s\n",
+			Name,
+			Sorted.empty() ? 0 : Sorted.front(),
+			Sorted.empty() ? 0 : Total / (double)Sorted.size(),
+			GetPercentile(Sorted, 50),
+			GetPercentile(Sorted, 95),
+			GetPercentile(Sorted, 99),
+			Sorted.empty() ? 0 : Sorted.back(),
+			bLast ? "" : ",");
+	}
+};
+
+// Camera keyframes spread evenly over a benchmark run, either read from a file with one "x y z yaw pitch" line per key ('#'
+// starts a comment), or generated from a seed so runs on different machines see the same views
+struct FCameraPath
+{
+	struct FKey
+	{
+		FVector3 Pos;
+		FVector2 Rot;
+	};
+	std::vector<FKey> Keys;
+
+	bool Load(const char* Filename)
+	{
+		FILE* File = nullptr;
+		if (fopen_s(&File, Filename, "r") || !File)
+		{
+			return false;
+		}
+
+		char Line[256];
+		while (fgets(Line, sizeof(Line), File))
+		{
+			FKey Key;
+			if (Line[0] != '#' && sscanf_s(Line, "%f %f %f %f %f", &Key.Pos.x, &Key.Pos.y, &Key.Pos.z, &Key.Rot.x, &Key.Rot.y) == 5)
+			{
+				Keys.push_back(Key);
+			}
+		}
+		fclose(File);
+		return !Keys.empty();
+	}
+
+	// Keys within Radius of Center, looking around; a fixed LCG instead of rand() so the path doesn't depend on the CRT
+	void Generate(uint32 Seed, const FVector3& Center, float Radius, uint32 NumKeys)
+	{
+		uint32 State = Seed;
+		auto Random = [&State]()
+		{
+			State = State * 1664525u + 1013904223u;
+			return (float)(State >> 8) / (float)(1u << 24);
+		};
+
+		Keys.clear();
+		for (uint32 Index = 0; Index < NumKeys; ++Index)
+		{
+			FKey Key;
+			Key.Pos.x = Center.x + (Random() * 2.0f - 1.0f) * Radius;
+			Key.Pos.y = Center.y + (Random() * 2.0f - 1.0f) * Radius * 0.25f;
+			Key.Pos.z = Center.z + (Random() * 2.0f - 1.0f) * Radius;
+			Key.Rot.x = Random() * 360.0f;
+			Key.Rot.y = (Random() * 2.0f - 1.0f) * 30.0f;
+			Keys.push_back(Key);
+		}
+	}
+
+	// T from 0 to 1 across all the keys, linear in between
+	void Evaluate(float T, FVector3& OutPos, FVector2& OutRot) const
+	{
+		check(!Keys.empty());
+		float KeyT = std::min(std::max(T, 0.0f), 1.0f) * (float)(Keys.size() - 1);
+		uint32 Index = std::min((uint32)KeyT, (uint32)Keys.size() - 1);
+		const FKey& A = Keys[Index];
+		const FKey& B = Keys[std::min(Index + 1, (uint32)Keys.size() - 1)];
+		float Alpha = KeyT - (float)Index;
+		auto Lerp = [Alpha](float X, float Y) { return X + (Y - X) * Alpha; };
+		OutPos = FVector3(Lerp(A.Pos.x, B.Pos.x), Lerp(A.Pos.y, B.Pos.y), Lerp(A.Pos.z, B.Pos.z));
+		OutRot.x = Lerp(A.Rot.x, B.Rot.x);
+		OutRot.y = Lerp(A.Rot.y, B.Rot.y);
+	}
+};
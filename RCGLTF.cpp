@@ -82,6 +82,44 @@ static inline uint32 GetSizeInBytes(int GLTFComponentType)
 	return 0;
 }
 
+static inline uint32 GetNumComponents(int GLTFType)
+{
+	switch (GLTFType)
+	{
+	case TINYGLTF_TYPE_SCALAR:
+		return 1;
+	case TINYGLTF_TYPE_VEC2:
+		return 2;
+	case TINYGLTF_TYPE_VEC3:
+		return 3;
+	case TINYGLTF_TYPE_VEC4:
+	case TINYGLTF_TYPE_MAT2:
+		return 4;
+	case TINYGLTF_TYPE_MAT3:
+		return 9;
+	case TINYGLTF_TYPE_MAT4:
+		return 16;
+
+	default:
+		check(0);
+		break;
+	}
+
+	return 0;
+}
+
+// Size of one tightly packed element of the accessor
+static inline uint32 GetElementSize(const tinygltf::Accessor& Accessor)
+{
+	return GetSizeInBytes(Accessor.componentType) * GetNumComponents(Accessor.type);
+}
+
+// A byteStride of 0 means the elements are tightly packed; the view's length says nothing about it as views can be shared
+static inline uint32 GetStride(const tinygltf::Accessor& Accessor, const tinygltf::BufferView& BufferView)
+{
+	return BufferView.byteStride == 0 ? GetElementSize(Accessor) : (uint32)BufferView.byteStride;
+}
+
 static inline VkPrimitiveTopology GetPrimType(int GLTFMode)
 {
 	switch (GLTFMode)
@@ -106,11 +144,30 @@ static inline VkPrimitiveTopology GetPrimType(int GLTFMode)
 	return VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
 }
 
-static int GetOrAddVertexDecl(SVulkan::SDevice& Device, tinygltf::Model& Model, tinygltf::Primitive& GLTFPrim, FScene::FPrim& OutPrim, FPSOCache& PSOCache)
+// Where the data of one of a prim's vertex streams comes from: a range of a glTF buffer, or for a missing semantic (Src is null)
+// one of the shared constants
+struct FPrimStream
+{
+	const uint8* Src = nullptr;
+	uint32 Size = 0;
+	FPSOCache::EDefaultAttribute Default = FPSOCache::DefaultZero;
+};
+
+// What's needed to create a prim's buffers, worked out on the CPU without touching the device
+struct FPrimSetup
 {
 	FPSOCache::FVertexDecl VertexDecl;
+	std::vector<FPrimStream> Streams;
+	const uint8* IndexSrc = nullptr;
+	uint32 IndexSize = 0;
+	uint32 NumVertices = 0;
+};
+
+// Only reads the model, so it can run for many prims at once
+static void SetupPrim(tinygltf::Model& Model, const std::vector<const uint8*>& BufferData, tinygltf::Primitive& GLTFPrim, FScene::FPrim& OutPrim, FPrimSetup& OutSetup)
+{
+	FPSOCache::FVertexDecl& VertexDecl = OutSetup.VertexDecl;
 	uint32 BindingIndex = 0;
-	uint32 MaxSize = 0;
 	for (auto Pair : GLTFPrim.attributes)
 	{
 		std::string Name = Pair.first;
@@ -118,101 +175,528 @@ static int GetOrAddVertexDecl(SVulkan::SDevice& Device, tinygltf::Model& Model,
 
 		tinygltf::BufferView& BufferView = Model.bufferViews[Accessor.bufferView];
 
-		auto FixNormalOrPosition = [&](const std::string& InName, uint32 Count, FVector3* Data)
-		{
-			bool bPosition = InName == "POSITION";
-			if (bPosition)
-			{
-				for (uint32 Index = 0; Index < Count; ++Index)
-				{
-					OutPrim.ObjectSpaceBounds.Min = FVector3::Min(OutPrim.ObjectSpaceBounds.Min, *Data);
-					OutPrim.ObjectSpaceBounds.Max = FVector3::Max(OutPrim.ObjectSpaceBounds.Max, *Data);
-					++Data;
-				}
-			}
-		};
-#if SCENE_USE_SINGLE_BUFFERS
 		VertexDecl.AddAttribute(BindingIndex, BindingIndex, GetFormat(Accessor.componentType, Accessor.type), 0, Name.c_str());
 
-		uint32 Size = (uint32)BufferView.byteLength;
-		MaxSize = MaxSize > Size ? MaxSize : Size;
-		OutPrim.VertexBuffers.push_back(FBufferWithMem());
-		FBufferWithMem& VB = OutPrim.VertexBuffers.back();
-		VB.Create(Device, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, EMemLocation::CPU_TO_GPU, Size, true);
-		{
-			unsigned char* SrcData = (unsigned char*)Model.buffers[BufferView.buffer].data.data();
-			SrcData += BufferView.byteOffset + Accessor.byteOffset;
-			float* DestData = (float*)VB.Lock();
-			memcpy(DestData, SrcData, Size);
-			FixNormalOrPosition(Name, (uint32)Accessor.count, (FVector3*)DestData);
-			VB.Unlock();
-		}
-		Device.SetDebugName(VB.Buffer.Buffer, "GLTFVB");
-#else
-		OutPrim.VertexOffsets.push_back(BufferView.byteOffset + Accessor.byteOffset);
-		OutPrim.VertexBuffers.push_back(BufferView.buffer);
-		VertexDecl.AddAttribute(BindingIndex, UINT32_MAX, GetFormat(Accessor.componentType, Accessor.type), 0, Name.c_str());
-#endif
-		uint32 Stride = BufferView.byteStride == 0 ? (uint32)(BufferView.byteLength / Accessor.count) : (uint32)BufferView.byteStride;
+		uint32 Stride = GetStride(Accessor, BufferView);
 		check(Stride <= 256);
 		VertexDecl.AddBinding(BindingIndex, Stride);
 
+		FPrimStream Stream;
+#if SCENE_USE_SINGLE_BUFFERS
+		Stream.Size = (uint32)BufferView.byteLength;
+#else
+		// Just this accessor's vertices, as a buffer view can be shared; the last one only needs its own element, not a whole stride
+		Stream.Size = Accessor.count == 0 ? 0 : (uint32)(Accessor.count - 1) * Stride + GetElementSize(Accessor);
+#endif
+		Stream.Src = BufferData[BufferView.buffer] + BufferView.byteOffset + Accessor.byteOffset;
+		OutSetup.Streams.push_back(Stream);
+		OutSetup.NumVertices = std::max(OutSetup.NumVertices, (uint32)Accessor.count);
+
 		++BindingIndex;
 	}
 
-	auto AddDummyStream = [&](const char* Semantic, VkFormat Format, uint8* Values, uint8 NumComponents)
+	auto AddDefaultStream = [&](const char* Semantic, VkFormat Format, FPSOCache::EDefaultAttribute Default)
 	{
 		if (GLTFPrim.attributes.find(Semantic) == GLTFPrim.attributes.end())
 		{
-#if SCENE_USE_SINGLE_BUFFERS
 			VertexDecl.AddAttribute(BindingIndex, BindingIndex, Format, 0, Semantic);
-/*
-			if (Device.bUseVertexDivisor)
+			VertexDecl.AddBinding(BindingIndex, 0, true);
+
+			FPrimStream Stream;
+			Stream.Default = Default;
+			OutSetup.Streams.push_back(Stream);
+			++BindingIndex;
+		}
+	};
+
+	AddDefaultStream("NORMAL", VK_FORMAT_R8G8B8A8_UNORM, FPSOCache::DefaultNormal);
+	AddDefaultStream("TANGENT", VK_FORMAT_R8G8B8A8_UNORM, FPSOCache::DefaultTangent);
+	AddDefaultStream("TEXCOORD_0", VK_FORMAT_R8G8_UNORM, FPSOCache::DefaultTexCoord);
+	AddDefaultStream("COLOR", VK_FORMAT_R8G8B8A8_UNORM, FPSOCache::DefaultColor);
+
+	tinygltf::Accessor& Indices = Model.accessors[GLTFPrim.indices];
+	check(Indices.type == TINYGLTF_TYPE_SCALAR);
+	tinygltf::BufferView& IndicesBufferView = Model.bufferViews[Indices.bufferView];
+	// Prims without a material get the default one CreateGLTFGfxResources() adds after the model's
+	OutPrim.Material = GLTFPrim.material == -1 ? (int32)Model.materials.size() : GLTFPrim.material;
+	OutPrim.PrimType = GetPrimType(GLTFPrim.mode);
+	OutPrim.NumIndices = (uint32)Indices.count;
+	OutPrim.IndexType = GetIndexType(Indices.componentType);
+	OutSetup.IndexSrc = BufferData[IndicesBufferView.buffer] + IndicesBufferView.byteOffset + Indices.byteOffset;
+#if SCENE_USE_SINGLE_BUFFERS
+	OutSetup.IndexSize = (uint32)IndicesBufferView.byteLength;
+#else
+	OutSetup.IndexSize = OutPrim.NumIndices * GetSizeInBytes(Indices.componentType);
+#endif
+}
+
+// Where a prim's streams and indices get written; ~0u for the missing attributes, which come from FPSOCache::DefaultAttributes
+struct FPrimRegions
+{
+	std::vector<uint32> Streams;
+	uint32 Indices = ~0u;
+};
+
+// Geometry writes for the scene's buffers. Host visible destinations get written in place; the rest is packed into staging
+// batches of up to MaxBatchBytes, each copied with one vkCmdCopyBuffer per destination, one VkBufferCopy per region. Regions
+// are reserved on one thread, after which any number of them can be written at once.
+// The loading thread fills one batch at a time and queues it once it's full; the render thread hands queued batches over to
+// FPendingOpsManager in Tick() and retires them by the sync point of the frame that copies them. At most MaxBatchesInFlight
+// batches hold staging at once, so BeginBatch() waits for the oldest one to finish
+struct FGeometryUploads
+{
+	enum
+	{
+		MaxBatchBytes = 64 * 1024 * 1024,
+		MaxBatchesInFlight = 3,
+	};
+
+	struct FRegion
+	{
+		FBufferWithMem* Dest = nullptr;
+		uint32 DestOffset = 0;
+		uint32 Size = 0;
+		// -1 if written in place
+		int32 Batch = -1;
+		uint32 SrcOffset = 0;
+	};
+	std::vector<FRegion> Regions;
+	std::vector<uint32> BatchSizes;
+	// Null until BeginBatch()
+	std::vector<FStagingBuffer*> Batches;
+
+	struct FBatch
+	{
+		FStagingBuffer* Staging = nullptr;
+		std::vector<std::pair<SVulkan::FBuffer*, std::vector<VkBufferCopy>>> Copies;
+		// Invalid until Tick() has handed the copies over
+		SVulkan::FSyncPoint SyncPoint;
+	};
+
+	// Mutex guards everything below
+	std::mutex Mutex;
+	std::condition_variable BatchRetired;
+	std::deque<FBatch> Filled;
+	std::deque<FBatch> InFlight;
+	// Nothing ticks the uploads any more, so BeginBatch() stops waiting
+	bool bCancelled = false;
+	uint32 NumWaits = 0;
+
+	// Dest can't move until Submit()
+	uint32 Reserve(FBufferWithMem& Dest, EMemLocation DestLocation, uint32 DestOffset, uint32 Size)
+	{
+		FRegion Region;
+		Region.Dest = &Dest;
+		Region.DestOffset = DestOffset;
+		Region.Size = Size;
+		if (DestLocation == EMemLocation::GPU)
+		{
+			if (BatchSizes.empty() || (BatchSizes.back() > 0 && (uint64)BatchSizes.back() + Size > MaxBatchBytes))
 			{
-				OutPrim.VertexBuffers.push_back(PSOCache.ZeroBuffer);
-				VertexDecl.AddBinding(BindingIndex, PSOCache.ZeroBuffer.Size, true);
-				VertexDecl.Divisors.push_back({ BindingIndex, 0 });
+				BatchSizes.push_back(0);
 			}
-			else
-*/
+			Region.Batch = (int32)BatchSizes.size() - 1;
+			Region.SrcOffset = BatchSizes.back();
+			BatchSizes.back() = (Region.SrcOffset + Size + 15) & ~15u;
+		}
+		Regions.push_back(Region);
+		return (uint32)Regions.size() - 1;
+	}
+
+	// Loading thread, once everything has been reserved; batches go in order, and the regions of one can be written once it returns
+	void BeginBatch(uint32 Batch, FStagingBufferManager& StagingMgr)
+	{
+		check(Batch < (uint32)BatchSizes.size());
+		{
+			std::unique_lock<std::mutex> Lock(Mutex);
+			if (!bCancelled && Filled.size() + InFlight.size() >= MaxBatchesInFlight)
+			{
+				++NumWaits;
+				BatchRetired.wait(Lock, [this]() { return bCancelled || Filled.size() + InFlight.size() < MaxBatchesInFlight; });
+			}
+		}
+		Batches.resize(BatchSizes.size(), nullptr);
+		check(!Batches[Batch]);
+		// The staging manager hands back the buffer of a retired batch once the GPU is done with it
+		Batches[Batch] = StagingMgr.AcquireBuffer(BatchSizes[Batch], nullptr);
+	}
+
+	// Loading thread, after every region of the batch has been written
+	void EndBatch(uint32 Batch)
+	{
+		std::map<FBufferWithMem*, std::vector<VkBufferCopy>> Copies;
+		for (const FRegion& Region : Regions)
+		{
+			// Accessors without elements get empty regions, and vkCmdCopyBuffer doesn't take empty copies
+			if (Region.Batch == (int32)Batch && Region.Size > 0)
 			{
-				OutPrim.VertexBuffers.push_back(FBufferWithMem());
-				FBufferWithMem& VB = OutPrim.VertexBuffers.back();
-				VB.Create(Device, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, EMemLocation::CPU_TO_GPU, MaxSize, true);
+				VkBufferCopy Copy;
+				ZeroMem(Copy);
+				Copy.size = Region.Size;
+				Copy.srcOffset = Region.SrcOffset;
+				Copy.dstOffset = Region.DestOffset;
+				Copies[Region.Dest].push_back(Copy);
+			}
+		}
+
+		FBatch NewBatch;
+		NewBatch.Staging = Batches[Batch];
+		for (auto& Pair : Copies)
+		{
+			NewBatch.Copies.push_back(std::make_pair(&Pair.first->Buffer, std::move(Pair.second)));
+		}
+
+		std::lock_guard<std::mutex> Lock(Mutex);
+		Filled.push_back(std::move(NewBatch));
+	}
+
+	template <typename TFunc>
+	void Write(uint32 RegionIndex, TFunc Func)
+	{
+		const FRegion& Region = Regions[RegionIndex];
+		FBufferWithMem* Buffer = Region.Batch == -1 ? Region.Dest : Batches[Region.Batch]->Buffer;
+		Func((uint8*)Buffer->Lock() + (Region.Batch == -1 ? Region.DestOffset : Region.SrcOffset));
+		Buffer->Unlock();
+	}
+
+	// Render thread, before CmdBuffer executes the pending ops; with no CmdBuffer the batches aren't tracked any more
+	void Tick(FPendingOpsManager& PendingOpsMgr, SVulkan::FCmdBuffer* CmdBuffer)
+	{
+		bool bRetired = false;
+		{
+			std::lock_guard<std::mutex> Lock(Mutex);
+			while (!InFlight.empty() && InFlight.front().SyncPoint.IsComplete())
+			{
+				InFlight.pop_front();
+				bRetired = true;
+			}
+
+			if (!Filled.empty())
+			{
+				for (FBatch& Batch : Filled)
 				{
-					uint8* DestData = (uint8*)VB.Lock();
-					check(NumComponents > 0);
-					for (uint32 N = 0; N < MaxSize; N += NumComponents)
+					for (auto& Pair : Batch.Copies)
 					{
-						for (uint8 C = 0; C < NumComponents; ++C)
-						{
-							*DestData++ = Values[C];
-						}
+						PendingOpsMgr.AddCopyBufferRegions(Batch.Staging, Pair.first, std::move(Pair.second));
+					}
+					Batch.Copies.clear();
+					if (CmdBuffer)
+					{
+						Batch.SyncPoint = CmdBuffer->GetSyncPoint();
+						InFlight.push_back(std::move(Batch));
 					}
-					VB.Unlock();
 				}
-				Device.SetDebugName(VB.Buffer.Buffer, "GLTFVB");
-				VertexDecl.AddBinding(BindingIndex, 16, true);
+				Filled.clear();
+				PendingOpsMgr.AddMemoryBarrier(VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT);
 			}
-			++BindingIndex;
+		}
+		if (bRetired)
+		{
+			BatchRetired.notify_one();
+		}
+	}
+
+	// Render thread, once the loading thread is done with it; the last batches get copied at the start of the next frame
+	void Submit(FPendingOpsManager& PendingOpsMgr)
+	{
+		Tick(PendingOpsMgr, nullptr);
+		std::lock_guard<std::mutex> Lock(Mutex);
+		check(Batches.size() == BatchSizes.size());
+		// Their staging buffers are freed by the sync point the copies set on them
+		InFlight.clear();
+		Regions.clear();
+		BatchSizes.clear();
+		Batches.clear();
+	}
+
+	// Any thread; BeginBatch() stops waiting on batches nobody is going to retire
+	void Cancel()
+	{
+		{
+			std::lock_guard<std::mutex> Lock(Mutex);
+			bCancelled = true;
+		}
+		BatchRetired.notify_one();
+	}
+
+	uint64 GetNumStagedBytes() const
+	{
+		uint64 NumBytes = 0;
+		for (uint32 Size : BatchSizes)
+		{
+			NumBytes += Size;
+		}
+		return NumBytes;
+	}
+};
+
+static VkBufferUsageFlags GetGeometryUsage(VkBufferUsageFlags Usage, EMemLocation Location)
+{
+	return Location == EMemLocation::GPU ? Usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT : Usage;
+}
+
+// Only the regions going to Batch, -1 for the ones written in place
+static void FillPrimRegions(FGeometryUploads& Uploads, const FPrimSetup& Setup, const FPrimRegions& Regions, int32 Batch)
+{
+	for (size_t Index = 0; Index < Setup.Streams.size(); ++Index)
+	{
+		const FPrimStream& Stream = Setup.Streams[Index];
+		if (Regions.Streams[Index] == ~0u || Uploads.Regions[Regions.Streams[Index]].Batch != Batch)
+		{
+			continue;
+		}
+
+		Uploads.Write(Regions.Streams[Index], [&](uint8* DestData)
+		{
+			memcpy(DestData, Stream.Src, Stream.Size);
+		});
+	}
+
+	if (Uploads.Regions[Regions.Indices].Batch == Batch)
+	{
+		Uploads.Write(Regions.Indices, [&](uint8* DestData)
+		{
+			memcpy(DestData, Setup.IndexSrc, Setup.IndexSize);
+		});
+	}
+}
+
+#if SCENE_USE_SINGLE_BUFFERS
+// Allocations take the device's memory lock anyway, so buffers get created one prim after another
+static void CreatePrimBuffers(SVulkan::SDevice& Device, const FSceneMemPolicy& MemPolicy, VkBuffer DefaultAttributes, const FPrimSetup& Setup, FScene::FPrim& Prim)
+{
+	for (const FPrimStream& Stream : Setup.Streams)
+	{
+		if (Stream.Src)
+		{
+			Prim.VertexBuffers.push_back(FBufferWithMem());
+			FBufferWithMem& VB = Prim.VertexBuffers.back();
+			VB.Create(Device, GetGeometryUsage(VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, MemPolicy.VertexBuffers), MemPolicy.VertexBuffers, Stream.Size, MemPolicy.VertexBuffers != EMemLocation::GPU);
+			Device.SetDebugName(VB.Buffer.Buffer, "GLTFVB");
+			Prim.BindingBuffers.push_back(VB.Buffer.Buffer);
+			Prim.BindingOffsets.push_back(0);
+		}
+		else
+		{
+			Prim.BindingBuffers.push_back(DefaultAttributes);
+			Prim.BindingOffsets.push_back(FPSOCache::GetDefaultAttributeOffset(Stream.Default));
+		}
+	}
+
+	Prim.IndexBuffer.Create(Device, GetGeometryUsage(VK_BUFFER_USAGE_INDEX_BUFFER_BIT, MemPolicy.IndexBuffers), MemPolicy.IndexBuffers, Setup.IndexSize, MemPolicy.IndexBuffers != EMemLocation::GPU);
+	Device.SetDebugName(Prim.IndexBuffer.Buffer.Buffer, "GLTFIB");
+}
+
+// After every prim's buffers exist
+static void ReservePrimRegions(FGeometryUploads& Uploads, const FSceneMemPolicy& MemPolicy, const FPrimSetup& Setup, FScene::FPrim& Prim, FPrimRegions& OutRegions)
+{
+	uint32 NumVertexBuffers = 0;
+	for (const FPrimStream& Stream : Setup.Streams)
+	{
+		OutRegions.Streams.push_back(Stream.Src ? Uploads.Reserve(Prim.VertexBuffers[NumVertexBuffers++], MemPolicy.VertexBuffers, 0, Stream.Size) : ~0u);
+	}
+	OutRegions.Indices = Uploads.Reserve(Prim.IndexBuffer, MemPolicy.IndexBuffers, 0, Setup.IndexSize);
+}
 #else
-#error
-#endif
+// A group's buffers are 32 bit sized, so a decl with more data than this gets split over several groups
+static const uint64 MaxVertexGroupSize = 256 * 1024 * 1024;
+
+struct FVertexGroupLayout
+{
+	const FPSOCache::FVertexDecl* VertexDecl = nullptr;
+	uint32 FirstPrim = 0;
+	uint32 NumVertices = 0;
+	uint32 IndexSize = 0;
+};
+
+// Each per vertex binding gets NumVertices elements, starting 16 byte aligned; instance rate ones are the shared defaults
+static uint64 GetVertexGroupSize(const FPSOCache::FVertexDecl& VertexDecl, uint64 NumVertices, std::vector<VkDeviceSize>* OutBindingOffsets)
+{
+	uint64 Size = 0;
+	for (const VkVertexInputBindingDescription& Binding : VertexDecl.BindingDescs)
+	{
+		if (OutBindingOffsets)
+		{
+			OutBindingOffsets->push_back(Size);
 		}
-	};
+		if (Binding.inputRate == VK_VERTEX_INPUT_RATE_VERTEX)
+		{
+			Size += (NumVertices * Binding.stride + 15) & ~15ull;
+		}
+	}
+	return Size;
+}
+
+// Appends each prim to the open group for its decl, which only needs the sizes worked out by SetupPrim()
+static void LayoutVertexGroups(FScene& Scene, const std::vector<FPSOCache::FVertexDecl>& PrimDecls, const std::vector<FPrimSetup>& PrimSetups, const std::vector<FScene::FPrim*>& Prims, std::vector<FVertexGroupLayout>& OutLayouts)
+{
+	// Indexes OpenGroups, one entry per distinct decl
+	FHashIndexTable DeclTable;
+	std::vector<int32> OpenGroups;
+	for (uint32 Index = 0; Index < (uint32)Prims.size(); ++Index)
+	{
+		const FPSOCache::FVertexDecl& VertexDecl = PrimDecls[Index];
+		const FPrimSetup& Setup = PrimSetups[Index];
+		FScene::FPrim& Prim = *Prims[Index];
 
-	uint8 NormalValue[] = {0, 0, 255};
-	uint8 TangentValue[] = {0, 255, 0};
-	uint8 TexCoordValue[] = {0, 0};
-	uint8 ColorValue[] = {255, 255, 255, 255};
-	AddDummyStream("NORMAL", VK_FORMAT_R8G8B8_UNORM, NormalValue, 3);
-	AddDummyStream("TANGENT", VK_FORMAT_R8G8B8A8_UNORM, TangentValue, 3);
-	AddDummyStream("TEXCOORD_0", VK_FORMAT_R8G8_UNORM, TexCoordValue, 2);
-	AddDummyStream("COLOR", VK_FORMAT_R8G8B8A8_UNORM, ColorValue, 4);
+		uint64 Hash = VertexDecl.GetHash();
+		int32 Open = DeclTable.Find(Hash, [&](int32 Candidate) { return *OutLayouts[OpenGroups[Candidate]].VertexDecl == VertexDecl; });
+		bool bFits = false;
+		if (Open != -1)
+		{
+			FVertexGroupLayout& Layout = OutLayouts[OpenGroups[Open]];
+			bFits = GetVertexGroupSize(VertexDecl, (uint64)Layout.NumVertices + Setup.NumVertices, nullptr) <= MaxVertexGroupSize
+				&& (uint64)Layout.IndexSize + 3 + Setup.IndexSize <= MaxVertexGroupSize;
+		}
+		if (!bFits)
+		{
+			int32 Group = (int32)OutLayouts.size();
+			OutLayouts.emplace_back();
+			OutLayouts.back().VertexDecl = &VertexDecl;
+			OutLayouts.back().FirstPrim = Index;
+			Scene.VertexGroups.emplace_back();
+			if (Open == -1)
+			{
+				Open = (int32)OpenGroups.size();
+				DeclTable.Add(Hash, Open);
+				OpenGroups.push_back(Group);
+			}
+			else
+			{
+				OpenGroups[Open] = Group;
+			}
+		}
 
-	return PSOCache.FindOrAddVertexDecl(VertexDecl);
+		FVertexGroupLayout& Layout = OutLayouts[OpenGroups[Open]];
+		Prim.VertexGroup = OpenGroups[Open];
+		uint32 IndexOffset = (Layout.IndexSize + 3) & ~3u;
+		Prim.BaseVertex = (int32)Layout.NumVertices;
+		Prim.FirstIndex = IndexOffset / (Prim.IndexType == VK_INDEX_TYPE_UINT16 ? 2 : 4);
+		Layout.NumVertices += Setup.NumVertices;
+		Layout.IndexSize = IndexOffset + Setup.IndexSize;
+	}
 }
 
+// Allocations take the device's memory lock, so this is done one group after another
+static void CreateVertexGroupBuffers(SVulkan::SDevice& Device, const FSceneMemPolicy& MemPolicy, VkBuffer DefaultAttributes, FScene& Scene, const std::vector<FPrimSetup>& PrimSetups, const std::vector<FVertexGroupLayout>& Layouts)
+{
+	for (size_t Index = 0; Index < Layouts.size(); ++Index)
+	{
+		const FVertexGroupLayout& Layout = Layouts[Index];
+		FScene::FVertexGroup& Group = Scene.VertexGroups[Index];
+		uint32 VertexSize = (uint32)GetVertexGroupSize(*Layout.VertexDecl, Layout.NumVertices, &Group.BindingOffsets);
+
+		FBufferWithMem VB;
+		VB.Create(Device, GetGeometryUsage(VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, MemPolicy.VertexBuffers), MemPolicy.VertexBuffers, VertexSize, MemPolicy.VertexBuffers != EMemLocation::GPU);
+		Device.SetDebugName(VB.Buffer.Buffer, "GLTFVB");
+		Group.VertexBuffer = (int)Scene.Buffers.size();
+		Scene.Buffers.push_back(VB);
+
+		// Every prim in the group has the same missing attributes
+		const std::vector<FPrimStream>& Streams = PrimSetups[Layout.FirstPrim].Streams;
+		for (size_t StreamIndex = 0; StreamIndex < Streams.size(); ++StreamIndex)
+		{
+			if (Streams[StreamIndex].Src)
+			{
+				Group.BindingBuffers.push_back(VB.Buffer.Buffer);
+			}
+			else
+			{
+				Group.BindingBuffers.push_back(DefaultAttributes);
+				Group.BindingOffsets[StreamIndex] = FPSOCache::GetDefaultAttributeOffset(Streams[StreamIndex].Default);
+			}
+		}
+
+		FBufferWithMem IB;
+		IB.Create(Device, GetGeometryUsage(VK_BUFFER_USAGE_INDEX_BUFFER_BIT, MemPolicy.IndexBuffers), MemPolicy.IndexBuffers, std::max(Layout.IndexSize, 4u), MemPolicy.IndexBuffers != EMemLocation::GPU);
+		Device.SetDebugName(IB.Buffer.Buffer, "GLTFIB");
+		Group.IndexBuffer = (int)Scene.Buffers.size();
+		Scene.Buffers.push_back(IB);
+	}
+}
+
+// After every group's buffers exist
+static void ReservePrimRegions(FGeometryUploads& Uploads, const FSceneMemPolicy& MemPolicy, FScene& Scene, const std::vector<FVertexGroupLayout>& Layouts, const FPrimSetup& Setup, const FScene::FPrim& Prim, FPrimRegions& OutRegions)
+{
+	const FVertexGroupLayout& Layout = Layouts[Prim.VertexGroup];
+	const FScene::FVertexGroup& Group = Scene.VertexGroups[Prim.VertexGroup];
+	FBufferWithMem& VB = Scene.Buffers[Group.VertexBuffer];
+	for (size_t Index = 0; Index < Setup.Streams.size(); ++Index)
+	{
+		const FPrimStream& Stream = Setup.Streams[Index];
+		uint32 Offset = (uint32)Group.BindingOffsets[Index] + (uint32)Prim.BaseVertex * Layout.VertexDecl->BindingDescs[Index].stride;
+		OutRegions.Streams.push_back(Stream.Src ? Uploads.Reserve(VB, MemPolicy.VertexBuffers, Offset, Stream.Size) : ~0u);
+	}
+
+	uint32 IndexStride = Prim.IndexType == VK_INDEX_TYPE_UINT16 ? 2 : 4;
+	OutRegions.Indices = Uploads.Reserve(Scene.Buffers[Group.IndexBuffer], MemPolicy.IndexBuffers, Prim.FirstIndex * IndexStride, Setup.IndexSize);
+}
+#endif
+
+// Read only view of a whole file
+struct FMappedFile
+{
+	HANDLE File = INVALID_HANDLE_VALUE;
+	HANDLE Mapping = nullptr;
+	const uint8* Data = nullptr;
+	uint64 Size = 0;
+	// With '/' separators, so the same file is found however its path was joined
+	std::string Path;
+	bool bBufferData = false;
+
+	FMappedFile() = default;
+	FMappedFile(const FMappedFile&) = delete;
+	FMappedFile& operator=(const FMappedFile&) = delete;
+
+	~FMappedFile()
+	{
+		Close();
+	}
+
+	bool Open(const char* Filename)
+	{
+		check(!Data);
+		File = ::CreateFileA(Filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		LARGE_INTEGER FileSize;
+		if (File == INVALID_HANDLE_VALUE || !::GetFileSizeEx(File, &FileSize) || FileSize.QuadPart == 0)
+		{
+			Close();
+			return false;
+		}
+
+		Mapping = ::CreateFileMappingA(File, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		Data = Mapping ? (const uint8*)::MapViewOfFile(Mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+		if (!Data)
+		{
+			Close();
+			return false;
+		}
+		Size = (uint64)FileSize.QuadPart;
+		return true;
+	}
+
+	void Close()
+	{
+		if (Data)
+		{
+			::UnmapViewOfFile(Data);
+			Data = nullptr;
+		}
+		if (Mapping)
+		{
+			::CloseHandle(Mapping);
+			Mapping = nullptr;
+		}
+		if (File != INVALID_HANDLE_VALUE)
+		{
+			::CloseHandle(File);
+			File = INVALID_HANDLE_VALUE;
+		}
+		Size = 0;
+		Path.clear();
+	}
+};
+
 struct FGLTFLoader
 {
 	tinygltf::TinyGLTF Loader;
@@ -221,6 +705,18 @@ struct FGLTFLoader
 	std::string Warnings;
 	std::string Filename;
 
+	// tinygltf always copies buffers into tinygltf::Buffer::data; wherever the bytes can be mapped instead (the BIN chunk of a
+	// .glb, external .bin files) that copy is dropped right after parsing and vertices/indices are read from the mapping. The
+	// copy still exists while parsing, so this lowers the memory held afterwards rather than the peak
+	std::deque<FMappedFile> MappedFiles;
+	std::vector<const uint8*> BufferData;
+
+	// Built on the loading thread by CreateGLTFGfxResources(); each prim's VertexDecl indexes PrimDecls until MoveGLTFScene()
+	// registers them with the PSO cache
+	FScene Scene;
+	std::vector<FPSOCache::FVertexDecl> PrimDecls;
+	FGeometryUploads GeometryUploads;
+
 	std::atomic<bool> bFinishedLoading = false;
 };
 
@@ -229,17 +725,199 @@ const char* GetGLTFFilename(FGLTFLoader* Loader)
 	return Loader ? Loader->Filename.c_str() : nullptr;
 }
 
-FGLTFLoader* CreateGLTFLoader(const char* Filename)
+static std::string GetBaseDir(const std::string& Filename)
+{
+	size_t Slash = Filename.find_last_of("/\\");
+	return Slash == std::string::npos ? std::string() : Filename.substr(0, Slash + 1);
+}
+
+static bool IsGLB(const char* Filename)
+{
+	size_t Length = strlen(Filename);
+	return Length >= 4 && _stricmp(Filename + Length - 4, ".glb") == 0;
+}
+
+// Returns where the BIN chunk starts, or nullptr if there isn't one
+static const uint8* GetGLBBinChunk(const FMappedFile& File, uint64& OutSize)
+{
+	const uint32 BinChunkType = 0x004E4942;
+	const uint32* Header = (const uint32*)File.Data;
+	if (File.Size < 20 || Header[0] != 0x46546C67 || Header[1] != 2)
+	{
+		return nullptr;
+	}
+
+	uint64 BinChunk = 20 + (uint64)Header[3];
+	if (BinChunk + 8 > File.Size)
+	{
+		return nullptr;
+	}
+	const uint32* BinHeader = (const uint32*)(File.Data + BinChunk);
+	if (BinHeader[1] != BinChunkType || BinChunk + 8 + BinHeader[0] > File.Size)
+	{
+		return nullptr;
+	}
+	OutSize = BinHeader[0];
+	return File.Data + BinChunk + 8;
+}
+
+static FMappedFile* MapGLTFFile(FGLTFLoader* Loader, std::string Path)
+{
+	std::replace(Path.begin(), Path.end(), '\\', '/');
+	for (FMappedFile& File : Loader->MappedFiles)
+	{
+		if (File.Path == Path)
+		{
+			return &File;
+		}
+	}
+
+	Loader->MappedFiles.emplace_back();
+	FMappedFile& File = Loader->MappedFiles.back();
+	if (!File.Open(Path.c_str()))
+	{
+		Loader->MappedFiles.pop_back();
+		return nullptr;
+	}
+	File.Path = Path;
+	return &File;
+}
+
+// tinygltf's reads of external files (.bin buffers and images); going through the mapping MapGLTFBuffers() reuses
+// means each file is only read from disk once. tinygltf still gets its own copy, as it checks the size of what it read
+static bool ReadMappedGLTFFile(std::vector<unsigned char>* Out, std::string* Err, const std::string& Path, void* UserData)
+{
+	FMappedFile* File = MapGLTFFile((FGLTFLoader*)UserData, Path);
+	if (!File)
+	{
+		if (Err)
+		{
+			*Err += "Unable to map " + Path + "\n";
+		}
+		return false;
+	}
+	Out->assign(File->Data, File->Data + File->Size);
+	return true;
+}
+
+static tinygltf::FsCallbacks GetMappedFsCallbacks(FGLTFLoader* Loader)
+{
+	tinygltf::FsCallbacks Callbacks = {};
+	Callbacks.FileExists = &tinygltf::FileExists;
+	Callbacks.ExpandFilePath = &tinygltf::ExpandFilePath;
+	Callbacks.ReadWholeFile = &ReadMappedGLTFFile;
+	Callbacks.WriteWholeFile = &tinygltf::WriteWholeFile;
+	Callbacks.user_data = Loader;
+	return Callbacks;
+}
+
+static void MapGLTFBuffers(FGLTFLoader* Loader, const FMappedFile* GLBFile)
+{
+	std::string BaseDir = GetBaseDir(Loader->Filename);
+	for (tinygltf::Buffer& GLTFBuffer : Loader->Model.buffers)
+	{
+		const uint8* Data = GLTFBuffer.data.data();
+		uint64 MappedSize = 0;
+		const uint8* Mapped = nullptr;
+		if (GLTFBuffer.uri.empty())
+		{
+			Mapped = GLBFile ? GetGLBBinChunk(*GLBFile, MappedSize) : nullptr;
+		}
+		else if (GLTFBuffer.uri.compare(0, 5, "data:") != 0)
+		{
+			FMappedFile* File = MapGLTFFile(Loader, BaseDir + GLTFBuffer.uri);
+			if (File)
+			{
+				File->bBufferData = true;
+				Mapped = File->Data;
+				MappedSize = File->Size;
+			}
+		}
+
+		if (Mapped && MappedSize >= GLTFBuffer.data.size())
+		{
+			Data = Mapped;
+			std::vector<unsigned char>().swap(GLTFBuffer.data);
+		}
+		Loader->BufferData.push_back(Data);
+	}
+
+	// Images were decoded while parsing
+	for (FMappedFile& File : Loader->MappedFiles)
+	{
+		if (!File.bBufferData && &File != GLBFile)
+		{
+			File.Close();
+		}
+	}
+}
+
+// The loader as it was before mapping: tinygltf reads the whole file and vertices/indices come from its copies. Only kept to
+// compare against with -gltfloadbenchbaseline
+static bool LoadGLTFWithoutMapping(FGLTFLoader* Loader, const char* Filename)
+{
+	bool bLoaded = IsGLB(Filename)
+		? Loader->Loader.LoadBinaryFromFile(&Loader->Model, &Loader->Error, &Loader->Warnings, Filename)
+		: Loader->Loader.LoadASCIIFromFile(&Loader->Model, &Loader->Error, &Loader->Warnings, Filename);
+	if (bLoaded)
+	{
+		for (tinygltf::Buffer& GLTFBuffer : Loader->Model.buffers)
+		{
+			Loader->BufferData.push_back(GLTFBuffer.data.data());
+		}
+	}
+	return bLoaded;
+}
+
+FGLTFLoader* CreateGLTFLoader(const char* Filename, bool bMapBuffers)
 {
 	FGLTFLoader* Loader = new FGLTFLoader;
 	Loader->Filename = Filename;
 	//Loader->bFinishedLoading = false;
-	if (Loader->Loader.LoadASCIIFromFile(&Loader->Model, &Loader->Error, &Loader->Warnings, Filename))
+	bool bLoaded = false;
+	if (!bMapBuffers)
+	{
+		bLoaded = LoadGLTFWithoutMapping(Loader, Filename);
+	}
+	else if (IsGLB(Filename))
+	{
+		Loader->Loader.SetFsCallbacks(GetMappedFsCallbacks(Loader));
+		// Parse straight out of the mapping instead of reading the whole file into memory first
+		Loader->MappedFiles.emplace_back();
+		FMappedFile& File = Loader->MappedFiles.back();
+		if (File.Open(Filename) && File.Size <= UINT32_MAX)
+		{
+			bLoaded = Loader->Loader.LoadBinaryFromMemory(&Loader->Model, &Loader->Error, &Loader->Warnings, File.Data, (uint32)File.Size, GetBaseDir(Filename));
+		}
+		if (bLoaded)
+		{
+			MapGLTFBuffers(Loader, &File);
+		}
+	}
+	else
+	{
+		Loader->Loader.SetFsCallbacks(GetMappedFsCallbacks(Loader));
+		bLoaded = Loader->Loader.LoadASCIIFromFile(&Loader->Model, &Loader->Error, &Loader->Warnings, Filename);
+		if (bLoaded)
+		{
+			MapGLTFBuffers(Loader, nullptr);
+		}
+	}
+
+	if (bLoaded)
 	{
 		Loader->bFinishedLoading = true;
 		return Loader;
 	}
-	
+
+	if (!Loader->Error.empty())
+	{
+		::OutputDebugStringA("*** Unable to load ");
+		::OutputDebugStringA(Filename);
+		::OutputDebugStringA(": ");
+		::OutputDebugStringA(Loader->Error.c_str());
+		::OutputDebugStringA("\n");
+	}
 	delete Loader;
 	return nullptr;
 }
@@ -253,13 +931,177 @@ void FreeGLTFLoader(FGLTFLoader* Loader)
 {
 	if (Loader)
 	{
+		// Staging buffers of a scene that never got handed over stay with the staging manager until it's destroyed
+		Loader->Scene.Destroy();
 		delete Loader;
 	}
 }
 
+// -gltfloadbench: grid meshes with positions, normals, UVs and 32 bit indices, each under its own node, adding up to about SizeInMB
+// of vertex and index data. Written as a .glb, or for any other extension as the .gltf plus a .bin next to it
+bool WriteTestGLTFScene(const char* Filename, uint32 SizeInMB)
+{
+	const uint32 GridSize = 256;
+	const uint32 NumVertices = GridSize * GridSize;
+	const uint32 NumIndices = (GridSize - 1) * (GridSize - 1) * 6;
+	const uint64 PositionsSize = NumVertices * 3 * sizeof(float);
+	const uint64 UVsSize = NumVertices * 2 * sizeof(float);
+	const uint64 IndicesSize = NumIndices * sizeof(uint32);
+	const uint64 MeshSize = PositionsSize * 2 + UVsSize + IndicesSize;
+	const float Height = 4.0f;
+
+	bool bBinary = IsGLB(Filename);
+	uint32 NumMeshes = std::max(1u, (uint32)(((uint64)SizeInMB << 20) / MeshSize));
+	if (bBinary)
+	{
+		// GLB lengths are 32 bit; leave room for the JSON
+		NumMeshes = std::min(NumMeshes, (uint32)((UINT32_MAX - (64u << 20)) / MeshSize));
+	}
+	uint64 BinSize = MeshSize * NumMeshes;
+	uint32 NumPerRow = (uint32)ceil(sqrt((double)NumMeshes));
+
+	// Every mesh has the same data
+	std::vector<float> Positions;
+	std::vector<float> Normals;
+	std::vector<float> UVs;
+	std::vector<uint32> Indices;
+	for (uint32 Z = 0; Z < GridSize; ++Z)
+	{
+		for (uint32 X = 0; X < GridSize; ++X)
+		{
+			Positions.push_back((float)X);
+			Positions.push_back(Height * sinf((float)X * 0.1f) * cosf((float)Z * 0.1f));
+			Positions.push_back((float)Z);
+			Normals.push_back(0);
+			Normals.push_back(1);
+			Normals.push_back(0);
+			UVs.push_back((float)X / (float)(GridSize - 1));
+			UVs.push_back((float)Z / (float)(GridSize - 1));
+		}
+	}
+	for (uint32 Z = 0; Z + 1 < GridSize; ++Z)
+	{
+		for (uint32 X = 0; X + 1 < GridSize; ++X)
+		{
+			uint32 Index = Z * GridSize + X;
+			uint32 Quad[6] = {Index, Index + GridSize, Index + 1, Index + 1, Index + GridSize, Index + GridSize + 1};
+			Indices.insert(Indices.end(), Quad, Quad + 6);
+		}
+	}
+
+	std::string BinFilename = std::string(Filename, strrchr(Filename, '.') ? strrchr(Filename, '.') : Filename + strlen(Filename)) + ".bin";
+	std::stringstream JSON;
+	JSON << "{\"asset\":{\"version\":\"2.0\"},\"scene\":0,\"scenes\":[{\"nodes\":[";
+	for (uint32 Index = 0; Index < NumMeshes; ++Index)
+	{
+		JSON << (Index ? "," : "") << Index;
+	}
+	JSON << "]}],\"nodes\":[";
+	for (uint32 Index = 0; Index < NumMeshes; ++Index)
+	{
+		JSON << (Index ? "," : "") << "{\"mesh\":" << Index << ",\"translation\":[" << (Index % NumPerRow) * GridSize << ",0," << (Index / NumPerRow) * GridSize << "]}";
+	}
+	JSON << "],\"meshes\":[";
+	for (uint32 Index = 0; Index < NumMeshes; ++Index)
+	{
+		uint32 First = Index * 4;
+		JSON << (Index ? "," : "") << "{\"primitives\":[{\"attributes\":{\"POSITION\":" << First << ",\"NORMAL\":" << First + 1 << ",\"TEXCOORD_0\":" << First + 2 << "},\"indices\":" << First + 3 << "}]}";
+	}
+	// No materials, the loader adds a default one
+	JSON << "],\"accessors\":[";
+	for (uint32 Index = 0; Index < NumMeshes; ++Index)
+	{
+		uint32 First = Index * 4;
+		JSON << (Index ? "," : "")
+			<< "{\"bufferView\":" << First << ",\"componentType\":5126,\"count\":" << NumVertices << ",\"type\":\"VEC3\",\"min\":[0," << -Height << ",0],\"max\":[" << GridSize - 1 << "," << Height << "," << GridSize - 1 << "]},"
+			<< "{\"bufferView\":" << First + 1 << ",\"componentType\":5126,\"count\":" << NumVertices << ",\"type\":\"VEC3\"},"
+			<< "{\"bufferView\":" << First + 2 << ",\"componentType\":5126,\"count\":" << NumVertices << ",\"type\":\"VEC2\"},"
+			<< "{\"bufferView\":" << First + 3 << ",\"componentType\":5125,\"count\":" << NumIndices << ",\"type\":\"SCALAR\"}";
+	}
+	JSON << "],\"bufferViews\":[";
+	for (uint32 Index = 0; Index < NumMeshes; ++Index)
+	{
+		uint64 Offset = Index * MeshSize;
+		JSON << (Index ? "," : "")
+			<< "{\"buffer\":0,\"byteOffset\":" << Offset << ",\"byteLength\":" << PositionsSize << ",\"target\":34962},"
+			<< "{\"buffer\":0,\"byteOffset\":" << Offset + PositionsSize << ",\"byteLength\":" << PositionsSize << ",\"target\":34962},"
+			<< "{\"buffer\":0,\"byteOffset\":" << Offset + PositionsSize * 2 << ",\"byteLength\":" << UVsSize << ",\"target\":34962},"
+			<< "{\"buffer\":0,\"byteOffset\":" << Offset + PositionsSize * 2 + UVsSize << ",\"byteLength\":" << IndicesSize << ",\"target\":34963}";
+	}
+	JSON << "],\"buffers\":[{\"byteLength\":" << BinSize;
+	if (!bBinary)
+	{
+		const char* BinName = BinFilename.c_str() + GetBaseDir(BinFilename).size();
+		JSON << ",\"uri\":\"" << BinName << "\"";
+	}
+	JSON << "}]}";
+	std::string JSONString = JSON.str();
+
+	FILE* File = nullptr;
+	if (fopen_s(&File, Filename, "wb") || !File)
+	{
+		return false;
+	}
+
+	if (bBinary)
+	{
+		// Chunks have to be 4 byte aligned; the JSON is padded with spaces, the BIN chunk already is
+		while (JSONString.size() % 4)
+		{
+			JSONString += ' ';
+		}
+		uint32 Header[5] = {0x46546C67, 2, (uint32)(12 + 8 + JSONString.size() + 8 + BinSize), (uint32)JSONString.size(), 0x4E4F534A};
+		fwrite(Header, sizeof(Header), 1, File);
+		fwrite(JSONString.data(), JSONString.size(), 1, File);
+		uint32 BinHeader[2] = {(uint32)BinSize, 0x004E4942};
+		fwrite(BinHeader, sizeof(BinHeader), 1, File);
+	}
+	else
+	{
+		fwrite(JSONString.data(), JSONString.size(), 1, File);
+		fclose(File);
+		if (fopen_s(&File, BinFilename.c_str(), "wb") || !File)
+		{
+			return false;
+		}
+	}
+
+	for (uint32 Index = 0; Index < NumMeshes; ++Index)
+	{
+		fwrite(Positions.data(), PositionsSize, 1, File);
+		fwrite(Normals.data(), PositionsSize, 1, File);
+		fwrite(UVs.data(), UVsSize, 1, File);
+		fwrite(Indices.data(), IndicesSize, 1, File);
+	}
+	bool bWritten = !ferror(File);
+	fclose(File);
+	return bWritten;
+}
+
 //double GetTimeInMs();
 
-void CreateGLTFGfxResources(FGLTFLoader* Loader, SVulkan::SDevice& Device, FPSOCache& PSOCache, FScene& Scene, FPendingOpsManager& PendingStagingOps, FStagingBufferManager* StagingMgr)
+static void ComputePrimBounds(tinygltf::Model& Model, const std::vector<const uint8*>& BufferData, int32 PositionAccessor, FBoundingBox& OutBounds)
+{
+	tinygltf::Accessor& Accessor = Model.accessors[PositionAccessor];
+	if (Accessor.count == 0)
+	{
+		// Leaves the box empty
+		return;
+	}
+	tinygltf::BufferView& BufferView = Model.bufferViews[Accessor.bufferView];
+	uint32 Stride = GetStride(Accessor, BufferView);
+	const uint8* Data = BufferData[BufferView.buffer] + BufferView.byteOffset + Accessor.byteOffset;
+	for (size_t Index = 0; Index < Accessor.count; ++Index)
+	{
+		const FVector3& Position = *(const FVector3*)Data;
+		OutBounds.Min = FVector3::Min(OutBounds.Min, Position);
+		OutBounds.Max = FVector3::Max(OutBounds.Max, Position);
+		Data += Stride;
+	}
+}
+
+// Runs on the loading thread: everything but registering the vertex decls, which the render thread does in MoveGLTFScene()
+void CreateGLTFGfxResources(FGLTFLoader* Loader, SVulkan::SDevice& Device, const FSceneMemPolicy& MemPolicy, VkBuffer DefaultAttributes, FStagingBufferManager* StagingMgr, FTextureUploader* Uploader, FJobSystem* JobSystem)
 {
 	//double Begin = GetTimeInMs();
 	//bool bLoaded = Loader->Loader.LoadASCIIFromFile(&Model, &Error, &Warnings, Filename);
@@ -271,6 +1113,7 @@ void CreateGLTFGfxResources(FGLTFLoader* Loader, SVulkan::SDevice& Device, FPSOC
 	//Begin = GetTimeInMs();
 	if (Loader)
 	{
+		FScene& Scene = Loader->Scene;
 		auto FindTextureValueDouble = [](tinygltf::Material& GLTFMaterial, const char* Name, bool bIsAdditional) -> double
 		{
 			auto& Values = bIsAdditional ? GLTFMaterial.additionalValues : GLTFMaterial.values;
@@ -300,40 +1143,42 @@ void CreateGLTFGfxResources(FGLTFLoader* Loader, SVulkan::SDevice& Device, FPSOC
 			Scene.Materials.push_back(Mtl);
 		}
 
+		bool bNeedsDefaultMaterial = false;
+		for (tinygltf::Mesh& GLTFMesh : Loader->Model.meshes)
+		{
+			for (tinygltf::Primitive& GLTFPrim : GLTFMesh.primitives)
+			{
+				bNeedsDefaultMaterial = bNeedsDefaultMaterial || GLTFPrim.material == -1;
+			}
+		}
+		if (bNeedsDefaultMaterial)
+		{
+			FScene::FMaterial Mtl;
+			Mtl.Name = "Default";
+			Scene.Materials.push_back(Mtl);
+		}
+
+		// Prims are set up (decls, streams, bounds) as jobs, their buffers created in one go, then filled as jobs again
+		struct FPrimJob
+		{
+			uint32 Mesh;
+			uint32 Prim;
+			tinygltf::Primitive* GLTFPrim;
+		};
+		std::vector<FPrimJob> PrimJobs;
+
 		for (tinygltf::Mesh& GLTFMesh : Loader->Model.meshes)
 		{
 			FScene::FMesh Mesh;
 			for (tinygltf::Primitive& GLTFPrim : GLTFMesh.primitives)
 			{
-				FScene::FPrim Prim;
-				tinygltf::Accessor& Indices = Loader->Model.accessors[GLTFPrim.indices];
-				check(Indices.type == TINYGLTF_TYPE_SCALAR);
-
-				tinygltf::BufferView& IndicesBufferView = Loader->Model.bufferViews[Indices.bufferView];
-				Prim.VertexDecl = GetOrAddVertexDecl(Device, Loader->Model, GLTFPrim, Prim, PSOCache);
-				Prim.Material = GLTFPrim.material;
-				Prim.PrimType = GetPrimType(GLTFPrim.mode);
-				Prim.NumIndices = (uint32)IndicesBufferView.byteLength / GetSizeInBytes(Indices.componentType);
-#if SCENE_USE_SINGLE_BUFFERS
-				uint32 Size = (uint32)IndicesBufferView.byteLength;
-				Prim.IndexBuffer.Create(Device, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, EMemLocation::CPU_TO_GPU, Size, true);
-				{
-					unsigned char* SrcData = Loader->Model.buffers[IndicesBufferView.buffer].data.data();
-					SrcData += IndicesBufferView.byteOffset + Indices.byteOffset;
-					unsigned short* DestData = (unsigned short*)Prim.IndexBuffer.Lock();
-					memcpy(DestData, SrcData, Size);
-					Prim.IndexBuffer.Unlock();
-				}
-				Device.SetDebugName(Prim.IndexBuffer.Buffer.Buffer, "GLTFIB");
-#else
-				Prim.IndexOffset = Indices.byteOffset + IndicesBufferView.byteOffset;
-				Prim.IndexBuffer = IndicesBufferView.buffer;
-#endif
-				Prim.IndexType = GetIndexType(Indices.componentType);
+				PrimJobs.push_back({(uint32)Scene.Meshes.size(), (uint32)Mesh.Prims.size(), &GLTFPrim});
 
+				FScene::FPrim Prim;
 				static uint32 ID = 0;
 				Prim.ID = ID;
 				++ID;
+				Prim.VertexDecl = (int)PrimJobs.size() - 1;
 
 				Mesh.Prims.push_back(Prim);
 			}
@@ -341,117 +1186,124 @@ void CreateGLTFGfxResources(FGLTFLoader* Loader, SVulkan::SDevice& Device, FPSOC
 			Scene.Meshes.push_back(Mesh);
 		}
 
-#if !SCENE_USE_SINGLE_BUFFERS
-		//#todo Flip Y
-		check(Model.buffers.size() == 1);
-		for (tinygltf::Buffer& GLTFBuffer : Loader->Model.buffers)
+		auto ForPrimRange = [&](uint32 FirstPrim, uint32 NumPrims, auto Func)
+		{
+			if (JobSystem)
+			{
+				JobSystem->ParallelFor(NumPrims, 8, [&](uint32 Index)
+				{
+					Func(FirstPrim + Index);
+				});
+			}
+			else
+			{
+				for (uint32 Index = FirstPrim; Index < FirstPrim + NumPrims; ++Index)
+				{
+					Func(Index);
+				}
+			}
+		};
+		auto ForEachPrim = [&](auto Func)
+		{
+			ForPrimRange(0, (uint32)PrimJobs.size(), Func);
+		};
+
+		std::vector<FPrimSetup> PrimSetups(PrimJobs.size());
+		Loader->PrimDecls.resize(PrimJobs.size());
+		ForEachPrim([&](uint32 Index)
+		{
+			FPrimJob& Job = PrimJobs[Index];
+			FScene::FPrim& Prim = Scene.Meshes[Job.Mesh].Prims[Job.Prim];
+			SetupPrim(Loader->Model, Loader->BufferData, *Job.GLTFPrim, Prim, PrimSetups[Index]);
+			Loader->PrimDecls[Index] = std::move(PrimSetups[Index].VertexDecl);
+
+			auto FoundPosition = Job.GLTFPrim->attributes.find("POSITION");
+			if (FoundPosition != Job.GLTFPrim->attributes.end())
+			{
+				ComputePrimBounds(Loader->Model, Loader->BufferData, FoundPosition->second, Prim.ObjectSpaceBounds);
+			}
+		});
+
+		std::vector<FScene::FPrim*> Prims;
+		for (FPrimJob& Job : PrimJobs)
+		{
+			Prims.push_back(&Scene.Meshes[Job.Mesh].Prims[Job.Prim]);
+		}
+
+		FGeometryUploads& Uploads = Loader->GeometryUploads;
+		std::vector<FPrimRegions> PrimRegions(PrimJobs.size());
+#if SCENE_USE_SINGLE_BUFFERS
+		for (uint32 Index = 0; Index < (uint32)PrimJobs.size(); ++Index)
+		{
+			CreatePrimBuffers(Device, MemPolicy, DefaultAttributes, PrimSetups[Index], *Prims[Index]);
+		}
+		for (uint32 Index = 0; Index < (uint32)PrimJobs.size(); ++Index)
+		{
+			ReservePrimRegions(Uploads, MemPolicy, PrimSetups[Index], *Prims[Index], PrimRegions[Index]);
+		}
+#else
+		std::vector<FVertexGroupLayout> Layouts;
+		LayoutVertexGroups(Scene, Loader->PrimDecls, PrimSetups, Prims, Layouts);
+		CreateVertexGroupBuffers(Device, MemPolicy, DefaultAttributes, Scene, PrimSetups, Layouts);
+		for (uint32 Index = 0; Index < (uint32)PrimJobs.size(); ++Index)
 		{
-			FBufferWithMem Buffer;
-			uint32 Size = (uint32)GLTFBuffer.data.size();
-			Buffer.Create(Device, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, EMemLocation::CPU_TO_GPU, Size, true);
-			float* Data = (float*)Buffer.Lock();
-			memcpy(Data, GLTFBuffer.data.data(), Size);
-			Buffer.Unlock();
-			Device.SetDebugName(Buffer.Buffer.Buffer, "GLTFBuffer");
-			Scene.Buffers.push_back(Buffer);
+			ReservePrimRegions(Uploads, MemPolicy, Scene, Layouts, PrimSetups[Index], *Prims[Index], PrimRegions[Index]);
 		}
 #endif
+
+		ForEachPrim([&](uint32 Index)
+		{
+			FillPrimRegions(Uploads, PrimSetups[Index], PrimRegions[Index], -1);
+		});
+
+		// Regions get reserved one prim after another, so the prims writing to a batch are a contiguous range
+		std::vector<std::pair<uint32, uint32>> BatchPrims(Uploads.BatchSizes.size(), std::make_pair(~0u, 0u));
+		for (uint32 Index = 0; Index < (uint32)PrimJobs.size(); ++Index)
+		{
+			auto AddRegion = [&](uint32 Region)
+			{
+				int32 Batch = Region == ~0u ? -1 : Uploads.Regions[Region].Batch;
+				if (Batch != -1)
+				{
+					BatchPrims[Batch].first = std::min(BatchPrims[Batch].first, Index);
+					BatchPrims[Batch].second = std::max(BatchPrims[Batch].second, Index + 1);
+				}
+			};
+			for (uint32 Region : PrimRegions[Index].Streams)
+			{
+				AddRegion(Region);
+			}
+			AddRegion(PrimRegions[Index].Indices);
+		}
+		for (uint32 Batch = 0; Batch < (uint32)BatchPrims.size(); ++Batch)
+		{
+			Uploads.BeginBatch(Batch, *StagingMgr);
+			ForPrimRange(BatchPrims[Batch].first, BatchPrims[Batch].second - BatchPrims[Batch].first, [&](uint32 Index)
+			{
+				FillPrimRegions(Uploads, PrimSetups[Index], PrimRegions[Index], (int32)Batch);
+			});
+			Uploads.EndBatch(Batch);
+		}
+		{
+			std::stringstream ss;
+			ss << "*** GLTF geometry: vertices in " << FSceneMemPolicy::GetName(MemPolicy.VertexBuffers) << ", indices in " << FSceneMemPolicy::GetName(MemPolicy.IndexBuffers)
+				<< ", " << (Uploads.GetNumStagedBytes() >> 20) << "MB staged in " << Uploads.BatchSizes.size() << " batches, at most " << (uint32)FGeometryUploads::MaxBatchesInFlight << " in flight, waited " << Uploads.NumWaits << " times\n";
+			::OutputDebugStringA(ss.str().c_str());
+		}
 		//AddDefaultVertexInputs(Device);
 
 		for (tinygltf::Image& GLTFImage : Loader->Model.images)
 		{
+			// Images embedded in a .glb keep their bufferView, but tinygltf has decoded them all the same
 			check(!GLTFImage.as_is);
-			check(GLTFImage.bufferView == -1);
 			check(!GLTFImage.image.empty());
 			{
 				FScene::FTexture Texture;
 				Texture.Image.Create(Device, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL | VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, EMemLocation::GPU, GLTFImage.width, GLTFImage.height, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT, GetNumMips(GLTFImage.width, GLTFImage.height));
 				Device.SetDebugName(Texture.Image.Image.Image, "GLTFTexture");
 
-				SVulkan::FCmdBuffer* CmdBuffer = Device.BeginCommandBuffer(Device.GfxQueueIndex);
-
-				uint32 Size = GLTFImage.width * GLTFImage.height * sizeof(uint32);
-				FStagingBuffer* TempBuffer = StagingMgr->AcquireBuffer(Size, CmdBuffer);
-
-				uint8* Data = (uint8*)TempBuffer->Buffer->Lock();
-				memcpy(Data, GLTFImage.image.data(), Size);
-				TempBuffer->Buffer->Unlock();
-
-				Device.TransitionImage(CmdBuffer, Texture.GetImage(),
-					VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_IMAGE_LAYOUT_UNDEFINED, 0,
-					VK_PIPELINE_STAGE_TRANSFER_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_ACCESS_TRANSFER_WRITE_BIT,
-					VK_IMAGE_ASPECT_COLOR_BIT);
-
-				VkBufferImageCopy Region;
-				ZeroMem(Region);
-				Region.imageExtent.width = GLTFImage.width;
-				Region.imageExtent.height = GLTFImage.height;
-				Region.imageExtent.depth = 1;
-				Region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-				Region.imageSubresource.layerCount = 1;
-				vkCmdCopyBufferToImage(CmdBuffer->CmdBuffer, TempBuffer->Buffer->Buffer.Buffer, Texture.GetImage(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &Region);
-
-				// All mips in DST
-				uint32 RemainingMips = Texture.Image.Image.NumMips;
-				uint32 Width = GLTFImage.width;
-				uint32 Height = GLTFImage.height;
-				for (uint32 Mip = 1; Mip < Texture.Image.Image.NumMips; ++Mip)
-				{
-					// Prev mip to SRC
-					Device.TransitionImage(CmdBuffer, Texture.GetImage(),
-						VK_PIPELINE_STAGE_TRANSFER_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_ACCESS_TRANSFER_WRITE_BIT,
-						VK_PIPELINE_STAGE_TRANSFER_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_ACCESS_TRANSFER_READ_BIT,
-						VK_IMAGE_ASPECT_COLOR_BIT, Mip - 1, 1);
-					VkImageBlit Region;
-					ZeroMem(Region);
-					Region.srcOffsets[1].x = Width;
-					Region.srcOffsets[1].y = Height;
-					Region.srcOffsets[1].z = 1;
-					Width = Max(Width >> 1, 1u);
-					Height = Max(Height >> 1, 1u);
-					Region.dstOffsets[1].x = Width;
-					Region.dstOffsets[1].y = Height;
-					Region.dstOffsets[1].z = 1;
-					Region.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-					Region.srcSubresource.mipLevel = Mip - 1;
-					Region.srcSubresource.layerCount = 1;
-					Region.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-					Region.dstSubresource.mipLevel = Mip;
-					Region.dstSubresource.layerCount = 1;
-					vkCmdBlitImage(CmdBuffer->CmdBuffer, Texture.GetImage(), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-						Texture.GetImage(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &Region, VK_FILTER_LINEAR);
-/*
-					// Test mips cleared to different colors
-					VkImageSubresourceRange Range = {};
-					Range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-					Range.baseMipLevel = Mip;
-					Range.layerCount = 1;
-					Range.levelCount = 1;
-					VkClearColorValue Color;
-					Color.float32[0] = (Mip & 4) ? 1 : 0;
-					Color.float32[1] = (Mip & 2) ? 1 : 0;
-					Color.float32[2] = (Mip & 1) ? 1 : 0;
-					Color.float32[3] = 1;
-					vkCmdClearColorImage(CmdBuffer->CmdBuffer, Texture.GetImage(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-						&Color, 1, &Range);
-*/
-					// Prev mip to DST
-					Device.TransitionImage(CmdBuffer, Texture.GetImage(),
-						VK_PIPELINE_STAGE_TRANSFER_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_ACCESS_TRANSFER_READ_BIT,
-						VK_PIPELINE_STAGE_TRANSFER_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_ACCESS_TRANSFER_WRITE_BIT,
-						VK_IMAGE_ASPECT_COLOR_BIT, Mip - 1, 1);
-				}
-
-				// All mips to READ
-				Device.TransitionImage(CmdBuffer, Texture.GetImage(),
-					VK_PIPELINE_STAGE_TRANSFER_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_ACCESS_TRANSFER_WRITE_BIT,
-					VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_ACCESS_SHADER_READ_BIT,
-					VK_IMAGE_ASPECT_COLOR_BIT);
-
-				CmdBuffer->End();
-				Device.Submit(Device.GfxQueue, CmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_NULL_HANDLE, VK_NULL_HANDLE);
-
-				//StagingMgr->ReleaseBuffer(TempBuffer);
+				// Copied on the transfer queue, mips get built on graphics once it lands
+				Uploader->AddTexture(Texture.GetImage(), GLTFImage.width, GLTFImage.height, Texture.Image.Image.NumMips, std::move(GLTFImage.image));
 
 				Scene.Textures.push_back(Texture);
 			}
@@ -495,6 +1347,11 @@ void CreateGLTFGfxResources(FGLTFLoader* Loader, SVulkan::SDevice& Device, FPSOC
 				Scene.Instances.push_back(Instance);
 			}
 		}
+
+		// Everything has been copied out, so let go of the parsed model and mappings here rather than on the render thread
+		Loader->Model = tinygltf::Model();
+		Loader->BufferData.clear();
+		Loader->MappedFiles.clear();
 	}
 
 	//End = GetTimeInMs();
@@ -504,3 +1361,31 @@ void CreateGLTFGfxResources(FGLTFLoader* Loader, SVulkan::SDevice& Device, FPSOC
 
 	//return true;
 }
+
+// Render thread, every frame while the loading thread may still be filling geometry batches
+void TickGLTFUploads(FGLTFLoader* Loader, FPendingOpsManager& PendingOpsMgr, SVulkan::FCmdBuffer* CmdBuffer)
+{
+	Loader->GeometryUploads.Tick(PendingOpsMgr, CmdBuffer);
+}
+
+// The loading thread stops waiting on geometry batches once the render thread no longer ticks them
+void CancelGLTFUploads(FGLTFLoader* Loader)
+{
+	Loader->GeometryUploads.Cancel();
+}
+
+// The render thread's part of loading; geometry batches not handed over yet get copied at the start of the next frame
+void MoveGLTFScene(FGLTFLoader* Loader, FPSOCache& PSOCache, FPendingOpsManager& PendingOpsMgr, FScene& OutScene)
+{
+	for (FScene::FMesh& Mesh : Loader->Scene.Meshes)
+	{
+		for (FScene::FPrim& Prim : Mesh.Prims)
+		{
+			Prim.VertexDecl = PSOCache.FindOrAddVertexDecl(Loader->PrimDecls[Prim.VertexDecl]);
+		}
+	}
+	// Before the move, as the regions point into the loader's scene
+	Loader->GeometryUploads.Submit(PendingOpsMgr);
+	OutScene = std::move(Loader->Scene);
+	Loader->Scene = FScene();
+}
@@ -4,7 +4,7 @@
 
 #include "../RCUtils/RCUtilsMath.h"
 
-#define SCENE_USE_SINGLE_BUFFERS	1
+#define SCENE_USE_SINGLE_BUFFERS	0
 
 
 struct FBoundingBox
@@ -25,6 +25,19 @@ struct FBoundingBox
 	}
 };
 
+// Where each class of scene resource lives. GPU buffers get filled through staging copies recorded at the start of the frame
+// after loading; CPU_TO_GPU ones are written in place, but then every vertex fetch goes over the bus on a discrete GPU
+struct FSceneMemPolicy
+{
+	EMemLocation VertexBuffers = EMemLocation::GPU;
+	EMemLocation IndexBuffers = EMemLocation::GPU;
+
+	static const char* GetName(EMemLocation Location)
+	{
+		return Location == EMemLocation::GPU ? "gpu" : Location == EMemLocation::CPU_TO_GPU ? "cpu_to_gpu" : "cpu";
+	}
+};
+
 struct FScene
 {
 	std::vector<FBufferWithMem> Buffers;
@@ -37,17 +50,21 @@ struct FScene
 #if SCENE_USE_SINGLE_BUFFERS
 		FBufferWithMem IndexBuffer;
 		std::vector<FBufferWithMem> VertexBuffers;
+		// Per binding of the decl: one of VertexBuffers, or FPSOCache::DefaultAttributes for a missing attribute
+		std::vector<VkBuffer> BindingBuffers;
+		std::vector<VkDeviceSize> BindingOffsets;
 #else
-		int IndexBuffer;
-		VkDeviceSize IndexOffset;
-		std::vector<int> VertexBuffers;
-		std::vector<VkDeviceSize> VertexOffsets;
+		// Where the prim lives in its vertex group's buffers; indices are relative to BaseVertex
+		int VertexGroup = -1;
+		uint32 FirstIndex = 0;
+		int32 BaseVertex = 0;
 #endif
 		uint32 NumIndices = 0;
 		VkIndexType IndexType = VK_INDEX_TYPE_UINT32;
 		VkPrimitiveTopology PrimType = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;;
 		int Material = -1;
 		int VertexDecl = -1;
+		FPSOCache::FGfxPSOVariantHandle PSOVariants[2];	// Solid, wireframe
 
 		FBoundingBox ObjectSpaceBounds;
 	};
@@ -59,6 +76,20 @@ struct FScene
 
 	std::vector<FMesh> Meshes;
 
+#if !SCENE_USE_SINGLE_BUFFERS
+	// Prims with the same vertex decl share a device local vertex buffer and index buffer (both in Buffers), so consecutive ones
+	// only need binding once. Each of the decl's bindings is a range of the vertex buffer, except the instance rate ones for
+	// missing attributes, which point at FPSOCache::DefaultAttributes
+	struct FVertexGroup
+	{
+		int VertexBuffer = -1;
+		int IndexBuffer = -1;
+		std::vector<VkBuffer> BindingBuffers;
+		std::vector<VkDeviceSize> BindingOffsets;
+	};
+	std::vector<FVertexGroup> VertexGroups;
+#endif
+
 	struct FInstance
 	{
 		uint32 ID;
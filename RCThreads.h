@@ -0,0 +1,340 @@
+#pragma once
+
+#include "../RCUtils/RCUtilsBase.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Jobs added with the same counter can be waited on as a group
+struct FJobCounter
+{
+	std::atomic<int32> Count = 0;
+
+	bool IsDone() const
+	{
+		return Count.load(std::memory_order_acquire) == 0;
+	}
+};
+
+struct FJob
+{
+	std::function<void()> Func;
+	FJobCounter* Counter = nullptr;
+
+	// Unfinished dependencies, plus one held by AddJob() until the job has been set up
+	std::atomic<int32> NumBlockers = 1;
+
+	// bFinished is only set, and Dependents only touched, with Mutex held
+	std::mutex Mutex;
+	std::atomic<bool> bFinished = false;
+	std::vector<std::shared_ptr<FJob>> Dependents;
+};
+typedef std::shared_ptr<FJob> FJobHandle;
+
+// Work stealing scheduler: each worker pushes and pops at the back of its own deque and steals from the front of the others
+// when it runs dry. Other threads (eg main) hand out their jobs round robin, and run jobs themselves while they wait.
+// Jobs shouldn't block for long (file IO etc), as any waiting thread might pick them up.
+struct FJobSystem
+{
+	struct FWorker
+	{
+		std::mutex Mutex;
+		std::deque<FJobHandle> Jobs;
+	};
+	std::vector<std::thread> Threads;
+	std::deque<FWorker> Workers;
+	std::atomic<uint32> NextWorker = 0;
+
+	std::mutex SleepMutex;
+	std::condition_variable JobAdded;
+	std::atomic<int32> NumQueued = 0;
+	bool bQuit = false;
+
+	struct
+	{
+		std::atomic<uint64> NumJobs = 0;
+		std::atomic<uint64> NumSteals = 0;
+	} Stats;
+
+	void Init(uint32 NumThreads)
+	{
+		check(Threads.empty() && NumThreads > 0);
+		for (uint32 Index = 0; Index < NumThreads; ++Index)
+		{
+			Workers.emplace_back();
+		}
+		for (uint32 Index = 0; Index < NumThreads; ++Index)
+		{
+			Threads.emplace_back(&FJobSystem::WorkerLoop, this, Index);
+		}
+	}
+
+	// Jobs already queued still run before the workers exit
+	void Destroy()
+	{
+		{
+			std::lock_guard<std::mutex> Lock(SleepMutex);
+			bQuit = true;
+		}
+		JobAdded.notify_all();
+		for (auto& Thread : Threads)
+		{
+			Thread.join();
+		}
+		Threads.clear();
+		Workers.clear();
+		bQuit = false;
+	}
+
+	bool IsRunning() const
+	{
+		return !Threads.empty();
+	}
+
+	uint32 GetNumWorkers() const
+	{
+		return (uint32)Threads.size();
+	}
+
+	// The job runs once all of Dependencies have finished
+	FJobHandle AddJob(std::function<void()> Func, FJobCounter* Counter = nullptr, std::initializer_list<FJobHandle> Dependencies = {})
+	{
+		check(IsRunning());
+		FJobHandle Job = std::make_shared<FJob>();
+		Job->Func = std::move(Func);
+		Job->Counter = Counter;
+		if (Counter)
+		{
+			Counter->Count.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		for (const FJobHandle& Dependency : Dependencies)
+		{
+			std::lock_guard<std::mutex> Lock(Dependency->Mutex);
+			if (!Dependency->bFinished)
+			{
+				Job->NumBlockers.fetch_add(1, std::memory_order_relaxed);
+				Dependency->Dependents.push_back(Job);
+			}
+		}
+
+		Unblock(Job);
+		return Job;
+	}
+
+	void Wait(const FJobHandle& Job)
+	{
+		HelpUntil([&Job]() { return Job->bFinished.load(std::memory_order_acquire); });
+	}
+
+	void Wait(const FJobCounter& Counter)
+	{
+		HelpUntil([&Counter]() { return Counter.IsDone(); });
+	}
+
+	// Calls Func(Index) for every Index in [0, Num), BatchSize indices per job; the calling thread takes the first batch
+	template <typename TFunc>
+	void ParallelFor(uint32 Num, uint32 BatchSize, TFunc Func)
+	{
+		BatchSize = std::max(1u, BatchSize);
+		FJobCounter Counter;
+		if (IsRunning())
+		{
+			for (uint32 Begin = BatchSize; Begin < Num; Begin += BatchSize)
+			{
+				uint32 End = std::min(Begin + BatchSize, Num);
+				AddJob([&Func, Begin, End]()
+				{
+					for (uint32 Index = Begin; Index < End; ++Index)
+					{
+						Func(Index);
+					}
+				}, &Counter);
+			}
+		}
+
+		uint32 End = IsRunning() ? std::min(BatchSize, Num) : Num;
+		for (uint32 Index = 0; Index < End; ++Index)
+		{
+			Func(Index);
+		}
+		Wait(Counter);
+	}
+
+	struct FCurrentWorker
+	{
+		const FJobSystem* System = nullptr;
+		int32 Index = -1;
+	};
+
+	static FCurrentWorker& GetCurrentWorker()
+	{
+		static thread_local FCurrentWorker Current;
+		return Current;
+	}
+
+	int32 GetCurrentWorkerIndex() const
+	{
+		const FCurrentWorker& Current = GetCurrentWorker();
+		return Current.System == this ? Current.Index : -1;
+	}
+
+	void Unblock(const FJobHandle& Job)
+	{
+		if (Job->NumBlockers.fetch_sub(1, std::memory_order_acq_rel) != 1)
+		{
+			return;
+		}
+
+		int32 Self = GetCurrentWorkerIndex();
+		uint32 Index = Self != -1 ? (uint32)Self : NextWorker.fetch_add(1, std::memory_order_relaxed) % (uint32)Workers.size();
+		{
+			std::lock_guard<std::mutex> Lock(Workers[Index].Mutex);
+			Workers[Index].Jobs.push_back(Job);
+		}
+		{
+			std::lock_guard<std::mutex> Lock(SleepMutex);
+			NumQueued.fetch_add(1, std::memory_order_relaxed);
+		}
+		JobAdded.notify_one();
+	}
+
+	// Newest first from our own deque, oldest first from anyone else's
+	FJobHandle TryPopJob(int32 Self)
+	{
+		uint32 NumWorkers = (uint32)Workers.size();
+		uint32 Start = Self != -1 ? (uint32)Self : 0;
+		for (uint32 Offset = 0; Offset < NumWorkers; ++Offset)
+		{
+			uint32 Index = (Start + Offset) % NumWorkers;
+			FWorker& Worker = Workers[Index];
+			std::lock_guard<std::mutex> Lock(Worker.Mutex);
+			if (Worker.Jobs.empty())
+			{
+				continue;
+			}
+
+			FJobHandle Job;
+			if ((int32)Index == Self)
+			{
+				Job = std::move(Worker.Jobs.back());
+				Worker.Jobs.pop_back();
+			}
+			else
+			{
+				Job = std::move(Worker.Jobs.front());
+				Worker.Jobs.pop_front();
+				Stats.NumSteals.fetch_add(1, std::memory_order_relaxed);
+			}
+			NumQueued.fetch_sub(1, std::memory_order_relaxed);
+			return Job;
+		}
+
+		return nullptr;
+	}
+
+	void Run(const FJobHandle& Job)
+	{
+		Job->Func();
+		Job->Func = nullptr;
+
+		std::vector<FJobHandle> Dependents;
+		{
+			std::lock_guard<std::mutex> Lock(Job->Mutex);
+			Job->bFinished = true;
+			Dependents.swap(Job->Dependents);
+		}
+		for (const FJobHandle& Dependent : Dependents)
+		{
+			Unblock(Dependent);
+		}
+
+		Stats.NumJobs.fetch_add(1, std::memory_order_relaxed);
+		// Last, as a waiter can return and free the counter as soon as it reaches zero
+		if (Job->Counter)
+		{
+			Job->Counter->Count.fetch_sub(1, std::memory_order_release);
+		}
+	}
+
+	template <typename TFunc>
+	void HelpUntil(TFunc IsDone)
+	{
+		int32 Self = GetCurrentWorkerIndex();
+		while (!IsDone())
+		{
+			FJobHandle Job = IsRunning() ? TryPopJob(Self) : nullptr;
+			if (Job)
+			{
+				Run(Job);
+			}
+			else
+			{
+				std::this_thread::yield();
+			}
+		}
+	}
+
+	void WorkerLoop(uint32 Index)
+	{
+		GetCurrentWorker().System = this;
+		GetCurrentWorker().Index = (int32)Index;
+		for (;;)
+		{
+			FJobHandle Job = TryPopJob((int32)Index);
+			if (Job)
+			{
+				Run(Job);
+				continue;
+			}
+
+			std::unique_lock<std::mutex> Lock(SleepMutex);
+			JobAdded.wait(Lock, [this]() { return bQuit || NumQueued.load(std::memory_order_relaxed) > 0; });
+			if (bQuit && NumQueued.load(std::memory_order_relaxed) <= 0)
+			{
+				break;
+			}
+		}
+	}
+};
+
+// Any thread can push; one consumer takes the whole list at once, which avoids the ABA problem of single pops
+template <typename T>
+struct TLockFreeList
+{
+	struct FNode
+	{
+		T Value;
+		FNode* Next;
+	};
+	std::atomic<FNode*> Head = nullptr;
+
+	void Push(const T& Value)
+	{
+		FNode* Node = new FNode{Value, Head.load(std::memory_order_relaxed)};
+		while (!Head.compare_exchange_weak(Node->Next, Node, std::memory_order_release, std::memory_order_relaxed))
+		{
+		}
+	}
+
+	// Items come out newest first
+	template <typename TFunc>
+	void PopAll(TFunc Func)
+	{
+		FNode* Node = Head.exchange(nullptr, std::memory_order_acquire);
+		while (Node)
+		{
+			Func(Node->Value);
+			FNode* Next = Node->Next;
+			delete Node;
+			Node = Next;
+		}
+	}
+};
@@ -179,20 +179,25 @@ void SVulkan::GetPhysicalDevices()
 		uint32 TransferQueueIndex = FindQueue(QueueProps, VK_QUEUE_TRANSFER_BIT);
 		uint32 PresentQueueIndex = VK_QUEUE_FAMILY_IGNORED;
 #if defined(VK_USE_PLATFORM_WIN32_KHR) && VK_USE_PLATFORM_WIN32_KHR
-		if (vkGetPhysicalDeviceWin32PresentationSupportKHR(PD, GfxQueueIndex))
+		// Headless has no surface extensions to query, and nothing to present
+		if (!bHeadless)
 		{
-			PresentQueueIndex = GfxQueueIndex;
-		}
-		else if (GfxQueueIndex != ComputeQueueIndex && vkGetPhysicalDeviceWin32PresentationSupportKHR(PD, ComputeQueueIndex))
-		{
-			PresentQueueIndex = ComputeQueueIndex;
-		}
-		else if (GfxQueueIndex != TransferQueueIndex && vkGetPhysicalDeviceWin32PresentationSupportKHR(PD, TransferQueueIndex))
-		{
-			PresentQueueIndex = TransferQueueIndex;
+			if (vkGetPhysicalDeviceWin32PresentationSupportKHR(PD, GfxQueueIndex))
+			{
+				PresentQueueIndex = GfxQueueIndex;
+			}
+			else if (GfxQueueIndex != ComputeQueueIndex && vkGetPhysicalDeviceWin32PresentationSupportKHR(PD, ComputeQueueIndex))
+			{
+				PresentQueueIndex = ComputeQueueIndex;
+			}
+			else if (GfxQueueIndex != TransferQueueIndex && vkGetPhysicalDeviceWin32PresentationSupportKHR(PD, TransferQueueIndex))
+			{
+				PresentQueueIndex = TransferQueueIndex;
+			}
 		}
 #endif
-		if (Props.apiVersion < VK_API_VERSION_1_1)
+		// 1.2 for timeline semaphores
+		if (Props.apiVersion < VK_API_VERSION_1_2)
 		{
 			continue;
 		}
@@ -216,6 +221,10 @@ void SVulkan::GetPhysicalDevices()
 		{
 			IntegratedDevices.push_back(PD);
 		}
+		else if (Props.deviceType == VK_PHYSICAL_DEVICE_TYPE_CPU)
+		{
+			CPUDevices.push_back(PD);
+		}
 		else
 		{
 			// What is this? :)
@@ -230,6 +239,7 @@ void SVulkan::GetPhysicalDevices()
 		Device.GfxQueueIndex = GfxQueueIndex;
 		Device.TransferQueueIndex = TransferQueueIndex;
 		Device.PresentQueueIndex = PresentQueueIndex;
+		Device.QueueFamilyProps = QueueProps;
 	}
 }
 
@@ -316,12 +326,20 @@ void SVulkan::CreateInstance()
 	::OutputDebugStringA("Using Instance Layers:\n");
 	PrintList(Layers);
 
-	VerifyExtensions(ExtensionProperties, GInstanceExtensions);
-	Info.ppEnabledExtensionNames = GInstanceExtensions.data();
-	Info.enabledExtensionCount = (uint32)GInstanceExtensions.size();
+	std::vector<const char*> InstanceExtensions;
+	for (const char* Extension : GInstanceExtensions)
+	{
+		if (!bHeadless || !strstr(Extension, "_surface"))
+		{
+			InstanceExtensions.push_back(Extension);
+		}
+	}
+	VerifyExtensions(ExtensionProperties, InstanceExtensions);
+	Info.ppEnabledExtensionNames = InstanceExtensions.data();
+	Info.enabledExtensionCount = (uint32)InstanceExtensions.size();
 
 	::OutputDebugStringA("Using Instance Extensions:\n");
-	PrintList(GInstanceExtensions);
+	PrintList(InstanceExtensions);
 
 	// Needed to enable 1.1
 	VkApplicationInfo AppInfo;
@@ -379,12 +397,21 @@ void SVulkan::FSwapchain::SetupSurface(SDevice* InDevice, VkInstance InInstance,
 
 void SVulkan::FSwapchain::Create(SDevice& Device, GLFWwindow* Window)
 {
-	AcquireBackbufferSemaphore = Device.CreateSemaphore();
-	FinalSemaphore = Device.CreateSemaphore();
-
 	VERIFY_VKRESULT(vkGetPhysicalDeviceSurfaceCapabilitiesKHR(Device.PhysicalDevice, Surface, &SurfaceCaps));
 
-	DestroyImages();
+	// Frames still in flight can be using the old images
+	std::vector<VkImageView> OldImageViews;
+	OldImageViews.swap(ImageViews);
+	if (!OldImageViews.empty())
+	{
+		Device.DeferDelete([&Device, OldImageViews]()
+			{
+				for (VkImageView ImageView : OldImageViews)
+				{
+					vkDestroyImageView(Device.Device, ImageView, nullptr);
+				}
+			});
+	}
 
 	int Width = 0, Height = 0;
 	glfwGetFramebufferSize(Window, &Width, &Height);
@@ -418,6 +445,11 @@ void SVulkan::FSwapchain::Create(SDevice& Device, GLFWwindow* Window)
 	CreateInfo.oldSwapchain = Swapchain;
 
 	VERIFY_VKRESULT(vkCreateSwapchainKHR(Device.Device, &CreateInfo, nullptr, &Swapchain));
+	if (CreateInfo.oldSwapchain != VK_NULL_HANDLE)
+	{
+		VkSwapchainKHR OldSwapchain = CreateInfo.oldSwapchain;
+		Device.DeferDelete([&Device, OldSwapchain]() { vkDestroySwapchainKHR(Device.Device, OldSwapchain, nullptr); });
+	}
 
 	uint32 NumImages = 0;
 	VERIFY_VKRESULT(vkGetSwapchainImagesKHR(Device.Device, Swapchain, &NumImages, nullptr));
@@ -433,30 +465,133 @@ void SVulkan::FSwapchain::Create(SDevice& Device, GLFWwindow* Window)
 	VERIFY_VKRESULT(vkGetPhysicalDeviceSurfaceCapabilitiesKHR(Device.PhysicalDevice, Surface, &SurfaceCaps));
 }
 
-void SVulkan::FSwapchain::Recreate(SDevice& Device, GLFWwindow* Window)
+void SVulkan::FSwapchain::Recreate(SDevice& Device, GLFWwindow* Window, VkSemaphore AcquireSemaphore)
 {
-	DestroySemaphores();
 	Create(Device, Window);
-	bool bAcquire = AcquireBackbuffer();
+	bool bAcquire = AcquireBackbuffer(AcquireSemaphore);
 	check(bAcquire);
 }
 
 
-bool FDescriptorPSOCache::GetParameter(const char* Name, uint32& OutBinding, VkDescriptorType& OutType)
+FShaderParameter FDescriptorPSOCache::GetParameter(const char* Name) const
 {
 	check(Name && *Name);
-	auto Found = PSO->ParameterMap.find(Name);
-	if (Found == PSO->ParameterMap.end())
+	return FShaderParameter(SVulkan::FPSO::FindParameterSlot(PSO->ParameterMap, Name));
+}
+
+// Prefixed to the VkPipelineCache data so a cache from another GPU or driver is never handed to the driver
+struct FPipelineCacheFileHeader
+{
+	uint32 Magic;
+	uint32 Version;
+	uint32 VendorID;
+	uint32 DeviceID;
+	uint32 DriverVersion;
+	uint8 PipelineCacheUUID[VK_UUID_SIZE];
+	uint64 DataSize;
+};
+
+static const uint32 GPipelineCacheMagic = 0x434F5350;
+static const uint32 GPipelineCacheVersion = 1;
+
+static FPipelineCacheFileHeader MakePipelineCacheHeader(const VkPhysicalDeviceProperties& Props, uint64 DataSize)
+{
+	FPipelineCacheFileHeader Header;
+	ZeroMem(Header);
+	Header.Magic = GPipelineCacheMagic;
+	Header.Version = GPipelineCacheVersion;
+	Header.VendorID = Props.vendorID;
+	Header.DeviceID = Props.deviceID;
+	Header.DriverVersion = Props.driverVersion;
+	memcpy(Header.PipelineCacheUUID, Props.pipelineCacheUUID, VK_UUID_SIZE);
+	Header.DataSize = DataSize;
+	return Header;
+}
+
+void FPSOCache::CreatePipelineCache()
+{
+	RCUtils::FCmdLine& CmdLine = RCUtils::FCmdLine::Get();
+	const char* Filename = nullptr;
+	PipelineCacheFilename = CmdLine.TryGetStringFromPrefix("-psocache=", Filename) ? Filename : "PipelineCache.bin";
+
+	// -coldpsocache: start from an empty cache and write a fresh one on exit
+	if (CmdLine.Contains("-coldpsocache"))
 	{
-		return false;
+		remove(PipelineCacheFilename.c_str());
+	}
+
+	std::vector<char> File;
+	if (!CmdLine.Contains("-nopsocache"))
+	{
+		File = RCUtils::LoadFileToArray(PipelineCacheFilename.c_str());
+	}
+
+	VkPipelineCacheCreateInfo Info;
+	ZeroVulkanMem(Info, VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO);
+	if (File.size() >= sizeof(FPipelineCacheFileHeader))
+	{
+		FPipelineCacheFileHeader Header;
+		memcpy(&Header, File.data(), sizeof(Header));
+		FPipelineCacheFileHeader Expected = MakePipelineCacheHeader(Device->Props, File.size() - sizeof(Header));
+		if (!memcmp(&Header, &Expected, sizeof(Header)))
+		{
+			Info.initialDataSize = (size_t)Header.DataSize;
+			Info.pInitialData = File.data() + sizeof(Header);
+		}
+		else
+		{
+			::OutputDebugStringA("*** Ignoring pipeline cache from a different device/driver: ");
+			::OutputDebugStringA(PipelineCacheFilename.c_str());
+			::OutputDebugStringA("\n");
+		}
+	}
+
+	VERIFY_VKRESULT(vkCreatePipelineCache(Device->Device, &Info, nullptr, &PipelineCache));
+	LoadedPipelineCacheSize = Info.initialDataSize;
+
+	std::stringstream ss;
+	ss << "*** Pipeline cache " << PipelineCacheFilename << ": " << (Info.initialDataSize ? "warm" : "cold") << ", " << Info.initialDataSize << " bytes\n";
+	::OutputDebugStringA(ss.str().c_str());
+}
+
+void FPSOCache::SavePipelineCache()
+{
+	size_t Size = 0;
+	VERIFY_VKRESULT(vkGetPipelineCacheData(Device->Device, PipelineCache, &Size, nullptr));
+	std::vector<char> Data(sizeof(FPipelineCacheFileHeader) + Size);
+	VERIFY_VKRESULT(vkGetPipelineCacheData(Device->Device, PipelineCache, &Size, Data.data() + sizeof(FPipelineCacheFileHeader)));
+
+	FPipelineCacheFileHeader Header = MakePipelineCacheHeader(Device->Props, Size);
+	memcpy(Data.data(), &Header, sizeof(Header));
+
+	FILE* File = nullptr;
+	if (fopen_s(&File, PipelineCacheFilename.c_str(), "wb") || !File)
+	{
+		::OutputDebugStringA("*** Unable to write pipeline cache ");
+		::OutputDebugStringA(PipelineCacheFilename.c_str());
+		::OutputDebugStringA("\n");
+		return;
+	}
+	fwrite(Data.data(), 1, sizeof(Header) + Size, File);
+	fclose(File);
+}
+
+// -psocachebench: total pipeline creation so far; run once with -coldpsocache and once without to compare a cold start against a warm one.
+// Driver side shader caches are outside our control, so disable those as well for a true cold number
+void FPSOCache::LogPipelineCacheBench(const char* Stage)
+{
+	if (!RCUtils::FCmdLine::Get().Contains("-psocachebench"))
+	{
+		return;
 	}
 
-	OutBinding = Found->second.first;
-	OutType = Found->second.second;
-	return true;
+	std::stringstream ss;
+	ss << "*** Pipeline cache bench (" << Stage << ", " << (LoadedPipelineCacheSize ? "warm" : "cold") << " " << LoadedPipelineCacheSize << " bytes): "
+		<< (NumPipelinesCreated - (uint32)ComputePSOs.size()) << " graphics + " << ComputePSOs.size() << " compute pipelines in " << PipelineCreateTimeMs << "ms\n";
+	::OutputDebugStringA(ss.str().c_str());
 }
 
-void SVulkan::SDevice::Create()
+void SVulkan::SDevice::Create(bool bWithSwapchain)
 {
 	uint32 NumExtensions = 0;
 	VERIFY_VKRESULT(vkEnumerateDeviceExtensionProperties(PhysicalDevice, nullptr, &NumExtensions, nullptr));
@@ -477,11 +612,17 @@ void SVulkan::SDevice::Create()
 	//	bUseVertexDivisor = true;
 	//}
 
-	VerifyExtensions(ExtensionProperties, GDeviceExtensions);
-
-	std::vector<const char*> DeviceExtensions = GDeviceExtensions;
+	std::vector<const char*> DeviceExtensions;
+	for (const char* Extension : GDeviceExtensions)
+	{
+		if (bWithSwapchain || strcmp(Extension, VK_KHR_SWAPCHAIN_EXTENSION_NAME))
+		{
+			DeviceExtensions.push_back(Extension);
+		}
+	}
+	VerifyExtensions(ExtensionProperties, DeviceExtensions);
 
-	bPushDescriptor = OptionalExtension(ExtensionProperties, VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME);
+	bPushDescriptor = !RCUtils::FCmdLine::Get().Contains("-nopushdescriptors") && OptionalExtension(ExtensionProperties, VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME);
 	if (bPushDescriptor)
 	{
 		DeviceExtensions.push_back(VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME);
@@ -519,7 +660,18 @@ void SVulkan::SDevice::Create()
 
 	VkPhysicalDeviceFeatures2 Features;
 	ZeroVulkanMem(Features, VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2);
+	VkPhysicalDeviceTimelineSemaphoreFeatures TimelineFeatures;
+	ZeroVulkanMem(TimelineFeatures, VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES);
+	Features.pNext = &TimelineFeatures;
+	// Descriptor indexing is core in 1.2, which every device we pick supports; the features themselves are still optional
+	VkPhysicalDeviceDescriptorIndexingFeatures IndexingFeatures;
+	ZeroVulkanMem(IndexingFeatures, VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES);
+	TimelineFeatures.pNext = &IndexingFeatures;
 	vkGetPhysicalDeviceFeatures2(PhysicalDevice, &Features);
+	// Required in 1.2; all GPU progress tracking goes through timeline semaphores
+	check(TimelineFeatures.timelineSemaphore);
+	bDescriptorIndexing = IndexingFeatures.descriptorBindingPartiallyBound
+		&& Features.features.shaderSampledImageArrayDynamicIndexing;
 
 	//VkPhysicalDeviceVertexAttributeDivisorFeaturesEXT Divisor;
 	//ZeroVulkanMem(Divisor, VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VERTEX_ATTRIBUTE_DIVISOR_FEATURES_EXT);
@@ -546,16 +698,27 @@ void SVulkan::SDevice::Create()
 	vkGetDeviceQueue(Device, GfxQueueIndex, 0, &GfxQueue);
 	vkGetDeviceQueue(Device, TransferQueueIndex, 0, &TransferQueue);
 	vkGetDeviceQueue(Device, ComputeQueueIndex, 0, &ComputeQueue);
-	vkGetDeviceQueue(Device, PresentQueueIndex, 0, &PresentQueue);
+	if (PresentQueueIndex != VK_QUEUE_FAMILY_IGNORED)
+	{
+		vkGetDeviceQueue(Device, PresentQueueIndex, 0, &PresentQueue);
+	}
 
-	CmdPools[GfxQueueIndex].Create(Device, GfxQueueIndex);
+	for (uint32 QueueIndex : {GfxQueueIndex, ComputeQueueIndex, TransferQueueIndex})
+	{
+		if (Timelines.find(QueueIndex) == Timelines.end())
+		{
+			Timelines[QueueIndex].Create(Device);
+		}
+	}
+
+	CmdPools[GfxQueueIndex].Create(Device, GfxQueueIndex, &Timelines[GfxQueueIndex]);
 	if (GfxQueueIndex != ComputeQueueIndex)
 	{
-		CmdPools[ComputeQueueIndex].Create(Device, ComputeQueueIndex);
+		CmdPools[ComputeQueueIndex].Create(Device, ComputeQueueIndex, &Timelines[ComputeQueueIndex]);
 	}
 	if (GfxQueueIndex != TransferQueueIndex)
 	{
-		CmdPools[TransferQueueIndex].Create(Device, TransferQueueIndex);
+		CmdPools[TransferQueueIndex].Create(Device, TransferQueueIndex, &Timelines[TransferQueueIndex]);
 	}
 
 	vkGetPhysicalDeviceMemoryProperties(PhysicalDevice, &MemProperties);
@@ -753,10 +916,13 @@ bool FShaderLibrary::DoCompileFromSource(FShaderInfo* Info)
 	return DoCompileFromBinary(Info);
 }
 
-void FGPUTiming::Init(SVulkan::SDevice* InDevice, FPendingOpsManager& PendingOpsMgr)
+void FGPUTiming::Init(SVulkan::SDevice* InDevice, FPendingOpsManager& PendingOpsMgr, uint32 QueueIndex)
 {
 	Device = InDevice;
 
+	uint32 ValidBits = Device->QueueFamilyProps[QueueIndex].timestampValidBits;
+	TimestampMask = ValidBits >= 64 ? ~0ull : ((1ull << ValidBits) - 1);
+
 	VkQueryPoolCreateInfo PoolCreateInfo;
 	ZeroVulkanMem(PoolCreateInfo, VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO);
 	PoolCreateInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
@@ -6,10 +6,17 @@
 
 #include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <sstream>
+#include <deque>
 #include <direct.h>
+#include <functional>
 #include <list>
+#include <mutex>
 #include <set>
+#include <thread>
+#include <unordered_map>
 
 #define NOMINMAX
 #define WIN32_LEAN_AND_MEAN
@@ -23,6 +30,7 @@ extern "C"
 }
 
 #include "RCVulkanBase.h"
+#include "RCThreads.h"
 
 
 enum class EMemLocation
@@ -109,6 +117,8 @@ struct FRenderTargetInfo : public FAttachmentInfo
 	}
 };
 
+struct FGPUProfiler;
+
 struct SVulkan
 {
 	VkInstance Instance = VK_NULL_HANDLE;
@@ -116,6 +126,11 @@ struct SVulkan
 
 	std::vector<VkPhysicalDevice> DiscreteDevices;
 	std::vector<VkPhysicalDevice> IntegratedDevices;
+	// Software implementations such as lavapipe; only picked when there is no GPU
+	std::vector<VkPhysicalDevice> CPUDevices;
+
+	// No window: no surface or swapchain extensions, and Swapchain is left empty
+	bool bHeadless = false;
 
 	struct FBuffer
 	{
@@ -229,14 +244,17 @@ struct SVulkan
 			check(Result == SPV_REFLECT_RESULT_SUCCESS);
 			uint32 NumDescSets = 0;
 			spvReflectEnumerateDescriptorSets(&Module, &NumDescSets, nullptr);
-			check(NumDescSets == 0 || NumDescSets == 1);
-			//DescSetInfo.resize(NumDescSets);
-			spvReflectEnumerateDescriptorSets(&Module, &NumDescSets, &DescSetInfo);
+			std::vector<SpvReflectDescriptorSet*> DescSets(NumDescSets);
+			spvReflectEnumerateDescriptorSets(&Module, &NumDescSets, DescSets.data());
 
-			//for (auto& SetInfo : DescSetInfo)
-			if (DescSetInfo)
+			for (SpvReflectDescriptorSet* SetInfo : DescSets)
 			{
-				auto& SetInfo = DescSetInfo;
+				// Parameters are only looked up in set 0, the per draw set; any other set (eg bindless) is bound by the caller
+				if (SetInfo->set == 0)
+				{
+					DescSetInfo = SetInfo;
+				}
+
 				std::vector<VkDescriptorSetLayoutBinding>& InfoBindings = SetInfoBindings[SetInfo->set];
 				for (uint32 Index = 0; Index < SetInfo->binding_count; ++Index)
 				{
@@ -276,10 +294,53 @@ struct SVulkan
 		VkPipeline Pipeline = VK_NULL_HANDLE;
 		VkPipelineLayout Layout = VK_NULL_HANDLE;
 
-		std::map<std::string, std::pair<uint32, VkDescriptorType>> ParameterMap;
+		struct FParameterInfo
+		{
+			uint32 Set;
+			uint32 Binding;
+			VkDescriptorType Type;
+			// Index in ParameterSlots, set by AssignParameterSlots()
+			int32 Slot = -1;
+
+			bool operator == (const FParameterInfo& Other) const
+			{
+				return Set == Other.Set && Binding == Other.Binding && Type == Other.Type;
+			}
+		};
+		typedef std::map<std::string, FParameterInfo> FParameterMap;
+		FParameterMap ParameterMap;
+
+		// ParameterMap flattened in name order, so a slot index is the same for every PSO built from the same map
+		typedef FParameterInfo FParameterSlot;
+		std::vector<FParameterSlot> ParameterSlots;
 
 		std::vector<VkDescriptorSetLayout> SetLayouts;
 		std::map<EShaderStages, SVulkan::FShader*> Shaders;
+
+		static void AssignParameterSlots(FParameterMap& InParameterMap)
+		{
+			int32 Slot = 0;
+			for (auto& Pair : InParameterMap)
+			{
+				Pair.second.Slot = Slot++;
+			}
+		}
+
+		void BuildParameterSlots()
+		{
+			ParameterSlots.clear();
+			for (auto& Pair : ParameterMap)
+			{
+				check(Pair.second.Slot == (int32)ParameterSlots.size());
+				ParameterSlots.push_back(Pair.second);
+			}
+		}
+
+		static int32 FindParameterSlot(const FParameterMap& InParameterMap, const char* Name)
+		{
+			auto Found = InParameterMap.find(Name);
+			return Found == InParameterMap.end() ? -1 : Found->second.Slot;
+		}
 	};
 
 	struct FComputePSO : public FPSO
@@ -294,108 +355,113 @@ struct SVulkan
 		}
 	};
 
-	struct FFence
+	// One timeline semaphore per queue family; each primary command buffer signals a new value when it finishes. Completion
+	// is read back once per frame by Refresh(), so checking whether anything has finished is a compare against CompletedValue
+	struct FTimeline
 	{
-		VkFence Fence = VK_NULL_HANDLE;
-		/*std::atomic<*/uint64 Counter = 0;
+		VkSemaphore Semaphore = VK_NULL_HANDLE;
 		VkDevice Device = VK_NULL_HANDLE;
-		enum class EState
-		{
-			Reset,
-			WaitingSignal,
-			Signaled,
-		};
-		EState State = EState::Reset;
+		uint64 NextValue = 1;
+		uint64 LastSubmittedValue = 0;
+		uint64 CompletedValue = 0;
 
 		void Create(VkDevice InDevice)
 		{
 			Device = InDevice;
-			check(Fence == VK_NULL_HANDLE);
-			check(State == EState::Reset);
-			VkFenceCreateInfo Info;
-			ZeroVulkanMem(Info, VK_STRUCTURE_TYPE_FENCE_CREATE_INFO);
-			VERIFY_VKRESULT(vkCreateFence(Device, &Info, nullptr, &Fence));
-		}
+			check(Semaphore == VK_NULL_HANDLE);
+			VkSemaphoreTypeCreateInfo TypeInfo;
+			ZeroVulkanMem(TypeInfo, VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO);
+			TypeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+			TypeInfo.initialValue = 0;
 
-		void Destroy()
-		{
-			vkDestroyFence(Device, Fence, nullptr);
-			Fence = VK_NULL_HANDLE;
+			VkSemaphoreCreateInfo Info;
+			ZeroVulkanMem(Info, VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO);
+			Info.pNext = &TypeInfo;
+			VERIFY_VKRESULT(vkCreateSemaphore(Device, &Info, nullptr, &Semaphore));
 		}
 
-		operator VkFence()
+		void Destroy()
 		{
-			return Fence;
+			vkDestroySemaphore(Device, Semaphore, nullptr);
+			Semaphore = VK_NULL_HANDLE;
 		}
 
-		void Reset()
+		void Refresh()
 		{
-			check(State == EState::Signaled);
-			VERIFY_VKRESULT(vkResetFences(Device, 1, &Fence));
-			State = EState::Reset;
+			VERIFY_VKRESULT(vkGetSemaphoreCounterValue(Device, Semaphore, &CompletedValue));
 		}
 
-		void Refresh()
+		inline bool IsComplete(uint64 Value) const
 		{
-			check(State != EState::Reset);
-			if (State == EState::WaitingSignal)
-			{
-				VkResult Result = vkGetFenceStatus(Device, Fence);
-				if (Result == VK_SUCCESS)
-				{
-					++Counter;
-					vkResetFences(Device, 1, &Fence);
-					State = EState::Signaled;
-				}
-				else if (Result != VK_NOT_READY)
-				{
-					check(0);
-				}
-			}
+			return CompletedValue >= Value;
 		}
 
-		inline bool IsSignaled() const
+		// Returns false if Value wasn't reached within the timeout; CompletedValue only moves on once it has been
+		bool Wait(uint64 Value, uint64 TimeOutInNanoseconds)
 		{
-			if (State == EState::Signaled)
+			if (IsComplete(Value))
 			{
 				return true;
 			}
-			else if (State != EState::WaitingSignal)
+
+			check(Value <= LastSubmittedValue);
+			VkSemaphoreWaitInfo Info;
+			ZeroVulkanMem(Info, VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO);
+			Info.semaphoreCount = 1;
+			Info.pSemaphores = &Semaphore;
+			Info.pValues = &Value;
+			VkResult Result = vkWaitSemaphores(Device, &Info, TimeOutInNanoseconds);
+			if (Result == VK_TIMEOUT)
 			{
-				check(0);
+				return false;
 			}
 
-			return false;
+			VERIFY_VKRESULT(Result);
+			CompletedValue = std::max(CompletedValue, Value);
+			return true;
+		}
+	};
+
+	// Where a command buffer ends up on its queue's timeline; whatever it used can be released once this has completed
+	struct FSyncPoint
+	{
+		FTimeline* Timeline = nullptr;
+		uint64 Value = 0;
+
+		inline bool IsValid() const
+		{
+			return Timeline != nullptr;
 		}
 
-		void Wait(uint64 TimeOutInNanoseconds)
+		inline bool IsSubmitted() const
 		{
-			if (State == EState::WaitingSignal)
-			{
-				VkResult Result = vkWaitForFences(Device, 1, &Fence, VK_TRUE, TimeOutInNanoseconds);
-				if (Result == VK_SUCCESS)
-				{
-					Refresh();
-				}
-				else
-				{
-					check(0);
-				}
-			}
-			else if (State != EState::Signaled)
-			{
-				check(0);
-			}
+			return Timeline->LastSubmittedValue >= Value;
+		}
+
+		inline bool IsComplete() const
+		{
+			return Timeline->IsComplete(Value);
 		}
 	};
 
 	struct FFramebuffer;
 	struct FCmdBuffer
 	{
-		FFence Fence;
-		/*std::atomic<*/uint64 LastSubmittedFence = 0;
 		VkCommandBuffer CmdBuffer = VK_NULL_HANDLE;
 
+		// The value is picked when a primary begins, so primaries on a queue have to be submitted in the order they were begun.
+		// Secondaries have no value of their own; they finish along with the primary they are recorded for
+		FTimeline* Timeline = nullptr;
+		uint64 TimelineValue = 0;
+		bool bSecondary = false;
+
+		// Work on other queues this has to wait for at submit time; see WaitFor()
+		std::vector<FSyncPoint> WaitSyncPoints;
+		std::vector<VkPipelineStageFlags> WaitStages;
+
+		// Set between FGPUProfiler::BeginFrame() and EndFrame(); FMarkerScopes recorded meanwhile get timestamps
+		FGPUProfiler* Profiler = nullptr;
+
 		enum class EState
 		{
 			Available,
@@ -416,21 +482,18 @@ struct SVulkan
 			return State == EState::Submitted;
 		}
 
-		FCmdBuffer(VkDevice Device, VkCommandPool CmdPool)
+		FCmdBuffer(VkDevice Device, VkCommandPool CmdPool, FTimeline* InTimeline, VkCommandBufferLevel Level = VK_COMMAND_BUFFER_LEVEL_PRIMARY)
 		{
 			VkCommandBufferAllocateInfo Info;
 			ZeroVulkanMem(Info, VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO);
 			Info.commandBufferCount = 1;
-			Info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+			Info.level = Level;
 			Info.commandPool = CmdPool;
 			vkAllocateCommandBuffers(Device, &Info, &CmdBuffer);
 
-			Fence.Create(Device);
-		}
-
-		void Destroy()
-		{
-			Fence.Destroy();
+			bSecondary = Level == VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+			check(bSecondary == (InTimeline == nullptr));
+			Timeline = InTimeline;
 		}
 
 		operator VkCommandBuffer()
@@ -443,9 +506,22 @@ struct SVulkan
 			return State == EState::Available;
 		}
 
+		inline FSyncPoint GetSyncPoint() const
+		{
+			check(State != EState::Available);
+			FSyncPoint SyncPoint;
+			SyncPoint.Timeline = Timeline;
+			SyncPoint.Value = TimelineValue;
+			return SyncPoint;
+		}
+
 		void Begin()
 		{
-			check(State == EState::Available);
+			check(!bSecondary && State == EState::Available);
+			TimelineValue = Timeline->NextValue++;
+			WaitSyncPoints.clear();
+			WaitStages.clear();
+			Profiler = nullptr;
 			VkCommandBufferBeginInfo Info;
 			ZeroVulkanMem(Info, VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO);
 			Info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
@@ -453,14 +529,54 @@ struct SVulkan
 			State = EState::Begun;
 		}
 
+		// Secondaries continue the primary's render pass so they end from inside it
 		void End()
 		{
-			check(State == EState::Begun);
+			check(State == EState::Begun || (bSecondary && State == EState::InRenderPass));
 			vkEndCommandBuffer(CmdBuffer);
 			State = EState::Ended;
 		}
 
-		void BeginRenderPass(FFramebuffer* Framebuffer);
+		// Stages in Stages wait on the GPU until SyncPoint has been reached, eg graphics consuming results from the compute queue.
+		// Resources shared with another queue family still need an ownership transfer, or VK_SHARING_MODE_CONCURRENT
+		void WaitFor(const FSyncPoint& SyncPoint, VkPipelineStageFlags Stages)
+		{
+			check(!bSecondary && State != EState::Available && State != EState::Submitted);
+			check(SyncPoint.IsValid() && SyncPoint.Timeline != Timeline);
+			WaitSyncPoints.push_back(SyncPoint);
+			WaitStages.push_back(Stages);
+		}
+
+		void BeginRenderPass(FFramebuffer* Framebuffer, VkSubpassContents Contents = VK_SUBPASS_CONTENTS_INLINE);
+
+		// Flips Y, so +Y is up in clip space
+		void SetViewportAndScissor(VkViewport Viewport, VkRect2D Scissor)
+		{
+			check(Viewport.height >= 0);
+			Viewport.y = Viewport.height;
+			Viewport.height *= -1.0f;
+			vkCmdSetViewport(CmdBuffer, 0, 1, &Viewport);
+			vkCmdSetScissor(CmdBuffer, 0, 1, &Scissor);
+		}
+
+		// Records into the first subpass of Framebuffer's render pass, to be executed by Primary
+		void BeginSecondary(const FCmdBuffer* Primary, FFramebuffer* Framebuffer);
+
+		// The secondaries count as submitted from here on, and become available again once this command buffer has finished
+		void ExecuteCommands(uint32 NumSecondaries, FCmdBuffer* const* Secondaries)
+		{
+			check(!bSecondary && State == EState::InRenderPass);
+			std::vector<VkCommandBuffer> CmdBuffers;
+			for (uint32 Index = 0; Index < NumSecondaries; ++Index)
+			{
+				FCmdBuffer* Secondary = Secondaries[Index];
+				check(Secondary->bSecondary && Secondary->State == EState::Ended);
+				check(Secondary->Timeline == Timeline && Secondary->TimelineValue == TimelineValue);
+				Secondary->State = EState::Submitted;
+				CmdBuffers.push_back(Secondary->CmdBuffer);
+			}
+			vkCmdExecuteCommands(CmdBuffer, (uint32)CmdBuffers.size(), CmdBuffers.data());
+		}
 
 		void EndRenderPass()
 		{
@@ -471,15 +587,13 @@ struct SVulkan
 
 		void Refresh()
 		{
-			if (State == EState::Submitted)
+			if (State == EState::Submitted && Timeline->IsComplete(TimelineValue))
 			{
-				Fence.Refresh();
-				if (Fence.IsSignaled())
+				State = EState::Available;
+				VERIFY_VKRESULT(vkResetCommandBuffer(CmdBuffer, 0));
+				if (bSecondary)
 				{
-					State = EState::Available;
-					Fence.Reset();
-					VERIFY_VKRESULT(vkResetCommandBuffer(CmdBuffer, 0));
-					++LastSubmittedFence;
+					Timeline = nullptr;
 				}
 			}
 		}
@@ -491,11 +605,17 @@ struct SVulkan
 		std::vector<FCmdBuffer*> CmdBuffers;
 		uint32 QueueIndex  = ~0;
 		VkDevice Device = VK_NULL_HANDLE;
+		VkCommandBufferLevel Level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		FTimeline* Timeline = nullptr;
 
-		void Create(VkDevice InDevice, uint32 InQueueIndex)
+		// Secondary pools have no timeline, their command buffers use the one of the primary they are recorded for
+		void Create(VkDevice InDevice, uint32 InQueueIndex, FTimeline* InTimeline, VkCommandBufferLevel InLevel = VK_COMMAND_BUFFER_LEVEL_PRIMARY)
 		{
 			Device = InDevice;
 			QueueIndex = InQueueIndex;
+			Timeline = InTimeline;
+			Level = InLevel;
+			check((Level == VK_COMMAND_BUFFER_LEVEL_SECONDARY) == (Timeline == nullptr));
 
 			VkCommandPoolCreateInfo Info;
 			ZeroVulkanMem(Info, VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO);
@@ -508,7 +628,7 @@ struct SVulkan
 		{
 			for (auto* CmdBuffer : CmdBuffers)
 			{
-				CmdBuffer->Destroy();
+				delete CmdBuffer;
 			}
 			CmdBuffers.clear();
 
@@ -526,19 +646,29 @@ struct SVulkan
 				}
 			}
 
-			FCmdBuffer* CmdBuffer =  new FCmdBuffer(Device, CmdPool);
+			FCmdBuffer* CmdBuffer =  new FCmdBuffer(Device, CmdPool, Timeline, Level);
 			CmdBuffers.push_back(CmdBuffer);
 			return CmdBuffer;
 		}
 
 		FCmdBuffer* Begin()
 		{
+			check(Level == VK_COMMAND_BUFFER_LEVEL_PRIMARY);
 			Refresh();
 			FCmdBuffer* CmdBuffer = GetOrAddCmdBuffer();
 			CmdBuffer->Begin();
 			return CmdBuffer;
 		}
 
+		FCmdBuffer* BeginSecondary(const FCmdBuffer* Primary, FFramebuffer* Framebuffer)
+		{
+			check(Level == VK_COMMAND_BUFFER_LEVEL_SECONDARY);
+			Refresh();
+			FCmdBuffer* CmdBuffer = GetOrAddCmdBuffer();
+			CmdBuffer->BeginSecondary(Primary, Framebuffer);
+			return CmdBuffer;
+		}
+
 		void Refresh()
 		{
 			for (auto* CmdBuffer : CmdBuffers)
@@ -548,24 +678,165 @@ struct SVulkan
 		}
 	};
 
+	// Objects the GPU might still be using. An entry is deleted once every timeline has completed all the values handed out
+	// when it was added, so nothing recorded up to then, submitted or not, can still reference it. Values only grow, so the
+	// entries complete in order and Refresh() stops at the first one still pending
+	struct FDeferredDeletionQueue
+	{
+		struct FEntry
+		{
+			std::vector<FSyncPoint> SyncPoints;
+			std::function<void()> Delete;
+		};
+		std::deque<FEntry> Entries;
+
+		void Add(std::vector<FSyncPoint>&& SyncPoints, std::function<void()>&& Delete)
+		{
+			FEntry Entry;
+			Entry.SyncPoints = std::move(SyncPoints);
+			Entry.Delete = std::move(Delete);
+			Entries.push_back(std::move(Entry));
+		}
+
+		void Refresh()
+		{
+			while (!Entries.empty() && IsComplete(Entries.front()))
+			{
+				Entries.front().Delete();
+				Entries.pop_front();
+			}
+		}
+
+		// Only once the device is idle
+		void Flush()
+		{
+			for (FEntry& Entry : Entries)
+			{
+				Entry.Delete();
+			}
+			Entries.clear();
+		}
+
+		static bool IsComplete(const FEntry& Entry)
+		{
+			for (const FSyncPoint& SyncPoint : Entry.SyncPoints)
+			{
+				if (!SyncPoint.IsComplete())
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+	};
+
 #if !USE_VMA
+	struct SDevice;
+	struct FMemBlock;
+
 	struct FMemAlloc
 	{
 		VkDeviceMemory Memory = VK_NULL_HANDLE;
 		VkDeviceSize Offset = 0;
 		VkDeviceSize Size = 0;
 		void* MappedMem = nullptr;
+		FMemBlock* Block = nullptr;
+
+		void Flush(VkDevice Device);
+	};
 
-		void Flush(VkDevice Device)
+	// One vkAllocateMemory that gets carved up into FMemAllocs; first fit on a list of free ranges sorted by offset
+	struct FMemBlock
+	{
+		SDevice* Owner = nullptr;
+		VkDeviceMemory Memory = VK_NULL_HANDLE;
+		VkDeviceSize Size = 0;
+		VkDeviceSize UsedSize = 0;
+		uint32 MemTypeIndex = ~0;
+		uint32 NumAllocs = 0;
+		// Buffers and optimal images never share a block so bufferImageGranularity can be ignored
+		bool bLinear = true;
+		bool bDedicated = false;
+		uint8* MappedMem = nullptr;
+
+		struct FRange
+		{
+			VkDeviceSize Offset;
+			VkDeviceSize Size;
+		};
+		std::vector<FRange> FreeRanges;
+
+		bool TryAlloc(VkDeviceSize InSize, VkDeviceSize Alignment, VkDeviceSize& OutOffset)
+		{
+			for (size_t Index = 0; Index < FreeRanges.size(); ++Index)
+			{
+				FRange Range = FreeRanges[Index];
+				VkDeviceSize AlignedOffset = (Range.Offset + Alignment - 1) / Alignment * Alignment;
+				VkDeviceSize Padding = AlignedOffset - Range.Offset;
+				if (Range.Size < Padding + InSize)
+				{
+					continue;
+				}
+
+				FreeRanges.erase(FreeRanges.begin() + Index);
+				VkDeviceSize Remaining = Range.Size - Padding - InSize;
+				if (Remaining > 0)
+				{
+					FreeRanges.insert(FreeRanges.begin() + Index, { AlignedOffset + InSize, Remaining });
+				}
+				if (Padding > 0)
+				{
+					FreeRanges.insert(FreeRanges.begin() + Index, { Range.Offset, Padding });
+				}
+
+				OutOffset = AlignedOffset;
+				UsedSize += InSize;
+				++NumAllocs;
+				return true;
+			}
+
+			return false;
+		}
+
+		void Free(VkDeviceSize Offset, VkDeviceSize InSize)
 		{
-			VkMappedMemoryRange Range;
-			ZeroVulkanMem(Range, VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE);
-			Range.memory = Memory;
-			Range.offset = Offset;
-			Range.size = Size;
-			VERIFY_VKRESULT(vkFlushMappedMemoryRanges(Device, 1, &Range));
+			auto It = std::lower_bound(FreeRanges.begin(), FreeRanges.end(), Offset, [](const FRange& Range, VkDeviceSize Value)
+				{
+					return Range.Offset < Value;
+				});
+			It = FreeRanges.insert(It, { Offset, InSize });
+
+			// Merge with the next and previous ranges
+			auto Next = It + 1;
+			if (Next != FreeRanges.end() && It->Offset + It->Size == Next->Offset)
+			{
+				It->Size += Next->Size;
+				It = FreeRanges.erase(Next) - 1;
+			}
+			if (It != FreeRanges.begin())
+			{
+				auto Prev = It - 1;
+				if (Prev->Offset + Prev->Size == It->Offset)
+				{
+					Prev->Size += It->Size;
+					FreeRanges.erase(It);
+				}
+			}
+
+			check(UsedSize >= InSize && NumAllocs > 0);
+			UsedSize -= InSize;
+			--NumAllocs;
 		}
 	};
+
+	struct FMemStats
+	{
+		uint32 NumBlocks = 0;
+		uint32 NumAllocs = 0;
+		uint64 BlockBytes = 0;
+		uint64 UsedBytes = 0;
+		uint32 NumBlocksAllocated = 0;
+	};
 #endif
 
 	struct SDevice
@@ -573,6 +844,8 @@ struct SVulkan
 		VkInstance Instance = VK_NULL_HANDLE;
 		VkDevice Device = VK_NULL_HANDLE;
 		std::map<uint32, FCommandPool> CmdPools;
+		std::map<uint32, FTimeline> Timelines;
+		FDeferredDeletionQueue DeferredDeletion;
 		VkPhysicalDevice PhysicalDevice = VK_NULL_HANDLE;
 		VkPhysicalDeviceProperties Props;
 		VkQueue GfxQueue = VK_NULL_HANDLE;
@@ -583,16 +856,29 @@ struct SVulkan
 		uint32 ComputeQueueIndex = VK_QUEUE_FAMILY_IGNORED;
 		uint32 TransferQueueIndex = VK_QUEUE_FAMILY_IGNORED;
 		uint32 PresentQueueIndex = VK_QUEUE_FAMILY_IGNORED;
+		std::vector<VkQueueFamilyProperties> QueueFamilyProps;
 		VkPhysicalDeviceMemoryProperties MemProperties;
 		//bool bUseVertexDivisor = false;
 		bool bHasMarkerExtension = false;
 #if USE_VMA
 		VmaAllocator VMAAllocator = VK_NULL_HANDLE;
 #else
-		std::vector<FMemAlloc*> MemAllocs;
+		std::mutex MemMutex;
+		std::vector<FMemBlock*> MemBlocks;
+		VkDeviceSize MemBlockSize = 64 * 1024 * 1024;
+		// Every vkAllocateMemory so far
+		uint32 NumBlocksAllocated = 0;
 #endif
 
 		bool bPushDescriptor = false;
+		// Partially bound, dynamically indexed sampled image arrays; needed for -bindless
+		bool bDescriptorIndexing = false;
+
+		// Without push descriptors uniform buffers are bound as dynamic, so per draw data only changes the offset
+		inline VkDescriptorType GetLayoutDescriptorType(VkDescriptorType Type) const
+		{
+			return (!bPushDescriptor && Type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER) ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC : Type;
+		}
 
 		inline uint32 FindMemoryTypeIndex(VkMemoryPropertyFlags MemProps, uint32 Type) const
 		{
@@ -612,24 +898,121 @@ struct SVulkan
 		}
 
 #if !USE_VMA
-		FMemAlloc* AllocMemory(VkDeviceSize Size, VkMemoryPropertyFlags MemPropFlags, uint32 Type, bool bMapped)
+		FMemAlloc* AllocMemory(const VkMemoryRequirements& MemReqs, VkMemoryPropertyFlags MemPropFlags, bool bMapped, bool bLinear)
 		{
-			FMemAlloc* MemAlloc = new FMemAlloc();
-			VkMemoryAllocateInfo Info;
-			ZeroVulkanMem(Info, VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO);
-			Info.allocationSize = Size;
-			Info.memoryTypeIndex = FindMemoryTypeIndex(MemPropFlags, Type);
-			VERIFY_VKRESULT(vkAllocateMemory(Device, &Info, nullptr, &MemAlloc->Memory));
-			MemAlloc->Size = Size;
-			MemAllocs.push_back(MemAlloc);
+			std::lock_guard<std::mutex> Lock(MemMutex);
+
+			uint32 MemTypeIndex = FindMemoryTypeIndex(MemPropFlags, MemReqs.memoryTypeBits);
+			VkDeviceSize Offset = 0;
+			FMemBlock* Block = nullptr;
+
+			// Big resources get their own allocation instead of eating up most of a shared block
+			bool bDedicated = MemReqs.size > MemBlockSize / 2;
+			if (!bDedicated)
+			{
+				for (FMemBlock* Entry : MemBlocks)
+				{
+					if (!Entry->bDedicated && Entry->MemTypeIndex == MemTypeIndex && Entry->bLinear == bLinear && Entry->TryAlloc(MemReqs.size, MemReqs.alignment, Offset))
+					{
+						Block = Entry;
+						break;
+					}
+				}
+			}
+
+			if (!Block)
+			{
+				Block = new FMemBlock();
+				Block->Owner = this;
+				Block->Size = bDedicated ? MemReqs.size : MemBlockSize;
+				Block->MemTypeIndex = MemTypeIndex;
+				Block->bLinear = bLinear;
+				Block->bDedicated = bDedicated;
+				Block->FreeRanges.push_back({ 0, Block->Size });
+
+				VkMemoryAllocateInfo Info;
+				ZeroVulkanMem(Info, VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO);
+				Info.allocationSize = Block->Size;
+				Info.memoryTypeIndex = MemTypeIndex;
+				VERIFY_VKRESULT(vkAllocateMemory(Device, &Info, nullptr, &Block->Memory));
+				MemBlocks.push_back(Block);
+				++NumBlocksAllocated;
+
+				bool bAllocated = Block->TryAlloc(MemReqs.size, MemReqs.alignment, Offset);
+				check(bAllocated);
+			}
 
-			if (bMapped)
+			if (bMapped && !Block->MappedMem)
 			{
-				VERIFY_VKRESULT(vkMapMemory(Device, MemAlloc->Memory, MemAlloc->Offset, MemAlloc->Size, 0, &MemAlloc->MappedMem))
+				// Blocks stay persistently mapped so sub-allocations never map/unmap
+				check(MemProperties.memoryTypes[MemTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+				VERIFY_VKRESULT(vkMapMemory(Device, Block->Memory, 0, VK_WHOLE_SIZE, 0, (void**)&Block->MappedMem));
 			}
 
+			FMemAlloc* MemAlloc = new FMemAlloc();
+			MemAlloc->Memory = Block->Memory;
+			MemAlloc->Offset = Offset;
+			MemAlloc->Size = MemReqs.size;
+			MemAlloc->Block = Block;
+			MemAlloc->MappedMem = bMapped ? Block->MappedMem + Offset : nullptr;
 			return MemAlloc;
 		}
+
+		void FreeMemory(FMemAlloc* MemAlloc)
+		{
+			std::lock_guard<std::mutex> Lock(MemMutex);
+
+			FMemBlock* Block = MemAlloc->Block;
+			check(Block && Block->Owner == this);
+			Block->Free(MemAlloc->Offset, MemAlloc->Size);
+			delete MemAlloc;
+
+			if (Block->NumAllocs == 0 && (Block->bDedicated || HasOtherEmptyBlock(Block)))
+			{
+				MemBlocks.erase(std::find(MemBlocks.begin(), MemBlocks.end(), Block));
+				DestroyMemBlock(Block);
+			}
+		}
+
+		// One empty shared block per memory type (and buffer/image kind) is kept around, so allocating and freeing the same
+		// amount over and over doesn't create and destroy a whole block each time
+		bool HasOtherEmptyBlock(const FMemBlock* Block) const
+		{
+			for (const FMemBlock* Entry : MemBlocks)
+			{
+				if (Entry != Block && Entry->NumAllocs == 0 && !Entry->bDedicated && Entry->MemTypeIndex == Block->MemTypeIndex && Entry->bLinear == Block->bLinear)
+				{
+					return true;
+				}
+			}
+			return false;
+		}
+
+		void DestroyMemBlock(FMemBlock* Block)
+		{
+			if (Block->MappedMem)
+			{
+				vkUnmapMemory(Device, Block->Memory);
+			}
+			vkFreeMemory(Device, Block->Memory, nullptr);
+			delete Block;
+		}
+
+		FMemStats GetMemStats()
+		{
+			std::lock_guard<std::mutex> Lock(MemMutex);
+
+			FMemStats Stats;
+			for (FMemBlock* Block : MemBlocks)
+			{
+				++Stats.NumBlocks;
+				Stats.NumAllocs += Block->NumAllocs;
+				Stats.BlockBytes += Block->Size;
+				Stats.UsedBytes += Block->UsedSize;
+			}
+			Stats.NumBlocksAllocated = NumBlocksAllocated;
+			return Stats;
+		}
 #endif
 
 		VkBufferView CreateBufferView(FBuffer& Buffer, VkFormat Format, VkDeviceSize Size, VkDeviceSize Offset = 0)
@@ -671,10 +1054,11 @@ struct SVulkan
 			return Semaphore;
 		}
 
-		void Create();
+		void Create(bool bWithSwapchain);
 
 		void DestroyPre()
 		{
+			DeferredDeletion.Flush();
 			CmdPools[GfxQueueIndex].Destroy();
 			if (GfxQueueIndex != ComputeQueueIndex)
 			{
@@ -688,6 +1072,7 @@ struct SVulkan
 
 		void Destroy()
 		{
+			DeferredDeletion.Flush();
 			CmdPools[GfxQueueIndex].Destroy();
 			if (GfxQueueIndex != ComputeQueueIndex)
 			{
@@ -697,15 +1082,25 @@ struct SVulkan
 			{
 				CmdPools[TransferQueueIndex].Destroy();
 			}
+			for (auto& Pair : Timelines)
+			{
+				Pair.second.Destroy();
+			}
+			Timelines.clear();
 
 #if USE_VMA
 #else
-			for (FMemAlloc* Alloc : MemAllocs)
+			for (FMemBlock* Block : MemBlocks)
 			{
-				vkFreeMemory(Device, Alloc->Memory, nullptr);
-				delete Alloc;
+				if (Block->NumAllocs > 0)
+				{
+					std::stringstream ss;
+					ss << "*** Leaked " << Block->NumAllocs << " allocations (" << Block->UsedSize << " bytes) on memory type " << Block->MemTypeIndex << "\n";
+					::OutputDebugStringA(ss.str().c_str());
+				}
+				DestroyMemBlock(Block);
 			}
-			MemAllocs.clear();
+			MemBlocks.clear();
 #endif
 
 #if USE_VMA
@@ -732,8 +1127,39 @@ struct SVulkan
 			vkCmdPipelineBarrier(CmdBuffer->CmdBuffer, SrcStageMask, DestStageMask, 0, 0, nullptr, 0, nullptr, 1, &ImageBarrier);
 		}
 
+		// One vkGetSemaphoreCounterValue per queue; everything else checks its sync points against the values read here
+		void RefreshTimelines()
+		{
+			for (auto& Pair : Timelines)
+			{
+				Pair.second.Refresh();
+			}
+		}
+
+		// The last value handed out on every timeline, ie covering everything recorded so far
+		std::vector<FSyncPoint> GetLatestSyncPoints()
+		{
+			std::vector<FSyncPoint> SyncPoints;
+			for (auto& Pair : Timelines)
+			{
+				FSyncPoint SyncPoint;
+				SyncPoint.Timeline = &Pair.second;
+				SyncPoint.Value = Pair.second.NextValue - 1;
+				SyncPoints.push_back(SyncPoint);
+			}
+			return SyncPoints;
+		}
+
+		// Runs Delete once the GPU is past everything recorded so far, instead of having to wait for idle
+		void DeferDelete(std::function<void()> Delete)
+		{
+			DeferredDeletion.Add(GetLatestSyncPoints(), std::move(Delete));
+		}
+
 		void RefreshCommandBuffers()
 		{
+			RefreshTimelines();
+			DeferredDeletion.Refresh();
 			CmdPools[GfxQueueIndex].Refresh();
 			if (GfxQueueIndex != ComputeQueueIndex)
 			{
@@ -750,38 +1176,69 @@ struct SVulkan
 			return CmdPools[QueueIndex].Begin();
 		}
 
+		// Without a separate family compute work goes through the graphics queue and timeline, and runs in submit order
+		bool HasAsyncCompute() const
+		{
+			return ComputeQueueIndex != GfxQueueIndex;
+		}
+
+		// Besides SignalSemaphore, signals CmdBuffer's value on its queue's timeline
 		void Submit(VkQueue Queue, FCmdBuffer* CmdBuffer, VkPipelineStageFlags WaitFlags, VkSemaphore WaitSemaphore, VkSemaphore SignalSemaphore)
 		{
-			check(CmdBuffer->State == FCmdBuffer::EState::Ended);
+			check(CmdBuffer->State == FCmdBuffer::EState::Ended && !CmdBuffer->bSecondary);
+			FTimeline* Timeline = CmdBuffer->Timeline;
+			check(CmdBuffer->TimelineValue > Timeline->LastSubmittedValue);
 
-			VkSubmitInfo Info;
-			ZeroVulkanMem(Info, VK_STRUCTURE_TYPE_SUBMIT_INFO);
-			Info.commandBufferCount = 1;
-			Info.pCommandBuffers = &CmdBuffer->CmdBuffer;
+			VkSemaphore SignalSemaphores[2] = { Timeline->Semaphore, SignalSemaphore };
+			// Binary semaphores ignore their value
+			uint64 SignalValues[2] = { CmdBuffer->TimelineValue, 0 };
+
+			std::vector<VkSemaphore> WaitSemaphores;
+			std::vector<uint64> WaitValues;
+			std::vector<VkPipelineStageFlags> WaitStages;
 			if (WaitSemaphore != VK_NULL_HANDLE)
 			{
-				Info.waitSemaphoreCount = 1;
-				Info.pWaitSemaphores = &WaitSemaphore;
-				Info.pWaitDstStageMask = &WaitFlags;
+				WaitSemaphores.push_back(WaitSemaphore);
+				WaitValues.push_back(0);
+				WaitStages.push_back(WaitFlags);
 			}
-			if (SignalSemaphore != VK_NULL_HANDLE)
+			for (uint32 Index = 0; Index < (uint32)CmdBuffer->WaitSyncPoints.size(); ++Index)
 			{
-				Info.signalSemaphoreCount = 1;
-				Info.pSignalSemaphores = &SignalSemaphore;
+				const FSyncPoint& SyncPoint = CmdBuffer->WaitSyncPoints[Index];
+				// Waiting on a value that was never submitted would hang the queue
+				check(SyncPoint.IsSubmitted());
+				WaitSemaphores.push_back(SyncPoint.Timeline->Semaphore);
+				WaitValues.push_back(SyncPoint.Value);
+				WaitStages.push_back(CmdBuffer->WaitStages[Index]);
 			}
-			vkQueueSubmit(Queue, 1, &Info, CmdBuffer->Fence.Fence);
 
-			check(CmdBuffer->Fence.State == FFence::EState::Reset);
-			CmdBuffer->Fence.State = FFence::EState::WaitingSignal;
+			VkTimelineSemaphoreSubmitInfo TimelineInfo;
+			ZeroVulkanMem(TimelineInfo, VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO);
+			TimelineInfo.signalSemaphoreValueCount = SignalSemaphore != VK_NULL_HANDLE ? 2 : 1;
+			TimelineInfo.pSignalSemaphoreValues = SignalValues;
+			TimelineInfo.waitSemaphoreValueCount = (uint32)WaitValues.size();
+			TimelineInfo.pWaitSemaphoreValues = WaitValues.data();
+
+			VkSubmitInfo Info;
+			ZeroVulkanMem(Info, VK_STRUCTURE_TYPE_SUBMIT_INFO);
+			Info.pNext = &TimelineInfo;
+			Info.commandBufferCount = 1;
+			Info.pCommandBuffers = &CmdBuffer->CmdBuffer;
+			Info.waitSemaphoreCount = (uint32)WaitSemaphores.size();
+			Info.pWaitSemaphores = WaitSemaphores.data();
+			Info.pWaitDstStageMask = WaitStages.data();
+			Info.signalSemaphoreCount = TimelineInfo.signalSemaphoreValueCount;
+			Info.pSignalSemaphores = SignalSemaphores;
+			VERIFY_VKRESULT(vkQueueSubmit(Queue, 1, &Info, VK_NULL_HANDLE));
+
+			Timeline->LastSubmittedValue = CmdBuffer->TimelineValue;
 			CmdBuffer->State = FCmdBuffer::EState::Submitted;
 		}
 
-		void WaitForFence(FFence& Fence, uint64 FenceCounter, uint64 TimeOutInNanoseconds = 500000000ull)
+		// Without a timeout this only returns once the sync point has completed
+		bool WaitForSyncPoint(const FSyncPoint& SyncPoint, uint64 TimeOutInNanoseconds = UINT64_MAX)
 		{
-			if (Fence.Counter == FenceCounter)
-			{
-				Fence.Wait(TimeOutInNanoseconds);
-			}
+			return SyncPoint.Timeline->Wait(SyncPoint.Value, TimeOutInNanoseconds);
 		}
 
 		template <typename T>
@@ -832,8 +1289,6 @@ struct SVulkan
 		VkInstance Instance = VK_NULL_HANDLE;
 		SDevice* Device = nullptr;
 		VkSwapchainKHR Swapchain = VK_NULL_HANDLE;
-		VkSemaphore AcquireBackbufferSemaphore = VK_NULL_HANDLE;
-		VkSemaphore FinalSemaphore = VK_NULL_HANDLE;
 		uint32 ImageIndex = ~0;
 		std::vector<VkImage> Images;
 		std::vector<VkImageView> ImageViews;
@@ -867,7 +1322,10 @@ struct SVulkan
 		}
 
 		void Create(SDevice& Device, GLFWwindow* Window);
-		void Recreate(SDevice& Device, GLFWwindow* Window);
+
+		// AcquireSemaphore must not have a signal pending. The old swapchain and its views are only deleted once the frames in
+		// flight are done with them, so this doesn't need the device to be idle
+		void Recreate(SDevice& Device, GLFWwindow* Window, VkSemaphore AcquireSemaphore);
 
 		void DestroyImages()
 		{
@@ -905,18 +1363,9 @@ struct SVulkan
 			return FRenderTargetInfo(ImageViews[ImageIndex], Format, LoadOp, StoreOp);
 		}
 
-		void DestroySemaphores()
-		{
-			vkDestroySemaphore(Device->Device, AcquireBackbufferSemaphore, nullptr);
-			AcquireBackbufferSemaphore = VK_NULL_HANDLE;
-			vkDestroySemaphore(Device->Device, FinalSemaphore, nullptr);
-			FinalSemaphore = VK_NULL_HANDLE;
-		}
-
 		void Destroy()
 		{
 			DestroyImages();
-			DestroySemaphores();
 
 			vkDestroySwapchainKHR(Device->Device, Swapchain, nullptr);
 			Swapchain = VK_NULL_HANDLE;
@@ -925,10 +1374,11 @@ struct SVulkan
 			Surface = VK_NULL_HANDLE;
 		}
 
-		bool AcquireBackbuffer()
+		// The semaphores belong to the caller's frame in flight, so a new acquire never reuses one a previous frame still waits on
+		bool AcquireBackbuffer(VkSemaphore AcquireSemaphore)
 		{
 			uint64 Timeout = 5 * 1000 * 1000;
-			VkResult Result = vkAcquireNextImageKHR(Device->Device, Swapchain, Timeout, AcquireBackbufferSemaphore, VK_NULL_HANDLE, &ImageIndex);
+			VkResult Result = vkAcquireNextImageKHR(Device->Device, Swapchain, Timeout, AcquireSemaphore, VK_NULL_HANDLE, &ImageIndex);
 			if (Result == VK_ERROR_OUT_OF_DATE_KHR)
 			{
 				return false;
@@ -966,13 +1416,7 @@ struct SVulkan
 
 		void SetViewportAndScissor(FCmdBuffer* CmdBuffer)
 		{
-			VkViewport Viewport = GetViewport();
-			check(Viewport.height >= 0);
-			Viewport.y = Viewport.height;
-			Viewport.height *= -1.0f;
-			vkCmdSetViewport(CmdBuffer->CmdBuffer, 0, 1, &Viewport);
-			VkRect2D Scissor = GetScissor();
-			vkCmdSetScissor(CmdBuffer->CmdBuffer, 0, 1, &Scissor);
+			CmdBuffer->SetViewportAndScissor(GetViewport(), GetScissor());
 		}
 	};
 	FSwapchain Swapchain;
@@ -1066,8 +1510,10 @@ struct SVulkan
 
 	VkPhysicalDevice PhysicalDevice = VK_NULL_HANDLE;
 
+	// A null Window sets up for headless rendering
 	void Init(GLFWwindow* Window)
 	{
+		bHeadless = Window == nullptr;
 		VERIFY_VKRESULT(volkInitialize());
 
 		CreateInstance();
@@ -1125,7 +1571,7 @@ struct SVulkan
 
 	VkPhysicalDevice FindPhysicalDeviceByVendorID(uint32 VendorID)
 	{
-		for (auto Pair : Devices)
+		for (auto& Pair : Devices)
 		{
 			if (Pair.second.Props.vendorID == VendorID)
 			{
@@ -1157,7 +1603,7 @@ struct SVulkan
 	void SetupDevices(GLFWwindow* Window)
 	{
 		GetPhysicalDevices();
-		check(!DiscreteDevices.empty() || !IntegratedDevices.empty());
+		check(!DiscreteDevices.empty() || !IntegratedDevices.empty() || !CPUDevices.empty());
 
 		PhysicalDevice = SelectPreferredDevice();
 		if (PhysicalDevice == VK_NULL_HANDLE)
@@ -1166,14 +1612,21 @@ struct SVulkan
 			{
 				PhysicalDevice = DiscreteDevices.front();
 			}
-			else
+			else if (!IntegratedDevices.empty())
 			{
 				PhysicalDevice = IntegratedDevices.front();
 			}
+			else
+			{
+				PhysicalDevice = CPUDevices.front();
+			}
 		}
 
-		Devices[PhysicalDevice].Create();
-		SetupSwapchain(Devices[PhysicalDevice], Window);
+		Devices[PhysicalDevice].Create(!bHeadless);
+		if (!bHeadless)
+		{
+			SetupSwapchain(Devices[PhysicalDevice], Window);
+		}
 	}
 
 	void InitDebugCallback();
@@ -1291,7 +1744,10 @@ struct SVulkan
 
 	void Deinit()
 	{
-		Swapchain.Destroy();
+		if (!bHeadless)
+		{
+			Swapchain.Destroy();
+		}
 		DestroyDevices();
 		if (DebugReportCallback != VK_NULL_HANDLE)
 		{
@@ -1304,10 +1760,28 @@ struct SVulkan
 	}
 };
 
+#if !USE_VMA
+inline void SVulkan::FMemAlloc::Flush(VkDevice Device)
+{
+	// Sub-allocations don't start on an atom boundary, so widen the range to what the spec requires
+	VkDeviceSize AtomSize = Block->Owner->Props.limits.nonCoherentAtomSize;
+	VkDeviceSize Start = Offset / AtomSize * AtomSize;
+	VkDeviceSize End = Min((Offset + Size + AtomSize - 1) / AtomSize * AtomSize, Block->Size);
+
+	VkMappedMemoryRange Range;
+	ZeroVulkanMem(Range, VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE);
+	Range.memory = Memory;
+	Range.offset = Start;
+	Range.size = End - Start;
+	VERIFY_VKRESULT(vkFlushMappedMemoryRanges(Device, 1, &Range));
+}
+#endif
+
 struct FMarkerScope
 {
 	VkCommandBuffer CmdBuffer;
 	bool bHasMarkerExtension;
+	SVulkan::FCmdBuffer* ProfiledCmdBuffer = nullptr;
 
 	FMarkerScope(SVulkan::SDevice& Device, SVulkan::FCmdBuffer* InCmdBuffer, const char* Name)
 		: FMarkerScope(&Device, InCmdBuffer, Name)
@@ -1329,17 +1803,32 @@ struct FMarkerScope
 			Info.color[3] = 1.0f;
 			vkCmdDebugMarkerBeginEXT(CmdBuffer, &Info);
 		}
+		if (InCmdBuffer->Profiler)
+		{
+			ProfiledCmdBuffer = InCmdBuffer;
+			BeginProfilerScope(Name);
+		}
 	}
 
 	~FMarkerScope()
 	{
+		if (ProfiledCmdBuffer)
+		{
+			EndProfilerScope();
+		}
 		if (bHasMarkerExtension)
 		{
 			vkCmdDebugMarkerEndEXT(CmdBuffer);
 		}
 	}
+
+	// After FGPUProfiler
+	inline void BeginProfilerScope(const char* Name);
+	inline void EndProfilerScope();
 };
 
+// After FDescriptorCache; call before destroying a buffer, buffer view or image view a cached descriptor set may have used
+inline void OnDescriptorResourceDestroyed(uint64 Handle);
 
 struct FBufferWithMem
 {
@@ -1352,6 +1841,8 @@ struct FBufferWithMem
 	SVulkan::FMemAlloc* Mem = nullptr;
 #endif
 	uint32 Size = 0;
+	// Set once the buffer (or its view) is written into a descriptor, so only those tell the descriptor caches when destroyed
+	bool bUsedByDescriptors = false;
 
 	void Create(SVulkan::SDevice& InDevice, VkBufferUsageFlags UsageFlags, EMemLocation Location, uint32 InSize, bool bMapped)
 	{
@@ -1378,21 +1869,30 @@ struct FBufferWithMem
 
 		VkMemoryRequirements MemReqs;
 		vkGetBufferMemoryRequirements(InDevice.Device, Buffer.Buffer, &MemReqs);
-		Mem = InDevice.AllocMemory(MemReqs.size, MemPropFlags, MemReqs.memoryTypeBits, bMapped);
+		Mem = InDevice.AllocMemory(MemReqs, MemPropFlags, bMapped, true);
 		VERIFY_VKRESULT(vkBindBufferMemory(InDevice.Device, Buffer.Buffer, Mem->Memory, Mem->Offset));
 #endif
 	}
 
 	void Destroy()
 	{
+		if (bUsedByDescriptors)
+		{
+			OnDescriptorResourceDestroyed((uint64)Buffer.Buffer);
+		}
 #if USE_VMA
 		vmaDestroyBuffer(Allocator, Buffer.Buffer, Mem);
 		Mem = {};
 		this->AllocInfo = {};
 #else
 		Buffer.Destroy();
-		Mem = nullptr;
+		if (Mem)
+		{
+			Mem->Block->Owner->FreeMemory(Mem);
+			Mem = nullptr;
+		}
 #endif
+		bUsedByDescriptors = false;
 	}
 
 	void* Lock()
@@ -1430,6 +1930,10 @@ struct FBufferWithMemAndView : public FBufferWithMem
 
 	void Destroy()
 	{
+		if (bUsedByDescriptors)
+		{
+			OnDescriptorResourceDestroyed((uint64)View);
+		}
 		vkDestroyBufferView(Buffer.Device, View, nullptr);
 		View = VK_NULL_HANDLE;
 
@@ -1469,7 +1973,7 @@ struct FImageWithMem
 		VkMemoryRequirements MemReqs;
 		vkGetImageMemoryRequirements(InDevice.Device, Image.Image, &MemReqs);
 
-		Mem = InDevice.AllocMemory(MemReqs.size, MemPropFlags, MemReqs.memoryTypeBits, false);
+		Mem = InDevice.AllocMemory(MemReqs, MemPropFlags, false, false);
 		VERIFY_VKRESULT(vkBindImageMemory(InDevice.Device, Image.Image, Mem->Memory, Mem->Offset));
 #endif
 		Image.Width = Width;
@@ -1485,6 +1989,11 @@ struct FImageWithMem
 		AllocInfo = {};
 #else
 		Image.Destroy();
+		if (Mem)
+		{
+			Mem->Block->Owner->FreeMemory(Mem);
+			Mem = nullptr;
+		}
 #endif
 	}
 };
@@ -1492,6 +2001,8 @@ struct FImageWithMem
 struct FImageWithMemAndView : public FImageWithMem
 {
 	VkImageView View = VK_NULL_HANDLE;
+	// See FBufferWithMem::bUsedByDescriptors
+	bool bUsedByDescriptors = false;
 
 	void Create(SVulkan::SDevice& InDevice, VkFormat Format, VkImageUsageFlags UsageFlags, 
 		EMemLocation Location, uint32 Width, uint32 Height, VkFormat ViewFormat, 
@@ -1505,6 +2016,11 @@ struct FImageWithMemAndView : public FImageWithMem
 	{
 		if (View != VK_NULL_HANDLE)
 		{
+			if (bUsedByDescriptors)
+			{
+				OnDescriptorResourceDestroyed((uint64)View);
+				bUsedByDescriptors = false;
+			}
 			vkDestroyImageView(Image.Device, View, nullptr);
 			View = VK_NULL_HANDLE;
 			FImageWithMem::Destroy();
@@ -1783,6 +2299,26 @@ struct FRenderTargetCache
 		return FB;
 	}
 
+	// For resizes; the render passes stay as they only depend on formats
+	void DeferDestroyFramebuffers(SVulkan::SDevice& InDevice)
+	{
+		std::vector<SVulkan::FFramebuffer*> OldFramebuffers;
+		for (auto Pair : Framebuffers)
+		{
+			OldFramebuffers.push_back(Pair.second);
+		}
+		Framebuffers.clear();
+
+		InDevice.DeferDelete([OldFramebuffers]()
+			{
+				for (SVulkan::FFramebuffer* Framebuffer : OldFramebuffers)
+				{
+					Framebuffer->Destroy();
+					delete Framebuffer;
+				}
+			});
+	}
+
 	void Destroy()
 	{
 		for (auto Pair : Framebuffers)
@@ -1801,6 +2337,120 @@ struct FRenderTargetCache
 	}
 };
 
+// FNV-1a
+inline uint64 HashBytes64(const void* Data, size_t Size, uint64 Hash = 0xcbf29ce484222325ull)
+{
+	const uint8* Bytes = (const uint8*)Data;
+	for (size_t Index = 0; Index < Size; ++Index)
+	{
+		Hash = (Hash ^ Bytes[Index]) * 0x100000001b3ull;
+	}
+	return Hash;
+}
+
+// splitmix64 finalizer, for keys that are already packed into 64 bits
+inline uint64 HashUInt64(uint64 Key)
+{
+	Key = (Key ^ (Key >> 30)) * 0xbf58476d1ce4e5b9ull;
+	Key = (Key ^ (Key >> 27)) * 0x94d049bb133111ebull;
+	return Key ^ (Key >> 31);
+}
+
+// Open addressing (linear probing) table from a precomputed 64-bit hash to an index into the owner's array.
+// Different keys may share a hash, so Find() takes a predicate to confirm the candidate index.
+struct FHashIndexTable
+{
+	struct FSlot
+	{
+		uint64 Hash;
+		int32 Index;
+	};
+	std::vector<FSlot> Slots;
+	uint32 NumUsed = 0;
+
+	template <typename TPredicate>
+	int32 Find(uint64 Hash, TPredicate IsMatch) const
+	{
+		if (Slots.empty())
+		{
+			return -1;
+		}
+
+		uint32 Mask = (uint32)Slots.size() - 1;
+		for (uint32 SlotIndex = (uint32)Hash & Mask; ; SlotIndex = (SlotIndex + 1) & Mask)
+		{
+			const FSlot& Slot = Slots[SlotIndex];
+			if (Slot.Index == -1)
+			{
+				return -1;
+			}
+			else if (Slot.Hash == Hash && IsMatch(Slot.Index))
+			{
+				return Slot.Index;
+			}
+		}
+	}
+
+	void Add(uint64 Hash, int32 Index)
+	{
+		check(Index != -1);
+		// Keep the load factor under 1/2
+		if ((NumUsed + 1) * 2 > (uint32)Slots.size())
+		{
+			std::vector<FSlot> OldSlots;
+			OldSlots.swap(Slots);
+			Slots.resize(OldSlots.empty() ? 64 : OldSlots.size() * 2, FSlot{0, -1});
+			NumUsed = 0;
+			for (const FSlot& Slot : OldSlots)
+			{
+				if (Slot.Index != -1)
+				{
+					Insert(Slot.Hash, Slot.Index);
+				}
+			}
+		}
+
+		Insert(Hash, Index);
+	}
+
+	void Insert(uint64 Hash, int32 Index)
+	{
+		uint32 Mask = (uint32)Slots.size() - 1;
+		uint32 SlotIndex = (uint32)Hash & Mask;
+		while (Slots[SlotIndex].Index != -1)
+		{
+			SlotIndex = (SlotIndex + 1) & Mask;
+		}
+		Slots[SlotIndex].Hash = Hash;
+		Slots[SlotIndex].Index = Index;
+		++NumUsed;
+	}
+
+	void Clear()
+	{
+		Slots.clear();
+		NumUsed = 0;
+	}
+};
+
+// Resolved once from a parameter name; valid for every variant of the PSO it came from
+struct FShaderParameter
+{
+	int32 Slot = -1;
+
+	FShaderParameter() = default;
+
+	explicit FShaderParameter(int32 InSlot)
+		: Slot(InSlot)
+	{
+	}
+
+	bool IsValid() const
+	{
+		return Slot != -1;
+	}
+};
+
 enum EPSOFlags
 {
 	EPSODoubleSided		= 1 << 0,
@@ -1836,48 +2486,100 @@ struct FPSOCache
 			Desc.stride = Stride;
 			BindingDescs.push_back(Desc);
 		}
+
+		uint64 GetHash() const
+		{
+			uint64 Hash = HashBytes64(AttrDescs.data(), AttrDescs.size() * sizeof(AttrDescs[0]));
+			Hash = HashBytes64(BindingDescs.data(), BindingDescs.size() * sizeof(BindingDescs[0]), Hash);
+			for (auto& Name : Names)
+			{
+				Hash = HashBytes64(Name.c_str(), Name.size() + 1, Hash);
+			}
+			return Hash;
+		}
+
+		bool operator == (const FVertexDecl& Other) const
+		{
+			return AttrDescs == Other.AttrDescs
+				&& BindingDescs == Other.BindingDescs
+				&& Names == Other.Names;
+		}
 	};
 	std::vector<FVertexDecl> VertexDecls;
+	FHashIndexTable VertexDeclTable;
 
+	// Call after FShaderLibrary::RecompileShaders(). Every PSO is rebuilt from the shaders now in its FShaderInfos: layouts,
+	// parameters and pipelines, so FShaderParameters have to be resolved again and descriptor sets allocated with the old
+	// layouts dropped (FDescriptorCache::Reset()). The old pipelines and layouts go once the GPU is done with them
 	void RecompileShaders()
 	{
-		for (auto& OuterPair : GfxPSOs)
+		WaitForCompiles();
+
+		std::vector<VkPipeline> OldPipelines;
+		for (SVulkan::FGfxPSO& PSO : GfxPSOVariants)
+		{
+			OldPipelines.push_back(PSO.Pipeline);
+		}
+		for (SVulkan::FComputePSO& PSO : ComputePSOs)
 		{
-			auto& Map = OuterPair.second;
-			for (auto& InnerPair : Map)
+			OldPipelines.push_back(PSO.Pipeline);
+		}
+		std::vector<FLayout> OldLayouts;
+		OldLayouts.swap(PipelineLayouts);
+		PipelineLayoutTable.Clear();
+		VkDevice VulkanDevice = Device->Device;
+		Device->DeferDelete([VulkanDevice, OldPipelines, OldLayouts]() mutable
 			{
-				SVulkan::FGfxPSO& PSO = InnerPair.second;
-				vkDestroyPipeline(Device->Device, PSO.Pipeline, nullptr);
-				//PSO.Reset();
-			}
+				for (VkPipeline Pipeline : OldPipelines)
+				{
+					vkDestroyPipeline(VulkanDevice, Pipeline, nullptr);
+				}
+				for (FLayout& Layout : OldLayouts)
+				{
+					Layout.Destroy(VulkanDevice);
+				}
+			});
+
+		for (FGfxPSOEntry& Entry : GfxPSOEntries)
+		{
+			Entry.ReloadShaders();
+			Entry.SetLayouts.clear();
+			Entry.GfxPipelineInfo.layout = GetOrCreateEntryLayout(Entry);
+			Entry.ParameterMap = BuildParameterMap(Entry.Reflection);
 		}
 
-		//for (auto& Pair : ComputePSOs)
+		auto Start = std::chrono::high_resolution_clock::now();
+		for (size_t Index = 0; Index < GfxPSOVariants.size(); ++Index)
 		{
-			//vkDestroyPipeline(Device->Device, Pair.second.Pipeline, nullptr);
-			//Compute.Reset();
+			uint64 Key = GfxPSOVariantKeys[Index];
+			const FGfxPSOEntry& Entry = GfxPSOEntries[(uint32)(Key >> 32)];
+			FPSOSecondHandle SecondHandle;
+			SecondHandle.Data = (uint32)Key;
+			SVulkan::FGfxPSO& PSO = GfxPSOVariants[Index];
+			SetupGfxPSOVariant(Entry, PSO);
+			PSO.Pipeline = CreateGfxPipeline(Device, PipelineCache, Entry, SecondHandle, SecondHandle.VertexDecl == -1 ? nullptr : &VertexDecls[SecondHandle.VertexDecl]);
+			Device->SetDebugName(PSO.Pipeline, PSO.Name.c_str());
+		}
+		AddPipelineCreateTime(Start, (uint32)GfxPSOVariants.size());
+
+		for (size_t Index = 0; Index < ComputePSOs.size(); ++Index)
+		{
+			std::string Name = ComputePSOs[Index].Name;
+			ComputePSOs[Index] = SVulkan::FComputePSO();
+			CreateComputePipeline(Name.c_str(), ComputeShaderInfos[Index], ComputePSOs[Index]);
 		}
 	}
 
 	int32 FindOrAddVertexDecl(const FVertexDecl& VertexDecl)
 	{
-		int32 Index = 0;
-		for (auto& Entry : VertexDecls)
+		uint64 Hash = VertexDecl.GetHash();
+		int32 Index = VertexDeclTable.Find(Hash, [&](int32 Candidate) { return VertexDecls[Candidate] == VertexDecl; });
+		if (Index == -1)
 		{
-			if (Entry.AttrDescs == VertexDecl.AttrDescs
-				&& Entry.BindingDescs == VertexDecl.BindingDescs
-				&& Entry.Names == VertexDecl.Names
-				)
-			{
-				//check(Entry.Names == VertexDecl.Names);
-				return Index;
-			}
-
-			++Index;
+			Index = (int32)VertexDecls.size();
+			VertexDecls.push_back(VertexDecl);
+			VertexDeclTable.Add(Hash, Index);
 		}
-
-		VertexDecls.push_back(VertexDecl);
-		check(Index == (int32)VertexDecls.size() - 1);
 		return Index;
 	}
 
@@ -1901,6 +2603,18 @@ struct FPSOCache
 		std::vector<SVulkan::FShader*> Shaders;
 	};
 	std::vector<FLayout> PipelineLayouts;
+	FHashIndexTable PipelineLayoutTable;
+
+	// Shaders using this set get BindlessSetLayout instead of a layout built from reflection; it's left out of FPSO::SetLayouts
+	uint32 BindlessSet = ~0u;
+	VkDescriptorSetLayout BindlessSetLayout = VK_NULL_HANDLE;
+
+	void SetBindlessSetLayout(uint32 Set, VkDescriptorSetLayout Layout)
+	{
+		check(PipelineLayouts.empty());
+		BindlessSet = Set;
+		BindlessSetLayout = Layout;
+	}
 
 	struct FPSOSecondHandle
 	{
@@ -1936,11 +2650,68 @@ struct FPSOCache
 		return A.Data < B.Data;
 	}
 
-	std::map<int32, std::map<FPSOSecondHandle, SVulkan::FGfxPSO>> GfxPSOs;
+	static uint64 GetGfxPSOVariantKey(int32 EntryIndex, FPSOSecondHandle SecondHandle)
+	{
+		return ((uint64)(uint32)EntryIndex << 32) | SecondHandle.Data;
+	}
+
+	// Index into GfxPSOVariants; stays valid until Destroy() so callers can keep it instead of looking the PSO up every draw
+	struct FGfxPSOVariantHandle
+	{
+		int32 Index = -1;
+
+		bool IsValid() const
+		{
+			return Index != -1;
+		}
+	};
+
+	// A deque so pointers returned by GetGfxPSO() survive new variants being added
+	std::deque<SVulkan::FGfxPSO> GfxPSOVariants;
+	std::vector<uint64> GfxPSOVariantKeys;
+	FHashIndexTable GfxPSOVariantTable;
 	std::vector<SVulkan::FComputePSO> ComputePSOs;
+	// What each of ComputePSOs was made from, for RecompileShaders()
+	std::vector<FShaderInfo*> ComputeShaderInfos;
 
 	SVulkan::SDevice* Device =  nullptr;
-	FBufferWithMem ZeroBuffer;
+
+	// Constants for vertex attributes a mesh doesn't have, one 16 byte slot each. Bound with instance rate and stride 0, so
+	// every vertex of every instance reads the same value out of the one buffer without needing a divisor
+	enum EDefaultAttribute
+	{
+		DefaultZero,
+		DefaultNormal,
+		DefaultTangent,
+		DefaultTexCoord,
+		DefaultColor,
+
+		NumDefaultAttributes,
+	};
+	FBufferWithMem DefaultAttributes;
+
+	static VkDeviceSize GetDefaultAttributeOffset(EDefaultAttribute Attribute)
+	{
+		return (VkDeviceSize)Attribute * 16;
+	}
+
+	VkPipelineCache PipelineCache = VK_NULL_HANDLE;
+	std::string PipelineCacheFilename;
+	size_t LoadedPipelineCacheSize = 0;
+	uint32 NumPipelinesCreated = 0;
+	double PipelineCreateTimeMs = 0;
+
+	// -asyncpso: TryGetGfxPSO misses are compiled as jobs on JobSystem and handed back through CompiledPSOs
+	struct FCompiledPSO
+	{
+		FGfxPSOVariantHandle Variant;
+		VkPipeline Pipeline;
+		double TimeMs;
+	};
+	bool bAsyncCompile = false;
+	FJobSystem* JobSystem = nullptr;
+	FJobCounter CompileJobs;
+	TLockFreeList<FCompiledPSO> CompiledPSOs;
 
 	struct FPSOHandle
 	{
@@ -1977,7 +2748,7 @@ struct FPSOCache
 		VkRect2D Scissor;
 		std::string Name = "<Unknown>";
 
-		std::map<std::string, std::pair<uint32, VkDescriptorType>> ParameterMap;
+		SVulkan::FPSO::FParameterMap ParameterMap;
 
 		FGfxPSOEntry()
 		{
@@ -2034,12 +2805,14 @@ struct FPSOCache
 
 		std::map<EShaderStages, SpvReflectDescriptorSet*> Reflection;
 		std::map<EShaderStages, SVulkan::FShader*> Shaders;
+		std::map<EShaderStages, FShaderInfo*> ShaderInfos;
 		std::vector<VkDescriptorSetLayout> SetLayouts;
 
 		void AddShader(EShaderStages Stage, FShaderInfo* SI, VkShaderStageFlagBits Flag)
 		{
 			Reflection[Stage] = SI->Shader->DescSetInfo;
 			Shaders[Stage] = SI->Shader;
+			ShaderInfos[Stage] = SI;
 
 			ZeroVulkanMem(StageInfos[GfxPipelineInfo.stageCount], VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO);
 			StageInfos[GfxPipelineInfo.stageCount].stage = Flag;
@@ -2049,6 +2822,26 @@ struct FPSOCache
 			++GfxPipelineInfo.stageCount;
 		}
 
+		// Picks up the FShaders a FShaderLibrary::RecompileShaders() put in the same FShaderInfos; stages keep their order as
+		// the maps are sorted by stage
+		void ReloadShaders()
+		{
+			std::map<EShaderStages, FShaderInfo*> Infos = ShaderInfos;
+			Reflection.clear();
+			Shaders.clear();
+			GfxPipelineInfo.stageCount = 0;
+			for (auto& Pair : Infos)
+			{
+				AddShader(Pair.first, Pair.second, FShaderLibrary::GetVulkanStage(Pair.second->Stage));
+			}
+		}
+
+		SVulkan::FShader* GetShader(EShaderStages Stage) const
+		{
+			auto Found = Shaders.find(Stage);
+			return Found == Shaders.end() ? nullptr : Found->second;
+		}
+
 		void Finalize(SVulkan::SDevice* Device, /*VkRenderPass RenderPass, */FPSOSecondHandle SecondHandle, FVertexDecl* VertexDecl)
 		{
 			//GfxPipelineInfo.renderPass = RenderPass;
@@ -2102,27 +2895,197 @@ struct FPSOCache
 
 	std::vector<FGfxPSOEntry> GfxPSOEntries;
 
+	static VkPipeline CreateGfxPipeline(SVulkan::SDevice* Device, VkPipelineCache PipelineCache, FGfxPSOEntry Entry, FPSOSecondHandle SecondHandle, FVertexDecl* VertexDecl)
+	{
+		Entry.FixPointers(Device);
+		Entry.Finalize(Device, /*RenderPass->RenderPass, */SecondHandle, VertexDecl);
+		VkPipeline Pipeline = VK_NULL_HANDLE;
+		VERIFY_VKRESULT(vkCreateGraphicsPipelines(Device->Device, PipelineCache, 1, &Entry.GfxPipelineInfo, nullptr, &Pipeline));
+		return Pipeline;
+	}
+
+	FGfxPSOVariantHandle FindGfxPSOVariant(int32 EntryIndex, FPSOSecondHandle SecondHandle) const
+	{
+		uint64 Key = GetGfxPSOVariantKey(EntryIndex, SecondHandle);
+		FGfxPSOVariantHandle Handle;
+		Handle.Index = GfxPSOVariantTable.Find(HashUInt64(Key), [&](int32 Candidate) { return GfxPSOVariantKeys[Candidate] == Key; });
+		return Handle;
+	}
+
+	static void SetupGfxPSOVariant(const FGfxPSOEntry& Entry, SVulkan::FGfxPSO& PSO)
+	{
+		PSO.Name = Entry.Name;
+		PSO.ParameterMap = Entry.ParameterMap;
+		PSO.BuildParameterSlots();
+		PSO.Shaders = Entry.Shaders;
+		PSO.SetLayouts = Entry.SetLayouts;
+		PSO.Layout = Entry.GfxPipelineInfo.layout;
+	}
+
+	// Adds a new variant; its Pipeline stays VK_NULL_HANDLE until compiled
+	FGfxPSOVariantHandle AddGfxPSO(int32 EntryIndex, FPSOSecondHandle SecondHandle)
+	{
+		const FGfxPSOEntry& Entry = GfxPSOEntries[EntryIndex];
+		FGfxPSOVariantHandle Handle;
+		Handle.Index = (int32)GfxPSOVariants.size();
+		GfxPSOVariants.emplace_back();
+		SetupGfxPSOVariant(Entry, GfxPSOVariants.back());
+
+		uint64 Key = GetGfxPSOVariantKey(EntryIndex, SecondHandle);
+		GfxPSOVariantKeys.push_back(Key);
+		GfxPSOVariantTable.Add(HashUInt64(Key), Handle.Index);
+		return Handle;
+	}
+
+	// Returns a handle to a compiled variant, building it on this thread if needed
+	FGfxPSOVariantHandle GetGfxPSOVariant(FPSOHandle GfxEntryHandle, FPSOSecondHandle SecondHandle = FPSOSecondHandle())
+	{
+		check(GfxEntryHandle.Index != -1);
+		FGfxPSOVariantHandle Handle = FindGfxPSOVariant(GfxEntryHandle.Index, SecondHandle);
+		if (!Handle.IsValid())
+		{
+			Handle = AddGfxPSO(GfxEntryHandle.Index, SecondHandle);
+			SVulkan::FGfxPSO& PSO = GfxPSOVariants[Handle.Index];
+			auto Start = std::chrono::high_resolution_clock::now();
+			PSO.Pipeline = CreateGfxPipeline(Device, PipelineCache, GfxPSOEntries[GfxEntryHandle.Index], SecondHandle, SecondHandle.VertexDecl == -1 ? nullptr : &VertexDecls[SecondHandle.VertexDecl]);
+			AddPipelineCreateTime(Start, 1);
+			Device->SetDebugName(PSO.Pipeline, PSO.Name.c_str());
+		}
+		else if (GfxPSOVariants[Handle.Index].Pipeline == VK_NULL_HANDLE)
+		{
+			// Queued by TryGetGfxPSOVariant; this caller can't skip its draw so wait for it
+			WaitForCompiles();
+			check(GfxPSOVariants[Handle.Index].Pipeline != VK_NULL_HANDLE);
+		}
+		return Handle;
+	}
+
+	// Same as GetGfxPSOVariant, but with -asyncpso a miss is queued for a worker; the pipeline is VK_NULL_HANDLE until PublishCompiledPSOs() picks it up
+	FGfxPSOVariantHandle TryGetGfxPSOVariant(FPSOHandle GfxEntryHandle, FPSOSecondHandle SecondHandle = FPSOSecondHandle())
+	{
+		if (!bAsyncCompile)
+		{
+			return GetGfxPSOVariant(GfxEntryHandle, SecondHandle);
+		}
+
+		check(GfxEntryHandle.Index != -1);
+		FGfxPSOVariantHandle Handle = FindGfxPSOVariant(GfxEntryHandle.Index, SecondHandle);
+		if (Handle.IsValid())
+		{
+			return Handle;
+		}
+
+		Handle = AddGfxPSO(GfxEntryHandle.Index, SecondHandle);
+
+		// The job gets its own copies as the render thread can grow GfxPSOEntries/VertexDecls meanwhile
+		FGfxPSOEntry Entry = GfxPSOEntries[GfxEntryHandle.Index];
+		bool bHasVertexDecl = SecondHandle.VertexDecl != -1;
+		FVertexDecl VertexDecl = bHasVertexDecl ? VertexDecls[SecondHandle.VertexDecl] : FVertexDecl();
+		JobSystem->AddJob([this, Handle, Entry, SecondHandle, bHasVertexDecl, VertexDecl]() mutable
+		{
+			FCompiledPSO Compiled;
+			Compiled.Variant = Handle;
+			auto Start = std::chrono::high_resolution_clock::now();
+			Compiled.Pipeline = CreateGfxPipeline(Device, PipelineCache, Entry, SecondHandle, bHasVertexDecl ? &VertexDecl : nullptr);
+			Compiled.TimeMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - Start).count();
+			CompiledPSOs.Push(Compiled);
+		}, &CompileJobs);
+		return Handle;
+	}
+
+	// Also publishes them, so every variant has its pipeline afterwards
+	void WaitForCompiles()
+	{
+		if (bAsyncCompile)
+		{
+			JobSystem->Wait(CompileJobs);
+		}
+		PublishCompiledPSOs();
+	}
+
+	// Do not cache this pointer!
+	SVulkan::FGfxPSO* GetGfxPSO(FGfxPSOVariantHandle Handle)
+	{
+		check(Handle.IsValid());
+		return &GfxPSOVariants[Handle.Index];
+	}
+
 	// Do not cache this pointer!
 	SVulkan::FGfxPSO* GetGfxPSO(FPSOHandle GfxEntryHandle, FPSOSecondHandle SecondHandle = FPSOSecondHandle())
+	{
+		return GetGfxPSO(GetGfxPSOVariant(GfxEntryHandle, SecondHandle));
+	}
+
+	// Returns nullptr while the variant is still being compiled by -asyncpso. Do not cache this pointer!
+	SVulkan::FGfxPSO* TryGetGfxPSO(FPSOHandle GfxEntryHandle, FPSOSecondHandle SecondHandle = FPSOSecondHandle())
+	{
+		SVulkan::FGfxPSO* PSO = GetGfxPSO(TryGetGfxPSOVariant(GfxEntryHandle, SecondHandle));
+		return PSO->Pipeline != VK_NULL_HANDLE ? PSO : nullptr;
+	}
+
+	// Creates all missing variants with a single vkCreateGraphicsPipelines call; returns how many were created
+	uint32 PrewarmGfxPSOs(FPSOHandle GfxEntryHandle, const std::set<FPSOSecondHandle>& SecondHandles)
 	{
 		check(GfxEntryHandle.Index != -1);
-		auto& VertexDeclMap = GfxPSOs[GfxEntryHandle.Index];
-		auto FoundVertexDecl = VertexDeclMap.find(SecondHandle);
-		if (FoundVertexDecl == VertexDeclMap.end())
+		std::vector<FPSOSecondHandle> Missing;
+		for (FPSOSecondHandle SecondHandle : SecondHandles)
+		{
+			if (!FindGfxPSOVariant(GfxEntryHandle.Index, SecondHandle).IsValid())
+			{
+				Missing.push_back(SecondHandle);
+			}
+		}
+
+		if (Missing.empty())
+		{
+			return 0;
+		}
+
+		// Reserved up front so the pointers set up by FixPointers stay valid
+		std::vector<FGfxPSOEntry> Entries;
+		Entries.reserve(Missing.size());
+		std::vector<VkGraphicsPipelineCreateInfo> CreateInfos;
+		for (FPSOSecondHandle SecondHandle : Missing)
 		{
-			FGfxPSOEntry Entry = GfxPSOEntries[GfxEntryHandle.Index];
+			Entries.push_back(GfxPSOEntries[GfxEntryHandle.Index]);
+			FGfxPSOEntry& Entry = Entries.back();
 			Entry.FixPointers(Device);
-			SVulkan::FGfxPSO PSO;
-			PSO.ParameterMap = Entry.ParameterMap;
-			PSO.Shaders = Entry.Shaders;
-			PSO.SetLayouts = Entry.SetLayouts;
-			PSO.Layout = Entry.GfxPipelineInfo.layout;
 			Entry.Finalize(Device, /*RenderPass->RenderPass, */SecondHandle, SecondHandle.VertexDecl == -1 ? nullptr : &VertexDecls[SecondHandle.VertexDecl]);
-			VERIFY_VKRESULT(vkCreateGraphicsPipelines(Device->Device, VK_NULL_HANDLE, 1, &Entry.GfxPipelineInfo, nullptr, &PSO.Pipeline));
-			VertexDeclMap[SecondHandle] = PSO;
-			Device->SetDebugName(PSO.Pipeline, Entry.Name.c_str());
+			CreateInfos.push_back(Entry.GfxPipelineInfo);
+		}
+
+		std::vector<VkPipeline> Pipelines(Missing.size(), VK_NULL_HANDLE);
+		auto Start = std::chrono::high_resolution_clock::now();
+		VERIFY_VKRESULT(vkCreateGraphicsPipelines(Device->Device, PipelineCache, (uint32)CreateInfos.size(), CreateInfos.data(), nullptr, Pipelines.data()));
+		AddPipelineCreateTime(Start, (uint32)Pipelines.size());
+
+		for (size_t Index = 0; Index < Missing.size(); ++Index)
+		{
+			SVulkan::FGfxPSO& PSO = GfxPSOVariants[AddGfxPSO(GfxEntryHandle.Index, Missing[Index]).Index];
+			PSO.Pipeline = Pipelines[Index];
+			Device->SetDebugName(PSO.Pipeline, PSO.Name.c_str());
 		}
-		return &VertexDeclMap[SecondHandle];
+
+		return (uint32)Missing.size();
+	}
+
+	// Render thread only; makes pipelines finished by the workers visible to TryGetGfxPSO
+	void PublishCompiledPSOs()
+	{
+		CompiledPSOs.PopAll([this](const FCompiledPSO& Compiled)
+		{
+			SVulkan::FGfxPSO& PSO = GfxPSOVariants[Compiled.Variant.Index];
+			check(PSO.Pipeline == VK_NULL_HANDLE);
+			PSO.Pipeline = Compiled.Pipeline;
+			PipelineCreateTimeMs += Compiled.TimeMs;
+			++NumPipelinesCreated;
+			Device->SetDebugName(PSO.Pipeline, PSO.Name.c_str());
+		});
+	}
+
+	uint32 GetNumQueuedCompiles() const
+	{
+		return (uint32)CompileJobs.Count.load(std::memory_order_relaxed);
 	}
 
 	// Do not cache this pointer!
@@ -2132,16 +3095,56 @@ struct FPSOCache
 		return &ComputePSOs[Handle.Index];
 	}
 
-	void Init(SVulkan::SDevice* InDevice)
+	FShaderParameter GetGfxParameter(FPSOHandle GfxEntryHandle, const char* Name) const
+	{
+		check(GfxEntryHandle.Index != -1);
+		return FShaderParameter(SVulkan::FPSO::FindParameterSlot(GfxPSOEntries[GfxEntryHandle.Index].ParameterMap, Name));
+	}
+
+	FShaderParameter GetComputeParameter(FPSOHandle Handle, const char* Name) const
+	{
+		check(Handle.Index != -1);
+		return FShaderParameter(SVulkan::FPSO::FindParameterSlot(ComputePSOs[Handle.Index].ParameterMap, Name));
+	}
+
+	void AddPipelineCreateTime(std::chrono::high_resolution_clock::time_point Start, uint32 NumPipelines)
+	{
+		PipelineCreateTimeMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - Start).count();
+		NumPipelinesCreated += NumPipelines;
+	}
+
+	void CreatePipelineCache();
+	void SavePipelineCache();
+	void LogPipelineCacheBench(const char* Stage);
+
+	// Without a running JobSystem -asyncpso is ignored
+	void Init(SVulkan::SDevice* InDevice, FJobSystem* InJobSystem = nullptr)
 	{
 		Device = InDevice;
-		ZeroBuffer.Create(*InDevice, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, EMemLocation::CPU_TO_GPU, 4 * sizeof(float), true);
+		JobSystem = InJobSystem;
+		CreatePipelineCache();
+
+		bAsyncCompile = RCUtils::FCmdLine::Get().Contains("-asyncpso") && JobSystem && JobSystem->IsRunning();
+		DefaultAttributes.Create(*InDevice, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, EMemLocation::CPU_TO_GPU, NumDefaultAttributes * 16, true);
 		{
-			void* Mem = ZeroBuffer.Lock();
-			memset(Mem, ZeroBuffer.Size, 255);
-			ZeroBuffer.Unlock();
+			// Read as R8G8B8A8_UNORM (R8G8_UNORM for the texcoord)
+			static const uint8 Values[NumDefaultAttributes][4] =
+			{
+				{0, 0, 0, 0},
+				{0, 0, 255, 0},
+				{0, 255, 0, 0},
+				{0, 0, 0, 0},
+				{255, 255, 255, 255},
+			};
+			uint8* Mem = (uint8*)DefaultAttributes.Lock();
+			memset(Mem, 0, DefaultAttributes.Size);
+			for (uint32 Index = 0; Index < NumDefaultAttributes; ++Index)
+			{
+				memcpy(Mem + GetDefaultAttributeOffset((EDefaultAttribute)Index), Values[Index], sizeof(Values[Index]));
+			}
+			DefaultAttributes.Unlock();
 		}
-		Device->SetDebugName(ZeroBuffer.Buffer.Buffer, "ZeroBuffer");
+		Device->SetDebugName(DefaultAttributes.Buffer.Buffer, "DefaultAttributes");
 	}
 
 	VkPipelineLayout GetOrCreatePipelineLayout(SVulkan::FShader* VS, SVulkan::FShader* HS, SVulkan::FShader* DS, SVulkan::FShader* GS, SVulkan::FShader* PS, std::vector<VkDescriptorSetLayout>& OutLayouts)
@@ -2162,12 +3165,12 @@ struct FPSOCache
 			Shaders.push_back(PS);
 		}
 
-		for (const FLayout& Layout : PipelineLayouts)
+		uint64 ShadersHash = HashBytes64(Shaders.data(), Shaders.size() * sizeof(Shaders[0]));
+		int32 Found = PipelineLayoutTable.Find(ShadersHash, [&](int32 Candidate) { return PipelineLayouts[Candidate].Shaders == Shaders; });
+		if (Found != -1)
 		{
-			if (Layout.Shaders == Shaders)
-			{
-				return Layout.PipelineLayout;
-			}
+			OutLayouts = PipelineLayouts[Found].DSLayouts;
+			return PipelineLayouts[Found].PipelineLayout;
 		}
 
 		VkPipelineLayoutCreateInfo Info;
@@ -2229,9 +3232,27 @@ struct FPSOCache
 			}
 		}
 
+		for (auto& Pair : LayoutBindings)
+		{
+			for (VkDescriptorSetLayoutBinding& Binding : Pair.second)
+			{
+				Binding.descriptorType = Pair.first == BindlessSet ? Binding.descriptorType : Device->GetLayoutDescriptorType(Binding.descriptorType);
+			}
+		}
+
 		FLayout Layout;
+		std::vector<VkDescriptorSetLayout> AllLayouts;
 		for (auto Pair : LayoutBindings)
 		{
+			check(Pair.first == (uint32)AllLayouts.size());
+			if (Pair.first == BindlessSet)
+			{
+				// Shared with FBindlessDescriptors, not owned by this layout
+				check(BindlessSetLayout != VK_NULL_HANDLE);
+				AllLayouts.push_back(BindlessSetLayout);
+				continue;
+			}
+
 			VkDescriptorSetLayoutCreateInfo DSInfo;
 			ZeroVulkanMem(DSInfo, VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO);
 			DSInfo.bindingCount = (uint32)Pair.second.size();
@@ -2240,10 +3261,11 @@ struct FPSOCache
 			VkDescriptorSetLayout DSLayout = VK_NULL_HANDLE;
 			VERIFY_VKRESULT(vkCreateDescriptorSetLayout(Device->Device, &DSInfo, nullptr, &DSLayout));
 			Layout.DSLayouts.push_back(DSLayout);
+			AllLayouts.push_back(DSLayout);
 		}
 
-		Info.setLayoutCount = (uint32)Layout.DSLayouts.size();
-		Info.pSetLayouts = Layout.DSLayouts.data();
+		Info.setLayoutCount = (uint32)AllLayouts.size();
+		Info.pSetLayouts = AllLayouts.data();
 
 		check(Layout.DSLayouts.size() > 0 || LayoutBindings.size() == 0);
 		OutLayouts = Layout.DSLayouts;
@@ -2251,11 +3273,53 @@ struct FPSOCache
 		VERIFY_VKRESULT(vkCreatePipelineLayout(Device->Device, &Info, nullptr, &Layout.PipelineLayout));
 
 		Layout.Shaders = Shaders;
+		PipelineLayoutTable.Add(ShadersHash, (int32)PipelineLayouts.size());
 		PipelineLayouts.push_back(Layout);
 
 		return Layout.PipelineLayout;
 	}
 
+	VkPipelineLayout GetOrCreateEntryLayout(FGfxPSOEntry& Entry)
+	{
+		return GetOrCreatePipelineLayout(Entry.GetShader(EShaderStages::Vertex), Entry.GetShader(EShaderStages::Hull), Entry.GetShader(EShaderStages::Domain), Entry.GetShader(EShaderStages::Geometry), Entry.GetShader(EShaderStages::Pixel), Entry.SetLayouts);
+	}
+
+	// Parameters by name from the shaders' reflection, with their slots assigned
+	SVulkan::FPSO::FParameterMap BuildParameterMap(const std::map<EShaderStages, SpvReflectDescriptorSet*>& Reflection)
+	{
+		SVulkan::FPSO::FParameterMap ParameterMap;
+		for (auto& Pair : Reflection)
+		{
+			SpvReflectDescriptorSet* Set = Pair.second;
+			if (!Set)
+			{
+				continue;
+			}
+			for (uint32 Index = 0; Index < Set->binding_count; ++Index)
+			{
+				SpvReflectDescriptorBinding* SetBinding = Set->bindings[Index];
+				std::string Name = SetBinding->resource_type == SPV_REFLECT_RESOURCE_FLAG_CBV
+					? SetBinding->type_description->type_name
+					: SetBinding->name;
+				check(Name[0]);
+
+				SVulkan::FPSO::FParameterInfo Info = {SetBinding->set, SetBinding->binding, Device->GetLayoutDescriptorType((VkDescriptorType)SetBinding->descriptor_type)};
+
+				auto Found = ParameterMap.find(Name);
+				if (Found == ParameterMap.end())
+				{
+					ParameterMap[Name] = Info;
+				}
+				else
+				{
+					check(Found->second == Info);
+				}
+			}
+		}
+		SVulkan::FPSO::AssignParameterSlots(ParameterMap);
+		return ParameterMap;
+	}
+
 	template <typename TFunction>
 	FPSOHandle InternalCreateGfxPSO(const char* Name, FShaderInfo* VS, FShaderInfo* HS, FShaderInfo* DS, FShaderInfo* GS, FShaderInfo* PS, SVulkan::FRenderPass* RenderPass, TFunction Callback)
 	{
@@ -2296,50 +3360,13 @@ struct FPSOCache
 			Entry.AddShader(EShaderStages::Pixel, PS, VK_SHADER_STAGE_FRAGMENT_BIT);
 		}
 
-		auto Layout = GetOrCreatePipelineLayout(VS->Shader, HS ? HS->Shader : nullptr, DS ? DS->Shader : nullptr, GS ? GS->Shader : nullptr, PS ? PS->Shader : nullptr, Entry.SetLayouts);
-
-		Entry.GfxPipelineInfo.layout = /*PSO.*/Layout;
+		Entry.GfxPipelineInfo.layout = GetOrCreateEntryLayout(Entry);
 		Entry.GfxPipelineInfo.renderPass = RenderPass->RenderPass;
 		Entry.FixPointers(Device);
 		Callback(Entry.GfxPipelineInfo);
 		Entry.Name = Name;
 
-		// Verify reflection
-		{
-			std::map<std::string, std::pair<uint32, VkDescriptorType>> ParameterMap;
-			for (auto& Pair : Entry.Reflection)
-			{
-				SpvReflectDescriptorSet* Set = Pair.second;
-				if (!Set)
-				{
-					continue;
-				}
-				for (uint32 Index = 0; Index < Set->binding_count; ++Index)
-				{
-					SpvReflectDescriptorBinding* SetBinding = Set->bindings[Index];
-					std::string Name = SetBinding->resource_type == SPV_REFLECT_RESOURCE_FLAG_CBV
-						? SetBinding->type_description->type_name
-						: SetBinding->name;
-					check(Name[0]);
-
-					uint32 Binding = SetBinding->binding;
-					VkDescriptorType Type = (VkDescriptorType)SetBinding->descriptor_type;
-
-					auto Found = ParameterMap.find(Name);
-					if (Found == ParameterMap.end())
-					{
-						ParameterMap[Name] = std::pair<uint32, VkDescriptorType>(Binding, Type);
-					}
-					else
-					{
-						check(ParameterMap[Name].first == Binding);
-						check(ParameterMap[Name].second == Type);
-					}
-				}
-			}
-
-			Entry.ParameterMap.swap(ParameterMap);
-		}
+		Entry.ParameterMap = BuildParameterMap(Entry.Reflection);
 
 		GfxPSOEntries.push_back(Entry);
 
@@ -2382,7 +3409,7 @@ struct FPSOCache
 		return InternalCreateGfxPSO(Name, VS, nullptr, nullptr, GS, PS, RenderPass, Callback);
 	}
 
-	FPSOHandle CreateComputePSO(const char* Name, FShaderInfo* CS)
+	void CreateComputePipeline(const char* Name, FShaderInfo* CS, SVulkan::FComputePSO& PSO)
 	{
 		check(CS->Shader && CS->Shader->ShaderModule);
 
@@ -2393,44 +3420,29 @@ struct FPSOCache
 		PipelineInfo.stage.module = CS->Shader->ShaderModule;
 		PipelineInfo.stage.pName = CS->EntryPoint.c_str();
 
-		SVulkan::FComputePSO PSO;
-		{
-			SpvReflectDescriptorSet* Set = CS->Shader->DescSetInfo;
-			if (Set)
-			{
-				for (uint32 Index = 0; Index < Set->binding_count; ++Index)
-				{
-					SpvReflectDescriptorBinding* SetBinding = Set->bindings[Index];
-					std::string Name = SetBinding->resource_type == SPV_REFLECT_RESOURCE_FLAG_CBV
-						? SetBinding->type_description->type_name
-						: SetBinding->name;
-					check(Name[0]);
-
-					uint32 Binding = SetBinding->binding;
-					VkDescriptorType Type = (VkDescriptorType)SetBinding->descriptor_type;
-
-					auto Found = PSO.ParameterMap.find(Name);
-					if (Found == PSO.ParameterMap.end())
-					{
-						PSO.ParameterMap[Name] = std::pair<uint32, VkDescriptorType>(Binding, Type);
-					}
-					else
-					{
-						check(PSO.ParameterMap[Name].first == Binding);
-						check(PSO.ParameterMap[Name].second == Type);
-					}
-				}
-			}
-		}
+		std::map<EShaderStages, SpvReflectDescriptorSet*> Reflection;
+		Reflection[EShaderStages::Compute] = CS->Shader->DescSetInfo;
+		PSO.ParameterMap = BuildParameterMap(Reflection);
+		PSO.BuildParameterSlots();
+		PSO.SetLayouts.clear();
 		PSO.Layout = GetOrCreatePipelineLayout(CS->Shader, nullptr, nullptr, nullptr, nullptr, PSO.SetLayouts);
 		PSO.Shaders[EShaderStages::Compute] = CS->Shader;
 
 		PipelineInfo.layout = PSO.Layout;
 
-		VERIFY_VKRESULT(vkCreateComputePipelines(Device->Device, VK_NULL_HANDLE, 1, &PipelineInfo, nullptr, &PSO.Pipeline));
+		auto Start = std::chrono::high_resolution_clock::now();
+		VERIFY_VKRESULT(vkCreateComputePipelines(Device->Device, PipelineCache, 1, &PipelineInfo, nullptr, &PSO.Pipeline));
+		AddPipelineCreateTime(Start, 1);
 		PSO.Name = Name;
-		ComputePSOs.push_back(PSO);
 		Device->SetDebugName(PSO.Pipeline, Name);
+	}
+
+	FPSOHandle CreateComputePSO(const char* Name, FShaderInfo* CS)
+	{
+		SVulkan::FComputePSO PSO;
+		CreateComputePipeline(Name, CS, PSO);
+		ComputePSOs.push_back(PSO);
+		ComputeShaderInfos.push_back(CS);
 		return FPSOHandle(ComputePSOs.size() - 1);
 	}
 
@@ -2446,23 +3458,36 @@ struct FPSOCache
 
 	void Destroy()
 	{
-		ZeroBuffer.Destroy();
+		WaitForCompiles();
+
+		{
+			std::stringstream ss;
+			ss << "*** Created " << NumPipelinesCreated << " pipelines in " << PipelineCreateTimeMs << "ms\n";
+			::OutputDebugStringA(ss.str().c_str());
+		}
+
+		SavePipelineCache();
+		vkDestroyPipelineCache(Device->Device, PipelineCache, nullptr);
+		PipelineCache = VK_NULL_HANDLE;
+
+		DefaultAttributes.Destroy();
 		for (auto PL : PipelineLayouts)
 		{
 			PL.Destroy(Device->Device);
 		}
 
 		PipelineLayouts.clear();
+		PipelineLayoutTable.Clear();
 
-		for (auto& OuterPair : GfxPSOs)
+		for (SVulkan::FGfxPSO& PSO : GfxPSOVariants)
 		{
-			for (auto& InnerPar : OuterPair.second)
-			{
-				vkDestroyPipeline(Device->Device, InnerPar.second.Pipeline, nullptr);
-			}
+			vkDestroyPipeline(Device->Device, PSO.Pipeline, nullptr);
 		}
-		GfxPSOs.clear();
+		GfxPSOVariants.clear();
+		GfxPSOVariantKeys.clear();
+		GfxPSOVariantTable.Clear();
 		FreePSOs(Device->Device, ComputePSOs);
+		ComputeShaderInfos.clear();
 	}
 };
 
@@ -2503,8 +3528,7 @@ struct FDescriptorCache
 
 			struct FUsedSets
 			{
-				SVulkan::FCmdBuffer* CmdBuffer = nullptr;
-				uint64 FenceCounter = 0;
+				SVulkan::FSyncPoint SyncPoint;
 				FDescriptorSets Sets;
 			};
 
@@ -2522,14 +3546,25 @@ struct FDescriptorCache
 				FreeSets.resize(FreeSets.size() - 1);
 
 				FUsedSets Entry;
-				Entry.CmdBuffer = CmdBuffer;
-				Entry.FenceCounter = CmdBuffer->LastSubmittedFence;
+				Entry.SyncPoint = CmdBuffer->GetSyncPoint();
 				Entry.Sets = OutSets;
 				UsedSets.push_back(Entry);
 
 				NumAvailable += (uint32)Layouts->size();
 
 			}
+
+			// For FCachedSets; the sets only go to UsedSets once evicted
+			void AllocCached(FDescriptorSets& OutSets)
+			{
+				if (Layouts->size() == 0)
+				{
+					return;
+				}
+				check(!FreeSets.empty());
+				OutSets = FreeSets.back();
+				FreeSets.resize(FreeSets.size() - 1);
+			}
 		};
 		std::vector<FPool> Pools;
 		VkDevice Device = VK_NULL_HANDLE;
@@ -2541,9 +3576,9 @@ struct FDescriptorCache
 		const uint32 NumEntries = 32;
 		std::vector<VkDescriptorPoolSize> PoolSizes;
 
-		void Init(VkDevice InDevice, SVulkan::FPSO* PSO)
+		void Init(SVulkan::SDevice* InDevice, SVulkan::FPSO* PSO)
 		{
-			Device = InDevice;
+			Device = InDevice->Device;
 			check(PSO->SetLayouts.size() > 0);
 			Layouts = PSO->SetLayouts;
 
@@ -2557,6 +3592,12 @@ struct FDescriptorCache
 				{
 					for (auto Pair : OuterPair.second->SetInfoBindings)
 					{
+						if (Pair.first >= (uint32)PSO->SetLayouts.size())
+						{
+							// Not allocated per draw (eg the bindless set)
+							continue;
+						}
+
 						if (LastSet == -1)
 						{
 							LastSet = (int32)Pair.first;
@@ -2568,7 +3609,7 @@ struct FDescriptorCache
 						for (VkDescriptorSetLayoutBinding Binding : Pair.second)
 						{
 							check(Binding.descriptorCount == 1);
-							TypeCounts[Binding.descriptorType] += Binding.descriptorCount;
+							TypeCounts[InDevice->GetLayoutDescriptorType(Binding.descriptorType)] += Binding.descriptorCount;
 							if (UniqueBindings.find(Binding.binding) == UniqueBindings.end())
 							{
 								UniqueBindings.insert(Binding.binding);
@@ -2633,7 +3674,7 @@ struct FDescriptorCache
 				for (int32 Index = (int32)Pool.UsedSets.size() - 1; Index >= 0; --Index)
 				{
 					auto& Used = Pool.UsedSets[Index];
-					if (Used.FenceCounter < Used.CmdBuffer->LastSubmittedFence)
+					if (Used.SyncPoint.IsComplete())
 					{
 						Pool.FreeSets.push_back(Used.Sets);
 
@@ -2677,6 +3718,89 @@ struct FDescriptorCache
 			return Sets;
 		}
 
+		// Sets that stay alive across draws and frames, keyed by the contents of the writes they were filled with
+		struct FCachedSets
+		{
+			uint64 Hash = 0;
+			std::vector<uint64> Key;
+			FDescriptorSets Sets;
+			int32 PoolIndex = -1;
+			SVulkan::FSyncPoint SyncPoint;
+		};
+		// Most recently used first
+		std::list<FCachedSets> CachedSets;
+		std::unordered_map<uint64, std::list<FCachedSets>::iterator> CachedSetsMap;
+
+		FDescriptorSets* FindCachedSets(uint64 Hash, const std::vector<uint64>& Key, SVulkan::FCmdBuffer* CmdBuffer)
+		{
+			auto Found = CachedSetsMap.find(Hash);
+			if (Found == CachedSetsMap.end() || Found->second->Key != Key)
+			{
+				return nullptr;
+			}
+
+			CachedSets.splice(CachedSets.begin(), CachedSets, Found->second);
+			FCachedSets& Entry = *Found->second;
+			Entry.SyncPoint = CmdBuffer->GetSyncPoint();
+			return &Entry.Sets;
+		}
+
+		// Returns sets the caller has to fill with the writes matching Key
+		FDescriptorSets* AddCachedSets(uint64 Hash, const std::vector<uint64>& Key, SVulkan::FCmdBuffer* CmdBuffer, uint32 MaxCachedSets, uint64& OutNumEvicted)
+		{
+			auto Found = CachedSetsMap.find(Hash);
+			if (Found != CachedSetsMap.end())
+			{
+				// Same hash, different contents
+				EvictCachedSets(Found->second);
+				++OutNumEvicted;
+			}
+
+			while (!CachedSets.empty() && CachedSets.size() >= MaxCachedSets)
+			{
+				EvictCachedSets(std::prev(CachedSets.end()));
+				++OutNumEvicted;
+			}
+
+			RefreshSets();
+			FPool* Pool = FindFreePool();
+			if (!Pool)
+			{
+				Pool = CreatePool();
+				check(Pool);
+			}
+
+			FCachedSets Entry;
+			Entry.Hash = Hash;
+			Entry.Key = Key;
+			Entry.PoolIndex = (int32)(Pool - Pools.data());
+			Entry.SyncPoint = CmdBuffer->GetSyncPoint();
+			Pool->AllocCached(Entry.Sets);
+			CachedSets.push_front(std::move(Entry));
+			CachedSetsMap[Hash] = CachedSets.begin();
+			return &CachedSets.front().Sets;
+		}
+
+		// The sets go back to their pool's UsedSets, so they are only reused once their last use has finished on the GPU
+		void EvictCachedSets(std::list<FCachedSets>::iterator It)
+		{
+			FPool::FUsedSets Used;
+			Used.SyncPoint = It->SyncPoint;
+			Used.Sets = It->Sets;
+			Pools[It->PoolIndex].UsedSets.push_back(Used);
+
+			CachedSetsMap.erase(It->Hash);
+			CachedSets.erase(It);
+		}
+
+		void FlushCachedSets()
+		{
+			while (!CachedSets.empty())
+			{
+				EvictCachedSets(CachedSets.begin());
+			}
+		}
+
 		void Destroy()
 		{
 			for (auto& Pool : Pools)
@@ -2689,175 +3813,1109 @@ struct FDescriptorCache
 
 	std::map<SVulkan::FPSO*, FDescriptorData> PSODescriptors;
 
+	// Per PSO; 0 allocates and updates a fresh set for every draw
+	uint32 MaxCachedSets = 0;
+	std::vector<uint64> KeyScratch;
+
+	struct FStats
+	{
+		uint64 Hits = 0;
+		uint64 Misses = 0;
+		uint64 Evictions = 0;
+	} Stats;
+
+	// Cached sets are keyed on raw handles, which the driver can hand out again once destroyed. Destroyed handles are queued
+	// here from any thread and the sets using them evicted by the thread recording with this cache, before its next lookup.
+	// Guarded by GetCachesMutex(), so queueing a handle on every cache takes a single lock
+	std::vector<uint64> DestroyedHandles;
+	std::atomic<uint32> NumDestroyedHandles = {0};
+
+	// Every initialized cache, so OnDescriptorResourceDestroyed() can reach them
+	static std::mutex& GetCachesMutex()
+	{
+		static std::mutex Mutex;
+		return Mutex;
+	}
+
+	static std::vector<FDescriptorCache*>& GetCaches()
+	{
+		static std::vector<FDescriptorCache*> Caches;
+		return Caches;
+	}
+
 	void Init(SVulkan::SDevice* InDevice)
 	{
 		Device = InDevice;
+		MaxCachedSets = RCUtils::FCmdLine::Get().TryGetIntPrefix("-descsetcache=", 1024);
+		if (MaxCachedSets > 0 && !Device->bPushDescriptor)
+		{
+			std::lock_guard<std::mutex> Lock(GetCachesMutex());
+			GetCaches().push_back(this);
+		}
 	}
 
-	void Destroy()
+	// Caller holds GetCachesMutex()
+	void AddDestroyedHandle(uint64 Handle)
 	{
-		for (auto Pair : PSODescriptors)
+		DestroyedHandles.push_back(Handle);
+		NumDestroyedHandles.store((uint32)DestroyedHandles.size(), std::memory_order_release);
+	}
+
+	// Walks a key laid out by BuildSetKey()
+	static bool KeyUsesHandles(const std::vector<uint64>& Key, const std::vector<uint64>& SortedHandles)
+	{
+		auto IsDestroyed = [&](uint64 Handle)
 		{
-			Pair.second.Destroy();
+			return std::binary_search(SortedHandles.begin(), SortedHandles.end(), Handle);
+		};
+
+		size_t Index = 0;
+		while (Index < Key.size())
+		{
+			VkDescriptorType Type = (VkDescriptorType)(uint32)Key[Index++];
+			switch (Type)
+			{
+			case VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER:
+			case VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE:
+			case VK_DESCRIPTOR_TYPE_SAMPLER:
+			case VK_DESCRIPTOR_TYPE_STORAGE_IMAGE:
+			case VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT:
+				if (IsDestroyed(Key[Index + 1]))
+				{
+					return true;
+				}
+				Index += 3;
+				break;
+			case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER:
+			case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC:
+			case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER:
+			case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC:
+				if (IsDestroyed(Key[Index]))
+				{
+					return true;
+				}
+				Index += 3;
+				break;
+			case VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER:
+			case VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER:
+				if (IsDestroyed(Key[Index]))
+				{
+					return true;
+				}
+				Index += 1;
+				break;
+			default:
+				check(0);
+				return true;
+			}
 		}
-		PSODescriptors.clear();
+		return false;
 	}
 
-	void UpdateDescriptors(SVulkan::FCmdBuffer* CmdBuffer, uint32 NumWrites, VkWriteDescriptorSet* DescriptorWrites, SVulkan::FPSO* InPSO, VkPipelineBindPoint BindPoint)
+	void EvictDestroyedHandles()
 	{
-		if (Device->bPushDescriptor)
+		std::vector<uint64> Handles;
 		{
-			vkCmdPushDescriptorSetKHR(CmdBuffer->CmdBuffer, BindPoint, InPSO->Layout, 0, NumWrites, DescriptorWrites);
+			std::lock_guard<std::mutex> Lock(GetCachesMutex());
+			Handles.swap(DestroyedHandles);
+			NumDestroyedHandles.store(0, std::memory_order_relaxed);
 		}
-		else
+		std::sort(Handles.begin(), Handles.end());
+
+		for (auto& Pair : PSODescriptors)
 		{
-			if (PSODescriptors.find(InPSO) == PSODescriptors.end())
+			FDescriptorData& Data = Pair.second;
+			for (auto It = Data.CachedSets.begin(); It != Data.CachedSets.end();)
 			{
-				PSODescriptors[InPSO].Init(Device->Device, InPSO);
+				auto Next = std::next(It);
+				if (KeyUsesHandles(It->Key, Handles))
+				{
+					Data.EvictCachedSets(It);
+					++Stats.Evictions;
+				}
+				It = Next;
 			}
-
-			auto Sets = PSODescriptors[InPSO].AllocSets(CmdBuffer);
-			Sets.UpdateDescriptorWrites(NumWrites, DescriptorWrites, PSODescriptors[InPSO].NumDescriptorsPerSet);
-			vkUpdateDescriptorSets(Device->Device, NumWrites, DescriptorWrites, 0, nullptr);
-			vkCmdBindDescriptorSets(CmdBuffer->CmdBuffer, BindPoint, InPSO->Layout, 0, (uint32)Sets.Sets.size(), Sets.Sets.data(), 0, nullptr);
 		}
 	}
 
-	inline void UpdateDescriptors(SVulkan::FCmdBuffer* CmdBuffer, uint32 NumWrites, VkWriteDescriptorSet* DescriptorWrites, SVulkan::FGfxPSO* InPSO)
+	uint32 GetNumCachedSets() const
 	{
-		UpdateDescriptors(CmdBuffer, NumWrites, DescriptorWrites, InPSO, VK_PIPELINE_BIND_POINT_GRAPHICS);
+		uint32 NumCached = 0;
+		for (auto& Pair : PSODescriptors)
+		{
+			NumCached += (uint32)Pair.second.CachedSets.size();
+		}
+		return NumCached;
 	}
 
-	inline void UpdateDescriptors(SVulkan::FCmdBuffer* CmdBuffer, uint32 NumWrites, VkWriteDescriptorSet* DescriptorWrites, SVulkan::FComputePSO* InPSO)
+	// Resources destroyed through FBufferWithMem/FImageWithMemAndView after being written into a descriptor evict their sets
+	// already; this is for anything else
+	void FlushCachedSets()
 	{
-		UpdateDescriptors(CmdBuffer, NumWrites, DescriptorWrites, InPSO, VK_PIPELINE_BIND_POINT_COMPUTE);
+		for (auto& Pair : PSODescriptors)
+		{
+			Pair.second.FlushCachedSets();
+		}
 	}
-};
-
-
-struct FStagingBuffer
-{
-	FBufferWithMem* Buffer = nullptr;
-	SVulkan::FCmdBuffer* CmdBuffer = nullptr;
-	uint64 Fence = 0;
-};
 
-struct FStagingBufferManager
-{
-	std::list<FStagingBuffer*> FreeEntries;
-	std::vector<FStagingBuffer*> UsedEntries;
-
-	SVulkan::SDevice* Device = nullptr;
-
-	void Init(SVulkan::SDevice* InDevice)
+	// Everything a set's contents depend on; dynamic uniform buffer offsets are supplied at bind time so they aren't part of it
+	static uint64 BuildSetKey(uint32 NumWrites, const VkWriteDescriptorSet* DescriptorWrites, std::vector<uint64>& OutKey)
 	{
-		Device = InDevice;
+		OutKey.clear();
+		for (uint32 Index = 0; Index < NumWrites; ++Index)
+		{
+			const VkWriteDescriptorSet& Write = DescriptorWrites[Index];
+			OutKey.push_back(((uint64)Write.dstBinding << 32) | (uint64)Write.descriptorType);
+			switch (Write.descriptorType)
+			{
+			case VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER:
+			case VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE:
+			case VK_DESCRIPTOR_TYPE_SAMPLER:
+			case VK_DESCRIPTOR_TYPE_STORAGE_IMAGE:
+			case VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT:
+				OutKey.push_back((uint64)Write.pImageInfo->sampler);
+				OutKey.push_back((uint64)Write.pImageInfo->imageView);
+				OutKey.push_back((uint64)Write.pImageInfo->imageLayout);
+				break;
+			case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER:
+			case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC:
+			case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER:
+			case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC:
+				OutKey.push_back((uint64)Write.pBufferInfo->buffer);
+				OutKey.push_back((uint64)Write.pBufferInfo->offset);
+				OutKey.push_back((uint64)Write.pBufferInfo->range);
+				break;
+			case VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER:
+			case VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER:
+				OutKey.push_back((uint64)*Write.pTexelBufferView);
+				break;
+			default:
+				check(0);
+				break;
+			}
+		}
+		return HashBytes64(OutKey.data(), OutKey.size() * sizeof(uint64));
 	}
 
 	void Destroy()
 	{
-		for (int32 Index = (int32)UsedEntries.size() - 1; Index >= 0; --Index)
 		{
-			FStagingBuffer* Entry = UsedEntries[Index];
-			Entry->Buffer->Destroy();
-			delete Entry->Buffer;
-			delete Entry;
+			std::lock_guard<std::mutex> Lock(GetCachesMutex());
+			auto& Caches = GetCaches();
+			Caches.erase(std::remove(Caches.begin(), Caches.end(), this), Caches.end());
 		}
 
-		for (FStagingBuffer* Buffer : FreeEntries)
+		for (auto Pair : PSODescriptors)
 		{
-			Buffer->Buffer->Destroy();
-			delete Buffer->Buffer;
-			delete Buffer;
+			Pair.second.Destroy();
 		}
-		FreeEntries.clear();
+		PSODescriptors.clear();
 	}
 
-	void Refresh()
+	// Drops every set, e.g. after FPSOCache::RecompileShaders() replaced the layouts they were allocated with; the pools go
+	// once the GPU is done with them
+	void Reset()
 	{
-		for (int32 Index = (int32)UsedEntries.size() - 1; Index >= 0; --Index)
+		std::vector<VkDescriptorPool> OldPools;
+		for (auto& Pair : PSODescriptors)
 		{
-			FStagingBuffer* Entry = UsedEntries[Index];
-			if (Entry->CmdBuffer)
+			for (auto& Pool : Pair.second.Pools)
 			{
-				if (Entry->CmdBuffer->Fence.Counter > Entry->Fence)
-				{
-					FreeEntries.push_back(Entry);
-					UsedEntries[Index] = UsedEntries[UsedEntries.size() - 1];
-					UsedEntries.resize(UsedEntries.size() - 1);
-				}
+				OldPools.push_back(Pool.Pool);
 			}
 		}
+		PSODescriptors.clear();
+
+		VkDevice VulkanDevice = Device->Device;
+		Device->DeferDelete([VulkanDevice, OldPools]()
+			{
+				for (VkDescriptorPool Pool : OldPools)
+				{
+					vkDestroyDescriptorPool(VulkanDevice, Pool, nullptr);
+				}
+			});
 	}
 
-	FStagingBuffer* AcquireBuffer(uint32 Size, SVulkan::FCmdBuffer* CurrentCmdBuffer)
+	void UpdateDescriptors(SVulkan::FCmdBuffer* CmdBuffer, uint32 NumWrites, VkWriteDescriptorSet* DescriptorWrites, SVulkan::FPSO* InPSO, VkPipelineBindPoint BindPoint, uint32 NumDynamicOffsets, const uint32* DynamicOffsets)
 	{
-		for (auto* Buffer : FreeEntries)
+		if (Device->bPushDescriptor)
 		{
-			if (Buffer->Buffer->Size == Size)
+			check(NumDynamicOffsets == 0);
+			vkCmdPushDescriptorSetKHR(CmdBuffer->CmdBuffer, BindPoint, InPSO->Layout, 0, NumWrites, DescriptorWrites);
+		}
+		else
+		{
+			auto Found = PSODescriptors.find(InPSO);
+			if (Found == PSODescriptors.end())
 			{
-				Buffer->CmdBuffer = CurrentCmdBuffer;
-				Buffer->Fence = CurrentCmdBuffer ? CurrentCmdBuffer->Fence.Counter : 0;
-				UsedEntries.push_back(Buffer);
-				FreeEntries.remove(Buffer);
-				return Buffer;
+				Found = PSODescriptors.insert(std::make_pair(InPSO, FDescriptorData())).first;
+				Found->second.Init(Device, InPSO);
 			}
-		}
-
-		FStagingBuffer* Entry = new FStagingBuffer;
-		Entry->Buffer = new FBufferWithMem;
-		Entry->Buffer->Create(*Device, VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, EMemLocation::CPU, Size, true);
-		Entry->CmdBuffer = CurrentCmdBuffer;
-		Entry->Fence = CurrentCmdBuffer ? CurrentCmdBuffer->Fence.Counter : 0;
-		UsedEntries.push_back(Entry);
-		return Entry;
-	}
-};
+			FDescriptorData& Data = Found->second;
 
+			if (MaxCachedSets > 0)
+			{
+				if (NumDestroyedHandles.load(std::memory_order_acquire) > 0)
+				{
+					EvictDestroyedHandles();
+				}
 
-struct FGPUTiming
-{
-	VkQueryPool QueryPool = VK_NULL_HANDLE;
-	FBufferWithMem QueryResultsBuffer;
-	SVulkan::SDevice* Device = nullptr;
+				uint64 Hash = BuildSetKey(NumWrites, DescriptorWrites, KeyScratch);
+				FDescriptorSets* Sets = Data.FindCachedSets(Hash, KeyScratch, CmdBuffer);
+				if (Sets)
+				{
+					++Stats.Hits;
+				}
+				else
+				{
+					++Stats.Misses;
+					Sets = Data.AddCachedSets(Hash, KeyScratch, CmdBuffer, MaxCachedSets, Stats.Evictions);
+					Sets->UpdateDescriptorWrites(NumWrites, DescriptorWrites, Data.NumDescriptorsPerSet);
+					vkUpdateDescriptorSets(Device->Device, NumWrites, DescriptorWrites, 0, nullptr);
+				}
+				vkCmdBindDescriptorSets(CmdBuffer->CmdBuffer, BindPoint, InPSO->Layout, 0, (uint32)Sets->Sets.size(), Sets->Sets.data(), NumDynamicOffsets, DynamicOffsets);
+				return;
+			}
 
-	void Init(SVulkan::SDevice* InDevice, struct FPendingOpsManager& PendingOpsMgr);
+			// Without caching every update is a miss
+			++Stats.Misses;
+			auto Sets = Data.AllocSets(CmdBuffer);
+			Sets.UpdateDescriptorWrites(NumWrites, DescriptorWrites, Data.NumDescriptorsPerSet);
+			vkUpdateDescriptorSets(Device->Device, NumWrites, DescriptorWrites, 0, nullptr);
+			vkCmdBindDescriptorSets(CmdBuffer->CmdBuffer, BindPoint, InPSO->Layout, 0, (uint32)Sets.Sets.size(), Sets.Sets.data(), NumDynamicOffsets, DynamicOffsets);
+		}
+	}
 
-	void Destroy()
+	inline void UpdateDescriptors(SVulkan::FCmdBuffer* CmdBuffer, uint32 NumWrites, VkWriteDescriptorSet* DescriptorWrites, SVulkan::FGfxPSO* InPSO, uint32 NumDynamicOffsets = 0, const uint32* DynamicOffsets = nullptr)
 	{
-		QueryResultsBuffer.Destroy();
-		vkDestroyQueryPool(Device->Device, QueryPool, nullptr);
+		UpdateDescriptors(CmdBuffer, NumWrites, DescriptorWrites, InPSO, VK_PIPELINE_BIND_POINT_GRAPHICS, NumDynamicOffsets, DynamicOffsets);
 	}
 
-	void BeginTimestamp(SVulkan::FCmdBuffer* CmdBuffer)
+	inline void UpdateDescriptors(SVulkan::FCmdBuffer* CmdBuffer, uint32 NumWrites, VkWriteDescriptorSet* DescriptorWrites, SVulkan::FComputePSO* InPSO, uint32 NumDynamicOffsets = 0, const uint32* DynamicOffsets = nullptr)
 	{
-		vkCmdWriteTimestamp(CmdBuffer->CmdBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, QueryPool, 0);
+		UpdateDescriptors(CmdBuffer, NumWrites, DescriptorWrites, InPSO, VK_PIPELINE_BIND_POINT_COMPUTE, NumDynamicOffsets, DynamicOffsets);
 	}
+};
 
-	void EndTimestamp(SVulkan::FCmdBuffer* CmdBuffer)
+inline void OnDescriptorResourceDestroyed(uint64 Handle)
+{
+	if (Handle == 0)
 	{
-		vkCmdWriteTimestamp(CmdBuffer->CmdBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, QueryPool, 1);
-		vkCmdCopyQueryPoolResults(CmdBuffer->CmdBuffer, QueryPool, 0, 2, QueryResultsBuffer.Buffer.Buffer, 0, sizeof(uint64), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
-		vkCmdResetQueryPool(CmdBuffer->CmdBuffer, QueryPool, 0, 2);
+		return;
 	}
 
-	double ReadTimestamp()
+	std::lock_guard<std::mutex> Lock(FDescriptorCache::GetCachesMutex());
+	for (FDescriptorCache* Cache : FDescriptorCache::GetCaches())
 	{
-#if USE_VMA
-		uint64* Values;
-		vmaMapMemory(QueryResultsBuffer.Allocator, QueryResultsBuffer.Mem, (void**)&Values);
-		double DeltaMs = (Values[1] - Values[0]) * (Device->Props.limits.timestampPeriod * 1e-6);
-		vmaUnmapMemory(QueryResultsBuffer.Allocator, QueryResultsBuffer.Mem);
-		return DeltaMs;
-#else
-		uint64* Values = (uint64*)QueryResultsBuffer.Mem->MappedMem;
-		double DeltaMs = (Values[1] - Values[0]) * (Device->Props.limits.timestampPeriod * 1e-6);
-		return DeltaMs;
-#endif
+		Cache->AddDestroyedHandle(Handle);
 	}
-};
+}
+
+// One scene wide descriptor set: every texture in a single partially bound array plus a storage buffer of materials.
+// Slots are written once when a texture is added, so draws only need a single vkCmdBindDescriptorSets.
+struct FBindlessDescriptors
+{
+	enum
+	{
+		TexturesBinding = 0,
+		MaterialsBinding = 1,
+	};
+
+	SVulkan::SDevice* Device = nullptr;
+	VkDescriptorSetLayout Layout = VK_NULL_HANDLE;
+	VkDescriptorPool Pool = VK_NULL_HANDLE;
+	VkDescriptorSet Set = VK_NULL_HANDLE;
+	uint32 MaxTextures = 0;
+	uint32 NumTextures = 0;
+
+	void Init(SVulkan::SDevice* InDevice, uint32 InMaxTextures)
+	{
+		Device = InDevice;
+		MaxTextures = InMaxTextures;
+
+		VkDescriptorSetLayoutBinding Bindings[2];
+		ZeroMem(Bindings);
+		Bindings[0].binding = TexturesBinding;
+		Bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+		Bindings[0].descriptorCount = MaxTextures;
+		Bindings[0].stageFlags = VK_SHADER_STAGE_ALL_GRAPHICS;
+		Bindings[1].binding = MaterialsBinding;
+		Bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		Bindings[1].descriptorCount = 1;
+		Bindings[1].stageFlags = VK_SHADER_STAGE_ALL_GRAPHICS;
+
+		// Slots past NumTextures are never written
+		VkDescriptorBindingFlags BindingFlags[2] = {VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT, 0};
+		VkDescriptorSetLayoutBindingFlagsCreateInfo FlagsInfo;
+		ZeroVulkanMem(FlagsInfo, VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO);
+		FlagsInfo.bindingCount = 2;
+		FlagsInfo.pBindingFlags = BindingFlags;
+
+		VkDescriptorSetLayoutCreateInfo LayoutInfo;
+		ZeroVulkanMem(LayoutInfo, VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO);
+		LayoutInfo.pNext = &FlagsInfo;
+		LayoutInfo.bindingCount = 2;
+		LayoutInfo.pBindings = Bindings;
+		VERIFY_VKRESULT(vkCreateDescriptorSetLayout(Device->Device, &LayoutInfo, nullptr, &Layout));
+
+		VkDescriptorPoolSize PoolSizes[2];
+		PoolSizes[0].type = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+		PoolSizes[0].descriptorCount = MaxTextures;
+		PoolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		PoolSizes[1].descriptorCount = 1;
+
+		VkDescriptorPoolCreateInfo PoolInfo;
+		ZeroVulkanMem(PoolInfo, VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO);
+		PoolInfo.maxSets = 1;
+		PoolInfo.poolSizeCount = 2;
+		PoolInfo.pPoolSizes = PoolSizes;
+		VERIFY_VKRESULT(vkCreateDescriptorPool(Device->Device, &PoolInfo, nullptr, &Pool));
+
+		VkDescriptorSetAllocateInfo AllocInfo;
+		ZeroVulkanMem(AllocInfo, VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO);
+		AllocInfo.descriptorPool = Pool;
+		AllocInfo.descriptorSetCount = 1;
+		AllocInfo.pSetLayouts = &Layout;
+		VERIFY_VKRESULT(vkAllocateDescriptorSets(Device->Device, &AllocInfo, &Set));
+	}
+
+	// Returns the slot for indexing the array in the shader, or -1 if it's full. The set isn't update-after-bind, so only add
+	// textures while no pending command buffer uses it
+	int32 AddTexture(FImageWithMemAndView& Image)
+	{
+		if (NumTextures >= MaxTextures)
+		{
+			return -1;
+		}
+
+		VkDescriptorImageInfo IInfo;
+		ZeroMem(IInfo);
+		IInfo.imageView = Image.View;
+		IInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+		VkWriteDescriptorSet Write;
+		ZeroVulkanMem(Write, VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET);
+		Write.dstSet = Set;
+		Write.dstBinding = TexturesBinding;
+		Write.dstArrayElement = NumTextures;
+		Write.descriptorCount = 1;
+		Write.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+		Write.pImageInfo = &IInfo;
+		vkUpdateDescriptorSets(Device->Device, 1, &Write, 0, nullptr);
+
+		return (int32)NumTextures++;
+	}
+
+	// Same restriction as AddTexture()
+	void SetMaterials(FBufferWithMem& Buffer)
+	{
+		VkDescriptorBufferInfo BInfo;
+		ZeroMem(BInfo);
+		BInfo.buffer = Buffer.Buffer.Buffer;
+		BInfo.range = Buffer.Size;
+
+		VkWriteDescriptorSet Write;
+		ZeroVulkanMem(Write, VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET);
+		Write.dstSet = Set;
+		Write.dstBinding = MaterialsBinding;
+		Write.descriptorCount = 1;
+		Write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		Write.pBufferInfo = &BInfo;
+		vkUpdateDescriptorSets(Device->Device, 1, &Write, 0, nullptr);
+	}
+
+	void Destroy()
+	{
+		if (Device)
+		{
+			vkDestroyDescriptorPool(Device->Device, Pool, nullptr);
+			vkDestroyDescriptorSetLayout(Device->Device, Layout, nullptr);
+			Pool = VK_NULL_HANDLE;
+			Layout = VK_NULL_HANDLE;
+			Set = VK_NULL_HANDLE;
+		}
+	}
+};
+
+struct FStagingBuffer
+{
+	FBufferWithMem* Buffer = nullptr;
+	// Invalid until the copy from this buffer has been recorded
+	SVulkan::FSyncPoint SyncPoint;
+	// Requested size; the buffer itself is rounded up to its size class
+	uint32 Size = 0;
+	uint32 SizeClass = 0;
+};
+
+struct FStagingBufferManager
+{
+	enum
+	{
+		MinSizeClassBits = 8,
+		NumSizeClasses = 32 - MinSizeClassBits,
+	};
+
+	// Free buffers bucketed by power of two size, starting at 256 bytes
+	std::vector<FStagingBuffer*> FreeEntries[NumSizeClasses];
+	std::vector<FStagingBuffer*> UsedEntries;
+
+	SVulkan::SDevice* Device = nullptr;
+
+	// The loading thread acquires buffers for the scene's geometry while the render thread uses and refreshes them
+	std::mutex Mutex;
+
+	// Free buffers get destroyed once more than this many bytes are sitting idle
+	uint64 MaxIdleBytes = 0;
+
+	struct FStats
+	{
+		uint64 Hits = 0;
+		uint64 Misses = 0;
+		uint64 Trimmed = 0;
+		uint64 HeldBytes = 0;
+		uint64 IdleBytes = 0;
+	};
+	FStats Stats;
+
+	void Init(SVulkan::SDevice* InDevice)
+	{
+		Device = InDevice;
+		MaxIdleBytes = (uint64)RCUtils::FCmdLine::Get().TryGetIntPrefix("-stagingmaxidle=", 64) * 1024 * 1024;
+	}
+
+	static uint32 GetSizeClass(uint32 Size)
+	{
+		uint32 SizeClass = 0;
+		while (SizeClass < NumSizeClasses - 1 && (1ull << (SizeClass + MinSizeClassBits)) < Size)
+		{
+			++SizeClass;
+		}
+		return SizeClass;
+	}
+
+	static uint32 GetSizeClassSize(uint32 SizeClass)
+	{
+		return 1u << (SizeClass + MinSizeClassBits);
+	}
+
+	void DestroyEntry(FStagingBuffer* Entry)
+	{
+		Stats.HeldBytes -= Entry->Buffer->Size;
+		Entry->Buffer->Destroy();
+		delete Entry->Buffer;
+		delete Entry;
+	}
+
+	void Destroy()
+	{
+		std::lock_guard<std::mutex> Lock(Mutex);
+		for (int32 Index = (int32)UsedEntries.size() - 1; Index >= 0; --Index)
+		{
+			DestroyEntry(UsedEntries[Index]);
+		}
+		UsedEntries.clear();
+
+		for (auto& Bucket : FreeEntries)
+		{
+			for (FStagingBuffer* Entry : Bucket)
+			{
+				DestroyEntry(Entry);
+			}
+			Bucket.clear();
+		}
+		Stats.IdleBytes = 0;
+	}
+
+	void Refresh()
+	{
+		std::lock_guard<std::mutex> Lock(Mutex);
+		for (int32 Index = (int32)UsedEntries.size() - 1; Index >= 0; --Index)
+		{
+			FStagingBuffer* Entry = UsedEntries[Index];
+			if (Entry->SyncPoint.IsValid() && Entry->SyncPoint.IsComplete())
+			{
+				FreeEntries[Entry->SizeClass].push_back(Entry);
+				Stats.IdleBytes += Entry->Buffer->Size;
+				UsedEntries[Index] = UsedEntries[UsedEntries.size() - 1];
+				UsedEntries.resize(UsedEntries.size() - 1);
+			}
+		}
+
+		Trim();
+	}
+
+	void Trim()
+	{
+		// Largest buffers go first as they are the least likely to be reused
+		for (int32 SizeClass = NumSizeClasses - 1; SizeClass >= 0 && Stats.IdleBytes > MaxIdleBytes; --SizeClass)
+		{
+			auto& Bucket = FreeEntries[SizeClass];
+			while (!Bucket.empty() && Stats.IdleBytes > MaxIdleBytes)
+			{
+				FStagingBuffer* Entry = Bucket.back();
+				Bucket.pop_back();
+				Stats.IdleBytes -= Entry->Buffer->Size;
+				++Stats.Trimmed;
+				DestroyEntry(Entry);
+			}
+		}
+	}
+
+	FStagingBuffer* AcquireBuffer(uint32 Size, SVulkan::FCmdBuffer* CurrentCmdBuffer)
+	{
+		std::lock_guard<std::mutex> Lock(Mutex);
+		uint32 SizeClass = GetSizeClass(Size);
+		FStagingBuffer* Entry = nullptr;
+		auto& Bucket = FreeEntries[SizeClass];
+		// Requests past the top class share its bucket without being rounded up to it, so those buffers can be too small
+		for (int32 Index = (int32)Bucket.size() - 1; Index >= 0; --Index)
+		{
+			if (Bucket[Index]->Buffer->Size >= Size)
+			{
+				Entry = Bucket[Index];
+				Bucket[Index] = Bucket.back();
+				Bucket.pop_back();
+				Stats.IdleBytes -= Entry->Buffer->Size;
+				++Stats.Hits;
+				break;
+			}
+		}
+
+		if (!Entry)
+		{
+			uint32 BufferSize = Max(Size, GetSizeClassSize(SizeClass));
+			Entry = new FStagingBuffer;
+			Entry->SizeClass = SizeClass;
+			Entry->Buffer = new FBufferWithMem;
+			Entry->Buffer->Create(*Device, VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, EMemLocation::CPU, BufferSize, true);
+			Stats.HeldBytes += BufferSize;
+			++Stats.Misses;
+		}
+
+		Entry->Size = Size;
+		Entry->SyncPoint = CurrentCmdBuffer ? CurrentCmdBuffer->GetSyncPoint() : SVulkan::FSyncPoint();
+		UsedEntries.push_back(Entry);
+		return Entry;
+	}
+};
+
+
+struct FRingAllocation
+{
+	VkBuffer Buffer = VK_NULL_HANDLE;
+	uint32 Offset = 0;
+	uint32 Size = 0;
+	void* Data = nullptr;
+};
+
+// Persistently mapped linear allocator for data that only lives for one frame (eg uniform buffers); space is
+// handed back a whole frame at a time once the command buffer for that frame has finished on the GPU. If the frames not
+// submitted yet need more than the whole buffer, it moves to a bigger one instead of waiting on itself
+struct FFrameRingBuffer
+{
+	FBufferWithMem Buffer;
+	SVulkan::SDevice* Device = nullptr;
+	VkBufferUsageFlags UsageFlags = 0;
+	uint32 Alignment = 0;
+
+	// Virtual offsets that only ever grow; the physical offset is modulo the buffer size
+	uint64 Head = 0;
+	uint64 Tail = 0;
+
+	struct FFrameMark
+	{
+		SVulkan::FSyncPoint SyncPoint;
+		uint64 End = 0;
+	};
+	std::deque<FFrameMark> Frames;
+
+	uint32 NumAllocations = 0;
+	uint32 LastFrameNumAllocations = 0;
+	uint64 LastFrameBytes = 0;
+	uint64 FrameStart = 0;
+	// What the current frame used in buffers it has since grown out of
+	uint64 FrameBytesBeforeGrow = 0;
+	uint32 NumGrows = 0;
+
+	void Init(SVulkan::SDevice* InDevice, uint32 Size, VkBufferUsageFlags InUsageFlags, uint32 InAlignment)
+	{
+		Device = InDevice;
+		UsageFlags = InUsageFlags;
+		Alignment = InAlignment;
+		CreateBuffer(Size);
+	}
+
+	void CreateBuffer(uint64 Size)
+	{
+		Size = (Size + Alignment - 1) / Alignment * Alignment;
+		check(Size <= UINT32_MAX);
+		Buffer.Create(*Device, UsageFlags, EMemLocation::CPU, (uint32)Size, true);
+		// Allocations reach the descriptors as raw handles, so this can't be flagged by FDescriptorPSOCache
+		Buffer.bUsedByDescriptors = true;
+		Device->SetDebugName(Buffer.Buffer.Buffer, "FrameRingBuffer");
+	}
+
+	void Destroy()
+	{
+		Buffer.Destroy();
+		Frames.clear();
+	}
+
+	void Refresh()
+	{
+		while (!Frames.empty() && Frames.front().SyncPoint.IsComplete())
+		{
+			Tail = Frames.front().End;
+			Frames.pop_front();
+		}
+	}
+
+	// Call once all the allocations for the frame recorded in CmdBuffer have been made
+	void EndFrame(SVulkan::FCmdBuffer* CmdBuffer)
+	{
+		FFrameMark Mark;
+		Mark.SyncPoint = CmdBuffer->GetSyncPoint();
+		Mark.End = Head;
+		Frames.push_back(Mark);
+
+		LastFrameNumAllocations = NumAllocations;
+		LastFrameBytes = FrameBytesBeforeGrow + Head - FrameStart;
+		NumAllocations = 0;
+		FrameStart = Head;
+		FrameBytesBeforeGrow = 0;
+	}
+
+	// Allocations already handed out stay valid: the old buffer is only deleted once the GPU is past everything recorded so far
+	void Grow(uint32 MinSize)
+	{
+		uint64 NewSize = std::max((uint64)Buffer.Size * 2, ((Head - FrameStart) + MinSize + Alignment) * 2);
+		FBufferWithMem OldBuffer = Buffer;
+		Device->DeferDelete([OldBuffer]() mutable
+			{
+				OldBuffer.Destroy();
+			});
+		CreateBuffer(NewSize);
+
+		FrameBytesBeforeGrow += Head - FrameStart;
+		Frames.clear();
+		Head = 0;
+		Tail = 0;
+		FrameStart = 0;
+		++NumGrows;
+
+		std::stringstream ss;
+		ss << "*** Frame ring buffer grown to " << (Buffer.Size >> 10) << "KB\n";
+		::OutputDebugStringA(ss.str().c_str());
+	}
+
+	uint64 GetStart(uint32 Size) const
+	{
+		const uint64 Capacity = Buffer.Size;
+		uint64 Start = (Head + Alignment - 1) / Alignment * Alignment;
+		if ((Start % Capacity) + Size > Capacity)
+		{
+			// Skip the end of the buffer, allocations can't wrap around
+			Start = (Start / Capacity + 1) * Capacity;
+		}
+		return Start;
+	}
+
+	FRingAllocation Allocate(uint32 Size)
+	{
+		if ((Head - FrameStart) + Size + Alignment > Buffer.Size)
+		{
+			// This frame alone needs more than the whole buffer; no point waiting for older frames first
+			Grow(Size);
+		}
+
+		uint64 Start = GetStart(Size);
+		while (Start + Size - Tail > Buffer.Size)
+		{
+			if (Frames.empty() || !Frames.front().SyncPoint.IsSubmitted())
+			{
+				// The space is held by frames still being recorded, so waiting would never free it
+				Grow(Size);
+			}
+			else
+			{
+				// Wait for the oldest frame that is still using the buffer
+				Device->WaitForSyncPoint(Frames.front().SyncPoint);
+				Refresh();
+			}
+			Start = GetStart(Size);
+		}
+
+		Head = Start + Size;
+		++NumAllocations;
+
+		FRingAllocation Allocation;
+		Allocation.Buffer = Buffer.Buffer.Buffer;
+		Allocation.Offset = (uint32)(Start % Buffer.Size);
+		Allocation.Size = Size;
+		Allocation.Data = (uint8*)Buffer.Lock() + Allocation.Offset;
+		return Allocation;
+	}
+
+	template <typename T>
+	FRingAllocation Allocate(const T& Data)
+	{
+		FRingAllocation Allocation = Allocate((uint32)sizeof(T));
+		*(T*)Allocation.Data = Data;
+		return Allocation;
+	}
+};
+
+// Hands out pieces of one FRingAllocation, so a worker thread can make its per draw allocations without touching the ring
+struct FRingSubAllocator
+{
+	FRingAllocation Block;
+	uint32 Alignment = 1;
+	uint32 Used = 0;
+
+	FRingSubAllocator() = default;
+
+	FRingSubAllocator(const FRingAllocation& InBlock, uint32 InAlignment)
+		: Block(InBlock)
+		, Alignment(InAlignment)
+	{
+	}
+
+	// Size of a block that fits NumAllocations of Size each
+	static uint32 GetBlockSize(uint32 NumAllocations, uint32 Size, uint32 Alignment)
+	{
+		return NumAllocations * ((Size + Alignment - 1) / Alignment * Alignment);
+	}
+
+	FRingAllocation Allocate(uint32 Size)
+	{
+		uint32 Start = (Used + Alignment - 1) / Alignment * Alignment;
+		check(Start + Size <= Block.Size);
+		Used = Start + Size;
+
+		FRingAllocation Allocation;
+		Allocation.Buffer = Block.Buffer;
+		Allocation.Offset = Block.Offset + Start;
+		Allocation.Size = Size;
+		Allocation.Data = (uint8*)Block.Data + Start;
+		return Allocation;
+	}
+
+	template <typename T>
+	FRingAllocation Allocate(const T& Data)
+	{
+		FRingAllocation Allocation = Allocate((uint32)sizeof(T));
+		*(T*)Allocation.Data = Data;
+		return Allocation;
+	}
+};
+
+
+// Begin/end timestamps for the work of one queue. Timestamps of all queues share the same time domain, so the ranges of
+// two instances can be compared to see how much async work overlapped
+struct FGPUTiming
+{
+	VkQueryPool QueryPool = VK_NULL_HANDLE;
+	FBufferWithMem QueryResultsBuffer;
+	SVulkan::SDevice* Device = nullptr;
+	uint64 TimestampMask = ~0ull;
+
+	void Init(SVulkan::SDevice* InDevice, struct FPendingOpsManager& PendingOpsMgr, uint32 QueueIndex);
+
+	bool IsSupported() const
+	{
+		return TimestampMask != 0;
+	}
+
+	void Destroy()
+	{
+		QueryResultsBuffer.Destroy();
+		vkDestroyQueryPool(Device->Device, QueryPool, nullptr);
+	}
+
+	// Nothing is recorded on a queue family without timestamps (timestampValidBits of 0), and the timestamps read as 0
+	void BeginTimestamp(SVulkan::FCmdBuffer* CmdBuffer)
+	{
+		if (!IsSupported())
+		{
+			return;
+		}
+		vkCmdWriteTimestamp(CmdBuffer->CmdBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, QueryPool, 0);
+	}
+
+	void EndTimestamp(SVulkan::FCmdBuffer* CmdBuffer)
+	{
+		if (!IsSupported())
+		{
+			return;
+		}
+		vkCmdWriteTimestamp(CmdBuffer->CmdBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, QueryPool, 1);
+		vkCmdCopyQueryPoolResults(CmdBuffer->CmdBuffer, QueryPool, 0, 2, QueryResultsBuffer.Buffer.Buffer, 0, sizeof(uint64), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+		vkCmdResetQueryPool(CmdBuffer->CmdBuffer, QueryPool, 0, 2);
+	}
+
+	void ReadTimestamps(uint64& OutBegin, uint64& OutEnd)
+	{
+		if (!IsSupported())
+		{
+			OutBegin = 0;
+			OutEnd = 0;
+			return;
+		}
+#if USE_VMA
+		uint64* Values;
+		vmaMapMemory(QueryResultsBuffer.Allocator, QueryResultsBuffer.Mem, (void**)&Values);
+		OutBegin = Values[0] & TimestampMask;
+		OutEnd = Values[1] & TimestampMask;
+		vmaUnmapMemory(QueryResultsBuffer.Allocator, QueryResultsBuffer.Mem);
+#else
+		uint64* Values = (uint64*)QueryResultsBuffer.Mem->MappedMem;
+		OutBegin = Values[0] & TimestampMask;
+		OutEnd = Values[1] & TimestampMask;
+#endif
+	}
+
+	double ReadTimestamp()
+	{
+		uint64 Begin, End;
+		ReadTimestamps(Begin, End);
+		return TicksToMs(End - Begin);
+	}
+
+	double TicksToMs(uint64 Ticks) const
+	{
+		return Ticks * (Device->Props.limits.timestampPeriod * 1e-6);
+	}
+};
+
+// Nested GPU timestamps for the graphics frame: every FMarkerScope recorded into the frame's command buffer between BeginFrame()
+// and EndFrame(), down to MaxDepth levels, gets a begin/end timestamp pair. Each frame uses the next query pool of the ring; it's
+// read back without waiting once its sync point has passed, and a frame that finds its pool still in flight isn't profiled
+struct FGPUProfiler
+{
+	enum
+	{
+		NumSlots = 4,
+		MaxQueries = 512,
+	};
+
+	struct FScope
+	{
+		std::string Name;
+		uint32 Depth = 0;
+		uint32 BeginQuery = 0;
+		uint32 EndQuery = 0;
+	};
+
+	struct FSlot
+	{
+		VkQueryPool QueryPool = VK_NULL_HANDLE;
+		SVulkan::FSyncPoint SyncPoint;
+		// Only the first NumScopes are used, so the names keep their memory from frame to frame
+		std::vector<FScope> Scopes;
+		uint32 NumScopes = 0;
+		uint32 NumQueries = 0;
+		uint64 Frame = 0;
+		bool bPending = false;
+	};
+	FSlot Slots[NumSlots];
+	uint32 NextSlot = 0;
+	FSlot* RecordingSlot = nullptr;
+
+	// Index into RecordingSlot->Scopes of every open FMarkerScope, ~0u for the ones not being timed
+	std::vector<uint32> OpenScopes;
+	uint32 MaxDepth = 2;
+
+	SVulkan::SDevice* Device = nullptr;
+	uint64 TimestampMask = 0;
+	uint64 NumFrames = 0;
+	std::vector<uint64> Timestamps;
+
+	struct FResult
+	{
+		std::string Name;
+		uint32 Depth = 0;
+		double Ms = 0;
+	};
+	// Latest frame read back; in the order the scopes began so every parent comes before its children, the root "Frame" first
+	std::vector<FResult> Results;
+	uint64 ResultsFrame = 0;
+
+	struct
+	{
+		uint32 NumSkippedFrames = 0;
+		uint32 NumDroppedScopes = 0;
+	} Stats;
+
+	void Init(SVulkan::SDevice* InDevice)
+	{
+		Device = InDevice;
+		uint32 ValidBits = Device->QueueFamilyProps[Device->GfxQueueIndex].timestampValidBits;
+		TimestampMask = ValidBits >= 64 ? ~0ull : ((1ull << ValidBits) - 1);
+		if (!IsSupported())
+		{
+			return;
+		}
+
+		VkQueryPoolCreateInfo PoolCreateInfo;
+		ZeroVulkanMem(PoolCreateInfo, VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO);
+		PoolCreateInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		PoolCreateInfo.queryCount = MaxQueries;
+		for (FSlot& Slot : Slots)
+		{
+			VERIFY_VKRESULT(vkCreateQueryPool(Device->Device, &PoolCreateInfo, nullptr, &Slot.QueryPool));
+		}
+	}
+
+	void Destroy()
+	{
+		for (FSlot& Slot : Slots)
+		{
+			vkDestroyQueryPool(Device->Device, Slot.QueryPool, nullptr);
+			Slot.QueryPool = VK_NULL_HANDLE;
+		}
+	}
+
+	bool IsSupported() const
+	{
+		return TimestampMask != 0;
+	}
+
+	// Whole frame time of the latest results
+	double GetFrameMs() const
+	{
+		return Results.empty() ? 0 : Results[0].Ms;
+	}
+
+	// Has to be called outside a render pass, before anything else is recorded
+	void BeginFrame(SVulkan::FCmdBuffer* CmdBuffer)
+	{
+		check(!RecordingSlot && CmdBuffer->IsOutsideRenderPass());
+		++NumFrames;
+		ReadResults();
+		if (!IsSupported())
+		{
+			return;
+		}
+
+		FSlot& Slot = Slots[NextSlot];
+		if (Slot.bPending)
+		{
+			++Stats.NumSkippedFrames;
+			return;
+		}
+		NextSlot = (NextSlot + 1) % NumSlots;
+
+		Slot.NumScopes = 0;
+		Slot.NumQueries = 0;
+		Slot.Frame = NumFrames;
+		vkCmdResetQueryPool(CmdBuffer->CmdBuffer, Slot.QueryPool, 0, MaxQueries);
+		RecordingSlot = &Slot;
+		CmdBuffer->Profiler = this;
+		BeginScope(CmdBuffer, "Frame");
+	}
+
+	// Right before CmdBuffer->End(); every FMarkerScope has to be closed by then
+	void EndFrame(SVulkan::FCmdBuffer* CmdBuffer)
+	{
+		if (!RecordingSlot)
+		{
+			return;
+		}
+
+		check(CmdBuffer->Profiler == this);
+		EndScope(CmdBuffer);
+		check(OpenScopes.empty());
+		RecordingSlot->SyncPoint = CmdBuffer->GetSyncPoint();
+		RecordingSlot->bPending = true;
+		RecordingSlot = nullptr;
+		CmdBuffer->Profiler = nullptr;
+	}
+
+	void BeginScope(SVulkan::FCmdBuffer* CmdBuffer, const char* Name)
+	{
+		FSlot& Slot = *RecordingSlot;
+		if (OpenScopes.size() >= MaxDepth || Slot.NumQueries + 2 > MaxQueries)
+		{
+			if (OpenScopes.size() < MaxDepth)
+			{
+				++Stats.NumDroppedScopes;
+			}
+			OpenScopes.push_back(~0u);
+			return;
+		}
+
+		if (Slot.NumScopes == Slot.Scopes.size())
+		{
+			Slot.Scopes.emplace_back();
+		}
+		FScope& Scope = Slot.Scopes[Slot.NumScopes];
+		Scope.Name = Name;
+		Scope.Depth = (uint32)OpenScopes.size();
+		Scope.BeginQuery = Slot.NumQueries++;
+		Scope.EndQuery = Slot.NumQueries++;
+		vkCmdWriteTimestamp(CmdBuffer->CmdBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, Slot.QueryPool, Scope.BeginQuery);
+		OpenScopes.push_back(Slot.NumScopes++);
+	}
+
+	void EndScope(SVulkan::FCmdBuffer* CmdBuffer)
+	{
+		check(!OpenScopes.empty());
+		uint32 ScopeIndex = OpenScopes.back();
+		OpenScopes.pop_back();
+		if (ScopeIndex != ~0u)
+		{
+			vkCmdWriteTimestamp(CmdBuffer->CmdBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, RecordingSlot->QueryPool, RecordingSlot->Scopes[ScopeIndex].EndQuery);
+		}
+	}
+
+	// Picks up every frame the GPU has finished since the last call and keeps the newest
+	void ReadResults()
+	{
+		for (FSlot& Slot : Slots)
+		{
+			if (!Slot.bPending || !Slot.SyncPoint.IsComplete())
+			{
+				continue;
+			}
 
-inline void SVulkan::FCmdBuffer::BeginRenderPass(FFramebuffer* Framebuffer)
+			Slot.bPending = false;
+			if (Slot.Frame < ResultsFrame)
+			{
+				continue;
+			}
+
+			Timestamps.resize(Slot.NumQueries);
+			VkResult Result = vkGetQueryPoolResults(Device->Device, Slot.QueryPool, 0, Slot.NumQueries, Timestamps.size() * sizeof(uint64), Timestamps.data(), sizeof(uint64), VK_QUERY_RESULT_64_BIT);
+			if (Result != VK_SUCCESS)
+			{
+				continue;
+			}
+
+			Results.resize(Slot.NumScopes);
+			for (uint32 Index = 0; Index < Slot.NumScopes; ++Index)
+			{
+				const FScope& Scope = Slot.Scopes[Index];
+				uint64 Ticks = ((Timestamps[Scope.EndQuery] & TimestampMask) - (Timestamps[Scope.BeginQuery] & TimestampMask)) & TimestampMask;
+				Results[Index].Name = Scope.Name;
+				Results[Index].Depth = Scope.Depth;
+				Results[Index].Ms = Ticks * (Device->Props.limits.timestampPeriod * 1e-6);
+			}
+			ResultsFrame = Slot.Frame;
+		}
+	}
+};
+
+inline void FMarkerScope::BeginProfilerScope(const char* Name)
+{
+	ProfiledCmdBuffer->Profiler->BeginScope(ProfiledCmdBuffer, Name);
+}
+
+inline void FMarkerScope::EndProfilerScope()
+{
+	ProfiledCmdBuffer->Profiler->EndScope(ProfiledCmdBuffer);
+}
+
+inline void SVulkan::FCmdBuffer::BeginRenderPass(FFramebuffer* Framebuffer, VkSubpassContents Contents)
 {
 	check(State == EState::Begun);
 	VkRenderPassBeginInfo Info;
@@ -2868,7 +4926,27 @@ inline void SVulkan::FCmdBuffer::BeginRenderPass(FFramebuffer* Framebuffer)
 	Info.framebuffer = Framebuffer->Framebuffer;
 	Info.clearValueCount = Framebuffer->GetClearCount();
 	Info.pClearValues = Framebuffer->GetClearValues();
-	vkCmdBeginRenderPass(CmdBuffer, &Info, VK_SUBPASS_CONTENTS_INLINE);
+	vkCmdBeginRenderPass(CmdBuffer, &Info, Contents);
+	State = EState::InRenderPass;
+}
+
+inline void SVulkan::FCmdBuffer::BeginSecondary(const FCmdBuffer* Primary, FFramebuffer* Framebuffer)
+{
+	check(bSecondary && State == EState::Available);
+	check(!Primary->bSecondary && Primary->State != EState::Available);
+	Timeline = Primary->Timeline;
+	TimelineValue = Primary->TimelineValue;
+
+	VkCommandBufferInheritanceInfo InheritanceInfo;
+	ZeroVulkanMem(InheritanceInfo, VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO);
+	InheritanceInfo.renderPass = Framebuffer->RenderPass->RenderPass;
+	InheritanceInfo.framebuffer = Framebuffer->Framebuffer;
+
+	VkCommandBufferBeginInfo Info;
+	ZeroVulkanMem(Info, VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO);
+	Info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+	Info.pInheritanceInfo = &InheritanceInfo;
+	VERIFY_VKRESULT(vkBeginCommandBuffer(CmdBuffer, &Info));
 	State = EState::InRenderPass;
 }
 
@@ -2884,6 +4962,7 @@ struct FPendingOpsManager
 			ECopyBufferToImage,
 			EUpdateBuffer,
 			EResetQueryPool,
+			EMemoryBarrier,
 		};
 
 		OpType Op = EInvalid;
@@ -2893,8 +4972,10 @@ struct FPendingOpsManager
 			FStagingBuffer* SrcStaging = nullptr;
 			VkBuffer Dest = VK_NULL_HANDLE;
 			uint32 Size = 0;
-			//uint32 SrcOffset = 0;
-			//uint32 DestOffset = 0;
+			uint32 SrcOffset = 0;
+			uint32 DestOffset = 0;
+			// When not empty, used instead of Size and the offsets
+			std::vector<VkBufferCopy> Regions;
 		};
 		FCopyBuffer Copy;
 
@@ -2928,6 +5009,15 @@ struct FPendingOpsManager
 		};
 		FResetQueryPool ResetQueryPool;
 
+		struct FMemoryBarrier
+		{
+			VkPipelineStageFlags SrcStage = 0;
+			VkAccessFlags SrcAccess = 0;
+			VkPipelineStageFlags DestStage = 0;
+			VkAccessFlags DestAccess = 0;
+		};
+		FMemoryBarrier Barrier;
+
 		void Exec(SVulkan::SDevice& Device, SVulkan::FCmdBuffer* CmdBuffer)
 		{
 			switch (Op)
@@ -2939,14 +5029,20 @@ struct FPendingOpsManager
 				break;
 			case ECopyBuffers:
 			{
-				VkBufferCopy Region;
-				ZeroMem(Region);
-				Region.size = Copy.Size;
-				Region.srcOffset = 0;//Copy.SrcOffset;
-				Region.dstOffset = 0;//Copy.DestOffset;
-				vkCmdCopyBuffer(CmdBuffer->CmdBuffer, Copy.SrcStaging->Buffer->Buffer.Buffer, Copy.Dest, 1, &Region);
-				Copy.SrcStaging->CmdBuffer = CmdBuffer;
-				Copy.SrcStaging->Fence = CmdBuffer->LastSubmittedFence;
+				if (Copy.Regions.empty())
+				{
+					VkBufferCopy Region;
+					ZeroMem(Region);
+					Region.size = Copy.Size;
+					Region.srcOffset = Copy.SrcOffset;
+					Region.dstOffset = Copy.DestOffset;
+					vkCmdCopyBuffer(CmdBuffer->CmdBuffer, Copy.SrcStaging->Buffer->Buffer.Buffer, Copy.Dest, 1, &Region);
+				}
+				else
+				{
+					vkCmdCopyBuffer(CmdBuffer->CmdBuffer, Copy.SrcStaging->Buffer->Buffer.Buffer, Copy.Dest, (uint32)Copy.Regions.size(), Copy.Regions.data());
+				}
+				Copy.SrcStaging->SyncPoint = CmdBuffer->GetSyncPoint();
 			}
 				break;
 			case ECopyBufferToImage:
@@ -2980,8 +5076,7 @@ struct FPendingOpsManager
 						CopyImage.Aspect);
 				}
 
-				CopyImage.SrcStaging->CmdBuffer = CmdBuffer;
-				CopyImage.SrcStaging->Fence = CmdBuffer->LastSubmittedFence;
+				CopyImage.SrcStaging->SyncPoint = CmdBuffer->GetSyncPoint();
 			}
 				break;
 			case EUpdateBuffer:
@@ -2989,6 +5084,15 @@ struct FPendingOpsManager
 				vkCmdUpdateBuffer(CmdBuffer->CmdBuffer, Update.Dest, Update.Offset, Update.Size, Update.Data.data());
 			}
 				break;
+			case EMemoryBarrier:
+			{
+				VkMemoryBarrier MemoryBarrier;
+				ZeroVulkanMem(MemoryBarrier, VK_STRUCTURE_TYPE_MEMORY_BARRIER);
+				MemoryBarrier.srcAccessMask = Barrier.SrcAccess;
+				MemoryBarrier.dstAccessMask = Barrier.DestAccess;
+				vkCmdPipelineBarrier(CmdBuffer->CmdBuffer, Barrier.SrcStage, Barrier.DestStage, 0, 1, &MemoryBarrier, 0, nullptr, 0, nullptr);
+			}
+				break;
 
 			default:
 				check(0);
@@ -3008,17 +5112,33 @@ struct FPendingOpsManager
 		}
 	}
 
-	void AddCopyBuffers(FStagingBuffer* SrcBuffer, SVulkan::FBuffer* DestBuffer)
+	// Size 0 copies the whole staging buffer. Nothing waits on the copy; add a barrier after a batch of them
+	void AddCopyBuffers(FStagingBuffer* SrcBuffer, SVulkan::FBuffer* DestBuffer, uint32 Size = 0, uint32 SrcOffset = 0, uint32 DestOffset = 0)
 	{
 		FPendingOp Op;
 		Op.Op = FPendingOp::ECopyBuffers;
 		Op.Copy.SrcStaging = SrcBuffer;
 		Op.Copy.Dest = DestBuffer->Buffer;
-		Op.Copy.Size = SrcBuffer->Buffer->Size;
+		Op.Copy.Size = Size ? Size : SrcBuffer->Size;
+		Op.Copy.SrcOffset = SrcOffset;
+		Op.Copy.DestOffset = DestOffset;
 
 		Ops.push_back(Op);
 	}
 
+	// Many ranges of one staging buffer into one buffer with a single vkCmdCopyBuffer
+	void AddCopyBufferRegions(FStagingBuffer* SrcBuffer, SVulkan::FBuffer* DestBuffer, std::vector<VkBufferCopy>&& Regions)
+	{
+		check(!Regions.empty());
+		FPendingOp Op;
+		Op.Op = FPendingOp::ECopyBuffers;
+		Op.Copy.SrcStaging = SrcBuffer;
+		Op.Copy.Dest = DestBuffer->Buffer;
+		Op.Copy.Regions = std::move(Regions);
+
+		Ops.push_back(std::move(Op));
+	}
+
 	void AddResetQueryPool(VkQueryPool Pool, uint32 FirstQuery, uint32 NumQueries)
 	{
 		FPendingOp Op;
@@ -3060,9 +5180,335 @@ struct FPendingOpsManager
 		Ops.push_back(Op);
 	}
 
+	void AddMemoryBarrier(VkPipelineStageFlags SrcStage, VkAccessFlags SrcAccess, VkPipelineStageFlags DestStage, VkAccessFlags DestAccess)
+	{
+		FPendingOp Op;
+		Op.Op = FPendingOp::EMemoryBarrier;
+		Op.Barrier.SrcStage = SrcStage;
+		Op.Barrier.SrcAccess = SrcAccess;
+		Op.Barrier.DestStage = DestStage;
+		Op.Barrier.DestAccess = DestAccess;
+
+		Ops.push_back(Op);
+	}
+
 	std::vector<FPendingOp> Ops;
 };
 
+// Streams texture data in on the transfer queue: a worker thread fills a staging buffer and records the copies for a batch
+// of images, and the main thread submits the batches in Tick(). Once a batch has finished, its images move over to the
+// graphics queue (a queue family ownership transfer if the families differ) and get their mips built at the start of a frame.
+// It has its own timeline, so the worker never touches the ones the rest of the device uses
+struct FTextureUploader
+{
+	enum
+	{
+		MaxBatchImages = 16,
+		MaxBatchBytes = 64 * 1024 * 1024,
+	};
+
+	struct FRequest
+	{
+		VkImage Image = VK_NULL_HANDLE;
+		uint32 Width = 0;
+		uint32 Height = 0;
+		uint32 NumMips = 1;
+		// RGBA8, Width * Height texels
+		std::vector<uint8> Data;
+	};
+
+	struct FBatch
+	{
+		std::vector<FRequest> Requests;
+		FBufferWithMem Staging;
+		SVulkan::FCmdBuffer* CmdBuffer = nullptr;
+		SVulkan::FSyncPoint SyncPoint;
+	};
+
+	SVulkan::SDevice* Device = nullptr;
+	SVulkan::FTimeline Timeline;
+	SVulkan::FCommandPool CmdPool;
+
+	// Mutex guards everything below, and the command pool and timeline while the worker is between batches
+	std::mutex Mutex;
+	std::condition_variable RequestAdded;
+	std::deque<FRequest> Requests;
+	std::deque<FBatch*> Recorded;
+	std::deque<FBatch*> Submitted;
+	uint32 NumPending = 0;
+	bool bQuit = false;
+	std::thread Thread;
+
+	struct
+	{
+		uint64 NumImages = 0;
+		uint64 NumBatches = 0;
+		uint64 NumBytes = 0;
+	} Stats;
+
+	void Init(SVulkan::SDevice* InDevice)
+	{
+		Device = InDevice;
+		Timeline.Create(Device->Device);
+		CmdPool.Create(Device->Device, Device->TransferQueueIndex, &Timeline);
+		Thread = std::thread(&FTextureUploader::WorkerLoop, this);
+	}
+
+	// Only once the device is idle
+	void Destroy()
+	{
+		{
+			std::lock_guard<std::mutex> Lock(Mutex);
+			bQuit = true;
+		}
+		RequestAdded.notify_one();
+		Thread.join();
+
+		for (std::deque<FBatch*>* Batches : {&Recorded, &Submitted})
+		{
+			for (FBatch* Batch : *Batches)
+			{
+				Batch->Staging.Destroy();
+				delete Batch;
+			}
+			Batches->clear();
+		}
+		Requests.clear();
+		CmdPool.Destroy();
+		Timeline.Destroy();
+	}
+
+	// Image has to be created with TRANSFER_SRC | TRANSFER_DST | SAMPLED and NumMips levels; it ends up in SHADER_READ_ONLY_OPTIMAL
+	void AddTexture(VkImage Image, uint32 Width, uint32 Height, uint32 NumMips, std::vector<uint8>&& Data)
+	{
+		check(Data.size() >= Width * Height * sizeof(uint32));
+		FRequest Request;
+		Request.Image = Image;
+		Request.Width = Width;
+		Request.Height = Height;
+		Request.NumMips = NumMips;
+		Request.Data = std::move(Data);
+		{
+			std::lock_guard<std::mutex> Lock(Mutex);
+			Requests.push_back(std::move(Request));
+			++NumPending;
+		}
+		RequestAdded.notify_one();
+	}
+
+	// Images not yet usable by the graphics queue
+	uint32 GetNumPending()
+	{
+		std::lock_guard<std::mutex> Lock(Mutex);
+		return NumPending;
+	}
+
+	// Main thread, once per frame; GfxCmdBuffer has to be outside a render pass
+	void Tick(SVulkan::FCmdBuffer* GfxCmdBuffer)
+	{
+		std::deque<FBatch*> Finished;
+		{
+			std::lock_guard<std::mutex> Lock(Mutex);
+			while (!Recorded.empty())
+			{
+				FBatch* Batch = Recorded.front();
+				Recorded.pop_front();
+				Device->Submit(Device->TransferQueue, Batch->CmdBuffer, 0, VK_NULL_HANDLE, VK_NULL_HANDLE);
+				Submitted.push_back(Batch);
+			}
+
+			if (Submitted.empty())
+			{
+				return;
+			}
+
+			Timeline.Refresh();
+			while (!Submitted.empty() && Submitted.front()->SyncPoint.IsComplete())
+			{
+				Finished.push_back(Submitted.front());
+				Submitted.pop_front();
+			}
+		}
+
+		for (FBatch* Batch : Finished)
+		{
+			for (FRequest& Request : Batch->Requests)
+			{
+				AcquireAndGenerateMips(GfxCmdBuffer, Request);
+			}
+			// The transfer queue is done with it
+			Batch->Staging.Destroy();
+
+			std::lock_guard<std::mutex> Lock(Mutex);
+			NumPending -= (uint32)Batch->Requests.size();
+			delete Batch;
+		}
+	}
+
+	bool IsSeparateQueueFamily() const
+	{
+		return Device->TransferQueueIndex != Device->GfxQueueIndex;
+	}
+
+	VkImageMemoryBarrier GetOwnershipBarrier(VkImage Image, VkAccessFlags SrcAccessMask, VkAccessFlags DestAccessMask) const
+	{
+		VkImageMemoryBarrier Barrier;
+		ZeroVulkanMem(Barrier, VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER);
+		Barrier.srcAccessMask = SrcAccessMask;
+		Barrier.dstAccessMask = DestAccessMask;
+		Barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		Barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		Barrier.srcQueueFamilyIndex = IsSeparateQueueFamily() ? Device->TransferQueueIndex : VK_QUEUE_FAMILY_IGNORED;
+		Barrier.dstQueueFamilyIndex = IsSeparateQueueFamily() ? Device->GfxQueueIndex : VK_QUEUE_FAMILY_IGNORED;
+		Barrier.image = Image;
+		Barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		Barrier.subresourceRange.layerCount = 1;
+		Barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+		return Barrier;
+	}
+
+	void RecordCopy(SVulkan::FCmdBuffer* CmdBuffer, const FRequest& Request, VkBuffer Staging, VkDeviceSize Offset)
+	{
+		Device->TransitionImage(CmdBuffer, Request.Image,
+			VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_IMAGE_LAYOUT_UNDEFINED, 0,
+			VK_PIPELINE_STAGE_TRANSFER_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_ACCESS_TRANSFER_WRITE_BIT,
+			VK_IMAGE_ASPECT_COLOR_BIT);
+
+		VkBufferImageCopy Region;
+		ZeroMem(Region);
+		Region.bufferOffset = Offset;
+		Region.imageExtent.width = Request.Width;
+		Region.imageExtent.height = Request.Height;
+		Region.imageExtent.depth = 1;
+		Region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		Region.imageSubresource.layerCount = 1;
+		vkCmdCopyBufferToImage(CmdBuffer->CmdBuffer, Staging, Request.Image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &Region);
+
+		// Release half of the ownership transfer; with a shared family it only orders the copy
+		VkImageMemoryBarrier Barrier = GetOwnershipBarrier(Request.Image, VK_ACCESS_TRANSFER_WRITE_BIT, 0);
+		vkCmdPipelineBarrier(CmdBuffer->CmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &Barrier);
+	}
+
+	void AcquireAndGenerateMips(SVulkan::FCmdBuffer* CmdBuffer, const FRequest& Request)
+	{
+		VkImageMemoryBarrier Barrier = GetOwnershipBarrier(Request.Image, IsSeparateQueueFamily() ? 0 : VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT);
+		vkCmdPipelineBarrier(CmdBuffer->CmdBuffer, IsSeparateQueueFamily() ? VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT : VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &Barrier);
+
+		// All mips in DST
+		uint32 Width = Request.Width;
+		uint32 Height = Request.Height;
+		for (uint32 Mip = 1; Mip < Request.NumMips; ++Mip)
+		{
+			// Prev mip to SRC
+			Device->TransitionImage(CmdBuffer, Request.Image,
+				VK_PIPELINE_STAGE_TRANSFER_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_ACCESS_TRANSFER_WRITE_BIT,
+				VK_PIPELINE_STAGE_TRANSFER_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_ACCESS_TRANSFER_READ_BIT,
+				VK_IMAGE_ASPECT_COLOR_BIT, Mip - 1, 1);
+			VkImageBlit Region;
+			ZeroMem(Region);
+			Region.srcOffsets[1].x = Width;
+			Region.srcOffsets[1].y = Height;
+			Region.srcOffsets[1].z = 1;
+			Width = Max(Width >> 1, 1u);
+			Height = Max(Height >> 1, 1u);
+			Region.dstOffsets[1].x = Width;
+			Region.dstOffsets[1].y = Height;
+			Region.dstOffsets[1].z = 1;
+			Region.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			Region.srcSubresource.mipLevel = Mip - 1;
+			Region.srcSubresource.layerCount = 1;
+			Region.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			Region.dstSubresource.mipLevel = Mip;
+			Region.dstSubresource.layerCount = 1;
+			vkCmdBlitImage(CmdBuffer->CmdBuffer, Request.Image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+				Request.Image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &Region, VK_FILTER_LINEAR);
+
+			// Prev mip to DST
+			Device->TransitionImage(CmdBuffer, Request.Image,
+				VK_PIPELINE_STAGE_TRANSFER_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_ACCESS_TRANSFER_READ_BIT,
+				VK_PIPELINE_STAGE_TRANSFER_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_ACCESS_TRANSFER_WRITE_BIT,
+				VK_IMAGE_ASPECT_COLOR_BIT, Mip - 1, 1);
+		}
+
+		// All mips to READ
+		Device->TransitionImage(CmdBuffer, Request.Image,
+			VK_PIPELINE_STAGE_TRANSFER_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_ACCESS_TRANSFER_WRITE_BIT,
+			VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_ACCESS_SHADER_READ_BIT,
+			VK_IMAGE_ASPECT_COLOR_BIT);
+	}
+
+	// Takes requests up to the batch limits; always at least one so an oversized image still goes through
+	FBatch* TakeBatch(std::unique_lock<std::mutex>& Lock)
+	{
+		RequestAdded.wait(Lock, [this]() { return bQuit || !Requests.empty(); });
+		if (bQuit)
+		{
+			return nullptr;
+		}
+
+		FBatch* Batch = new FBatch;
+		uint64 NumBytes = 0;
+		while (!Requests.empty() && Batch->Requests.size() < MaxBatchImages)
+		{
+			uint64 Size = Requests.front().Width * Requests.front().Height * sizeof(uint32);
+			if (!Batch->Requests.empty() && NumBytes + Size > MaxBatchBytes)
+			{
+				break;
+			}
+			NumBytes += Size;
+			Batch->Requests.push_back(std::move(Requests.front()));
+			Requests.pop_front();
+		}
+		return Batch;
+	}
+
+	void WorkerLoop()
+	{
+		for (;;)
+		{
+			FBatch* Batch = nullptr;
+			{
+				std::unique_lock<std::mutex> Lock(Mutex);
+				Batch = TakeBatch(Lock);
+				if (!Batch)
+				{
+					break;
+				}
+				Batch->CmdBuffer = CmdPool.Begin();
+				Batch->SyncPoint = Batch->CmdBuffer->GetSyncPoint();
+			}
+
+			std::vector<VkDeviceSize> Offsets;
+			VkDeviceSize Size = 0;
+			for (FRequest& Request : Batch->Requests)
+			{
+				// Offsets into the staging buffer need texel alignment
+				Offsets.push_back(Size);
+				Size += Request.Width * Request.Height * sizeof(uint32);
+			}
+			Batch->Staging.Create(*Device, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, EMemLocation::CPU, (uint32)Size, true);
+			Device->SetDebugName(Batch->Staging.Buffer.Buffer, "UploadStaging");
+
+			uint8* Data = (uint8*)Batch->Staging.Lock();
+			for (uint32 Index = 0; Index < (uint32)Batch->Requests.size(); ++Index)
+			{
+				FRequest& Request = Batch->Requests[Index];
+				memcpy(Data + Offsets[Index], Request.Data.data(), Request.Width * Request.Height * sizeof(uint32));
+				std::vector<uint8>().swap(Request.Data);
+				RecordCopy(Batch->CmdBuffer, Request, Batch->Staging.Buffer.Buffer, Offsets[Index]);
+			}
+			Batch->Staging.Unlock();
+			Batch->CmdBuffer->End();
+
+			std::lock_guard<std::mutex> Lock(Mutex);
+			Stats.NumImages += Batch->Requests.size();
+			Stats.NumBytes += Size;
+			++Stats.NumBatches;
+			Recorded.push_back(Batch);
+		}
+	}
+};
+
 inline bool operator < (const FPSOCache::FPSOHandle& A, const FPSOCache::FPSOHandle& B)
 {
 	return A.Index < B.Index;
@@ -3070,12 +5516,36 @@ inline bool operator < (const FPSOCache::FPSOHandle& A, const FPSOCache::FPSOHan
 
 struct FDescriptorPSOCache
 {
+	enum
+	{
+		MaxWrites = 16,
+	};
+
 	SVulkan::FPSO* PSO;
 	SVulkan::FComputePSO* ComputePSO = nullptr;
 	SVulkan::FGfxPSO* GfxPSO = nullptr;
-	std::vector<VkWriteDescriptorSet> Writes;
-	std::vector<VkDescriptorImageInfo> Images;
-	std::vector<VkDescriptorBufferInfo> Buffers;
+
+	// Fixed size so setting up a draw doesn't touch the heap; the object lives on the stack for one UpdateDescriptors()
+	VkWriteDescriptorSet Writes[MaxWrites];
+	VkDescriptorImageInfo Images[MaxWrites];
+	VkDescriptorBufferInfo Buffers[MaxWrites];
+	// Vulkan wants the offsets ordered by set, then by binding
+	struct FDynamicOffset
+	{
+		uint32 Set;
+		uint32 Binding;
+		uint32 Offset;
+
+		bool operator < (const FDynamicOffset& Other) const
+		{
+			return Set != Other.Set ? Set < Other.Set : Binding < Other.Binding;
+		}
+	};
+	FDynamicOffset DynamicOffsets[MaxWrites];
+	uint32 NumWrites = 0;
+	uint32 NumImages = 0;
+	uint32 NumBuffers = 0;
+	uint32 NumDynamicOffsets = 0;
 	bool bFinalized = false;
 
 	FDescriptorPSOCache(SVulkan::FComputePSO* InPSO)
@@ -3090,127 +5560,118 @@ struct FDescriptorPSOCache
 	{
 	}
 
-	void SetUniformBuffer(const char* Name, FBufferWithMem& Buffer)
+	// Writes point into this object's own Images/Buffers, so a copy would point into the original
+	FDescriptorPSOCache(const FDescriptorPSOCache&) = delete;
+	FDescriptorPSOCache& operator = (const FDescriptorPSOCache&) = delete;
+
+	void SetUniformBuffer(FShaderParameter Parameter, VkBuffer Buffer, uint32 Offset, uint32 Size)
 	{
 		check(!bFinalized);
-		uint32 Binding = UINT32_MAX;
-		VkDescriptorType Type = VK_DESCRIPTOR_TYPE_MAX_ENUM;
-		bool bFound = GetParameter(Name, Binding, Type);
-		if (bFound)
-		{
-			check(Type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER || Type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC);
-			VkWriteDescriptorSet Write;
-			ZeroVulkanMem(Write, VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET);
-			Write.descriptorCount = 1;
-			Write.dstBinding = Binding;
-			Write.descriptorType = Type;
-			VkDescriptorBufferInfo BInfo;
-			ZeroMem(BInfo);
-			BInfo.buffer = Buffer.Buffer.Buffer;
-			BInfo.range = Buffer.Size;
-			Write.pBufferInfo = (VkDescriptorBufferInfo*)Buffers.size();
-			Buffers.push_back(BInfo);
-			Writes.push_back(Write);
+		if (Parameter.IsValid())
+		{
+			const SVulkan::FPSO::FParameterSlot& Slot = PSO->ParameterSlots[Parameter.Slot];
+			check(Slot.Type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER || Slot.Type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC);
+			VkDescriptorBufferInfo& BInfo = AddBufferInfo();
+			BInfo.buffer = Buffer;
+			BInfo.range = Size;
+			if (Slot.Type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC)
+			{
+				check(NumDynamicOffsets < MaxWrites);
+				DynamicOffsets[NumDynamicOffsets++] = {Slot.Set, Slot.Binding, Offset};
+			}
+			else
+			{
+				BInfo.offset = Offset;
+			}
+			AddWrite(Slot).pBufferInfo = &BInfo;
 		}
 	}
 
-	void SetTexelBuffer(const char* Name, FBufferWithMemAndView& Buffer)
+	inline void SetUniformBuffer(FShaderParameter Parameter, FBufferWithMem& Buffer)
+	{
+		Buffer.bUsedByDescriptors = true;
+		SetUniformBuffer(Parameter, Buffer.Buffer.Buffer, 0, Buffer.Size);
+	}
+
+	inline void SetUniformBuffer(FShaderParameter Parameter, const FRingAllocation& Allocation)
+	{
+		SetUniformBuffer(Parameter, Allocation.Buffer, Allocation.Offset, Allocation.Size);
+	}
+
+	void SetTexelBuffer(FShaderParameter Parameter, FBufferWithMemAndView& Buffer)
 	{
 		check(!bFinalized);
-		uint32 Binding = UINT32_MAX;
-		VkDescriptorType Type = VK_DESCRIPTOR_TYPE_MAX_ENUM;
-		bool bFound = GetParameter(Name, Binding, Type);
-		if (bFound)
+		if (Parameter.IsValid())
 		{
-			check(Type == VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER || Type == VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER);
-			VkWriteDescriptorSet Write;
-			ZeroVulkanMem(Write, VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET);
-			Write.descriptorCount = 1;
-			Write.dstBinding = Binding;
-			Write.descriptorType = Type;
-			Write.pTexelBufferView = &Buffer.View;
-			Writes.push_back(Write);
+			const SVulkan::FPSO::FParameterSlot& Slot = PSO->ParameterSlots[Parameter.Slot];
+			check(Slot.Type == VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER || Slot.Type == VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER);
+			Buffer.bUsedByDescriptors = true;
+			AddWrite(Slot).pTexelBufferView = &Buffer.View;
 		}
 	}
 
-	void SetSampler(const char* Name, VkSampler Sampler)
+	void SetSampler(FShaderParameter Parameter, VkSampler Sampler)
 	{
 		check(!bFinalized);
-		uint32 Binding = UINT32_MAX;
-		VkDescriptorType Type = VK_DESCRIPTOR_TYPE_MAX_ENUM;
-		bool bFound = GetParameter(Name, Binding, Type);
-		if (bFound)
-		{
-			check(Type == VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER || Type == VK_DESCRIPTOR_TYPE_SAMPLER);
-			VkWriteDescriptorSet Write;
-			ZeroVulkanMem(Write, VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET);
-			Write.descriptorCount = 1;
-			Write.dstBinding = Binding;
-			Write.descriptorType = Type;
-			VkDescriptorImageInfo IInfo;
-			ZeroMem(IInfo);
-			IInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		if (Parameter.IsValid())
+		{
+			const SVulkan::FPSO::FParameterSlot& Slot = PSO->ParameterSlots[Parameter.Slot];
+			check(Slot.Type == VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER || Slot.Type == VK_DESCRIPTOR_TYPE_SAMPLER);
+			VkDescriptorImageInfo& IInfo = AddImageInfo();
 			IInfo.sampler = Sampler;
-			Write.pImageInfo = (VkDescriptorImageInfo*)Images.size();
-			Images.push_back(IInfo);
-			Writes.push_back(Write);
+			AddWrite(Slot).pImageInfo = &IInfo;
 		}
 	}
 
-	void SetImage(const char* Name, FImageWithMemAndView& Image, VkSampler Sampler)
+	void SetImage(FShaderParameter Parameter, FImageWithMemAndView& Image, VkSampler Sampler)
 	{
 		check(!bFinalized);
-		uint32 Binding = UINT32_MAX;
-		VkDescriptorType Type = VK_DESCRIPTOR_TYPE_MAX_ENUM;
-		bool bFound = GetParameter(Name, Binding, Type);
-		if (bFound)
-		{
-			check(Type == VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER || Type == VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE);
-			VkWriteDescriptorSet Write;
-			ZeroVulkanMem(Write, VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET);
-			Write.descriptorCount = 1;
-			Write.dstBinding = Binding;
-			Write.descriptorType = Type;
-			VkDescriptorImageInfo IInfo;
-			ZeroMem(IInfo);
-			IInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		if (Parameter.IsValid())
+		{
+			const SVulkan::FPSO::FParameterSlot& Slot = PSO->ParameterSlots[Parameter.Slot];
+			check(Slot.Type == VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER || Slot.Type == VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE);
+			VkDescriptorImageInfo& IInfo = AddImageInfo();
 			IInfo.sampler = Sampler;
 			IInfo.imageView = Image.View;
-			Write.pImageInfo = (VkDescriptorImageInfo*)Images.size();
-			Images.push_back(IInfo);
-			Writes.push_back(Write);
+			Image.bUsedByDescriptors = true;
+			AddWrite(Slot).pImageInfo = &IInfo;
 		}
 	}
 
+	// By name; resolving a FShaderParameter up front avoids the lookup
+	inline void SetUniformBuffer(const char* Name, VkBuffer Buffer, uint32 Offset, uint32 Size)
+	{
+		SetUniformBuffer(GetParameter(Name), Buffer, Offset, Size);
+	}
+
+	inline void SetUniformBuffer(const char* Name, FBufferWithMem& Buffer)
+	{
+		SetUniformBuffer(GetParameter(Name), Buffer);
+	}
+
+	inline void SetUniformBuffer(const char* Name, const FRingAllocation& Allocation)
+	{
+		SetUniformBuffer(GetParameter(Name), Allocation);
+	}
+
+	inline void SetTexelBuffer(const char* Name, FBufferWithMemAndView& Buffer)
+	{
+		SetTexelBuffer(GetParameter(Name), Buffer);
+	}
+
+	inline void SetSampler(const char* Name, VkSampler Sampler)
+	{
+		SetSampler(GetParameter(Name), Sampler);
+	}
+
+	inline void SetImage(const char* Name, FImageWithMemAndView& Image, VkSampler Sampler)
+	{
+		SetImage(GetParameter(Name), Image, Sampler);
+	}
+
 	void Finalize()
 	{
 		check(!bFinalized);
-		for (auto& Write : Writes)
-		{
-			switch (Write.descriptorType)
-			{
-			case VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER:
-			case VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE:
-			case VK_DESCRIPTOR_TYPE_SAMPLER:
-			case VK_DESCRIPTOR_TYPE_STORAGE_IMAGE:
-			case VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT:
-				Write.pImageInfo = &Images[(uint32)(uint64)Write.pImageInfo];
-				break;
-			case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER:
-			case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC:
-			case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER:
-			case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC:
-				Write.pBufferInfo = &Buffers[(uint32)(uint64)Write.pBufferInfo];
-				break;
-			case VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER:
-			case VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER:
-				// No-op
-				break;
-			default:
-				check(0);
-				break;
-			}
-		}
 		bFinalized = true;
 	}
 
@@ -3218,16 +5679,52 @@ struct FDescriptorPSOCache
 	{
 		Finalize();
 		check(bFinalized);
+
+		std::sort(DynamicOffsets, DynamicOffsets + NumDynamicOffsets);
+		uint32 Offsets[MaxWrites];
+		for (uint32 Index = 0; Index < NumDynamicOffsets; ++Index)
+		{
+			Offsets[Index] = DynamicOffsets[Index].Offset;
+		}
+
 		if (GfxPSO)
 		{
-			Cache.UpdateDescriptors(CmdBuffer, (uint32)Writes.size(), Writes.data(), GfxPSO);
+			Cache.UpdateDescriptors(CmdBuffer, NumWrites, Writes, GfxPSO, NumDynamicOffsets, Offsets);
 		}
 		else
 		{
 			check(ComputePSO);
-			Cache.UpdateDescriptors(CmdBuffer, (uint32)Writes.size(), Writes.data(), ComputePSO);
+			Cache.UpdateDescriptors(CmdBuffer, NumWrites, Writes, ComputePSO, NumDynamicOffsets, Offsets);
 		}
 	}
 
-	bool GetParameter(const char* Name, uint32& OutBinding, VkDescriptorType& OutType);
+	VkWriteDescriptorSet& AddWrite(const SVulkan::FPSO::FParameterSlot& Slot)
+	{
+		check(NumWrites < MaxWrites);
+		VkWriteDescriptorSet& Write = Writes[NumWrites++];
+		ZeroVulkanMem(Write, VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET);
+		Write.descriptorCount = 1;
+		Write.dstBinding = Slot.Binding;
+		Write.descriptorType = Slot.Type;
+		return Write;
+	}
+
+	VkDescriptorImageInfo& AddImageInfo()
+	{
+		check(NumImages < MaxWrites);
+		VkDescriptorImageInfo& IInfo = Images[NumImages++];
+		ZeroMem(IInfo);
+		IInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		return IInfo;
+	}
+
+	VkDescriptorBufferInfo& AddBufferInfo()
+	{
+		check(NumBuffers < MaxWrites);
+		VkDescriptorBufferInfo& BInfo = Buffers[NumBuffers++];
+		ZeroMem(BInfo);
+		return BInfo;
+	}
+
+	FShaderParameter GetParameter(const char* Name) const;
 };
@@ -18,6 +18,10 @@ ENTRY(8, "Show Roughness",					MODE_SHOW_ROUGHNESS) \
 ENTRY(9, "Show Metallic",					MODE_SHOW_METALLIC)
 
 
+// Descriptor set for -bindless; TestMesh.hlsl declares it as space1
+#define BINDLESS_SET				1
+#define MAX_BINDLESS_TEXTURES		1024
+
 #if HLSL
 cbuffer ViewUB : register(b0)
 {
@@ -33,5 +37,6 @@ cbuffer ViewUB : register(b0)
 cbuffer ObjUB : register(b1)
 {
 	float4x4 ObjMtx;
+	int4 ObjMaterial;		// Index into Materials (bindless only), N/A, N/A, N/A
 };
 #endif
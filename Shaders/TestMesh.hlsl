@@ -1,5 +1,9 @@
 #define HLSL	1
 
+#ifndef BINDLESS
+#define BINDLESS	0
+#endif
+
 #include "ShaderDefines.h"
 
 #define CONST_ENTRY(Index, String, Enum)	static const int Enum = Index;
@@ -7,10 +11,55 @@ VIEW_ENTRY_LIST(CONST_ENTRY)
 #undef CONST_ENTRY
 
 SamplerState SS : register(s2);
+
+#if BINDLESS
+struct FMaterial
+{
+	int BaseColor;
+	int Normal;
+	int MetallicRoughness;
+	int Padding;
+};
+
+// space1 is BINDLESS_SET
+Texture2D BindlessTextures[MAX_BINDLESS_TEXTURES] : register(t0, space1);
+StructuredBuffer<FMaterial> Materials : register(t1, space1);
+
+float4 SampleBaseTexture(float2 UV)
+{
+	return BindlessTextures[Materials[ObjMaterial.x].BaseColor].Sample(SS, UV);
+}
+
+float4 SampleNormalTexture(float2 UV)
+{
+	return BindlessTextures[Materials[ObjMaterial.x].Normal].Sample(SS, UV);
+}
+
+float4 SampleMetallicRoughnessTexture(float2 UV)
+{
+	return BindlessTextures[Materials[ObjMaterial.x].MetallicRoughness].Sample(SS, UV);
+}
+#else
 Texture2D BaseTexture : register(t3);
 Texture2D NormalTexture : register(t4);
 Texture2D MetallicRoughnessTexture : register(t5);
 
+float4 SampleBaseTexture(float2 UV)
+{
+	return BaseTexture.Sample(SS, UV);
+}
+
+float4 SampleNormalTexture(float2 UV)
+{
+	return NormalTexture.Sample(SS, UV);
+}
+
+float4 SampleMetallicRoughnessTexture(float2 UV)
+{
+	return MetallicRoughnessTexture.Sample(SS, UV);
+}
+#endif
+
 struct FGLTFVS
 {
 	// Use GLTF semantic names for easier binding
@@ -141,14 +190,14 @@ float4 TestGLTFPS(FGLTFPS In) : SV_Target0
 	//float L = max(0, dot(In.Normal, LightDir));
 	return float4(In.TEST0.xyz, 1);
 #else
-	float4 Diffuse = BaseTexture.Sample(SS, In.UV0);
+	float4 Diffuse = SampleBaseTexture(In.UV0);
 	if (Diffuse.a < 1)
 	{
 		discard;
 	}
 
-	float3 vNormalMap = NormalTexture.Sample(SS, In.UV0).xyz * 2 - 1;
-	float4 MetallicRoughness = MetallicRoughnessTexture.Sample(SS, In.UV0);
+	float3 vNormalMap = SampleNormalTexture(In.UV0).xyz * 2 - 1;
+	float4 MetallicRoughness = SampleMetallicRoughnessTexture(In.UV0);
 
 	bool bIdentityNormalBasis = Mode.y != 0;
 	bool bLightingOnly = Mode.z != 0;
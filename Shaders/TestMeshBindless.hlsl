@@ -0,0 +1,4 @@
+// TestMesh.hlsl fetching the scene's textures and materials from the bindless set
+#define BINDLESS	1
+
+#include "TestMesh.hlsl"
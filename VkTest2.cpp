@@ -14,12 +14,18 @@
 #define GLFW_INCLUDE_NONE
 #include <GLFW/glfw3.h>
 
+#include "RCBenchmark.h"
 #include "RCScene.h"
 
 #include "Shaders/ShaderDefines.h"
 
 #include "../RCUtils/RCUtilsMath.h"
 
+// Implemented in RCGLTF.cpp along with tinygltf
+#include "../tinygltf/stb_image_write.h"
+
+#include <future>
+#include <psapi.h>
 #include <thread>
 
 
@@ -49,7 +55,6 @@ static void GenerateBoundingBox(FStagingBuffer* VB, FStagingBuffer* IB, const FB
 		iaa,
 	};
 
-#if SCENE_USE_SINGLE_BUFFERS
 	uint32 Color = 0xff00ffff;
 	FUnlitVertex* Pos = (FUnlitVertex*)VB->Buffer->Lock();
 	Pos[iii].Set(FVector3(BB.Min.x, BB.Min.y, BB.Min.z), Color);
@@ -76,9 +81,6 @@ static void GenerateBoundingBox(FStagingBuffer* VB, FStagingBuffer* IB, const FB
 	Indices[20] = iai; Indices[21] = iaa;
 	Indices[22] = iia; Indices[23] = iaa;
 	IB->Buffer->Unlock();
-#else
-	check(0);
-#endif
 }
 
 static void GenerateIcosahedron(FStagingBuffer* VB, FStagingBuffer* IB, FVector3 Center, float Radius, uint32 Color = 0xff0000ff)
@@ -108,7 +110,6 @@ static void GenerateIcosahedron(FStagingBuffer* VB, FStagingBuffer* IB, FVector3
 	memcpy(Indices, SrcIndices, sizeof(SrcIndices));
 	IB->Buffer->Unlock();
 
-#if SCENE_USE_SINGLE_BUFFERS
 	FUnlitVertex* Pos = (FUnlitVertex*)VB->Buffer->Lock();
 
 	float X = 0.525731112119133606f * Radius;
@@ -128,15 +129,14 @@ static void GenerateIcosahedron(FStagingBuffer* VB, FStagingBuffer* IB, FVector3
 	Pos[11].Set(FVector3(-Z, -X, 0) + Center, Color);
 
 	VB->Buffer->Unlock();
-#else
-	check(0);
-#endif
 }
 
 //extern void RenderJOTL(SVulkan::SDevice& Device, FStagingBufferManager& StagingMgr, FDescriptorCache& DescriptorCache, SVulkan::FGfxPSO* PSO, SVulkan::FCmdBuffer*);
 
 static SVulkan GVulkan;
 
+static FJobSystem GJobSystem;
+
 static FShaderLibrary GShaderLibrary;
 
 static FRenderTargetCache GRenderTargetCache;
@@ -147,12 +147,20 @@ static FDescriptorCache GDescriptorCache;
 
 static FStagingBufferManager GStagingBufferMgr;
 
+static FFrameRingBuffer GUniformRing;
+
+static FTextureUploader GTextureUploader;
+
 struct FGLTFLoader;
-extern FGLTFLoader* CreateGLTFLoader(const char* Filename);
+extern FGLTFLoader* CreateGLTFLoader(const char* Filename, bool bMapBuffers);
 extern bool IsGLTFLoaderFinished(FGLTFLoader* Loader);
 extern const char* GetGLTFFilename(FGLTFLoader* Loader);
-extern void CreateGLTFGfxResources(FGLTFLoader* Loader, SVulkan::SDevice& Device, FPSOCache& PSOCache, FScene& Scene, FPendingOpsManager& PendingStagingOps, FStagingBufferManager* StagingMgr);
+extern void CreateGLTFGfxResources(FGLTFLoader* Loader, SVulkan::SDevice& Device, const FSceneMemPolicy& MemPolicy, VkBuffer DefaultAttributes, FStagingBufferManager* StagingMgr, FTextureUploader* Uploader, FJobSystem* JobSystem);
+extern void TickGLTFUploads(FGLTFLoader* Loader, FPendingOpsManager& PendingOpsMgr, SVulkan::FCmdBuffer* CmdBuffer);
+extern void CancelGLTFUploads(FGLTFLoader* Loader);
+extern void MoveGLTFScene(FGLTFLoader* Loader, FPSOCache& PSOCache, FPendingOpsManager& PendingOpsMgr, FScene& OutScene);
 extern void FreeGLTFLoader(FGLTFLoader* Loader);
+extern bool WriteTestGLTFScene(const char* Filename, uint32 SizeInMB);
 
 
 struct FCamera
@@ -230,10 +238,11 @@ static bool g_bWireframe = false;
 //extern bool LoadGLTF(SVulkan::SDevice& Device, const char* Filename, FPSOCache& PSOCache, FScene& Scene, FPendingOpsManager& PendingStagingOps, FStagingBufferManager* StagingMgr);
 
 
+// Not glfwGetTime(), as -headless never initializes GLFW
 double GetTimeInMs()
 {
-	double Time = glfwGetTime() * 1000.0;
-	return Time;
+	static const std::chrono::steady_clock::time_point Start = std::chrono::steady_clock::now();
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - Start).count();
 }
 
 FVector2 TryGetVector2Prefix(const char* Prefix, FVector2 Value)
@@ -309,6 +318,126 @@ struct FApp
 	FImageWithMemAndView DepthBuffer;
 
 	FPSOCache::FPSOHandle TestGLTFPSO;
+	struct
+	{
+		FShaderParameter ViewUB;
+		FShaderParameter ObjUB;
+		FShaderParameter SS;
+		FShaderParameter BaseTexture;
+		FShaderParameter NormalTexture;
+		FShaderParameter MetallicRoughnessTexture;
+	} TestGLTFParams;
+
+	// -bindless: textures and materials come from Bindless.Set, so draws only set the uniform buffers
+	bool bBindless = false;
+	FBindlessDescriptors Bindless;
+	FBufferWithMem BindlessMaterials;
+	int32 BindlessWhiteTexture = -1;
+	int32 BindlessDefaultNormalMap = -1;
+	FPSOCache::FPSOHandle TestGLTFBindlessPSO;
+	struct
+	{
+		FShaderParameter ViewUB;
+		FShaderParameter ObjUB;
+		FShaderParameter SS;
+	} TestGLTFBindlessParams;
+
+	// -parallelrecord: DrawSceneParallel() splits Scene.Instances into chunks recorded into secondary command buffers as
+	// jobs; each chunk owns one FRecordContext for the frame so nothing it touches needs a lock
+	struct FRecordContext
+	{
+		SVulkan::FCommandPool CmdPool;
+		FDescriptorCache DescriptorCache;
+		SVulkan::FCmdBuffer* CmdBuffer = nullptr;
+	};
+	bool bParallelRecord = false;
+	std::deque<FRecordContext> RecordContexts;
+	uint32 NumRecordThreads = 0;
+	double RecordTimeMs = 0;
+
+	// -recordbench: steps NumRecordThreads from 1 up to RecordContexts.size(), logging the average recording time of each
+	enum
+	{
+		RecordBenchFrames = 120,
+	};
+	struct
+	{
+		bool bEnabled = false;
+		uint32 NumFrames = 0;
+		double TotalMs = 0;
+	} RecordBench;
+
+	// -asynccompute: DispatchAsyncCompute() submits TestCS on the compute queue each frame. Nothing reads its output, so the
+	// graphics work doesn't wait for it; BeginFrame() only keeps it from running more than NumFramesInFlight frames ahead.
+	// Timestamps from different queues aren't calibrated against each other, so only the compute duration is reported
+	bool bAsyncCompute = false;
+	FGPUTiming ComputeTiming;
+	struct
+	{
+		double ComputeMs = 0;
+	} AsyncComputeStats;
+
+	// -benchmark: once the scene and its textures are in, runs -benchwarmup= frames and then -benchframes= measured ones with
+	// the camera following BenchmarkPath (-benchpath=File, or generated from -benchseed=), writes -benchout=<Prefix>.csv/.json
+	// and exits. Counters are per frame deltas; GPU time is the last timestamp pair that landed, so it lags by a frame or two
+	FBenchmark Benchmark;
+	FCameraPath BenchmarkPath;
+	std::atomic<uint32> NumSceneDraws = 0;
+	std::atomic<uint32> NumSceneVertexBinds = 0;
+	struct
+	{
+		uint32 NumPipelinesCreated = 0;
+		uint64 NumDescriptorMisses = 0;
+		uint64 NumStagingMisses = 0;
+		uint64 GPUProfilerFrame = 0;
+	} BenchmarkCounters;
+
+	// -framesinflight=N: the CPU records at most N frames ahead of the GPU. Each frame in flight owns its semaphores and
+	// command pool, and BeginFrame() waits for the submit that last used them. The uniform ring and descriptor caches stay
+	// shared, as they already release memory per submitted command buffer
+	enum
+	{
+		MaxFramesInFlight = 3,
+		FrameBenchFrames = 240,
+	};
+	struct FFrameContext
+	{
+		VkSemaphore AcquireSemaphore = VK_NULL_HANDLE;
+		SVulkan::FCommandPool CmdPool;
+
+		// The last submit from this frame
+		SVulkan::FSyncPoint SyncPoint;
+		// -asynccompute's submit for this frame, on the compute queue's own timeline
+		SVulkan::FSyncPoint ComputeSyncPoint;
+		double BeginTime = 0;
+		bool bLatencyPending = false;
+	};
+	FFrameContext Frames[MaxFramesInFlight];
+	uint32 NumFramesInFlight = 2;
+	uint32 CurrentFrame = 0;
+
+	// Signaled by a frame's submit and waited on by its present, one per swapchain image: a frame's sync point doesn't say the
+	// present engine is done with the semaphore, but the image isn't acquired again until its previous present has finished
+	std::vector<VkSemaphore> PresentSemaphores;
+
+	// Wait is the CPU time blocked on the frame's previous submit; Latency runs from the start of a frame on the CPU until its
+	// sync point is seen complete, so it's an upper bound that includes the polling delay
+	struct
+	{
+		double WaitMs = 0;
+		double LatencyMs = 0;
+	} FrameStats;
+
+	// -framebench: runs FrameBenchFrames frames at each of 1..MaxFramesInFlight frames in flight, logging the averages
+	struct
+	{
+		bool bEnabled = false;
+		uint32 NumFrames = 0;
+		uint32 NumLatencies = 0;
+		double BeginTime = 0;
+		double TotalWaitMs = 0;
+		double TotalLatencyMs = 0;
+	} FrameBench;
 	FPSOCache::FPSOHandle TestCSPSO;
 
 	FPSOCache::FPSOHandle ImGUIPSO;
@@ -322,6 +451,14 @@ struct FApp
 	FBufferWithMem TestCSUB;
 	FBufferWithMem ColorUB;
 	GLFWwindow* Window = nullptr;
+
+	// -headless: no window, surface or swapchain; frames render into OffscreenColor, sized by -resx/-resy. With -savepng=File
+	// the frame main() flags with bReadbackFrame (the last one of an -exitafterframes= run) is copied back and written out
+	bool bHeadless = false;
+	FImageWithMemAndView OffscreenColor;
+	const char* SavePNGFilename = nullptr;
+	FBufferWithMem ReadbackBuffer;
+	bool bReadbackFrame = false;
 	uint32 ImGuiMaxVertices = 32768 * 3;
 	uint32 ImGuiMaxIndices = 32768 * 3;
 	FImageWithMemAndView ImGuiFont;
@@ -330,6 +467,8 @@ struct FApp
 	FImageWithMemAndView WhiteTexture;
 	FImageWithMemAndView DefaultNormalMapTexture;
 	FGPUTiming GPUTiming;
+	// -gpuprofiledepth=N: how many levels of FMarkerScopes get timed, counting the whole frame as the first
+	FGPUProfiler GPUProfiler;
 	enum
 	{
 		NUM_IMGUI_BUFFERS = 3,
@@ -410,233 +549,769 @@ struct FApp
 			PendingOpsMgr.AddCopyBufferToImage(Buffer, DefaultNormalMapTexture.Image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 		}
 
-		GPUTiming.Init(&Device, PendingOpsMgr);
+		if (bBindless)
+		{
+			BindlessWhiteTexture = Bindless.AddTexture(WhiteTexture);
+			BindlessDefaultNormalMap = Bindless.AddTexture(DefaultNormalMapTexture);
+		}
+
+		GPUTiming.Init(&Device, PendingOpsMgr, Device.GfxQueueIndex);
+		GPUProfiler.Init(&Device);
+		GPUProfiler.MaxDepth = std::max(1u, (uint32)RCUtils::FCmdLine::Get().TryGetIntPrefix("-gpuprofiledepth=", GPUProfiler.MaxDepth));
 		RecreateDepthBuffer(Device);
 	}
 
-	void RecreateDepthBuffer(SVulkan::SDevice& Device)
+	// Has to run before any PSO is created, as the bindless set layout becomes part of the pipeline layouts
+	void InitBindless(SVulkan::SDevice& Device)
 	{
-		DepthBuffer.Destroy();
+		if (!RCUtils::FCmdLine::Get().Contains("-bindless"))
+		{
+			return;
+		}
 
-		int32 Width = 0, Height = 1;
-		glfwGetFramebufferSize(Window, &Width, &Height);
-		glfwSetFramebufferSizeCallback(Window, ResizeCallback);
-		DepthBuffer.Create(Device, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, EMemLocation::GPU, (uint32)Width, (uint32)Height, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT);
+		if (!Device.bDescriptorIndexing
+			|| Device.Props.limits.maxPerStageDescriptorSampledImages < MAX_BINDLESS_TEXTURES
+			|| Device.Props.limits.maxDescriptorSetSampledImages < MAX_BINDLESS_TEXTURES)
+		{
+			::OutputDebugStringA("*** Descriptor indexing not supported, ignoring -bindless\n");
+			return;
+		}
+
+		Bindless.Init(&Device, MAX_BINDLESS_TEXTURES);
+		GPSOCache.SetBindlessSetLayout(BINDLESS_SET, Bindless.Layout);
+		bBindless = true;
 	}
 
-	void Destroy()
+	// -vbmem= and -ibmem= take gpu (the default) or cpu_to_gpu; run -benchmark once with each to compare
+	void InitSceneMemPolicy()
 	{
-		vkDestroySampler(ImGuiFont.Image.Device, LinearMipSampler, nullptr);
-		DefaultNormalMapTexture.Destroy();
-		DepthBuffer.Destroy();
-		GPUTiming.Destroy();
-
-		WhiteTexture.Destroy();
+		auto GetLocation = [](const char* Prefix, EMemLocation Default)
+		{
+			const char* Name = nullptr;
+			if (RCUtils::FCmdLine::Get().TryGetStringFromPrefix(Prefix, Name))
+			{
+				if (!_stricmp(Name, "gpu"))
+				{
+					return EMemLocation::GPU;
+				}
+				else if (!_stricmp(Name, "cpu_to_gpu"))
+				{
+					return EMemLocation::CPU_TO_GPU;
+				}
+				::OutputDebugStringA("*** Unknown memory location ");
+				::OutputDebugStringA(Name);
+				::OutputDebugStringA("\n");
+			}
+			return Default;
+		};
+		SceneMemPolicy.VertexBuffers = GetLocation("-vbmem=", SceneMemPolicy.VertexBuffers);
+		SceneMemPolicy.IndexBuffers = GetLocation("-ibmem=", SceneMemPolicy.IndexBuffers);
+	}
 
-		vkDestroySampler(ImGuiFont.Image.Device, ImGuiFontSampler, nullptr);
-		for (int32 Index = 0; Index < NUM_IMGUI_BUFFERS; ++Index)
+	void InitBenchmark()
+	{
+		RCUtils::FCmdLine& CmdLine = RCUtils::FCmdLine::Get();
+		Benchmark.bEnabled = CmdLine.Contains("-benchmark");
+		if (!Benchmark.bEnabled)
 		{
-			ImGuiIB[Index].Destroy();
-			ImGuiVB[Index].Destroy();
-			ImGuiScaleTranslateUB[Index].Destroy();
+			return;
 		}
-		ImGuiFont.Destroy();
 
-		Scene.Destroy();
-		TestCSUB.Destroy();
-		TestCSBuffer.Destroy();
-		ClipVB.Destroy();
-		ColorUB.Destroy();
+		Benchmark.WarmupFrames = CmdLine.TryGetIntPrefix("-benchwarmup=", Benchmark.WarmupFrames);
+		Benchmark.NumFrames = std::max(1u, (uint32)CmdLine.TryGetIntPrefix("-benchframes=", Benchmark.NumFrames));
+		const char* OutputPrefix = nullptr;
+		if (CmdLine.TryGetStringFromPrefix("-benchout=", OutputPrefix))
+		{
+			Benchmark.OutputPrefix = OutputPrefix;
+		}
 
-		ImGui_ImplGlfw_Shutdown();
+		const char* PathFilename = nullptr;
+		if (CmdLine.TryGetStringFromPrefix("-benchpath=", PathFilename))
+		{
+			if (!BenchmarkPath.Load(PathFilename))
+			{
+				::OutputDebugStringA("*** Unable to read benchmark camera path ");
+				::OutputDebugStringA(PathFilename);
+				::OutputDebugStringA("\n");
+			}
+		}
+		else if (CmdLine.Contains("-benchseed="))
+		{
+			BenchmarkPath.Generate(CmdLine.TryGetIntPrefix("-benchseed=", 0), Camera.Pos, CmdLine.TryGetFloatPrefix("-benchradius=", 100.0f), 8);
+		}
 	}
 
-	void SetupImGuiAndResources(SVulkan::SDevice& Device)
+	uint64 GetNumDescriptorMisses() const
 	{
-		IMGUI_CHECKVERSION();
-
-		ImGui::CreateContext();
-		ImGui::StyleColorsDark();
-
-		ImGuiIO& IO = ImGui::GetIO();
-		ImGui_ImplGlfw_InitForVulkan(Window, true);
-
-		int32 Width = 0, Height = 0;
-		unsigned char* Pixels = nullptr;
-		IO.Fonts->GetTexDataAsAlpha8(&Pixels, &Width, &Height);
-
-		FStagingBuffer* FontBuffer = GStagingBufferMgr.AcquireBuffer(Width * Height * sizeof(uint32), nullptr);
-		uint8* Data = (uint8*)FontBuffer->Buffer->Lock();
-		for (int32 Index = 0; Index < Width * Height; ++Index)
+		uint64 NumMisses = GDescriptorCache.Stats.Misses;
+		for (const FRecordContext& Context : RecordContexts)
 		{
-			*Data++ = *Pixels;
-			*Data++ = *Pixels;
-			*Data++ = *Pixels;
-			*Data++ = *Pixels;
-			++Pixels;
+			NumMisses += Context.DescriptorCache.Stats.Misses;
 		}
-		FontBuffer->Buffer->Unlock();
-
-		ImGuiFont.Create(Device, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, EMemLocation::GPU, Width, Height, VK_FORMAT_R8G8B8A8_UNORM);
-		Device.SetDebugName(ImGuiFont.Image.Image, "ImGuiFont");
-
-		PendingOpsMgr.AddCopyBufferToImage(FontBuffer, ImGuiFont.Image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+		return NumMisses;
+	}
 
-		IO.Fonts->TexID = (void*)ImGuiFont.Image.Image;
+	// After Render() and once CpuDelta is known
+	void AddBenchmarkFrame(SVulkan::SDevice& Device)
+	{
+		uint64 NumDescriptorMisses = GetNumDescriptorMisses();
+		FBenchmark::FSample Sample;
+		Sample.Values[FBenchmark::CpuMs] = CpuDelta;
+		Sample.Values[FBenchmark::GpuMs] = GpuDelta;
+		Sample.Values[FBenchmark::NumDraws] = (double)NumSceneDraws.load(std::memory_order_relaxed);
+		Sample.Values[FBenchmark::NumVertexBinds] = (double)NumSceneVertexBinds.load(std::memory_order_relaxed);
+		Sample.Values[FBenchmark::NumPSOMisses] = (double)(GPSOCache.NumPipelinesCreated - BenchmarkCounters.NumPipelinesCreated);
+		Sample.Values[FBenchmark::NumDescriptorAllocs] = (double)(NumDescriptorMisses - BenchmarkCounters.NumDescriptorMisses);
+		Sample.Values[FBenchmark::NumStagingAllocs] = (double)(GStagingBufferMgr.Stats.Misses - BenchmarkCounters.NumStagingMisses);
+		Sample.Values[FBenchmark::NumUniformAllocs] = (double)GUniformRing.LastFrameNumAllocations;
+#if !USE_VMA
+		Sample.Values[FBenchmark::MemUsedMB] = (double)Device.GetMemStats().UsedBytes / (1024.0 * 1024.0);
+#endif
+		BenchmarkCounters.NumPipelinesCreated = GPSOCache.NumPipelinesCreated;
+		BenchmarkCounters.NumDescriptorMisses = NumDescriptorMisses;
+		BenchmarkCounters.NumStagingMisses = GStagingBufferMgr.Stats.Misses;
 
-		const uint32 ImGuiVertexSize = sizeof(ImDrawVert) * ImGuiMaxVertices;
-		for (int32 Index = 0; Index < NUM_IMGUI_BUFFERS; ++Index)
+		bool bSceneReady = LoadingState != ELoadingState::BeginLoading && LoadingState != ELoadingState::Loading && GTextureUploader.GetNumPending() == 0;
+		if (!bSceneReady)
 		{
-			ImGuiVB[Index].Create(Device, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, EMemLocation::CPU_TO_GPU, ImGuiVertexSize, true);
-			static_assert(sizeof(uint16) == sizeof(ImDrawIdx), "");
-			ImGuiIB[Index].Create(Device, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, EMemLocation::CPU_TO_GPU, ImGuiMaxIndices * sizeof(uint16), true);
-			ImGuiScaleTranslateUB[Index].Create(Device, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, EMemLocation::CPU_TO_GPU, (16 + 4) * sizeof(float), true);
+			return;
 		}
 
+		if (GPUProfiler.ResultsFrame != BenchmarkCounters.GPUProfilerFrame)
 		{
-			VkSamplerCreateInfo Info;
-			ZeroVulkanMem(Info, VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO);
-			VERIFY_VKRESULT(vkCreateSampler(Device.Device, &Info, nullptr, &ImGuiFontSampler));
+			BenchmarkCounters.GPUProfilerFrame = GPUProfiler.ResultsFrame;
+			// Path of each open scope, by depth
+			std::vector<std::string> Paths;
+			for (const FGPUProfiler::FResult& Result : GPUProfiler.Results)
+			{
+				Paths.resize(Result.Depth);
+				Paths.push_back(Paths.empty() ? Result.Name : Paths.back() + "/" + Result.Name);
+				Benchmark.AddGpuScope(Paths.back(), Result.Ms);
+			}
 		}
 
+		Benchmark.AddFrame(Sample);
+		if (Benchmark.IsFinished())
 		{
-			VkSamplerCreateInfo Info = { VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO, };
-			ZeroVulkanMem(Info, VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO);
-			Info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
-			Info.magFilter = VK_FILTER_LINEAR;
-			Info.minFilter = VK_FILTER_LINEAR;
-			Info.maxLod = 1.0f;
-			VERIFY_VKRESULT(vkCreateSampler(Device.Device, &Info, nullptr, &LinearMipSampler));
+			WriteBenchmarkResults(Device);
 		}
 	}
 
-	void Update(SVulkan::SDevice& Device)
+	void WriteBenchmarkResults(SVulkan::SDevice& Device)
 	{
-		++FrameIndex;
-		GStagingBufferMgr.Refresh();
-		Camera.UpdateMatrix();
+		std::string CSVFilename = Benchmark.OutputPrefix + ".csv";
+		std::string JSONFilename = Benchmark.OutputPrefix + ".json";
+		std::string Description = std::string(Device.Props.deviceName) + ", vbmem=" + FSceneMemPolicy::GetName(SceneMemPolicy.VertexBuffers) + " ibmem=" + FSceneMemPolicy::GetName(SceneMemPolicy.IndexBuffers);
+		bool bWritten = Benchmark.WriteCSV(CSVFilename.c_str()) && Benchmark.WriteJSON(JSONFilename.c_str(), Description.c_str());
+
+		std::vector<double> CpuMs = Benchmark.GetSortedValues(FBenchmark::CpuMs);
+		std::vector<double> GpuMs = Benchmark.GetSortedValues(FBenchmark::GpuMs);
+		char s[512];
+		sprintf(s, "*** Benchmark: %d frames; CPU p50 %f p95 %f p99 %f ms; GPU p50 %f p95 %f p99 %f ms%s\n", (int)Benchmark.Samples.size(),
+			(float)FBenchmark::GetPercentile(CpuMs, 50), (float)FBenchmark::GetPercentile(CpuMs, 95), (float)FBenchmark::GetPercentile(CpuMs, 99),
+			(float)FBenchmark::GetPercentile(GpuMs, 50), (float)FBenchmark::GetPercentile(GpuMs, 95), (float)FBenchmark::GetPercentile(GpuMs, 99),
+			bWritten ? "" : "; unable to write the results");
+		::OutputDebugStringA(s);
+	}
 
-		if (LoadingState == ELoadingState::Loading)
+	void InitAsyncCompute(SVulkan::SDevice& Device)
+	{
+		bAsyncCompute = RCUtils::FCmdLine::Get().Contains("-asynccompute");
+		if (bAsyncCompute)
 		{
-			if (IsGLTFLoaderFinished(GLTFLoader))
+			ComputeTiming.Init(&Device, PendingOpsMgr, Device.ComputeQueueIndex);
+			if (!Device.HasAsyncCompute())
 			{
-				TryLoadGLTF(Device);
+				::OutputDebugStringA("*** No separate compute queue family, async compute runs on the graphics queue\n");
+			}
+			if (!ComputeTiming.IsSupported())
+			{
+				::OutputDebugStringA("*** No timestamps on the compute queue, async compute won't be timed\n");
 			}
 		}
 	}
 
-	void ImGuiNewFrame()
+	SVulkan::FSyncPoint DispatchAsyncCompute(SVulkan::SDevice& Device)
 	{
-		ImGui_ImplGlfw_NewFrame();
-		ImGui::NewFrame();
-
-		// Setup time step
-		double current_time = glfwGetTime();
-		Time = current_time;
+		// With a shared family this goes through the graphics timeline, so it has to be submitted before the frame's command buffer begins
+		SVulkan::FCmdBuffer* CmdBuffer = Device.BeginCommandBuffer(Device.ComputeQueueIndex);
+		ComputeTiming.BeginTimestamp(CmdBuffer);
+		{
+			FMarkerScope MarkerScope(Device, CmdBuffer, "TestCompute");
+			SVulkan::FComputePSO* PSO = GPSOCache.GetComputePSO(TestCSPSO);
+			vkCmdBindPipeline(CmdBuffer->CmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, PSO->Pipeline);
 
-		ProcessInput();
+			FDescriptorPSOCache Cache(PSO);
+			Cache.SetUniformBuffer("CB0", TestCSUB);
+			Cache.SetTexelBuffer("output", TestCSBuffer);
+			Cache.UpdateDescriptors(GDescriptorCache, CmdBuffer);
+			for (int32 Index = 0; Index < 256; ++Index)
+			{
+				vkCmdDispatch(CmdBuffer->CmdBuffer, 256, 1, 1);
+			}
+		}
+		ComputeTiming.EndTimestamp(CmdBuffer);
+		CmdBuffer->End();
+		Device.Submit(Device.ComputeQueue, CmdBuffer, 0, VK_NULL_HANDLE, VK_NULL_HANDLE);
+		return CmdBuffer->GetSyncPoint();
 	}
 
-	void ProcessInput()
+	void UpdateAsyncComputeStats()
 	{
-		bLMouseButtonHeld = (glfwGetMouseButton(Window, GLFW_MOUSE_BUTTON_1) == GLFW_PRESS);
-		bRMouseButtonHeld = (glfwGetMouseButton(Window, GLFW_MOUSE_BUTTON_2) == GLFW_PRESS);
-		//bCtrlHeld = bCtrlHeld || (glfwGetKey(Window, GLFW_KEY_LEFT_CONTROL) == GLFW_PRESS || glfwGetKey(Window, GLFW_KEY_RIGHT_CONTROL) == GLFW_PRESS);
+		AsyncComputeStats.ComputeMs = ComputeTiming.ReadTimestamp();
+	}
 
-		if (glfwGetKey(Window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
+	void InitParallelRecord(SVulkan::SDevice& Device)
+	{
+		RecordBench.bEnabled = RCUtils::FCmdLine::Get().Contains("-recordbench");
+		bParallelRecord = RecordBench.bEnabled || RCUtils::FCmdLine::Get().Contains("-parallelrecord");
+		if (!bParallelRecord)
 		{
-			glfwSetWindowShouldClose(Window, true);
+			return;
 		}
 
-		if (ImGui::IsAnyWindowHovered())
+		// The main thread records a chunk too while it waits
+		uint32 NumThreads = RCUtils::FCmdLine::Get().TryGetIntPrefix("-recordthreads=", GJobSystem.GetNumWorkers() + 1);
+		NumThreads = std::max(1u, NumThreads);
+		for (uint32 Index = 0; Index < NumThreads; ++Index)
 		{
-			bLMouseButtonHeld = false;
-			bRMouseButtonHeld = false;
-			return;
+			RecordContexts.emplace_back();
+			FRecordContext& Context = RecordContexts.back();
+			Context.CmdPool.Create(Device.Device, Device.GfxQueueIndex, nullptr, VK_COMMAND_BUFFER_LEVEL_SECONDARY);
+			Context.DescriptorCache.Init(&Device);
 		}
+		NumRecordThreads = RecordBench.bEnabled ? 1 : NumThreads;
+	}
 
-		float CameraSpeed = 0.5f * (float)Time;
+	void InitFrames(SVulkan::SDevice& Device)
+	{
+		static_assert(MaxFramesInFlight <= NUM_IMGUI_BUFFERS, "ImGui buffers are reused every NUM_IMGUI_BUFFERS frames");
+		FrameBench.bEnabled = RCUtils::FCmdLine::Get().Contains("-framebench");
+		NumFramesInFlight = FrameBench.bEnabled ? 1 : RCUtils::FCmdLine::Get().TryGetIntPrefix("-framesinflight=", 2);
+		NumFramesInFlight = std::min(std::max(NumFramesInFlight, 1u), (uint32)MaxFramesInFlight);
+		for (FFrameContext& Frame : Frames)
+		{
+			Frame.AcquireSemaphore = Device.CreateSemaphore();
+			Frame.CmdPool.Create(Device.Device, Device.GfxQueueIndex, &Device.Timelines[Device.GfxQueueIndex]);
+		}
+		if (!bHeadless)
+		{
+			CreatePresentSemaphores(Device);
+		}
+	}
 
-		if (glfwGetKey(Window, GLFW_KEY_LEFT_SHIFT) == GLFW_PRESS || glfwGetKey(Window, GLFW_KEY_RIGHT_SHIFT) == GLFW_PRESS)
+	void CreatePresentSemaphores(SVulkan::SDevice& Device)
+	{
+		PresentSemaphores.resize(GVulkan.Swapchain.Images.size());
+		for (VkSemaphore& Semaphore : PresentSemaphores)
 		{
-			CameraSpeed *= 2.5f;
+			Semaphore = Device.CreateSemaphore();
 		}
+	}
 
+	void DestroyFrames()
+	{
+		for (VkSemaphore Semaphore : PresentSemaphores)
+		{
+			vkDestroySemaphore(Frames[0].CmdPool.Device, Semaphore, nullptr);
+		}
+		PresentSemaphores.clear();
 
-		if (glfwGetKey(Window, GLFW_KEY_W) == GLFW_PRESS)
+		for (FFrameContext& Frame : Frames)
 		{
-			Camera.Pos += CameraSpeed * Camera.Front;
+			VkDevice Device = Frame.CmdPool.Device;
+			vkDestroySemaphore(Device, Frame.AcquireSemaphore, nullptr);
+			Frame.AcquireSemaphore = VK_NULL_HANDLE;
+			Frame.CmdPool.Destroy();
+			Frame.SyncPoint = SVulkan::FSyncPoint();
+			Frame.ComputeSyncPoint = SVulkan::FSyncPoint();
 		}
+	}
 
-		if (glfwGetKey(Window, GLFW_KEY_S) == GLFW_PRESS)
+	FFrameContext& GetCurrentFrame()
+	{
+		return Frames[CurrentFrame];
+	}
+
+	VkSemaphore GetPresentSemaphore() const
+	{
+		return PresentSemaphores[GVulkan.Swapchain.ImageIndex];
+	}
+
+	// Blocks until the GPU is done with the frame NumFramesInFlight frames back, so its semaphores and command buffer can be reused
+	void BeginFrame(SVulkan::SDevice& Device)
+	{
+		FFrameContext& Frame = GetCurrentFrame();
+		double WaitBegin = GetTimeInMs();
+		if (Frame.SyncPoint.IsValid())
 		{
-			Camera.Pos -= CameraSpeed * Camera.Front;
+			Device.WaitForSyncPoint(Frame.SyncPoint);
+		}
+		if (Frame.ComputeSyncPoint.IsValid())
+		{
+			Device.WaitForSyncPoint(Frame.ComputeSyncPoint);
 		}
+		double Now = GetTimeInMs();
+		FrameStats.WaitMs = Now - WaitBegin;
 
-		if (glfwGetKey(Window, GLFW_KEY_A) == GLFW_PRESS)
+		Device.RefreshCommandBuffers();
+		for (FFrameContext& Other : Frames)
 		{
-			Camera.Pos += FVector3::Cross(Camera.Front, Camera.Up).GetNormalized() * CameraSpeed;
+			if (Other.bLatencyPending && Other.SyncPoint.IsComplete())
+			{
+				Other.bLatencyPending = false;
+				FrameStats.LatencyMs = Now - Other.BeginTime;
+				FrameBench.TotalLatencyMs += FrameStats.LatencyMs;
+				++FrameBench.NumLatencies;
+			}
 		}
+		Frame.BeginTime = WaitBegin;
+	}
 
-		if (glfwGetKey(Window, GLFW_KEY_D) == GLFW_PRESS)
+	void SubmitFrame(SVulkan::SDevice& Device, SVulkan::FCmdBuffer* CmdBuffer)
+	{
+		FFrameContext& Frame = GetCurrentFrame();
+		Frame.SyncPoint = CmdBuffer->GetSyncPoint();
+		Frame.bLatencyPending = true;
+		if (bHeadless)
 		{
-			Camera.Pos -= FVector3::Cross(Camera.Front, Camera.Up).GetNormalized() * CameraSpeed;
+			// Nothing acquired or presented
+			Device.Submit(Device.GfxQueue, CmdBuffer, 0, VK_NULL_HANDLE, VK_NULL_HANDLE);
 		}
-/*
-		if (glfwGetKey(Window, GLFW_KEY_UP) == GLFW_PRESS)
+		else
 		{
-			Camera.Pos -= CameraSpeed * Camera.Front;
+			Device.Submit(Device.PresentQueue, CmdBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, Frame.AcquireSemaphore, GetPresentSemaphore());
 		}
+	}
 
-		if (glfwGetKey(Window, GLFW_KEY_DOWN) == GLFW_PRESS)
+	void EndFrame(SVulkan::SDevice& Device)
+	{
+		CurrentFrame = (CurrentFrame + 1) % NumFramesInFlight;
+		if (FrameBench.bEnabled)
 		{
-			Camera.Pos += CameraSpeed * Camera.Front;
+			UpdateFrameBench(Device);
 		}
-*/
-		const float RotSpeed = 1.0f;
-		if (glfwGetKey(Window, GLFW_KEY_LEFT) == GLFW_PRESS)
+	}
+
+	void UpdateFrameBench(SVulkan::SDevice& Device)
+	{
+		if (FrameBench.NumFrames == 0)
 		{
-			Camera.Yaw -= RotSpeed;
+			FrameBench.BeginTime = GetTimeInMs();
 		}
-
-		if (glfwGetKey(Window, GLFW_KEY_RIGHT) == GLFW_PRESS)
+		FrameBench.TotalWaitMs += FrameStats.WaitMs;
+		if (++FrameBench.NumFrames < FrameBenchFrames)
 		{
-			Camera.Yaw += RotSpeed;
+			return;
 		}
 
-		if (glfwGetKey(Window, GLFW_KEY_PAGE_UP) == GLFW_PRESS)
+		double FrameMs = (GetTimeInMs() - FrameBench.BeginTime) / (double)(FrameBench.NumFrames - 1);
+		char s[160];
+		sprintf(s, "*** Frame bench: %d frames in flight, %f ms/frame (%.1f fps), %f ms waiting, %f ms latency\n", NumFramesInFlight, (float)FrameMs, (float)(1000.0 / FrameMs),
+			(float)(FrameBench.TotalWaitMs / FrameBench.NumFrames), FrameBench.NumLatencies ? (float)(FrameBench.TotalLatencyMs / FrameBench.NumLatencies) : 0.0f);
+		::OutputDebugStringA(s);
+
+		FrameBench.NumFrames = 0;
+		FrameBench.NumLatencies = 0;
+		FrameBench.TotalWaitMs = 0;
+		FrameBench.TotalLatencyMs = 0;
+		if (NumFramesInFlight < MaxFramesInFlight)
 		{
-			Camera.Pos += Camera.Up * CameraSpeed;
+			SetNumFramesInFlight(Device, NumFramesInFlight + 1);
+		}
+		else
+		{
+			FrameBench.bEnabled = false;
 		}
+	}
 
-		if (glfwGetKey(Window, GLFW_KEY_PAGE_DOWN) == GLFW_PRESS)
+	void SetNumFramesInFlight(SVulkan::SDevice& Device, uint32 Num)
+	{
+		// Drain so every frame context starts out idle
+		Device.WaitForIdle();
+		for (FFrameContext& Frame : Frames)
 		{
-			Camera.Pos -= Camera.Up * CameraSpeed;
+			Frame.bLatencyPending = false;
 		}
+		NumFramesInFlight = Num;
+		CurrentFrame = 0;
 	}
 
-	void DrawDataImGui(ImDrawData* DrawData, SVulkan::FCmdBuffer* CmdBuffer, SVulkan::FFramebuffer* Framebuffer)
+	void CreateOffscreenColor(SVulkan::SDevice& Device, uint32 Width, uint32 Height)
 	{
-		if (DrawData->CmdListsCount > 0)
+		OffscreenColor.Create(Device, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, EMemLocation::GPU, Width, Height, VK_FORMAT_R8G8B8A8_UNORM);
+		Device.SetDebugName(OffscreenColor.Image.Image, VK_OBJECT_TYPE_IMAGE, "OffscreenColor");
+
+		if (RCUtils::FCmdLine::Get().TryGetStringFromPrefix("-savepng=", SavePNGFilename))
 		{
-			uint32 NumVertices = DrawData->TotalVtxCount;
-			uint32 NumIndices = DrawData->TotalIdxCount;
-			uint32 DestVBOffset = 0;
-			uint32 DestIBOffset = 0;
-			ImDrawVert* DestVBData = (ImDrawVert*)ImGuiVB[FrameIndex % NUM_IMGUI_BUFFERS].Lock();
-			uint16* DestIBData = (uint16*)ImGuiIB[FrameIndex % NUM_IMGUI_BUFFERS].Lock();
-			for (int32 Index = 0; Index < DrawData->CmdListsCount; ++Index)
-			{
-				const ImDrawList* CmdList = DrawData->CmdLists[Index];
-				const ImDrawVert* SrcVB = CmdList->VtxBuffer.Data;
-				const ImDrawIdx* SrcIB = CmdList->IdxBuffer.Data;
+			ReadbackBuffer.Create(Device, VK_BUFFER_USAGE_TRANSFER_DST_BIT, EMemLocation::CPU, Width * Height * sizeof(uint32), true);
+		}
+	}
 
-				check(NumVertices + CmdList->VtxBuffer.Size <= ImGuiMaxVertices);
-				check(NumIndices + CmdList->IdxBuffer.Size <= ImGuiMaxIndices);
+	VkImage GetBackbufferImage() const
+	{
+		return bHeadless ? OffscreenColor.Image.Image : GVulkan.Swapchain.Images[GVulkan.Swapchain.ImageIndex];
+	}
 
-				memcpy(DestIBData, SrcIB, CmdList->IdxBuffer.Size * sizeof(ImDrawIdx));
-				memcpy(DestVBData, SrcVB, CmdList->VtxBuffer.Size * sizeof(ImDrawVert));
-				
+	VkFormat GetBackbufferFormat() const
+	{
+		return bHeadless ? OffscreenColor.Image.Format : GVulkan.Swapchain.Format;
+	}
+
+	FRenderTargetInfo GetBackbufferTargetInfo()
+	{
+		return bHeadless ? FRenderTargetInfo(OffscreenColor.View, OffscreenColor.Image.Format, VK_ATTACHMENT_LOAD_OP_LOAD, VK_ATTACHMENT_STORE_OP_STORE) : GVulkan.Swapchain.GetRenderTargetInfo();
+	}
+
+	VkViewport GetViewport() const
+	{
+		if (!bHeadless)
+		{
+			return GVulkan.Swapchain.GetViewport();
+		}
+
+		VkViewport Viewport;
+		ZeroMem(Viewport);
+		Viewport.width = (float)OffscreenColor.Image.Width;
+		Viewport.height = (float)OffscreenColor.Image.Height;
+		Viewport.maxDepth = 1.0f;
+		return Viewport;
+	}
+
+	VkRect2D GetScissor() const
+	{
+		if (!bHeadless)
+		{
+			return GVulkan.Swapchain.GetScissor();
+		}
+
+		VkRect2D Scissor;
+		ZeroMem(Scissor);
+		Scissor.extent.width = OffscreenColor.Image.Width;
+		Scissor.extent.height = OffscreenColor.Image.Height;
+		return Scissor;
+	}
+
+	void SetViewportAndScissor(SVulkan::FCmdBuffer* CmdBuffer)
+	{
+		CmdBuffer->SetViewportAndScissor(GetViewport(), GetScissor());
+	}
+
+	// OffscreenColor has to be in TRANSFER_SRC_OPTIMAL
+	void RecordReadback(SVulkan::FCmdBuffer* CmdBuffer)
+	{
+		VkBufferImageCopy Region;
+		ZeroMem(Region);
+		Region.imageExtent.width = OffscreenColor.Image.Width;
+		Region.imageExtent.height = OffscreenColor.Image.Height;
+		Region.imageExtent.depth = 1;
+		Region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		Region.imageSubresource.layerCount = 1;
+		vkCmdCopyImageToBuffer(CmdBuffer->CmdBuffer, OffscreenColor.Image.Image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, ReadbackBuffer.Buffer.Buffer, 1, &Region);
+
+		VkBufferMemoryBarrier Barrier;
+		ZeroVulkanMem(Barrier, VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER);
+		Barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		Barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+		Barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		Barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		Barrier.buffer = ReadbackBuffer.Buffer.Buffer;
+		Barrier.size = VK_WHOLE_SIZE;
+		vkCmdPipelineBarrier(CmdBuffer->CmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &Barrier, 0, nullptr);
+	}
+
+	void SaveReadback(SVulkan::SDevice& Device, const SVulkan::FSyncPoint& SyncPoint)
+	{
+		Device.WaitForSyncPoint(SyncPoint);
+		uint32 Width = OffscreenColor.Image.Width;
+		uint32 Height = OffscreenColor.Image.Height;
+		const uint8* Data = (const uint8*)ReadbackBuffer.Lock();
+		int Result = stbi_write_png(SavePNGFilename, (int)Width, (int)Height, 4, Data, (int)(Width * sizeof(uint32)));
+		ReadbackBuffer.Unlock();
+
+		::OutputDebugStringA(Result ? "*** Saved frame to " : "*** Unable to write ");
+		::OutputDebugStringA(SavePNGFilename);
+		::OutputDebugStringA("\n");
+	}
+
+	void RecreateDepthBuffer(SVulkan::SDevice& Device)
+	{
+		if (DepthBuffer.View != VK_NULL_HANDLE)
+		{
+			FImageWithMemAndView OldDepthBuffer = DepthBuffer;
+			Device.DeferDelete([OldDepthBuffer]() mutable { OldDepthBuffer.Destroy(); });
+			DepthBuffer = FImageWithMemAndView();
+		}
+
+		int32 Width = (int32)OffscreenColor.Image.Width, Height = (int32)OffscreenColor.Image.Height;
+		if (Window)
+		{
+			glfwGetFramebufferSize(Window, &Width, &Height);
+			glfwSetFramebufferSizeCallback(Window, ResizeCallback);
+		}
+		DepthBuffer.Create(Device, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, EMemLocation::GPU, (uint32)Width, (uint32)Height, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT);
+	}
+
+	void Destroy()
+	{
+		vkDestroySampler(ImGuiFont.Image.Device, LinearMipSampler, nullptr);
+		DefaultNormalMapTexture.Destroy();
+		DepthBuffer.Destroy();
+		GPUTiming.Destroy();
+		GPUProfiler.Destroy();
+		if (bHeadless)
+		{
+			OffscreenColor.Destroy();
+			if (SavePNGFilename)
+			{
+				ReadbackBuffer.Destroy();
+			}
+		}
+		if (bAsyncCompute)
+		{
+			ComputeTiming.Destroy();
+		}
+
+		WhiteTexture.Destroy();
+
+		if (BindlessMaterials.Buffer.Buffer != VK_NULL_HANDLE)
+		{
+			BindlessMaterials.Destroy();
+		}
+		Bindless.Destroy();
+
+		for (auto& Context : RecordContexts)
+		{
+			Context.DescriptorCache.Destroy();
+			Context.CmdPool.Destroy();
+		}
+		RecordContexts.clear();
+
+		DestroyFrames();
+
+		vkDestroySampler(ImGuiFont.Image.Device, ImGuiFontSampler, nullptr);
+		for (int32 Index = 0; Index < NUM_IMGUI_BUFFERS; ++Index)
+		{
+			ImGuiIB[Index].Destroy();
+			ImGuiVB[Index].Destroy();
+			ImGuiScaleTranslateUB[Index].Destroy();
+		}
+		ImGuiFont.Destroy();
+
+		Scene.Destroy();
+		TestCSUB.Destroy();
+		TestCSBuffer.Destroy();
+		ClipVB.Destroy();
+		ColorUB.Destroy();
+	}
+
+	void SetupImGuiAndResources(SVulkan::SDevice& Device)
+	{
+		IMGUI_CHECKVERSION();
+
+		ImGui::CreateContext();
+		ImGui::StyleColorsDark();
+
+		ImGuiIO& IO = ImGui::GetIO();
+		if (Window)
+		{
+			ImGui_ImplGlfw_InitForVulkan(Window, true);
+		}
+
+		int32 Width = 0, Height = 0;
+		unsigned char* Pixels = nullptr;
+		IO.Fonts->GetTexDataAsAlpha8(&Pixels, &Width, &Height);
+
+		FStagingBuffer* FontBuffer = GStagingBufferMgr.AcquireBuffer(Width * Height * sizeof(uint32), nullptr);
+		uint8* Data = (uint8*)FontBuffer->Buffer->Lock();
+		for (int32 Index = 0; Index < Width * Height; ++Index)
+		{
+			*Data++ = *Pixels;
+			*Data++ = *Pixels;
+			*Data++ = *Pixels;
+			*Data++ = *Pixels;
+			++Pixels;
+		}
+		FontBuffer->Buffer->Unlock();
+
+		ImGuiFont.Create(Device, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, EMemLocation::GPU, Width, Height, VK_FORMAT_R8G8B8A8_UNORM);
+		Device.SetDebugName(ImGuiFont.Image.Image, "ImGuiFont");
+
+		PendingOpsMgr.AddCopyBufferToImage(FontBuffer, ImGuiFont.Image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+		IO.Fonts->TexID = (void*)ImGuiFont.Image.Image;
+
+		const uint32 ImGuiVertexSize = sizeof(ImDrawVert) * ImGuiMaxVertices;
+		for (int32 Index = 0; Index < NUM_IMGUI_BUFFERS; ++Index)
+		{
+			ImGuiVB[Index].Create(Device, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, EMemLocation::CPU_TO_GPU, ImGuiVertexSize, true);
+			static_assert(sizeof(uint16) == sizeof(ImDrawIdx), "");
+			ImGuiIB[Index].Create(Device, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, EMemLocation::CPU_TO_GPU, ImGuiMaxIndices * sizeof(uint16), true);
+			ImGuiScaleTranslateUB[Index].Create(Device, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, EMemLocation::CPU_TO_GPU, (16 + 4) * sizeof(float), true);
+		}
+
+		{
+			VkSamplerCreateInfo Info;
+			ZeroVulkanMem(Info, VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO);
+			VERIFY_VKRESULT(vkCreateSampler(Device.Device, &Info, nullptr, &ImGuiFontSampler));
+		}
+
+		{
+			VkSamplerCreateInfo Info = { VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO, };
+			ZeroVulkanMem(Info, VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO);
+			Info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+			Info.magFilter = VK_FILTER_LINEAR;
+			Info.minFilter = VK_FILTER_LINEAR;
+			Info.maxLod = 1.0f;
+			VERIFY_VKRESULT(vkCreateSampler(Device.Device, &Info, nullptr, &LinearMipSampler));
+		}
+	}
+
+	void Update(SVulkan::SDevice& Device)
+	{
+		++FrameIndex;
+		GStagingBufferMgr.Refresh();
+		GUniformRing.Refresh();
+		GPSOCache.PublishCompiledPSOs();
+		NumSceneDraws.store(0, std::memory_order_relaxed);
+		NumSceneVertexBinds.store(0, std::memory_order_relaxed);
+		if (Benchmark.bEnabled && !BenchmarkPath.Keys.empty())
+		{
+			FVector2 Rot;
+			BenchmarkPath.Evaluate(Benchmark.GetProgress(), Camera.Pos, Rot);
+			Camera.Yaw = Rot.x;
+			Camera.Pitch = Rot.y;
+		}
+		Camera.UpdateMatrix();
+
+		if (LoadingState == ELoadingState::Loading)
+		{
+			if (IsGLTFLoaderFinished(GLTFLoader))
+			{
+				TryLoadGLTF(Device);
+			}
+		}
+	}
+
+	void ImGuiNewFrame()
+	{
+		// Headless only draws the UI, with DisplaySize and DeltaTime coming from Render()
+		if (Window)
+		{
+			ImGui_ImplGlfw_NewFrame();
+		}
+		ImGui::NewFrame();
+
+		// Setup time step
+		double current_time = GetTimeInMs() / 1000.0;
+		Time = current_time;
+
+		if (Window)
+		{
+			ProcessInput();
+		}
+	}
+
+	void ProcessInput()
+	{
+		bLMouseButtonHeld = (glfwGetMouseButton(Window, GLFW_MOUSE_BUTTON_1) == GLFW_PRESS);
+		bRMouseButtonHeld = (glfwGetMouseButton(Window, GLFW_MOUSE_BUTTON_2) == GLFW_PRESS);
+		//bCtrlHeld = bCtrlHeld || (glfwGetKey(Window, GLFW_KEY_LEFT_CONTROL) == GLFW_PRESS || glfwGetKey(Window, GLFW_KEY_RIGHT_CONTROL) == GLFW_PRESS);
+
+		if (glfwGetKey(Window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
+		{
+			glfwSetWindowShouldClose(Window, true);
+		}
+
+		if (ImGui::IsAnyWindowHovered())
+		{
+			bLMouseButtonHeld = false;
+			bRMouseButtonHeld = false;
+			return;
+		}
+
+		float CameraSpeed = 0.5f * (float)Time;
+
+		if (glfwGetKey(Window, GLFW_KEY_LEFT_SHIFT) == GLFW_PRESS || glfwGetKey(Window, GLFW_KEY_RIGHT_SHIFT) == GLFW_PRESS)
+		{
+			CameraSpeed *= 2.5f;
+		}
+
+
+		if (glfwGetKey(Window, GLFW_KEY_W) == GLFW_PRESS)
+		{
+			Camera.Pos += CameraSpeed * Camera.Front;
+		}
+
+		if (glfwGetKey(Window, GLFW_KEY_S) == GLFW_PRESS)
+		{
+			Camera.Pos -= CameraSpeed * Camera.Front;
+		}
+
+		if (glfwGetKey(Window, GLFW_KEY_A) == GLFW_PRESS)
+		{
+			Camera.Pos += FVector3::Cross(Camera.Front, Camera.Up).GetNormalized() * CameraSpeed;
+		}
+
+		if (glfwGetKey(Window, GLFW_KEY_D) == GLFW_PRESS)
+		{
+			Camera.Pos -= FVector3::Cross(Camera.Front, Camera.Up).GetNormalized() * CameraSpeed;
+		}
+/*
+		if (glfwGetKey(Window, GLFW_KEY_UP) == GLFW_PRESS)
+		{
+			Camera.Pos -= CameraSpeed * Camera.Front;
+		}
+
+		if (glfwGetKey(Window, GLFW_KEY_DOWN) == GLFW_PRESS)
+		{
+			Camera.Pos += CameraSpeed * Camera.Front;
+		}
+*/
+		const float RotSpeed = 1.0f;
+		if (glfwGetKey(Window, GLFW_KEY_LEFT) == GLFW_PRESS)
+		{
+			Camera.Yaw -= RotSpeed;
+		}
+
+		if (glfwGetKey(Window, GLFW_KEY_RIGHT) == GLFW_PRESS)
+		{
+			Camera.Yaw += RotSpeed;
+		}
+
+		if (glfwGetKey(Window, GLFW_KEY_PAGE_UP) == GLFW_PRESS)
+		{
+			Camera.Pos += Camera.Up * CameraSpeed;
+		}
+
+		if (glfwGetKey(Window, GLFW_KEY_PAGE_DOWN) == GLFW_PRESS)
+		{
+			Camera.Pos -= Camera.Up * CameraSpeed;
+		}
+	}
+
+	void DrawDataImGui(ImDrawData* DrawData, SVulkan::FCmdBuffer* CmdBuffer, SVulkan::FFramebuffer* Framebuffer)
+	{
+		if (DrawData->CmdListsCount > 0)
+		{
+			uint32 NumVertices = DrawData->TotalVtxCount;
+			uint32 NumIndices = DrawData->TotalIdxCount;
+			uint32 DestVBOffset = 0;
+			uint32 DestIBOffset = 0;
+			ImDrawVert* DestVBData = (ImDrawVert*)ImGuiVB[FrameIndex % NUM_IMGUI_BUFFERS].Lock();
+			uint16* DestIBData = (uint16*)ImGuiIB[FrameIndex % NUM_IMGUI_BUFFERS].Lock();
+			for (int32 Index = 0; Index < DrawData->CmdListsCount; ++Index)
+			{
+				const ImDrawList* CmdList = DrawData->CmdLists[Index];
+				const ImDrawVert* SrcVB = CmdList->VtxBuffer.Data;
+				const ImDrawIdx* SrcIB = CmdList->IdxBuffer.Data;
+
+				check(NumVertices + CmdList->VtxBuffer.Size <= ImGuiMaxVertices);
+				check(NumIndices + CmdList->IdxBuffer.Size <= ImGuiMaxIndices);
+
+				memcpy(DestIBData, SrcIB, CmdList->IdxBuffer.Size * sizeof(ImDrawIdx));
+				memcpy(DestVBData, SrcVB, CmdList->VtxBuffer.Size * sizeof(ImDrawVert));
+				
 				DestIBData += CmdList->IdxBuffer.Size;
 				DestVBData += CmdList->VtxBuffer.Size;
 			}
@@ -724,14 +1399,35 @@ struct FApp
 	FPendingOpsManager PendingOpsMgr;
 
 	FGLTFLoader* GLTFLoader = nullptr;
-
+	// Set while the loading thread streams geometry in, so the render thread can hand its batches over every frame
+	std::atomic<FGLTFLoader*> StreamingGLTFLoader = nullptr;
+	// Set on shutdown, after which nothing ticks the geometry uploads
+	std::atomic<bool> bCancelGLTFUploads = false;
+	FSceneMemPolicy SceneMemPolicy;
+	double LoadParseMs = 0;
+	double LoadCreateMs = 0;
+
+	// Parses the file and creates the scene's buffers and textures, splitting the work per prim over GJobSystem; the render
+	// thread only takes the finished scene over in TryLoadGLTF()
 	static void AsyncLoadingThread(FApp* This, std::string Filename)
 	{
 		This->LoadingState = ELoadingState::BeginLoading;
 
-		This->GLTFLoader = CreateGLTFLoader(Filename.c_str());
-		if (This->GLTFLoader)
+		double Begin = GetTimeInMs();
+		FGLTFLoader* Loader = CreateGLTFLoader(Filename.c_str(), !RCUtils::FCmdLine::Get().Contains("-gltfloadbenchbaseline"));
+		double Parsed = GetTimeInMs();
+		This->LoadParseMs = Parsed - Begin;
+		if (Loader)
 		{
+			This->StreamingGLTFLoader = Loader;
+			// Either this or Deinit() sees the other's write
+			if (This->bCancelGLTFUploads)
+			{
+				CancelGLTFUploads(Loader);
+			}
+			CreateGLTFGfxResources(Loader, GVulkan.Devices[GVulkan.PhysicalDevice], This->SceneMemPolicy, GPSOCache.DefaultAttributes.Buffer.Buffer, &GStagingBufferMgr, &GTextureUploader, &GJobSystem);
+			This->LoadCreateMs = GetTimeInMs() - Parsed;
+			This->GLTFLoader = Loader;
 			This->LoadingState = ELoadingState::Loading;
 		}
 		else
@@ -805,13 +1501,29 @@ struct FApp
 
 	void TryLoadGLTF(SVulkan::SDevice& Device)
 	{
-		//double StartTime = glfwGetTime();
-		CreateGLTFGfxResources(GLTFLoader, Device, GPSOCache, Scene, PendingOpsMgr, &GStagingBufferMgr);
-		LoadingState = ELoadingState::FinishedLoading;
+		double StartTime = GetTimeInMs();
+		StreamingGLTFLoader = nullptr;
+		MoveGLTFScene(GLTFLoader, GPSOCache, PendingOpsMgr, Scene);
 		LoadedGLTF = GetGLTFFilename(GLTFLoader);
 		FreeGLTFLoader(GLTFLoader);
 		GLTFLoader = nullptr;
+		{
+			// Peak commit covers the parsed copies as well as the staging and CPU_TO_GPU buffers
+			PROCESS_MEMORY_COUNTERS MemCounters;
+			ZeroMem(MemCounters);
+			::GetProcessMemoryInfo(::GetCurrentProcess(), &MemCounters, sizeof(MemCounters));
+			std::stringstream ss;
+			ss << "*** Loaded " << LoadedGLTF << ": parsed in " << (float)LoadParseMs << "ms, GPU resources in " << (float)LoadCreateMs << "ms on " << GJobSystem.GetNumWorkers() << " workers, handoff " << (float)(GetTimeInMs() - StartTime) << "ms, peak commit " << (MemCounters.PeakPagefileUsage >> 20) << "MB\n";
+			ss.flush();
+			::OutputDebugStringA(ss.str().c_str());
+		}
+
+		if (bBindless)
+		{
+			SetupBindlessMaterials(Device);
+		}
 
+		if (Window)
 		{
 			std::stringstream ss;
 			ss << "VkTest2 - " << LoadedGLTF;
@@ -840,6 +1552,79 @@ struct FApp
 				FixGLTFVertexDecl(TestGLTFVS->Shader, Prim.VertexDecl);
 			}
 		}
+
+		PrewarmScenePSOs();
+		GPSOCache.LogPipelineCacheBench("scene prewarm");
+		LoadingState = ELoadingState::FinishedLoading;
+	}
+
+	// Gives every scene texture a slot and uploads the per material slots; falls back to per draw descriptors if the textures don't fit
+	void SetupBindlessMaterials(SVulkan::SDevice& Device)
+	{
+		std::vector<int32> TextureSlots;
+		for (auto& Texture : Scene.Textures)
+		{
+			int32 Slot = Bindless.AddTexture(Texture.Image);
+			if (Slot == -1)
+			{
+				::OutputDebugStringA("*** Too many textures for the bindless set, ignoring -bindless\n");
+				bBindless = false;
+				return;
+			}
+			TextureSlots.push_back(Slot);
+		}
+
+		auto GetSlot = [&](int32 Texture, int32 DefaultSlot)
+		{
+			return Texture == -1 ? DefaultSlot : TextureSlots[Texture];
+		};
+
+		// The default material goes last, see GetPrimMaterialIndex()
+		uint32 NumMaterials = (uint32)Scene.Materials.size() + 1;
+		BindlessMaterials.Create(Device, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, EMemLocation::CPU_TO_GPU, NumMaterials * sizeof(FIntVector4), true);
+		{
+			// Matches FMaterial in TestMesh.hlsl
+			FIntVector4* Data = (FIntVector4*)BindlessMaterials.Lock();
+			for (auto& Material : Scene.Materials)
+			{
+				*Data++ = {GetSlot(Material.BaseColor, BindlessWhiteTexture), GetSlot(Material.Normal, BindlessDefaultNormalMap), GetSlot(Material.MetallicRoughness, BindlessWhiteTexture), 0};
+			}
+			*Data = {BindlessWhiteTexture, BindlessDefaultNormalMap, BindlessWhiteTexture, 0};
+			BindlessMaterials.Unlock();
+		}
+		Bindless.SetMaterials(BindlessMaterials);
+	}
+
+	FPSOCache::FPSOHandle GetScenePSO() const
+	{
+		return bBindless ? TestGLTFBindlessPSO : TestGLTFPSO;
+	}
+
+	// Build every TestGLTFPSO variant DrawScene will ask for so the first frames don't stall on pipeline creation
+	void PrewarmScenePSOs()
+	{
+		double StartTime = GetTimeInMs();
+		std::set<FPSOCache::FPSOSecondHandle> SecondHandles;
+		for (auto& Mesh : Scene.Meshes)
+		{
+			for (auto& Prim : Mesh.Prims)
+			{
+				const FScene::FMaterial* Material = GetPrimMaterial(Prim);
+				bool bDoubleSided = Material && Material->bDoubleSided;
+				SecondHandles.insert(FPSOCache::FPSOSecondHandle(Prim.VertexDecl, 
+					(bDoubleSided ? EPSODoubleSided : 0) |
+					(g_bWireframe ? EPSOWireFrame : 0)));
+			}
+		}
+
+		uint32 NumCreated = GPSOCache.PrewarmGfxPSOs(GetScenePSO(), SecondHandles);
+		double EndTime = GetTimeInMs();
+		{
+			std::stringstream ss;
+			ss << "Prewarmed " << NumCreated << " of " << SecondHandles.size() << " PSOs in " << (float)(EndTime - StartTime) << "ms\n";
+			ss.flush();
+			::OutputDebugStringA(ss.str().c_str());
+		}
 	}
 
 	struct : FCamera
@@ -874,6 +1659,7 @@ struct FApp
 	struct FObjUB
 	{
 		FMatrix4x4 ObjMtx;
+		FIntVector4 Material;
 	};
 
 	bool IsVisible(FScene::FPrim& Prim, FMatrix4x4 ObjToWorldMtx)
@@ -897,20 +1683,55 @@ struct FApp
 		return true;
 	}
 
-	FStagingBuffer* GetObjUB(SVulkan::FCmdBuffer* CmdBuffer, FMatrix4x4 ObjectMatrix = FMatrix4x4::GetIdentity())
+	FObjUB GetObjUBStruct(FMatrix4x4 ObjectMatrix = FMatrix4x4::GetIdentity(), int32 Material = 0)
 	{
 		FObjUB ObjUB;
 		ObjUB.ObjMtx = ObjectMatrix;
-		FStagingBuffer* ObjBuffer = GStagingBufferMgr.AcquireBuffer(sizeof(ObjUB), CmdBuffer);
-		*(FObjUB*)ObjBuffer->Buffer->Lock() = ObjUB;
-		ObjBuffer->Buffer->Unlock();
-		return ObjBuffer;
+		ObjUB.Material = {Material, 0, 0, 0};
+		return ObjUB;
+	}
+
+	// Filled by CullScene(): one entry per prim of every instance, the prims of instance N start at InstanceFirstPrim[N]
+	std::vector<uint32> InstanceFirstPrim;
+	std::vector<uint8> PrimVisibility;
+
+	void CullScene()
+	{
+		uint32 NumInstances = (uint32)Scene.Instances.size();
+		InstanceFirstPrim.resize(NumInstances);
+		uint32 NumPrims = 0;
+		for (uint32 Index = 0; Index < NumInstances; ++Index)
+		{
+			InstanceFirstPrim[Index] = NumPrims;
+			NumPrims += (uint32)Scene.Meshes[Scene.Instances[Index].Mesh].Prims.size();
+		}
+		PrimVisibility.resize(NumPrims);
+
+		GJobSystem.ParallelFor(NumInstances, 64, [this](uint32 InstanceIndex)
+			{
+				auto& Instance = Scene.Instances[InstanceIndex];
+				FMatrix4x4 ObjectMatrix = FMatrix4x4::GetIdentity();
+				ObjectMatrix.Rows[3] = Instance.Pos;
+				uint8* PrimVisible = PrimVisibility.data() + InstanceFirstPrim[InstanceIndex];
+				for (auto& Prim : Scene.Meshes[Instance.Mesh].Prims)
+				{
+					*PrimVisible++ = IsVisible(Prim, ObjectMatrix) ? 1 : 0;
+				}
+			});
+	}
+
+	FRingAllocation GetObjUB(FMatrix4x4 ObjectMatrix = FMatrix4x4::GetIdentity(), int32 Material = 0)
+	{
+		return GUniformRing.Allocate(GetObjUBStruct(ObjectMatrix, Material));
 	}
 
 	FViewUB GetViewUBStruct()
 	{
-		int W = 0, H = 1;
-		glfwGetWindowSize(Window, &W, &H);
+		int W = (int)OffscreenColor.Image.Width, H = (int)OffscreenColor.Image.Height;
+		if (Window)
+		{
+			glfwGetWindowSize(Window, &W, &H);
+		}
 		float FOVRadians = tan(ToRadians(Camera.FOVNearFar.x));
 
 		FViewUB ViewUB;
@@ -924,13 +1745,9 @@ struct FApp
 		return ViewUB;
 	}
 
-	FStagingBuffer* GetViewUB(SVulkan::FCmdBuffer* CmdBuffer)
+	FRingAllocation GetViewUB()
 	{
-		FViewUB ViewUB = GetViewUBStruct();
-		FStagingBuffer* ViewBuffer = GStagingBufferMgr.AcquireBuffer(sizeof(ViewUB), CmdBuffer);
-		*(FViewUB*)ViewBuffer->Buffer->Lock() = ViewUB;
-		ViewBuffer->Buffer->Unlock();
-		return ViewBuffer;
+		return GUniformRing.Allocate(GetViewUBStruct());
 	}
 
 	void DrawScene(SVulkan::SDevice& Device, SVulkan::FCmdBuffer* CmdBuffer)
@@ -950,94 +1767,318 @@ struct FApp
 			DeltaRot = 0;
 		}
 */
-		FStagingBuffer* ViewBuffer = GetViewUB(CmdBuffer);
+		FRingAllocation ViewBuffer = GetViewUB();
+		CullScene();
+		DrawInstances(Device, CmdBuffer, GDescriptorCache, 0, (uint32)Scene.Instances.size(), ViewBuffer, nullptr);
+
+		FRingAllocation ObjBuffer = GetObjUB();
+		RenderPointLight(CmdBuffer, ViewBuffer, ObjBuffer);
+	}
 
-		for (auto& Instance : Scene.Instances)
+	// nullptr for prims without a material (-1 in glTF)
+	const FScene::FMaterial* GetPrimMaterial(const FScene::FPrim& Prim) const
+	{
+		return Prim.Material == -1 ? nullptr : &Scene.Materials[Prim.Material];
+	}
+
+	// What the shaders index the bindless materials with; prims without a material get the default one after the scene's
+	int32 GetPrimMaterialIndex(const FScene::FPrim& Prim) const
+	{
+		return Prim.Material == -1 ? (int32)Scene.Materials.size() : Prim.Material;
+	}
+
+	FImageWithMemAndView& GetSceneTexture(int32 Texture, FImageWithMemAndView& Default)
+	{
+		return Scene.Textures.empty() || Texture == -1 ? Default : Scene.Textures[Texture].Image;
+	}
+
+	void SetPrimTextures(FDescriptorPSOCache& Cache, const FScene::FPrim& Prim, FShaderParameter BaseTexture, FShaderParameter NormalTexture, FShaderParameter MetallicRoughnessTexture)
+	{
+		const FScene::FMaterial* Material = GetPrimMaterial(Prim);
+		Cache.SetImage(BaseTexture, GetSceneTexture(Material ? Material->BaseColor : -1, WhiteTexture), LinearMipSampler);
+		Cache.SetImage(NormalTexture, GetSceneTexture(Material ? Material->Normal : -1, DefaultNormalMapTexture), LinearMipSampler);
+		Cache.SetImage(MetallicRoughnessTexture, GetSceneTexture(Material ? Material->MetallicRoughness : -1, WhiteTexture), LinearMipSampler);
+	}
+
+	FPSOCache::FGfxPSOVariantHandle& GetPrimPSOVariant(FScene::FPrim& Prim, FPSOCache::FPSOHandle ScenePSO)
+	{
+		FPSOCache::FGfxPSOVariantHandle& PSOVariant = Prim.PSOVariants[g_bWireframe ? 1 : 0];
+		if (!PSOVariant.IsValid())
 		{
-			std::stringstream ss;
-			ss << "InstanceID " << Instance.ID;
-			ss.flush();
-			FMarkerScope MarkerScope(Device, CmdBuffer, ss.str().c_str());
+			const FScene::FMaterial* Material = GetPrimMaterial(Prim);
+			PSOVariant = GPSOCache.TryGetGfxPSOVariant(ScenePSO, 
+				FPSOCache::FPSOSecondHandle(Prim.VertexDecl, 
+					(Material && Material->bDoubleSided ? EPSODoubleSided : 0) |
+					(g_bWireframe ? EPSOWireFrame : 0))
+				);
+		}
+		return PSOVariant;
+	}
+
+	// A visible prim's draw; DrawInstances() gathers them first so they can be recorded sorted by vertex group, then pipeline
+	struct FSceneDraw
+	{
+		uint64 SortKey = 0;
+		FScene::FPrim* Prim = nullptr;
+		FPSOCache::FGfxPSOVariantHandle PSOVariant;
+		FRingAllocation ObjBuffer;
+		uint32 InstanceID = 0;
+	};
 
+	// With an ObjAllocator this runs on a worker thread: PSO variants have to be resolved already, per draw uniforms come
+	// out of ObjAllocator and the bounds are left to DrawSceneOverlays()
+	void DrawInstances(SVulkan::SDevice& Device, SVulkan::FCmdBuffer* CmdBuffer, FDescriptorCache& DescriptorCache, uint32 FirstInstance, uint32 NumInstances, const FRingAllocation& ViewBuffer, FRingSubAllocator* ObjAllocator)
+	{
+		FPSOCache::FPSOHandle ScenePSO = GetScenePSO();
+		std::vector<FSceneDraw> Draws;
+		std::vector<std::pair<const FScene::FPrim*, FRingAllocation>> Bounds;
+		for (uint32 InstanceIndex = FirstInstance; InstanceIndex < FirstInstance + NumInstances; ++InstanceIndex)
+		{
+			auto& Instance = Scene.Instances[InstanceIndex];
 			auto& Mesh = Scene.Meshes[Instance.Mesh];
+			const uint8* PrimVisible = PrimVisibility.data() + InstanceFirstPrim[InstanceIndex];
 			for (auto& Prim : Mesh.Prims)
 			{
-				std::stringstream ss2;
-				ss2 << "PrimID " << Prim.ID;
-				ss2.flush();
-				FMarkerScope MarkerScope(Device, CmdBuffer, ss2.str().c_str());
-
+				bool bVisible = *PrimVisible++ != 0;
 				FMatrix4x4 ObjectMatrix = FMatrix4x4::GetIdentity();//FMatrix4x4::GetRotationZ(ToRadians(180));
 																	//ObjectMatrix *= FMatrix4x4::GetScale(Instance.Scale);
 				ObjectMatrix.Rows[3] = Instance.Pos;
 				//float RotateObjectAngle = 0;
 				//ObjectMatrix *= FMatrix4x4::GetRotationY(RotateObjectAngle);
-				FStagingBuffer* ObjBuffer = GetObjUB(CmdBuffer, ObjectMatrix);
-
-				if (Prim.ID == 96)
+				// Culled prims only need one for their bounds, which ObjAllocator doesn't have room for
+				FRingAllocation ObjBuffer;
+				if (bVisible)
+				{
+					ObjBuffer = ObjAllocator ? ObjAllocator->Allocate(GetObjUBStruct(ObjectMatrix, GetPrimMaterialIndex(Prim))) : GetObjUB(ObjectMatrix, GetPrimMaterialIndex(Prim));
+				}
+				else if (bShowBounds && !ObjAllocator)
 				{
-					int i = 0;
-					++i;
+					ObjBuffer = GetObjUB(ObjectMatrix, GetPrimMaterialIndex(Prim));
 				}
 
-				if (IsVisible(Prim, ObjectMatrix))
+				if (bVisible)
 				{
-					SVulkan::FGfxPSO* PSO = GPSOCache.GetGfxPSO(TestGLTFPSO, 
-						FPSOCache::FPSOSecondHandle(Prim.VertexDecl, 
-							(Scene.Materials[Prim.Material].bDoubleSided ? EPSODoubleSided : 0) |
-							(g_bWireframe ? EPSOWireFrame : 0))
-						);
-					vkCmdBindPipeline(CmdBuffer->CmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, PSO->Pipeline);
-					GVulkan.Swapchain.SetViewportAndScissor(CmdBuffer);
-					std::vector<VkBuffer> VBs;
-	#if SCENE_USE_SINGLE_BUFFERS
-					vkCmdBindIndexBuffer(CmdBuffer->CmdBuffer, Prim.IndexBuffer.Buffer.Buffer, 0, Prim.IndexType);
-					std::vector<VkDeviceSize> VertexOffsets;
-					for (auto VB : Prim.VertexBuffers)
+					FPSOCache::FGfxPSOVariantHandle PSOVariant = ObjAllocator ? Prim.PSOVariants[g_bWireframe ? 1 : 0] : GetPrimPSOVariant(Prim, ScenePSO);
+					// Still compiling with -asyncpso; skip the draw
+					if (GPSOCache.GetGfxPSO(PSOVariant)->Pipeline != VK_NULL_HANDLE)
 					{
-						VBs.push_back(VB.Buffer.Buffer);
-						VertexOffsets.push_back(0);
-					}
-					vkCmdBindVertexBuffers(CmdBuffer->CmdBuffer, 0, (uint32)VBs.size(), VBs.data(), VertexOffsets.data());
-	#else
-					SVulkan::FBuffer& IB = Scene.Buffers[Prim.IndexBuffer].Buffer;
-					vkCmdBindIndexBuffer(CmdBuffer->CmdBuffer, IB.Buffer, Prim.IndexOffset, Prim.IndexType);
-					for (int VBIndex : Prim.VertexBuffers)
-					{
-						VBs.push_back(Scene.Buffers[VBIndex].Buffer.Buffer);
-					}
-					check(VBs.size() == Prim.VertexOffsets.size());
-					vkCmdBindVertexBuffers(CmdBuffer->CmdBuffer, 0, (uint32)VBs.size(), VBs.data(), Prim.VertexOffsets.data());
-	#endif
-					{
-						FDescriptorPSOCache Cache(PSO);
-						Cache.SetUniformBuffer("ViewUB", *ViewBuffer->Buffer);
-						Cache.SetUniformBuffer("ObjUB", *ObjBuffer->Buffer);
-						Cache.SetSampler("SS", LinearMipSampler);
-						Cache.SetImage("BaseTexture", Scene.Textures.empty() || Scene.Materials[Prim.Material].BaseColor == -1 ? WhiteTexture : Scene.Textures[Scene.Materials[Prim.Material].BaseColor].Image, LinearMipSampler);
-						Cache.SetImage("NormalTexture", Scene.Textures.empty() || Scene.Materials[Prim.Material].Normal == -1 ? DefaultNormalMapTexture : Scene.Textures[Scene.Materials[Prim.Material].Normal].Image, LinearMipSampler);
-						Cache.SetImage("MetallicRoughnessTexture", Scene.Textures.empty() || Scene.Materials[Prim.Material].MetallicRoughness == -1 ? WhiteTexture : Scene.Textures[Scene.Materials[Prim.Material].MetallicRoughness].Image, LinearMipSampler);
-						Cache.UpdateDescriptors(GDescriptorCache, CmdBuffer);
+						FSceneDraw Draw;
+#if SCENE_USE_SINGLE_BUFFERS
+						Draw.SortKey = (uint32)PSOVariant.Index;
+#else
+						Draw.SortKey = ((uint64)(uint32)Prim.VertexGroup << 32) | (uint32)PSOVariant.Index;
+#endif
+						Draw.Prim = &Prim;
+						Draw.PSOVariant = PSOVariant;
+						Draw.ObjBuffer = ObjBuffer;
+						Draw.InstanceID = Instance.ID;
+						Draws.push_back(Draw);
 					}
+				}
 
-					if (!bForceCull)
-					{
-						vkCmdDrawIndexed(CmdBuffer->CmdBuffer, Prim.NumIndices, 1, 0, 0, 0);
-					}
+				if (bShowBounds && !ObjAllocator)
+				{
+					Bounds.push_back(std::make_pair(&Prim, ObjBuffer));
 				}
+			}
+		}
+
+		std::sort(Draws.begin(), Draws.end(), [](const FSceneDraw& A, const FSceneDraw& B) { return A.SortKey < B.SortKey; });
+
+		// Layout Bindless.Set was last bound with; only needs binding again when the pipeline layout changes
+		VkPipelineLayout BindlessLayout = VK_NULL_HANDLE;
+		VkPipeline BoundPipeline = VK_NULL_HANDLE;
+#if !SCENE_USE_SINGLE_BUFFERS
+		// Same for the vertex group's buffers, and the index type the IB was bound with
+		int BoundVertexGroup = -1;
+		VkIndexType BoundIndexType = VK_INDEX_TYPE_MAX_ENUM;
+#endif
+		uint32 NumDraws = 0;
+		uint32 NumVertexBinds = 0;
+		for (const FSceneDraw& Draw : Draws)
+		{
+			const FScene::FPrim& Prim = *Draw.Prim;
+			std::stringstream ss;
+			ss << "InstanceID " << Draw.InstanceID << " PrimID " << Prim.ID;
+			ss.flush();
+			FMarkerScope MarkerScope(Device, CmdBuffer, ss.str().c_str());
 
-				if (bShowBounds)
+			SVulkan::FGfxPSO* PSO = GPSOCache.GetGfxPSO(Draw.PSOVariant);
+			if (PSO->Pipeline != BoundPipeline)
+			{
+				vkCmdBindPipeline(CmdBuffer->CmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, PSO->Pipeline);
+				SetViewportAndScissor(CmdBuffer);
+				BoundPipeline = PSO->Pipeline;
+			}
+#if SCENE_USE_SINGLE_BUFFERS
+			vkCmdBindIndexBuffer(CmdBuffer->CmdBuffer, Prim.IndexBuffer.Buffer.Buffer, 0, Prim.IndexType);
+			vkCmdBindVertexBuffers(CmdBuffer->CmdBuffer, 0, (uint32)Prim.BindingBuffers.size(), Prim.BindingBuffers.data(), Prim.BindingOffsets.data());
+			++NumVertexBinds;
+#else
+			const FScene::FVertexGroup& Group = Scene.VertexGroups[Prim.VertexGroup];
+			if (Prim.VertexGroup != BoundVertexGroup || Prim.IndexType != BoundIndexType)
+			{
+				vkCmdBindIndexBuffer(CmdBuffer->CmdBuffer, Scene.Buffers[Group.IndexBuffer].Buffer.Buffer, 0, Prim.IndexType);
+				BoundIndexType = Prim.IndexType;
+			}
+			if (Prim.VertexGroup != BoundVertexGroup)
+			{
+				vkCmdBindVertexBuffers(CmdBuffer->CmdBuffer, 0, (uint32)Group.BindingBuffers.size(), Group.BindingBuffers.data(), Group.BindingOffsets.data());
+				BoundVertexGroup = Prim.VertexGroup;
+				++NumVertexBinds;
+			}
+#endif
+			if (bBindless)
+			{
+				if (BindlessLayout != PSO->Layout)
 				{
-					RenderBoundingBox(CmdBuffer, Prim, ViewBuffer, ObjBuffer);
+					vkCmdBindDescriptorSets(CmdBuffer->CmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, PSO->Layout, BINDLESS_SET, 1, &Bindless.Set, 0, nullptr);
+					BindlessLayout = PSO->Layout;
 				}
+
+				FDescriptorPSOCache Cache(PSO);
+				Cache.SetUniformBuffer(TestGLTFBindlessParams.ViewUB, ViewBuffer);
+				Cache.SetUniformBuffer(TestGLTFBindlessParams.ObjUB, Draw.ObjBuffer);
+				Cache.SetSampler(TestGLTFBindlessParams.SS, LinearMipSampler);
+				Cache.UpdateDescriptors(DescriptorCache, CmdBuffer);
+			}
+			else
+			{
+				FDescriptorPSOCache Cache(PSO);
+				Cache.SetUniformBuffer(TestGLTFParams.ViewUB, ViewBuffer);
+				Cache.SetUniformBuffer(TestGLTFParams.ObjUB, Draw.ObjBuffer);
+				Cache.SetSampler(TestGLTFParams.SS, LinearMipSampler);
+				SetPrimTextures(Cache, Prim, TestGLTFParams.BaseTexture, TestGLTFParams.NormalTexture, TestGLTFParams.MetallicRoughnessTexture);
+				Cache.UpdateDescriptors(DescriptorCache, CmdBuffer);
+			}
+
+			if (!bForceCull)
+			{
+#if SCENE_USE_SINGLE_BUFFERS
+				vkCmdDrawIndexed(CmdBuffer->CmdBuffer, Prim.NumIndices, 1, 0, 0, 0);
+#else
+				vkCmdDrawIndexed(CmdBuffer->CmdBuffer, Prim.NumIndices, 1, Prim.FirstIndex, Prim.BaseVertex, 0);
+#endif
+				++NumDraws;
 			}
 		}
 
-		FObjUB ObjUB;
-		ObjUB.ObjMtx = FMatrix4x4::GetIdentity();
-		FStagingBuffer* ObjBuffer = GStagingBufferMgr.AcquireBuffer(sizeof(ObjUB), CmdBuffer);
-		*(FObjUB*)ObjBuffer->Buffer->Lock() = ObjUB;
-		ObjBuffer->Buffer->Unlock();
+		// After all the prims, as they rebind everything
+		for (auto& Pair : Bounds)
+		{
+			RenderBoundingBox(CmdBuffer, *Pair.first, ViewBuffer, Pair.second);
+		}
+		NumSceneDraws.fetch_add(NumDraws, std::memory_order_relaxed);
+		NumSceneVertexBinds.fetch_add(NumVertexBinds, std::memory_order_relaxed);
+	}
+
+	// Has to be called in a render pass begun with VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS
+	void DrawSceneParallel(SVulkan::SDevice& Device, SVulkan::FCmdBuffer* CmdBuffer, SVulkan::FFramebuffer* Framebuffer)
+	{
+		double StartTime = GetTimeInMs();
+		FRingAllocation ViewBuffer = GetViewUB();
+
+		// The workers only read the PSO cache
+		FPSOCache::FPSOHandle ScenePSO = GetScenePSO();
+		for (auto& Mesh : Scene.Meshes)
+		{
+			for (auto& Prim : Mesh.Prims)
+			{
+				GetPrimPSOVariant(Prim, ScenePSO);
+			}
+		}
+
+		CullScene();
+
+		FJobCounter RecordJobs;
+		uint32 NumInstances = (uint32)Scene.Instances.size();
+		uint32 NumChunks = std::max(1u, std::min(NumRecordThreads, NumInstances));
+		auto GetFirstPrim = [&](uint32 InstanceIndex)
+		{
+			return InstanceIndex < NumInstances ? InstanceFirstPrim[InstanceIndex] : (uint32)PrimVisibility.size();
+		};
+		uint32 FirstInstance = 0;
+		for (uint32 Index = 0; Index < NumChunks; ++Index)
+		{
+			uint32 NumChunkInstances = (NumInstances - FirstInstance) / (NumChunks - Index);
+			uint32 NumVisiblePrims = (uint32)std::count(PrimVisibility.begin() + GetFirstPrim(FirstInstance), PrimVisibility.begin() + GetFirstPrim(FirstInstance + NumChunkInstances), (uint8)1);
+
+			// One ring allocation per chunk, sized for the prims that passed culling; the job carves their ObjUBs out of it
+			FRingSubAllocator ObjAllocator;
+			if (NumVisiblePrims > 0)
+			{
+				ObjAllocator = FRingSubAllocator(GUniformRing.Allocate(FRingSubAllocator::GetBlockSize(NumVisiblePrims, sizeof(FObjUB), GUniformRing.Alignment)), GUniformRing.Alignment);
+			}
+			FRecordContext& Context = RecordContexts[Index];
+			GJobSystem.AddJob([this, &Device, &Context, CmdBuffer, Framebuffer, FirstInstance, NumChunkInstances, ViewBuffer, ObjAllocator]() mutable
+				{
+					Context.CmdBuffer = Context.CmdPool.BeginSecondary(CmdBuffer, Framebuffer);
+					DrawInstances(Device, Context.CmdBuffer, Context.DescriptorCache, FirstInstance, NumChunkInstances, ViewBuffer, &ObjAllocator);
+					Context.CmdBuffer->End();
+				}, &RecordJobs);
+
+			FirstInstance += NumChunkInstances;
+		}
+		GJobSystem.Wait(RecordJobs);
+
+		std::vector<SVulkan::FCmdBuffer*> Secondaries;
+		for (uint32 Index = 0; Index < NumChunks; ++Index)
+		{
+			Secondaries.push_back(RecordContexts[Index].CmdBuffer);
+		}
+		CmdBuffer->ExecuteCommands((uint32)Secondaries.size(), Secondaries.data());
+
+		RecordTimeMs = GetTimeInMs() - StartTime;
+		if (RecordBench.bEnabled)
+		{
+			UpdateRecordBench();
+		}
+	}
+
+	void UpdateRecordBench()
+	{
+		RecordBench.TotalMs += RecordTimeMs;
+		if (++RecordBench.NumFrames < RecordBenchFrames)
+		{
+			return;
+		}
+
+		char s[128];
+		sprintf(s, "*** Record bench: %d threads, %d instances, %f ms\n", NumRecordThreads, (int)Scene.Instances.size(), (float)(RecordBench.TotalMs / RecordBench.NumFrames));
+		::OutputDebugStringA(s);
+
+		RecordBench.NumFrames = 0;
+		RecordBench.TotalMs = 0;
+		if (NumRecordThreads < (uint32)RecordContexts.size())
+		{
+			++NumRecordThreads;
+		}
+		else
+		{
+			RecordBench.bEnabled = false;
+		}
+	}
+
+	// What DrawScene() records besides the prims; these use the global caches, so with -parallelrecord they go inline after the secondaries
+	void DrawSceneOverlays(SVulkan::SDevice& Device, SVulkan::FCmdBuffer* CmdBuffer)
+	{
+		SetViewportAndScissor(CmdBuffer);
+		FRingAllocation ViewBuffer = GetViewUB();
+		if (bShowBounds)
+		{
+			FMarkerScope MarkerScope(&Device, CmdBuffer, "Bounds");
+			for (auto& Instance : Scene.Instances)
+			{
+				FMatrix4x4 ObjectMatrix = FMatrix4x4::GetIdentity();
+				ObjectMatrix.Rows[3] = Instance.Pos;
+				for (auto& Prim : Scene.Meshes[Instance.Mesh].Prims)
+				{
+					RenderBoundingBox(CmdBuffer, Prim, ViewBuffer, GetObjUB(ObjectMatrix, GetPrimMaterialIndex(Prim)));
+				}
+			}
+		}
+
+		FRingAllocation ObjBuffer = GetObjUB();
 		RenderPointLight(CmdBuffer, ViewBuffer, ObjBuffer);
 	}
 
@@ -1056,7 +2097,7 @@ struct FApp
 		return NewDecl;
 	}
 
-	void RenderSphere(SVulkan::FCmdBuffer* CmdBuffer, FStagingBuffer* ViewBuffer, FStagingBuffer* ObjBuffer, FVector3 Pos, float Radius, uint32 Color)
+	void RenderSphere(SVulkan::FCmdBuffer* CmdBuffer, const FRingAllocation& ViewBuffer, const FRingAllocation& ObjBuffer, FVector3 Pos, float Radius, uint32 Color)
 	{
 		int NumIndices = 20 * 3;
 		FStagingBuffer* VB = GStagingBufferMgr.AcquireBuffer(12 * sizeof(FUnlitVertex), CmdBuffer);
@@ -1070,8 +2111,8 @@ struct FApp
 		vkCmdBindVertexBuffers(CmdBuffer->CmdBuffer, 0, 1, &VB->Buffer->Buffer.Buffer, VBs);
 		{
 			FDescriptorPSOCache Cache(PSO);
-			Cache.SetUniformBuffer("ViewUB", *ViewBuffer->Buffer);
-			Cache.SetUniformBuffer("ObjUB", *ObjBuffer->Buffer);
+			Cache.SetUniformBuffer("ViewUB", ViewBuffer);
+			Cache.SetUniformBuffer("ObjUB", ObjBuffer);
 			Cache.SetSampler("SS", LinearMipSampler);
 			Cache.UpdateDescriptors(GDescriptorCache, CmdBuffer);
 		}
@@ -1079,12 +2120,12 @@ struct FApp
 		vkCmdDrawIndexed(CmdBuffer->CmdBuffer, NumIndices, 1, 0, 0, 0);
 	}
 
-	void RenderPointLight(SVulkan::FCmdBuffer* CmdBuffer, FStagingBuffer* ViewBuffer, FStagingBuffer* ObjBuffer)
+	void RenderPointLight(SVulkan::FCmdBuffer* CmdBuffer, const FRingAllocation& ViewBuffer, const FRingAllocation& ObjBuffer)
 	{
 		RenderSphere(CmdBuffer, ViewBuffer, ObjBuffer, PointLight.GetVector3(), 10, 0xff0000ff);
 	}
 
-	void RenderBoundingBox(SVulkan::FCmdBuffer* CmdBuffer, const FScene::FPrim& Prim, FStagingBuffer* ViewBuffer, FStagingBuffer* ObjBuffer)
+	void RenderBoundingBox(SVulkan::FCmdBuffer* CmdBuffer, const FScene::FPrim& Prim, const FRingAllocation& ViewBuffer, const FRingAllocation& ObjBuffer)
 	{
 		int NumIndices = 12 * 2;
 		FStagingBuffer* VB = GStagingBufferMgr.AcquireBuffer(8 * sizeof(FUnlitVertex), CmdBuffer);
@@ -1098,12 +2139,10 @@ struct FApp
 		vkCmdBindVertexBuffers(CmdBuffer->CmdBuffer, 0, 1, &VB->Buffer->Buffer.Buffer, VBs);
 		{
 			FDescriptorPSOCache Cache(PSO);
-			Cache.SetUniformBuffer("ViewUB", *ViewBuffer->Buffer);
-			Cache.SetUniformBuffer("ObjUB", *ObjBuffer->Buffer);
+			Cache.SetUniformBuffer("ViewUB", ViewBuffer);
+			Cache.SetUniformBuffer("ObjUB", ObjBuffer);
 			Cache.SetSampler("SS", LinearMipSampler);
-			Cache.SetImage("BaseTexture", Scene.Textures.empty() || Scene.Materials[Prim.Material].BaseColor == -1 ? WhiteTexture : Scene.Textures[Scene.Materials[Prim.Material].BaseColor].Image, LinearMipSampler);
-			Cache.SetImage("NormalTexture", Scene.Textures.empty() || Scene.Materials[Prim.Material].Normal == -1 ? DefaultNormalMapTexture : Scene.Textures[Scene.Materials[Prim.Material].Normal].Image, LinearMipSampler);
-			Cache.SetImage("MetallicRoughnessTexture", Scene.Textures.empty() || Scene.Materials[Prim.Material].MetallicRoughness == -1 ? WhiteTexture : Scene.Textures[Scene.Materials[Prim.Material].MetallicRoughness].Image, LinearMipSampler);
+			SetPrimTextures(Cache, Prim, Cache.GetParameter("BaseTexture"), Cache.GetParameter("NormalTexture"), Cache.GetParameter("MetallicRoughnessTexture"));
 			Cache.UpdateDescriptors(GDescriptorCache, CmdBuffer);
 		}
 
@@ -1119,21 +2158,34 @@ struct FApp
 			glfwGetFramebufferSize(Window, &W, &H);
 			glfwWaitEvents();
 		}
-		Device.WaitForIdle();
 
-		Swapchain.Recreate(Device, Window);
+		// Render() checks bResizeSwapchain before acquiring, and a failed acquire doesn't signal, so the semaphore is unused
+		Swapchain.Recreate(Device, Window, GetCurrentFrame().AcquireSemaphore);
+
+		// The image count can change; like the old swapchain, the old semaphores go once the frames in flight are done
+		std::vector<VkSemaphore> OldSemaphores;
+		OldSemaphores.swap(PresentSemaphores);
+		VkDevice VulkanDevice = Device.Device;
+		Device.DeferDelete([VulkanDevice, OldSemaphores]()
+			{
+				for (VkSemaphore Semaphore : OldSemaphores)
+				{
+					vkDestroySemaphore(VulkanDevice, Semaphore, nullptr);
+				}
+			});
+		CreatePresentSemaphores(Device);
 	}
 
 	void RenderTests(SVulkan::SDevice& Device, SVulkan::FCmdBuffer* CmdBuffer)
 	{
-		GVulkan.Swapchain.SetViewportAndScissor(CmdBuffer);
-		FStagingBuffer* ViewBuffer = GetViewUB(CmdBuffer);
-		FStagingBuffer* ObjBuffer = GetObjUB(CmdBuffer);
+		SetViewportAndScissor(CmdBuffer);
+		FRingAllocation ViewBuffer = GetViewUB();
+		FRingAllocation ObjBuffer = GetObjUB();
 		float Radius = 10;
 		float Dist = 100;
 		FVector3 Center(0, 0, 100);
 
-		auto InnerRenderSphere = [&](SVulkan::FCmdBuffer* CmdBuffer, FStagingBuffer* ViewBuffer, FStagingBuffer* ObjBuffer, FVector3 Pos, float Radius, uint32 Color)
+		auto InnerRenderSphere = [&](SVulkan::FCmdBuffer* CmdBuffer, const FRingAllocation& ViewBuffer, const FRingAllocation& ObjBuffer, FVector3 Pos, float Radius, uint32 Color)
 		{
 			std::stringstream ss;
 			ss << "Sphere " << Pos.x << "," << Pos.y << "," << Pos.z;
@@ -1204,6 +2256,42 @@ static bool GenerateImGuiUI(SVulkan::SDevice& Device, FApp& App, SVulkan::FCmdBu
 		ImGui::SliderFloat("CPU", &Value, 0, 66);
 		Value = (float)App.GpuDelta;
 		ImGui::SliderFloat("GPU", &Value, 0, 66);
+#if !USE_VMA
+		SVulkan::FMemStats MemStats = Device.GetMemStats();
+		ImGui::Text("Mem: %d allocs in %d blocks, %.2f/%.2f MB", MemStats.NumAllocs, MemStats.NumBlocks, (float)MemStats.UsedBytes / (1024.0f * 1024.0f), (float)MemStats.BlockBytes / (1024.0f * 1024.0f));
+#endif
+		ImGui::Text("Uniform ring: %d allocs, %.1f KB", GUniformRing.LastFrameNumAllocations, (float)GUniformRing.LastFrameBytes / 1024.0f);
+		ImGui::Text("Staging: %d hits, %d misses, %.2f MB held (%.2f MB idle)", (int)GStagingBufferMgr.Stats.Hits, (int)GStagingBufferMgr.Stats.Misses, (float)GStagingBufferMgr.Stats.HeldBytes / (1024.0f * 1024.0f), (float)GStagingBufferMgr.Stats.IdleBytes / (1024.0f * 1024.0f));
+		ImGui::Text("PSOs: %d created in %.2f ms, %d compiling", GPSOCache.NumPipelinesCreated, (float)GPSOCache.PipelineCreateTimeMs, GPSOCache.GetNumQueuedCompiles());
+		if (App.bParallelRecord)
+		{
+			ImGui::Text("Scene recording: %.2f ms in %d jobs", (float)App.RecordTimeMs, App.NumRecordThreads);
+		}
+		ImGui::Text("Jobs: %d run, %d stolen, %d workers", (int)GJobSystem.Stats.NumJobs, (int)GJobSystem.Stats.NumSteals, GJobSystem.GetNumWorkers());
+		ImGui::Text("Uploads: %d images in %d batches, %.2f MB, %d pending", (int)GTextureUploader.Stats.NumImages, (int)GTextureUploader.Stats.NumBatches, (float)GTextureUploader.Stats.NumBytes / (1024.0f * 1024.0f), GTextureUploader.GetNumPending());
+		if (App.bAsyncCompute && !App.ComputeTiming.IsSupported())
+		{
+			ImGui::Text("Async compute: no timestamps on the compute queue%s", Device.HasAsyncCompute() ? "" : " (graphics queue)");
+		}
+		else if (App.bAsyncCompute)
+		{
+			ImGui::Text("Async compute: %.2f ms%s", (float)App.AsyncComputeStats.ComputeMs, Device.HasAsyncCompute() ? "" : " (graphics queue)");
+		}
+		ImGui::Text("Frames in flight: %d, %.2f ms waiting, %.2f ms latency", App.NumFramesInFlight, (float)App.FrameStats.WaitMs, (float)App.FrameStats.LatencyMs);
+		if (App.GPUProfiler.IsSupported() && ImGui::TreeNode("GPU profile"))
+		{
+			for (const FGPUProfiler::FResult& Result : App.GPUProfiler.Results)
+			{
+				ImGui::Text("%*s%s: %.3f ms", Result.Depth * 2, "", Result.Name.c_str(), (float)Result.Ms);
+			}
+			ImGui::Text("%d frames skipped, %d scopes dropped", App.GPUProfiler.Stats.NumSkippedFrames, App.GPUProfiler.Stats.NumDroppedScopes);
+			ImGui::TreePop();
+		}
+		if (!Device.bPushDescriptor)
+		{
+			uint64 NumLookups = GDescriptorCache.Stats.Hits + GDescriptorCache.Stats.Misses;
+			ImGui::Text("Descriptor sets: %.1f%% hits, %d cached, %d evicted", NumLookups ? 100.0f * (float)GDescriptorCache.Stats.Hits / (float)NumLookups : 0.0f, GDescriptorCache.GetNumCachedSets(), (int)GDescriptorCache.Stats.Evictions);
+		}
 		ImGui::InputFloat3("Pos", App.Camera.Pos.Values);
 		ImGui::InputFloat2("Yaw/Pitch", App.Camera.Rot.Values);
 		ImGui::Checkbox("Skip Culling", &App.bSkipCull);
@@ -1247,49 +2335,84 @@ static bool GenerateImGuiUI(SVulkan::SDevice& Device, FApp& App, SVulkan::FCmdBu
 }
 
 
+// Slots come from the current shaders, so this runs again after every recompile
+static void ResolveShaderParameters(FApp& App)
+{
+	App.TestGLTFParams.ViewUB = GPSOCache.GetGfxParameter(App.TestGLTFPSO, "ViewUB");
+	App.TestGLTFParams.ObjUB = GPSOCache.GetGfxParameter(App.TestGLTFPSO, "ObjUB");
+	App.TestGLTFParams.SS = GPSOCache.GetGfxParameter(App.TestGLTFPSO, "SS");
+	App.TestGLTFParams.BaseTexture = GPSOCache.GetGfxParameter(App.TestGLTFPSO, "BaseTexture");
+	App.TestGLTFParams.NormalTexture = GPSOCache.GetGfxParameter(App.TestGLTFPSO, "NormalTexture");
+	App.TestGLTFParams.MetallicRoughnessTexture = GPSOCache.GetGfxParameter(App.TestGLTFPSO, "MetallicRoughnessTexture");
+
+	if (App.bBindless)
+	{
+		App.TestGLTFBindlessParams.ViewUB = GPSOCache.GetGfxParameter(App.TestGLTFBindlessPSO, "ViewUB");
+		App.TestGLTFBindlessParams.ObjUB = GPSOCache.GetGfxParameter(App.TestGLTFBindlessPSO, "ObjUB");
+		App.TestGLTFBindlessParams.SS = GPSOCache.GetGfxParameter(App.TestGLTFBindlessPSO, "SS");
+	}
+}
+
 static double Render(FApp& App)
 {
 	SVulkan::SDevice& Device = GVulkan.Devices[GVulkan.PhysicalDevice];
-	if (!GVulkan.Swapchain.AcquireBackbuffer() || App.bResizeSwapchain)
+	App.BeginFrame(Device);
+	if (!App.bHeadless && (App.bResizeSwapchain || !GVulkan.Swapchain.AcquireBackbuffer(App.GetCurrentFrame().AcquireSemaphore)))
 	{
 		App.RecreateSwapchain(Device, GVulkan.Swapchain);
-		GRenderTargetCache.Destroy();
+		GRenderTargetCache.DeferDestroyFramebuffers(Device);
 		App.RecreateDepthBuffer(Device);
 
 		App.bResizeSwapchain = false;
 	}
 
-	Device.RefreshCommandBuffers();
 	App.Update(Device);
 
-	SVulkan::FCmdBuffer* CmdBuffer = Device.BeginCommandBuffer(Device.GfxQueueIndex);
+	if (App.bAsyncCompute)
+	{
+		App.GetCurrentFrame().ComputeSyncPoint = App.DispatchAsyncCompute(Device);
+	}
+
+	SVulkan::FCmdBuffer* CmdBuffer = App.GetCurrentFrame().CmdPool.Begin();
+	App.GPUProfiler.BeginFrame(CmdBuffer);
+	if (FGLTFLoader* Loader = App.StreamingGLTFLoader)
+	{
+		TickGLTFUploads(Loader, App.PendingOpsMgr, CmdBuffer);
+	}
 	if (!App.PendingOpsMgr.Ops.empty())
 	{
 		FMarkerScope MarkerScope(Device, CmdBuffer, "Pending");
 		App.PendingOpsMgr.ExecutePendingStagingOps(Device, CmdBuffer);
 	}
+	{
+		FMarkerScope MarkerScope(Device, CmdBuffer, "Uploads");
+		GTextureUploader.Tick(CmdBuffer);
+	}
 
 	App.GPUTiming.BeginTimestamp(CmdBuffer);
 
-	float Width = GVulkan.Swapchain.GetViewport().width;
-	float Height = GVulkan.Swapchain.GetViewport().height;
+	float Width = App.GetViewport().width;
+	float Height = App.GetViewport().height;
 
 	ImGuiIO& IO = ImGui::GetIO();
 	IO.DisplaySize.x = Width;
 	IO.DisplaySize.y = Height;
 	IO.DeltaTime = App.LastDelta;
 
-	FRenderTargetInfo ColorInfo = GVulkan.Swapchain.GetRenderTargetInfo();
+	FRenderTargetInfo ColorInfo = App.GetBackbufferTargetInfo();
 	SVulkan::FFramebuffer* Framebuffer = GRenderTargetCache.GetOrCreateFrameBuffer(ColorInfo, FRenderTargetInfo(App.DepthBuffer.View, App.DepthBuffer.Image.Format, VK_ATTACHMENT_LOAD_OP_LOAD, VK_ATTACHMENT_STORE_OP_STORE), (uint32)Width, (uint32)Height);
 
 	App.ImGuiNewFrame();
 
-	Device.TransitionImage(CmdBuffer, GVulkan.Swapchain.Images[GVulkan.Swapchain.ImageIndex],
-		VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_IMAGE_LAYOUT_UNDEFINED, 0, 
+	// Headless, one OffscreenColor serves all frames in flight, so the clear has to wait for the previous frame's rendering and
+	// readback. A swapchain image is waited for at COLOR_ATTACHMENT_OUTPUT, which this barrier chains with
+	Device.TransitionImage(CmdBuffer, App.GetBackbufferImage(),
+		VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT,
 		VK_PIPELINE_STAGE_TRANSFER_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_ACCESS_TRANSFER_WRITE_BIT,
 		VK_IMAGE_ASPECT_COLOR_BIT);
+	// Also shared by the frames in flight
 	Device.TransitionImage(CmdBuffer, App.DepthBuffer.Image.Image,
-		VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_IMAGE_LAYOUT_UNDEFINED, 0,
+		VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
 		VK_PIPELINE_STAGE_TRANSFER_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_ACCESS_TRANSFER_WRITE_BIT,
 		VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT);
 
@@ -1298,10 +2421,10 @@ static double Render(FApp& App)
 	F += 0.005f;
 
 	float ClearColor[4] = {0.0f, abs(sin(F)), abs(cos(F)), 0.0f};
-	ClearColorImage(CmdBuffer->CmdBuffer, GVulkan.Swapchain.Images[GVulkan.Swapchain.ImageIndex], ClearColor);
+	ClearColorImage(CmdBuffer->CmdBuffer, App.GetBackbufferImage(), ClearColor);
 	ClearDepthImage(CmdBuffer->CmdBuffer, App.DepthBuffer.Image.Image, 1.0f, 0);
 
-	Device.TransitionImage(CmdBuffer, GVulkan.Swapchain.Images[GVulkan.Swapchain.ImageIndex],
+	Device.TransitionImage(CmdBuffer, App.GetBackbufferImage(),
 		VK_PIPELINE_STAGE_TRANSFER_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_ACCESS_TRANSFER_WRITE_BIT,
 		VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
 		VK_IMAGE_ASPECT_COLOR_BIT);
@@ -1310,62 +2433,97 @@ static double Render(FApp& App)
 		VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
 		VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT);
 
-	CmdBuffer->BeginRenderPass(Framebuffer);
-	if (!App.Scene.Meshes.empty())
+	// Hold the scene back until all of its textures are resident
+	bool bDrawScene = !App.Scene.Meshes.empty() && GTextureUploader.GetNumPending() == 0;
+	if (App.bParallelRecord && bDrawScene)
 	{
-		App.DrawScene(Device, CmdBuffer);
-	}
-
-	App.RenderTests(Device, CmdBuffer);
-
-	CmdBuffer->EndRenderPass();
+		// A subpass that executes secondaries can't record anything inline, so the rest goes in a second pass
+		CmdBuffer->BeginRenderPass(Framebuffer, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+		App.DrawSceneParallel(Device, CmdBuffer, Framebuffer);
+		CmdBuffer->EndRenderPass();
 
-	if (0)
+		CmdBuffer->BeginRenderPass(Framebuffer);
+		App.DrawSceneOverlays(Device, CmdBuffer);
+	}
+	else
 	{
-		FMarkerScope MarkerScope(Device, CmdBuffer, "TestCompute");
-		SVulkan::FComputePSO* PSO = GPSOCache.GetComputePSO(App.TestCSPSO);
-		vkCmdBindPipeline(CmdBuffer->CmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, PSO->Pipeline);
-
-		FDescriptorPSOCache Cache(PSO);
-		Cache.SetUniformBuffer("CB0", App.TestCSUB);
-		Cache.SetTexelBuffer("output", App.TestCSBuffer);
-		Cache.UpdateDescriptors(GDescriptorCache, CmdBuffer);
-		for (int32 Index = 0; Index < 256; ++Index)
+		CmdBuffer->BeginRenderPass(Framebuffer);
+		if (bDrawScene)
 		{
-			vkCmdDispatch(CmdBuffer->CmdBuffer, 256, 1, 1);
+			App.DrawScene(Device, CmdBuffer);
 		}
 	}
 
+	App.RenderTests(Device, CmdBuffer);
+
+	CmdBuffer->EndRenderPass();
+
 	App.GPUTiming.EndTimestamp(CmdBuffer);
 
 	bool bRecompileShaders = GenerateImGuiUI(Device, App, CmdBuffer, Framebuffer);
 
-	Device.TransitionImage(CmdBuffer, GVulkan.Swapchain.Images[GVulkan.Swapchain.ImageIndex],
-		VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
-		VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, 0,
-		VK_IMAGE_ASPECT_COLOR_BIT);
+	if (App.bHeadless)
+	{
+		Device.TransitionImage(CmdBuffer, App.GetBackbufferImage(),
+			VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+			VK_PIPELINE_STAGE_TRANSFER_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_ACCESS_TRANSFER_READ_BIT,
+			VK_IMAGE_ASPECT_COLOR_BIT);
+		if (App.bReadbackFrame)
+		{
+			App.RecordReadback(CmdBuffer);
+		}
+	}
+	else
+	{
+		Device.TransitionImage(CmdBuffer, App.GetBackbufferImage(),
+			VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+			VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, 0,
+			VK_IMAGE_ASPECT_COLOR_BIT);
+	}
+	App.GPUProfiler.EndFrame(CmdBuffer);
 	CmdBuffer->End();
 
-	Device.Submit(Device.PresentQueue, CmdBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, GVulkan.Swapchain.AcquireBackbufferSemaphore, GVulkan.Swapchain.FinalSemaphore);
+	GUniformRing.EndFrame(CmdBuffer);
+
+	App.SubmitFrame(Device, CmdBuffer);
 
-	if (!GVulkan.Swapchain.Present(Device.PresentQueue, GVulkan.Swapchain.FinalSemaphore))
+	if (App.bHeadless)
+	{
+		if (App.bReadbackFrame)
+		{
+			App.SaveReadback(Device, CmdBuffer->GetSyncPoint());
+		}
+	}
+	else if (!GVulkan.Swapchain.Present(Device.PresentQueue, App.GetPresentSemaphore()))
 	{
 		App.bResizeSwapchain = true;
 	}
+	App.EndFrame(Device);
 
 	if (bRecompileShaders)
 	{
-		Device.WaitForIdle();
+		// Compile jobs may still be reading the shaders about to be replaced; the old pipelines go through the deferred deletion queue
+		GPSOCache.WaitForCompiles();
 		if (GShaderLibrary.RecompileShaders())
 		{
 			GPSOCache.RecompileShaders();
+			GDescriptorCache.Reset();
+			for (auto& Context : App.RecordContexts)
+			{
+				Context.DescriptorCache.Reset();
+			}
+			ResolveShaderParameters(App);
 		}
 	}
 
-	//Device.WaitForFence(CmdBuffer.Fence, CmdBuffer.LastSubmittedFence);
+	//Device.WaitForSyncPoint(CmdBuffer->GetSyncPoint());
 	//vkDeviceWaitIdle(Device.Device);
 
-	double GpuTimeMS = App.GPUTiming.ReadTimestamp();
+	double GpuTimeMS = App.GPUProfiler.IsSupported() ? App.GPUProfiler.GetFrameMs() : App.GPUTiming.ReadTimestamp();
+	if (App.bAsyncCompute)
+	{
+		App.UpdateAsyncComputeStats();
+	}
 	return GpuTimeMS;
 }
 
@@ -1379,14 +2537,15 @@ static void SetupShaders(FApp& App)
 	FShaderInfo* UIPS = GShaderLibrary.RegisterShader("Shaders/UI.hlsl", "UIMainPS", FShaderInfo::EStage::Pixel);
 	FShaderInfo* TestGLTFVS = GShaderLibrary.RegisterShader("Shaders/TestMesh.hlsl", "TestGLTFVS", FShaderInfo::EStage::Vertex);
 	FShaderInfo* TestGLTFPS = GShaderLibrary.RegisterShader("Shaders/TestMesh.hlsl", "TestGLTFPS", FShaderInfo::EStage::Pixel);
+	FShaderInfo* TestGLTFBindlessPS = App.bBindless ? GShaderLibrary.RegisterShader("Shaders/TestMeshBindless.hlsl", "TestGLTFPS", FShaderInfo::EStage::Pixel) : nullptr;
 	GShaderLibrary.RecompileShaders();
 
 	App.TestCSPSO = GPSOCache.CreateComputePSO("TestCSPSO", TestCS);
 
-	SVulkan::FRenderPass* RenderPass = GRenderTargetCache.GetOrCreateRenderPass(FAttachmentInfo(GVulkan.Swapchain.Format, VK_ATTACHMENT_LOAD_OP_LOAD, VK_ATTACHMENT_STORE_OP_STORE), FAttachmentInfo(VK_FORMAT_D32_SFLOAT_S8_UINT, VK_ATTACHMENT_LOAD_OP_LOAD, VK_ATTACHMENT_STORE_OP_STORE));
+	SVulkan::FRenderPass* RenderPass = GRenderTargetCache.GetOrCreateRenderPass(FAttachmentInfo(App.GetBackbufferFormat(), VK_ATTACHMENT_LOAD_OP_LOAD, VK_ATTACHMENT_STORE_OP_STORE), FAttachmentInfo(VK_FORMAT_D32_SFLOAT_S8_UINT, VK_ATTACHMENT_LOAD_OP_LOAD, VK_ATTACHMENT_STORE_OP_STORE));
 
-	VkViewport Viewport = GVulkan.Swapchain.GetViewport();
-	VkRect2D Scissor = GVulkan.Swapchain.GetScissor();
+	VkViewport Viewport = App.GetViewport();
+	VkRect2D Scissor = App.GetScissor();
 
 	{
 		FPSOCache::FVertexDecl Decl;
@@ -1416,6 +2575,19 @@ static void SetupShaders(FApp& App)
 				DSInfo->depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
 			});
 	}
+
+	if (App.bBindless)
+	{
+		App.TestGLTFBindlessPSO = GPSOCache.CreateGfxPSO("TestGLTFBindlessPSO", TestGLTFVS, TestGLTFBindlessPS, RenderPass, [=](VkGraphicsPipelineCreateInfo& GfxPipelineInfo)
+			{
+				VkPipelineDepthStencilStateCreateInfo* DSInfo = (VkPipelineDepthStencilStateCreateInfo*)GfxPipelineInfo.pDepthStencilState;
+				DSInfo->depthTestEnable = VK_TRUE;
+				DSInfo->depthWriteEnable = VK_TRUE;
+				DSInfo->depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+			});
+	}
+
+	ResolveShaderParameters(App);
 }
 
 static void ErrorCallback(int Error, const char* Msg)
@@ -1474,15 +2646,439 @@ static void MouseCallback(GLFWwindow* Window, double XPos, double YPos)
 	}
 }
 
-static GLFWwindow* Init(FApp& App)
+// -jobbench: the same batch of small jobs through GJobSystem (one job each and as a ParallelFor) and through std::async
+static void RunJobBenchmark()
+{
+	const uint32 NumJobs = 10000;
+	std::vector<uint64> Results(NumJobs);
+	auto Work = [&Results](uint32 Index)
+	{
+		uint64 Value = Index;
+		for (uint32 Step = 0; Step < 2000; ++Step)
+		{
+			Value = Value * 6364136223846793005ull + 1442695040888963407ull;
+		}
+		Results[Index] = Value;
+	};
+
+	double Begin = GetTimeInMs();
+	{
+		FJobCounter Counter;
+		for (uint32 Index = 0; Index < NumJobs; ++Index)
+		{
+			GJobSystem.AddJob([&Work, Index]() { Work(Index); }, &Counter);
+		}
+		GJobSystem.Wait(Counter);
+	}
+	double JobsMs = GetTimeInMs() - Begin;
+
+	Begin = GetTimeInMs();
+	GJobSystem.ParallelFor(NumJobs, 64, Work);
+	double ParallelForMs = GetTimeInMs() - Begin;
+
+	Begin = GetTimeInMs();
+	{
+		std::vector<std::future<void>> Futures;
+		Futures.reserve(NumJobs);
+		for (uint32 Index = 0; Index < NumJobs; ++Index)
+		{
+			Futures.push_back(std::async(std::launch::async, Work, Index));
+		}
+		for (auto& Future : Futures)
+		{
+			Future.wait();
+		}
+	}
+	double AsyncMs = GetTimeInMs() - Begin;
+
+	char s[256];
+	sprintf(s, "*** Job bench: %d jobs on %d workers; AddJob %f ms, ParallelFor %f ms, std::async %f ms\n", NumJobs, GJobSystem.GetNumWorkers(), (float)JobsMs, (float)ParallelForMs, (float)AsyncMs);
+	::OutputDebugStringA(s);
+}
+
+// -psolookupbench: FPSOCache's own hashed vertex decl and PSO variant lookups against the linear scan and nested std::map they
+// replaced, over a range of synthetic decl counts. Every decl is added once, then looked up LookupsPerDecl times
+static void RunPSOLookupBenchmark()
+{
+	const uint32 DeclCounts[] = {16, 128, 1024, 4096};
+	const uint32 LookupsPerDecl = 16;
+	for (uint32 NumDecls : DeclCounts)
+	{
+		std::vector<FPSOCache::FVertexDecl> Decls(NumDecls);
+		for (uint32 Index = 0; Index < NumDecls; ++Index)
+		{
+			// Mostly the same attributes, like a real scene; only the strides and the last format differ
+			FPSOCache::FVertexDecl& Decl = Decls[Index];
+			const char* Names[] = {"POSITION", "NORMAL", "TEXCOORD_0", "COLOR"};
+			for (uint32 Attr = 0; Attr < 4; ++Attr)
+			{
+				Decl.AddAttribute(Attr, Attr, Attr == 3 && (Index & 1) ? VK_FORMAT_R8G8B8A8_UNORM : VK_FORMAT_R32G32B32_SFLOAT, 0, Names[Attr]);
+				Decl.AddBinding(Attr, 12 + 4 * ((Index >> (Attr * 4)) & 15));
+			}
+		}
+
+		double Begin = GetTimeInMs();
+		{
+			FPSOCache Cache;
+			for (uint32 Pass = 0; Pass <= LookupsPerDecl; ++Pass)
+			{
+				for (const FPSOCache::FVertexDecl& Decl : Decls)
+				{
+					Cache.FindOrAddVertexDecl(Decl);
+				}
+			}
+		}
+		double HashedDeclMs = GetTimeInMs() - Begin;
+
+		Begin = GetTimeInMs();
+		{
+			std::vector<FPSOCache::FVertexDecl> VertexDecls;
+			for (uint32 Pass = 0; Pass <= LookupsPerDecl; ++Pass)
+			{
+				for (const FPSOCache::FVertexDecl& Decl : Decls)
+				{
+					if (std::find(VertexDecls.begin(), VertexDecls.end(), Decl) == VertexDecls.end())
+					{
+						VertexDecls.push_back(Decl);
+					}
+				}
+			}
+		}
+		double LinearDeclMs = GetTimeInMs() - Begin;
+
+		// Two variants (single/double sided) of 4 PSOs per decl. The first pass adds each variant the way GetGfxPSOVariant() does
+		// on a miss, minus compiling the pipeline; later passes are hits through the real TryGetGfxPSOVariant()
+		Begin = GetTimeInMs();
+		{
+			FPSOCache Cache;
+			Cache.GfxPSOEntries.resize(4);
+			// Only hits go through TryGetGfxPSOVariant(), so no compile job is ever queued; this just skips the pipeline check
+			Cache.bAsyncCompile = true;
+			for (uint32 Index = 0; Index < NumDecls * 8; ++Index)
+			{
+				FPSOCache::FPSOSecondHandle SecondHandle(Index >> 3, (Index & 4) ? EPSODoubleSided : 0);
+				if (!Cache.FindGfxPSOVariant(Index & 3, SecondHandle).IsValid())
+				{
+					Cache.AddGfxPSO(Index & 3, SecondHandle);
+				}
+			}
+			for (uint32 Pass = 1; Pass <= LookupsPerDecl; ++Pass)
+			{
+				for (uint32 Index = 0; Index < NumDecls * 8; ++Index)
+				{
+					FPSOCache::FGfxPSOVariantHandle Handle = Cache.TryGetGfxPSOVariant(FPSOCache::FPSOHandle(Index & 3), FPSOCache::FPSOSecondHandle(Index >> 3, (Index & 4) ? EPSODoubleSided : 0));
+					check(Handle.IsValid());
+				}
+			}
+		}
+		double HashedVariantMs = GetTimeInMs() - Begin;
+
+		Begin = GetTimeInMs();
+		{
+			std::map<int32, std::map<FPSOCache::FPSOSecondHandle, int32>> Variants;
+			int32 NumVariants = 0;
+			for (uint32 Pass = 0; Pass <= LookupsPerDecl; ++Pass)
+			{
+				for (uint32 Index = 0; Index < NumDecls * 8; ++Index)
+				{
+					auto& Inner = Variants[Index & 3];
+					FPSOCache::FPSOSecondHandle SecondHandle(Index >> 3, (Index & 4) ? EPSODoubleSided : 0);
+					if (Inner.find(SecondHandle) == Inner.end())
+					{
+						Inner.insert(std::make_pair(SecondHandle, NumVariants++));
+					}
+				}
+			}
+		}
+		double MapVariantMs = GetTimeInMs() - Begin;
+
+		char s[256];
+		sprintf(s, "*** PSO lookup bench: %d decls; decls hashed %f ms, linear %f ms; %d variants hashed %f ms, std::map %f ms\n",
+			NumDecls, (float)HashedDeclMs, (float)LinearDeclMs, NumDecls * 8, (float)HashedVariantMs, (float)MapVariantMs);
+		::OutputDebugStringA(s);
+	}
+}
+
+// Copy of the FDescriptorPSOCache this tree started from, kept for -descbench: a std::map lookup per parameter and three vectors
+// that grow per draw, fixed up in Finalize()
+struct FBaselineDescriptorSetup
+{
+	SVulkan::FPSO* PSO;
+	std::vector<VkWriteDescriptorSet> Writes;
+	std::vector<VkDescriptorImageInfo> Images;
+	std::vector<VkDescriptorBufferInfo> Buffers;
+
+	FBaselineDescriptorSetup(SVulkan::FPSO* InPSO)
+		: PSO(InPSO)
+	{
+	}
+
+	bool GetParameter(const char* Name, uint32& OutBinding, VkDescriptorType& OutType)
+	{
+		auto Found = PSO->ParameterMap.find(Name);
+		if (Found == PSO->ParameterMap.end())
+		{
+			return false;
+		}
+
+		OutBinding = Found->second.Binding;
+		OutType = Found->second.Type;
+		return true;
+	}
+
+	void SetUniformBuffer(const char* Name, VkBuffer Buffer, VkDeviceSize Offset, VkDeviceSize Range)
+	{
+		uint32 Binding = UINT32_MAX;
+		VkDescriptorType Type = VK_DESCRIPTOR_TYPE_MAX_ENUM;
+		if (GetParameter(Name, Binding, Type))
+		{
+			VkWriteDescriptorSet Write;
+			ZeroVulkanMem(Write, VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET);
+			Write.descriptorCount = 1;
+			Write.dstBinding = Binding;
+			Write.descriptorType = Type;
+			VkDescriptorBufferInfo BInfo;
+			ZeroMem(BInfo);
+			BInfo.buffer = Buffer;
+			BInfo.offset = Offset;
+			BInfo.range = Range;
+			Write.pBufferInfo = (VkDescriptorBufferInfo*)Buffers.size();
+			Buffers.push_back(BInfo);
+			Writes.push_back(Write);
+		}
+	}
+
+	void SetImage(const char* Name, VkImageView View, VkSampler Sampler)
+	{
+		uint32 Binding = UINT32_MAX;
+		VkDescriptorType Type = VK_DESCRIPTOR_TYPE_MAX_ENUM;
+		if (GetParameter(Name, Binding, Type))
+		{
+			VkWriteDescriptorSet Write;
+			ZeroVulkanMem(Write, VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET);
+			Write.descriptorCount = 1;
+			Write.dstBinding = Binding;
+			Write.descriptorType = Type;
+			VkDescriptorImageInfo IInfo;
+			ZeroMem(IInfo);
+			IInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+			IInfo.sampler = Sampler;
+			IInfo.imageView = View;
+			Write.pImageInfo = (VkDescriptorImageInfo*)Images.size();
+			Images.push_back(IInfo);
+			Writes.push_back(Write);
+		}
+	}
+
+	void Finalize()
+	{
+		for (auto& Write : Writes)
+		{
+			if (Write.descriptorType == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER || Write.descriptorType == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC)
+			{
+				Write.pBufferInfo = &Buffers[(uint32)(uint64)Write.pBufferInfo];
+			}
+			else
+			{
+				Write.pImageInfo = &Images[(uint32)(uint64)Write.pImageInfo];
+			}
+		}
+	}
+};
+
+// -descbench: the CPU side of setting up TestGLTFPSO's descriptors for each draw of a synthetic 10k prim scene, through the
+// original FDescriptorPSOCache (FBaselineDescriptorSetup), the current one looking the parameters up by name, and the current one
+// using the slots resolved up front. Stops before UpdateDescriptors() so no GPU work is involved; the set key FDescriptorCache
+// builds from the writes is included as it's the rest of the per draw CPU cost
+static void RunDescriptorSetupBenchmark(FApp& App)
+{
+	const uint32 NumPrims = 10000;
+	const uint32 NumPasses = 16;
+	const uint32 ObjUBSize = 256;
+
+	// Only the parameters are needed, so no pipeline gets created
+	SVulkan::FGfxPSO PSO;
+	PSO.ParameterMap = GPSOCache.GfxPSOEntries[App.TestGLTFPSO.Index].ParameterMap;
+	PSO.BuildParameterSlots();
+	FImageWithMemAndView Texture;
+	std::vector<uint64> Key;
+
+	double Begin = GetTimeInMs();
+	for (uint32 Pass = 0; Pass < NumPasses; ++Pass)
+	{
+		for (uint32 Index = 0; Index < NumPrims; ++Index)
+		{
+			FBaselineDescriptorSetup Setup(&PSO);
+			Setup.SetUniformBuffer("ViewUB", VK_NULL_HANDLE, 0, ObjUBSize);
+			Setup.SetUniformBuffer("ObjUB", VK_NULL_HANDLE, Index * ObjUBSize, ObjUBSize);
+			Setup.SetImage("SS", VK_NULL_HANDLE, App.LinearMipSampler);
+			Setup.SetImage("BaseTexture", Texture.View, App.LinearMipSampler);
+			Setup.SetImage("NormalTexture", Texture.View, App.LinearMipSampler);
+			Setup.SetImage("MetallicRoughnessTexture", Texture.View, App.LinearMipSampler);
+			Setup.Finalize();
+			FDescriptorCache::BuildSetKey((uint32)Setup.Writes.size(), Setup.Writes.data(), Key);
+		}
+	}
+	double BaselineMs = GetTimeInMs() - Begin;
+
+	Begin = GetTimeInMs();
+	for (uint32 Pass = 0; Pass < NumPasses; ++Pass)
+	{
+		for (uint32 Index = 0; Index < NumPrims; ++Index)
+		{
+			FDescriptorPSOCache Cache(&PSO);
+			Cache.SetUniformBuffer("ViewUB", VK_NULL_HANDLE, 0, ObjUBSize);
+			Cache.SetUniformBuffer("ObjUB", VK_NULL_HANDLE, Index * ObjUBSize, ObjUBSize);
+			Cache.SetSampler("SS", App.LinearMipSampler);
+			Cache.SetImage("BaseTexture", Texture, App.LinearMipSampler);
+			Cache.SetImage("NormalTexture", Texture, App.LinearMipSampler);
+			Cache.SetImage("MetallicRoughnessTexture", Texture, App.LinearMipSampler);
+			Cache.Finalize();
+			FDescriptorCache::BuildSetKey(Cache.NumWrites, Cache.Writes, Key);
+		}
+	}
+	double ByNameMs = GetTimeInMs() - Begin;
+
+	Begin = GetTimeInMs();
+	for (uint32 Pass = 0; Pass < NumPasses; ++Pass)
+	{
+		for (uint32 Index = 0; Index < NumPrims; ++Index)
+		{
+			FDescriptorPSOCache Cache(&PSO);
+			Cache.SetUniformBuffer(App.TestGLTFParams.ViewUB, VK_NULL_HANDLE, 0, ObjUBSize);
+			Cache.SetUniformBuffer(App.TestGLTFParams.ObjUB, VK_NULL_HANDLE, Index * ObjUBSize, ObjUBSize);
+			Cache.SetSampler(App.TestGLTFParams.SS, App.LinearMipSampler);
+			Cache.SetImage(App.TestGLTFParams.BaseTexture, Texture, App.LinearMipSampler);
+			Cache.SetImage(App.TestGLTFParams.NormalTexture, Texture, App.LinearMipSampler);
+			Cache.SetImage(App.TestGLTFParams.MetallicRoughnessTexture, Texture, App.LinearMipSampler);
+			Cache.Finalize();
+			FDescriptorCache::BuildSetKey(Cache.NumWrites, Cache.Writes, Key);
+		}
+	}
+	double BySlotMs = GetTimeInMs() - Begin;
+
+	double NumDraws = (double)NumPrims * NumPasses;
+	char s[256];
+	sprintf(s, "*** Descriptor setup bench: %d prims x %d; baseline %f us/draw, by name %f us/draw, by slot %f us/draw\n", NumPrims, NumPasses,
+		(float)(BaselineMs * 1000.0 / NumDraws), (float)(ByNameMs * 1000.0 / NumDraws), (float)(BySlotMs * 1000.0 / NumDraws));
+	::OutputDebugStringA(s);
+}
+
+#if !USE_VMA
+// -membench: a few thousand buffers of mixed sizes created, half of them freed and made again in random order, through the block
+// sub-allocator and through one vkAllocateMemory each; then the same buffer created and destroyed over and over
+static void RunMemBenchmark(SVulkan::SDevice& Device)
 {
+	const uint32 NumBuffers = 2000;
+	const uint32 NumRounds = 8;
+	const uint32 NumChurns = 1000;
+	uint32 State = 1;
+	auto Random = [&State]()
+	{
+		State = State * 1664525u + 1013904223u;
+		return State >> 8;
+	};
+	std::vector<uint32> Sizes(NumBuffers);
+	for (uint32& Size : Sizes)
+	{
+		Size = 256u << (Random() % 13);
+	}
+	std::vector<uint32> Order(NumBuffers * NumRounds / 2);
+	for (uint32& Index : Order)
+	{
+		Index = Random() % NumBuffers;
+	}
+
+	VkBufferUsageFlags Usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	uint32 NumBlocksBefore = Device.GetMemStats().NumBlocksAllocated;
 	double Begin = GetTimeInMs();
-	glfwSetErrorCallback(ErrorCallback);
-	int RC = glfwInit();
-	check(RC != 0);
+	{
+		std::vector<FBufferWithMem> Buffers(NumBuffers);
+		for (uint32 Index = 0; Index < NumBuffers; ++Index)
+		{
+			Buffers[Index].Create(Device, Usage, EMemLocation::GPU, Sizes[Index], false);
+		}
+		for (uint32 Index : Order)
+		{
+			Buffers[Index].Destroy();
+			Buffers[Index].Create(Device, Usage, EMemLocation::GPU, Sizes[Index], false);
+		}
+		for (FBufferWithMem& Buffer : Buffers)
+		{
+			Buffer.Destroy();
+		}
+	}
+	double SubAllocMs = GetTimeInMs() - Begin;
+	uint32 SubAllocBlocks = Device.GetMemStats().NumBlocksAllocated - NumBlocksBefore;
+
+	Begin = GetTimeInMs();
+	{
+		std::vector<SVulkan::FBuffer> Buffers(NumBuffers);
+		std::vector<VkDeviceMemory> Memory(NumBuffers);
+		auto Create = [&](uint32 Index)
+		{
+			Buffers[Index].Create(Device.Device, Usage, Sizes[Index]);
+			VkMemoryRequirements MemReqs;
+			vkGetBufferMemoryRequirements(Device.Device, Buffers[Index].Buffer, &MemReqs);
+			VkMemoryAllocateInfo Info;
+			ZeroVulkanMem(Info, VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO);
+			Info.allocationSize = MemReqs.size;
+			Info.memoryTypeIndex = Device.FindMemoryTypeIndex(GetVulkanMemLocation(EMemLocation::GPU), MemReqs.memoryTypeBits);
+			VERIFY_VKRESULT(vkAllocateMemory(Device.Device, &Info, nullptr, &Memory[Index]));
+			VERIFY_VKRESULT(vkBindBufferMemory(Device.Device, Buffers[Index].Buffer, Memory[Index], 0));
+		};
+		auto Destroy = [&](uint32 Index)
+		{
+			Buffers[Index].Destroy();
+			vkFreeMemory(Device.Device, Memory[Index], nullptr);
+		};
+		for (uint32 Index = 0; Index < NumBuffers; ++Index)
+		{
+			Create(Index);
+		}
+		for (uint32 Index : Order)
+		{
+			Destroy(Index);
+			Create(Index);
+		}
+		for (uint32 Index = 0; Index < NumBuffers; ++Index)
+		{
+			Destroy(Index);
+		}
+	}
+	double DirectMs = GetTimeInMs() - Begin;
+
+	NumBlocksBefore = Device.GetMemStats().NumBlocksAllocated;
+	Begin = GetTimeInMs();
+	for (uint32 Index = 0; Index < NumChurns; ++Index)
+	{
+		FBufferWithMem Buffer;
+		Buffer.Create(Device, Usage, EMemLocation::GPU, 1024 * 1024, false);
+		Buffer.Destroy();
+	}
+	double ChurnMs = GetTimeInMs() - Begin;
+	uint32 ChurnBlocks = Device.GetMemStats().NumBlocksAllocated - NumBlocksBefore;
+
+	uint32 NumOps = NumBuffers + (uint32)Order.size();
+	char s[512];
+	sprintf(s, "*** Mem bench: %d creates; sub-allocated %f ms (%d vkAllocateMemory), one allocation each %f ms (%d vkAllocateMemory); %d create/destroy of 1MB %f ms (%d vkAllocateMemory)\n",
+		NumOps, (float)SubAllocMs, SubAllocBlocks, (float)DirectMs, NumOps, NumChurns, (float)ChurnMs, ChurnBlocks);
+	::OutputDebugStringA(s);
+}
+#endif
 
-	glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+static GLFWwindow* Init(FApp& App)
+{
+	double Begin = GetTimeInMs();
+	App.bHeadless = RCUtils::FCmdLine::Get().Contains("-headless");
+	if (!App.bHeadless)
+	{
+		glfwSetErrorCallback(ErrorCallback);
+		int RC = glfwInit();
+		check(RC != 0);
 
+		glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+	}
 
 	uint32 ResX = RCUtils::FCmdLine::Get().TryGetIntPrefix("-resx=", 1920);
 	uint32 ResY = RCUtils::FCmdLine::Get().TryGetIntPrefix("-resy=", 1080);
@@ -1505,12 +3101,15 @@ static GLFWwindow* Init(FApp& App)
 
 	App.PointLight = TryGetVector4Prefix("-pointlight=", App.PointLight);
 
-	GLFWwindow* Window = glfwCreateWindow(ResX, ResY, "VkTest2", 0, 0);
+	GLFWwindow* Window = nullptr;
+	if (!App.bHeadless)
+	{
+		Window = glfwCreateWindow(ResX, ResY, "VkTest2", 0, 0);
+		check(Window);
+		glfwHideWindow(Window);
+	}
 	App.Camera.Init((float)ResX, (float)ResY);
 
-	glfwHideWindow(Window);
-	check(Window);
-
 	if (RCUtils::FCmdLine::Get().Contains("-waitfordebugger"))
 	{
 		while (!::IsDebuggerPresent())
@@ -1522,29 +3121,84 @@ static GLFWwindow* Init(FApp& App)
 
 	GVulkan.Init(Window);
 	SVulkan::SDevice& Device = GVulkan.Devices[GVulkan.PhysicalDevice];
+	if (App.bHeadless)
+	{
+		App.CreateOffscreenColor(Device, ResX, ResY);
+	}
+
+	if (RCUtils::FCmdLine::Get().Contains("-psolookupbench"))
+	{
+		RunPSOLookupBenchmark();
+	}
+#if !USE_VMA
+	if (RCUtils::FCmdLine::Get().Contains("-membench"))
+	{
+		RunMemBenchmark(Device);
+	}
+#endif
+
+	GJobSystem.Init(std::max(1u, (uint32)RCUtils::FCmdLine::Get().TryGetIntPrefix("-jobthreads=", std::max(2u, std::thread::hardware_concurrency()) - 1)));
+	if (RCUtils::FCmdLine::Get().Contains("-jobbench"))
+	{
+		RunJobBenchmark();
+	}
 
 	GRenderTargetCache.Init(Device.Device);
 	GShaderLibrary.Init(Device.Device);
-	GPSOCache.Init(&Device);
+	GPSOCache.Init(&Device, &GJobSystem);
 	GDescriptorCache.Init(&Device);
 	GStagingBufferMgr.Init(&Device);
-
+	GTextureUploader.Init(&Device);
+	GUniformRing.Init(&Device, RCUtils::FCmdLine::Get().TryGetIntPrefix("-uniformringsize=", 16) * 1024 * 1024, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, (uint32)Device.Props.limits.minUniformBufferOffsetAlignment);
+	App.InitSceneMemPolicy();
+
+	// -gltfloadbench=MB: generates a scene with that much vertex and index data and loads it instead of -gltf=; it's a .glb unless
+	// -gltfloadbenchascii is also given. -gltfloadbenchbaseline loads it without mapping the buffers, as before. Peak memory is
+	// process wide, so compare them in separate runs; tinygltf copies the buffers either way, so the peak shouldn't differ much,
+	// only what stays allocated after parsing
 	const char* Filename = nullptr;
-	if (RCUtils::FCmdLine::Get().TryGetStringFromPrefix("-gltf=", Filename))
+	uint32 LoadBenchMB = RCUtils::FCmdLine::Get().TryGetIntPrefix("-gltfloadbench=", 0);
+	if (LoadBenchMB > 0)
+	{
+		Filename = RCUtils::FCmdLine::Get().Contains("-gltfloadbenchascii") ? "GLTFLoadBench.gltf" : "GLTFLoadBench.glb";
+		if (WriteTestGLTFScene(Filename, LoadBenchMB))
+		{
+			App.BeginAsyncLoading(Filename);
+		}
+		else
+		{
+			::OutputDebugStringA("*** Unable to write the load benchmark scene\n");
+		}
+	}
+	else if (RCUtils::FCmdLine::Get().TryGetStringFromPrefix("-gltf=", Filename))
 	{
 		App.BeginAsyncLoading(Filename);
 		//App.TryLoadGLTF(Device, Filename);
 	}
 
+	App.InitBindless(Device);
+	App.InitParallelRecord(Device);
+	App.InitFrames(Device);
+	App.InitAsyncCompute(Device);
+	App.InitBenchmark();
 	SetupShaders(App);
+	GPSOCache.LogPipelineCacheBench("startup");
 
 	App.Create(Device, Window);
 	App.SetupImGuiAndResources(Device);
 
-	glfwShowWindow(Window);
+	if (RCUtils::FCmdLine::Get().Contains("-descbench"))
+	{
+		RunDescriptorSetupBenchmark(App);
+	}
+
+	if (Window)
+	{
+		glfwShowWindow(Window);
 
-	glfwSetCursorPosCallback(Window, MouseCallback);
-	glfwSetScrollCallback(Window, ScrollCallback);
+		glfwSetCursorPosCallback(Window, MouseCallback);
+		glfwSetScrollCallback(Window, ScrollCallback);
+	}
 
 	double End = GetTimeInMs();
 	double Delta = End - Begin;
@@ -1557,12 +3211,33 @@ static GLFWwindow* Init(FApp& App)
 
 static void Deinit(FApp& App, GLFWwindow* Window)
 {
+	// The loading thread creates resources and feeds GTextureUploader and GJobSystem
+	if (App.AsyncLoadingThreadHandle)
+	{
+		App.bCancelGLTFUploads = true;
+		if (FGLTFLoader* Loader = App.StreamingGLTFLoader)
+		{
+			CancelGLTFUploads(Loader);
+		}
+		App.AsyncLoadingThreadHandle->join();
+		delete App.AsyncLoadingThreadHandle;
+		App.AsyncLoadingThreadHandle = nullptr;
+	}
+
 	GVulkan.DeinitPre();
 
-	ImGui_ImplGlfw_Shutdown();
+	if (Window)
+	{
+		ImGui_ImplGlfw_Shutdown();
+	}
 	ImGui::DestroyContext();
 
+	GTextureUploader.Destroy();
+	// A scene that finished loading but was never taken over
+	FreeGLTFLoader(App.GLTFLoader);
+	App.GLTFLoader = nullptr;
 	GStagingBufferMgr.Destroy();
+	GUniformRing.Destroy();
 
 	App.Destroy();
 
@@ -1570,11 +3245,15 @@ static void Deinit(FApp& App, GLFWwindow* Window)
 	GPSOCache.Destroy();
 	GShaderLibrary.Destroy();
 	GRenderTargetCache.Destroy();
+	GJobSystem.Destroy();
 
 	GVulkan.Deinit();
 
-	glfwDestroyWindow(Window);
-	glfwTerminate();
+	if (Window)
+	{
+		glfwDestroyWindow(Window);
+		glfwTerminate();
+	}
 }
 
 int main()
@@ -1596,27 +3275,38 @@ int main()
 		}
 	}
 
+	// Without a window only -exitafterframes= ends the run
+	bool bQuit = false;
 	uint32 Frame = 1;
-	while (!glfwWindowShouldClose(Window))
+	while (!bQuit && !(Window && glfwWindowShouldClose(Window)))
 	{
-		double CpuBegin = glfwGetTime() * 1000.0;
+		double CpuBegin = GetTimeInMs();
 
-		glfwPollEvents();
+		if (Window)
+		{
+			glfwPollEvents();
+		}
 
 		//App.Update();
 
+		App.bReadbackFrame = App.SavePNGFilename && Frame == ExitAfterNFrames;
 		App.GpuDelta = Render(App);
 
-		double CpuEnd = glfwGetTime() * 1000.0;
+		double CpuEnd = GetTimeInMs();
 
 		App.CpuDelta = CpuEnd - CpuBegin;
 
 		App.LastDelta = (float)App.CpuDelta;
 		++Frame;
 
-		if (Frame > ExitAfterNFrames)
+		if (App.Benchmark.bEnabled)
+		{
+			App.AddBenchmarkFrame(GVulkan.Devices[GVulkan.PhysicalDevice]);
+		}
+
+		if (Frame > ExitAfterNFrames || (App.Benchmark.bEnabled && App.Benchmark.IsFinished()))
 		{
-			glfwSetWindowShouldClose(Window, 1);
+			bQuit = true;
 		}
 	}
 